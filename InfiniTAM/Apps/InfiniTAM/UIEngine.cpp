@@ -271,8 +271,11 @@ void UIEngine::glutKeyUpFunction(unsigned char key, int x, int y)
 	break;
 	case 'w':
 	{
+		// surfel scenes are saved as point clouds rather than meshes
+		bool isSurfelEngine = dynamic_cast<ITMBasicSurfelEngine<ITMSurfelT>*>(uiEngine->mainEngine) != NULL;
+
 		printf("saving scene to model ... ");
-		uiEngine->mainEngine->SaveSceneToMesh("mesh.stl");
+		uiEngine->mainEngine->SaveSceneToMesh(isSurfelEngine ? "mesh.ply" : "mesh.stl");
 		printf("done\n");
 	}
 	break;
@@ -0,0 +1,262 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+// Fuses a sequence of images on the CPU and then raycasts the final view once with each of the caches of block lookups
+// in ITMVoxelBlockHash, reporting how many voxel reads had to look their block up in the hash and how long the raycasts
+// took. The same images are also fused into an ITMVoxelBlockCuckooHash, to compare the two hashes' allocation failures,
+// memory and lookup times.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../../InputSource/ImageSourceEngine.h"
+
+#include "../../ITMLib/ITMLibDefines.h"
+#include "../../ITMLib/Core/ITMBasicEngine.h"
+#include "../../ITMLib/Engines/Reconstruction/CPU/ITMSceneReconstructionEngine_CPU.h"
+#include "../../ITMLib/Engines/Visualisation/ITMVisualisationEngineFactory.h"
+#include "../../ITMLib/Engines/Visualisation/Shared/ITMVisualisationEngine_Shared.h"
+#include "../../ORUtils/NVTimer.h"
+
+using namespace InputSource;
+using namespace ITMLib;
+
+struct LookupCounts
+{
+	long long noReads, noLookups;
+};
+
+// Wraps a cache to count the voxel reads through it and the ones among them that miss the cache.
+template<class TCache>
+struct CountingCache
+{
+	TCache cache;
+	LookupCounts *counts;
+};
+
+static bool isBlockCached(const ITMVoxelBlockHash::IndexCache &cache, const Vector3i &blockPos)
+{
+	return IS_EQUAL3(blockPos, cache.blockPos);
+}
+
+static bool isBlockCached(const ITMVoxelBlockHash::NeighbourIndexCache &cache, const Vector3i &blockPos)
+{
+	int entryIdx = (blockPos.x & 1) + (blockPos.y & 1) * 2 + (blockPos.z & 1) * 4;
+	return IS_EQUAL3(blockPos, cache.blockPos[entryIdx]);
+}
+
+// found by the SDF readers in ITMRepresentationAccess.h for the counting caches
+template<class TVoxel, class TIndexData, class TCache>
+inline TVoxel readVoxel(const TVoxel *voxelData, const TIndexData *voxelIndex, const Vector3i &point, int &vmIndex, CountingCache<TCache> &cache)
+{
+	Vector3i blockPos;
+	pointToVoxelBlockPos(point, blockPos);
+
+	cache.counts->noReads++;
+	if (!isBlockCached(cache.cache, blockPos)) cache.counts->noLookups++;
+
+	return readVoxel(voxelData, voxelIndex, point, vmIndex, cache.cache);
+}
+
+// Raycasts every pixel in turn, keeping the cache from one ray to the next as each thread of the CPU visualisation engine does.
+template<class TIndex, class TCache>
+static void RaycastImage(Vector4f *pointsRay, const ITMScene<ITMVoxel, TIndex> *scene, const ITMRenderState *renderState,
+	const Matrix4f &invM, const Vector4f &projParams, TCache &cache)
+{
+	Vector2i imgSize = renderState->raycastResult->noDims;
+	const Vector2f *minmaximg = renderState->renderingRangeImage->GetData(MEMORYDEVICE_CPU);
+	const ITMVoxel *voxelData = scene->localVBA.GetVoxelBlocks();
+	const typename TIndex::IndexData *voxelIndex = scene->index.getIndexData();
+	Vector4f invProjParams = InvertProjectionParams(projParams);
+	float oneOverVoxelSize = 1.0f / scene->sceneParams->voxelSize, mu = scene->sceneParams->mu;
+
+	for (int locId = 0; locId < imgSize.x * imgSize.y; ++locId)
+	{
+		int y = locId / imgSize.x, x = locId - y * imgSize.x;
+		int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+
+		castRay<ITMVoxel, TIndex, false>(pointsRay[locId], NULL, x, y, voxelData, voxelIndex, invM, invProjParams, oneOverVoxelSize,
+			mu, minmaximg[locId2], NULL, cache);
+	}
+}
+
+template<class TCache, class TIndex>
+static void RunBenchmark(const char *name, const ITMScene<ITMVoxel, TIndex> *scene, const ITMRenderState *renderState,
+	const Matrix4f &invM, const Vector4f &projParams, int noRepetitions)
+{
+	ORUtils::Image<Vector4f> pointsRay(renderState->raycastResult->noDims, MEMORYDEVICE_CPU);
+	Vector4f *pointsRay_ptr = pointsRay.GetData(MEMORYDEVICE_CPU);
+
+	LookupCounts counts = { 0, 0 };
+	CountingCache<TCache> countingCache;
+	countingCache.counts = &counts;
+	RaycastImage(pointsRay_ptr, scene, renderState, invM, projParams, countingCache);
+
+	// the fastest of several raycasts, which is the least disturbed by whatever else runs on the machine
+	StopWatchInterface *timer;
+	sdkCreateTimer(&timer);
+	float minTime = 0.0f;
+	for (int i = 0; i < noRepetitions; i++)
+	{
+		sdkResetTimer(&timer);
+		sdkStartTimer(&timer);
+		TCache cache;
+		RaycastImage(pointsRay_ptr, scene, renderState, invM, projParams, cache);
+		sdkStopTimer(&timer);
+		if (i == 0 || sdkGetTimerValue(&timer) < minTime) minTime = sdkGetTimerValue(&timer);
+	}
+	sdkDeleteTimer(&timer);
+
+	int noRays = (int)pointsRay.dataSize, noHits = 0;
+	for (int i = 0; i < noRays; i++) if (pointsRay_ptr[i].w > 0) noHits++;
+
+	printf("%-20s reads %12lld  lookups %12lld (%5.1f%%)  lookups per ray %8.2f  hits %d  time %.2f ms\n", name, counts.noReads, counts.noLookups,
+		counts.noReads > 0 ? 100.0 * (double)counts.noLookups / (double)counts.noReads : 0.0, (double)counts.noLookups / (double)noRays, noHits, minTime);
+}
+
+// Looks up each of the blocks in turn, and returns the fastest time per lookup over the repetitions, in nanoseconds.
+template<class TIndexData>
+static double TimeLookups(const TIndexData *voxelIndex, const std::vector<Vector3i> &blockPositions, int noRepetitions, int &noFound)
+{
+	StopWatchInterface *timer;
+	sdkCreateTimer(&timer);
+	float minTime = 0.0f;
+	for (int i = 0; i < noRepetitions; i++)
+	{
+		sdkResetTimer(&timer);
+		sdkStartTimer(&timer);
+		noFound = 0;
+		for (size_t j = 0; j < blockPositions.size(); j++)
+		{
+			int vmIndex;
+			if (findVoxelBlock(voxelIndex, blockPositions[j], vmIndex) >= 0) noFound++;
+		}
+		sdkStopTimer(&timer);
+		if (i == 0 || sdkGetTimerValue(&timer) < minTime) minTime = sdkGetTimerValue(&timer);
+	}
+	sdkDeleteTimer(&timer);
+
+	return blockPositions.empty() ? 0.0 : 1e6 * (double)minTime / (double)blockPositions.size();
+}
+
+// Compares the cuckoo hash with the voxel block hash that the same images were fused into.
+static void CompareHashes(const ITMScene<ITMVoxel, ITMVoxelBlockHash> *scene, const ITMScene<ITMVoxel, ITMVoxelBlockCuckooHash> *cuckooScene,
+	int noRepetitions)
+{
+	const ITMVoxelBlockHash &hash = scene->index;
+	const ITMVoxelBlockCuckooHash &cuckooHash = cuckooScene->index;
+
+	// the blocks of each, in random order, so that the lookups do not just walk through the tables
+	std::vector<Vector3i> hashBlocks, cuckooBlocks, absentBlocks;
+	for (int i = 0; i < hash.noTotalEntries; i++) if (hash.GetEntries()[i].ptr >= 0) hashBlocks.push_back(hash.GetEntries()[i].pos.toInt());
+	for (int i = 0; i < cuckooHash.noTotalEntries; i++) if (cuckooHash.GetEntries()[i].ptr >= 0) cuckooBlocks.push_back(cuckooHash.GetEntries()[i].pos.toInt());
+
+	std::mt19937 generator(0);
+	std::shuffle(hashBlocks.begin(), hashBlocks.end(), generator);
+	std::shuffle(cuckooBlocks.begin(), cuckooBlocks.end(), generator);
+
+	// blocks far outside the scene, which neither hash holds
+	std::uniform_int_distribution<int> coordinate(-10000, 10000);
+	for (size_t i = 0; i < hashBlocks.size(); i++) absentBlocks.push_back(Vector3i(coordinate(generator), coordinate(generator), 20000 + coordinate(generator)));
+
+	size_t hashBytes = (hash.noTotalEntries + 1) * sizeof(ITMHashEntry) + hash.noExcessEntries * sizeof(int) + hash.noTotalEntries * sizeof(uchar);
+	size_t cuckooBytes = (cuckooHash.noTotalEntries + 2 * CUCKOO_BUCKET_SIZE - 1) * sizeof(ITMHashEntry);
+
+	int noHashFound, noCuckooFound, noHashAbsentFound, noCuckooAbsentFound;
+	double hashHitTime = TimeLookups(hash.getIndexData(), hashBlocks, noRepetitions, noHashFound);
+	double cuckooHitTime = TimeLookups(cuckooHash.getIndexData(), cuckooBlocks, noRepetitions, noCuckooFound);
+	double hashMissTime = TimeLookups(hash.getIndexData(), absentBlocks, noRepetitions, noHashAbsentFound);
+	double cuckooMissTime = TimeLookups(cuckooHash.getIndexData(), absentBlocks, noRepetitions, noCuckooAbsentFound);
+
+	// blocks that one of the hashes could not allocate
+	int noMissingFromHash, noMissingFromCuckoo;
+	TimeLookups(hash.getIndexData(), cuckooBlocks, 1, noMissingFromHash);
+	TimeLookups(cuckooHash.getIndexData(), hashBlocks, 1, noMissingFromCuckoo);
+	noMissingFromHash = (int)cuckooBlocks.size() - noMissingFromHash;
+	noMissingFromCuckoo = (int)hashBlocks.size() - noMissingFromCuckoo;
+
+	printf("%-20s blocks %8d  missing %6d  memory %7.2f MB  hit %6.1f ns  miss %6.1f ns\n", "voxel block hash", (int)hashBlocks.size(),
+		noMissingFromHash, (double)hashBytes / (1024.0 * 1024.0), hashHitTime, hashMissTime);
+	printf("%-20s blocks %8d  missing %6d  memory %7.2f MB  hit %6.1f ns  miss %6.1f ns  load %.1f%%  failed insertions %d\n", "cuckoo hash",
+		(int)cuckooBlocks.size(), noMissingFromCuckoo, (double)cuckooBytes / (1024.0 * 1024.0), cuckooHitTime, cuckooMissTime,
+		100.0f * cuckooHash.GetLoadFactor(), cuckooHash.GetNoFailedInsertions());
+}
+
+int main(int argc, char** argv)
+try
+{
+	if (argc < 4)
+	{
+		printf("usage: %s <calibfile> <rgbmask> <depthmask> [<noframes> [<norepetitions> [<nohashentries>]]]\n"
+		       "  fuses the images on the CPU and compares the caches of block lookups on a raycast of the final view,\n"
+		       "  and the voxel block hash with the cuckoo hash, both with the given number of entries besides the excess list\n"
+		       "\n"
+		       "example:\n"
+		       "  %s ./Files/Teddy/calib.txt ./Files/Teddy/Frames/%%04i.ppm ./Files/Teddy/Frames/%%04i.pgm 100\n\n", argv[0], argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int noFrames = argc > 4 ? atoi(argv[4]) : 100;
+	int noRepetitions = argc > 5 ? atoi(argv[5]) : 5;
+	int noHashEntries = argc > 6 ? atoi(argv[6]) : SDF_BUCKET_NUM;
+
+	ITMLibSettings settings;
+	settings.deviceType = ITMLibSettings::DEVICE_CPU;
+
+	// smaller tables show how the hashes cope when they fill up; the excess list keeps its default proportion
+	settings.sceneParams.SetHashSize(settings.sceneParams.noVoxelBlocks, noHashEntries, noHashEntries / (SDF_BUCKET_NUM / SDF_EXCESS_LIST_SIZE),
+		settings.sceneParams.noSwapTransferBlocks);
+
+	ImageMaskPathGenerator pathGenerator(argv[2], argv[3]);
+	ImageFileReader<ImageMaskPathGenerator> imageSource(argv[1], pathGenerator);
+
+	ITMBasicEngine<ITMVoxel, ITMVoxelIndex> mainEngine(&settings, imageSource.getCalib(), imageSource.getRGBImageSize(), imageSource.getDepthImageSize());
+
+	// fused along with the main engine's scene, at the poses the main engine tracks
+	ITMScene<ITMVoxel, ITMVoxelBlockCuckooHash> cuckooScene(&settings.sceneParams, false, MEMORYDEVICE_CPU);
+	ITMSceneReconstructionEngine_CPU<ITMVoxel, ITMVoxelBlockCuckooHash> cuckooReconstructionEngine;
+	cuckooReconstructionEngine.ResetScene(&cuckooScene);
+
+	ITMUChar4Image rgb(imageSource.getRGBImageSize(), true, false);
+	ITMShortImage rawDepth(imageSource.getDepthImageSize(), true, false);
+
+	int frameNo = 0;
+	for (; frameNo < noFrames && imageSource.hasMoreImages(); frameNo++)
+	{
+		imageSource.getImages(&rgb, &rawDepth);
+		mainEngine.ProcessFrame(&rgb, &rawDepth);
+
+		cuckooReconstructionEngine.AllocateSceneFromDepth(&cuckooScene, mainEngine.GetView(), mainEngine.GetTrackingState(), NULL);
+		cuckooReconstructionEngine.IntegrateIntoScene(&cuckooScene, mainEngine.GetView(), mainEngine.GetTrackingState(), NULL);
+	}
+	printf("fused %d frames\n", frameNo);
+
+	const ITMScene<ITMVoxel, ITMVoxelIndex> *scene = mainEngine.GetScene();
+	const ORUtils::SE3Pose *pose = mainEngine.GetTrackingState()->pose_d;
+	const ITMIntrinsics *intrinsics = &mainEngine.GetView()->calib.intrinsics_d;
+
+	ITMVisualisationEngine<ITMVoxel, ITMVoxelIndex> *visualisationEngine =
+		ITMVisualisationEngineFactory::MakeVisualisationEngine<ITMVoxel, ITMVoxelIndex>(ITMLibSettings::DEVICE_CPU);
+	ITMRenderState *renderState = visualisationEngine->CreateRenderState(scene, imageSource.getDepthImageSize());
+	visualisationEngine->FindVisibleBlocks(scene, pose, intrinsics, renderState);
+	visualisationEngine->CreateExpectedDepths(scene, pose, intrinsics, renderState);
+
+	RunBenchmark<ITMVoxelBlockHash::IndexCache>("IndexCache", scene, renderState, pose->GetInvM(), intrinsics->projectionParamsSimple.all, noRepetitions);
+	RunBenchmark<ITMVoxelBlockHash::NeighbourIndexCache>("NeighbourIndexCache", scene, renderState, pose->GetInvM(),
+		intrinsics->projectionParamsSimple.all, noRepetitions);
+	RunBenchmark<ITMVoxelBlockCuckooHash::NeighbourIndexCache>("cuckoo hash", &cuckooScene, renderState, pose->GetInvM(),
+		intrinsics->projectionParamsSimple.all, noRepetitions);
+
+	CompareHashes(scene, &cuckooScene, noRepetitions);
+
+	delete renderState;
+	delete visualisationEngine;
+	return 0;
+}
+catch(std::exception& e)
+{
+	std::cerr << e.what() << '\n';
+	return EXIT_FAILURE;
+}
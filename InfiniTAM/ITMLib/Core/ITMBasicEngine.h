@@ -61,6 +61,12 @@ namespace ITMLib
 		/// Extracts a mesh from the current scene and saves it to the model file specified by the file name
 		void SaveSceneToMesh(const char *fileName);
 
+		/// Like SaveSceneToMesh above, but samples the scene every lodStride voxels for a coarser mesh, see ITMMeshingEngine::MeshSceneLOD
+		void SaveSceneToMesh(const char *fileName, int lodStride);
+
+		/// Brings the block mesh cache up to date with the blocks fused since its last update, see ITMMeshingEngine::UpdateMesh
+		void UpdateMesh(ITMBlockMeshCache *meshCache, ITMBlockMeshCache::Delta *delta);
+
 		/// save and load the full scene and relocaliser (if any) to/from file
 		void SaveToFile();
 		void LoadFromFile();
@@ -24,13 +24,14 @@ ITMBasicEngine<TVoxel,TIndex>::ITMBasicEngine(const ITMLibSettings *settings, co
 	if ((imgSize_d.x == -1) || (imgSize_d.y == -1)) imgSize_d = imgSize_rgb;
 
 	MemoryDeviceType memoryType = settings->GetMemoryType();
-	this->scene = new ITMScene<TVoxel,TIndex>(&settings->sceneParams, settings->swappingMode == ITMLibSettings::SWAPPINGMODE_ENABLED, memoryType);
+	this->scene = new ITMScene<TVoxel,TIndex>(&settings->sceneParams, settings->swappingMode == ITMLibSettings::SWAPPINGMODE_ENABLED, memoryType,
+		settings->swappingBlockFile, settings->swappingMaxResidentBlocks);
 
 	const ITMLibSettings::DeviceType deviceType = settings->deviceType;
 
 	lowLevelEngine = ITMLowLevelEngineFactory::MakeLowLevelEngine(deviceType);
 	viewBuilder = ITMViewBuilderFactory::MakeViewBuilder(calib, deviceType);
-	visualisationEngine = ITMVisualisationEngineFactory::MakeVisualisationEngine<TVoxel,TIndex>(deviceType);
+	visualisationEngine = ITMVisualisationEngineFactory::MakeVisualisationEngine<TVoxel,TIndex>(deviceType, settings->useTiledRaycast);
 
 	meshingEngine = NULL;
 	if (settings->createMeshingEngine)
@@ -97,17 +98,32 @@ ITMBasicEngine<TVoxel,TIndex>::~ITMBasicEngine()
 
 template <typename TVoxel, typename TIndex>
 void ITMBasicEngine<TVoxel,TIndex>::SaveSceneToMesh(const char *objFileName)
+{
+	SaveSceneToMesh(objFileName, 1);
+}
+
+template <typename TVoxel, typename TIndex>
+void ITMBasicEngine<TVoxel,TIndex>::SaveSceneToMesh(const char *objFileName, int lodStride)
 {
 	if (meshingEngine == NULL) return;
 
 	ITMMesh *mesh = new ITMMesh(settings->GetMemoryType());
 
-	meshingEngine->MeshScene(mesh, scene);
-	mesh->WriteSTL(objFileName);
+	if (lodStride == 1) meshingEngine->MeshScene(mesh, scene);
+	else meshingEngine->MeshSceneLOD(mesh, scene, lodStride);
+	mesh->Write(objFileName);
 
 	delete mesh;
 }
 
+template <typename TVoxel, typename TIndex>
+void ITMBasicEngine<TVoxel,TIndex>::UpdateMesh(ITMBlockMeshCache *meshCache, ITMBlockMeshCache::Delta *delta)
+{
+	if (meshingEngine == NULL) return;
+
+	meshingEngine->UpdateMesh(meshCache, delta, scene);
+}
+
 template <typename TVoxel, typename TIndex>
 void ITMBasicEngine<TVoxel, TIndex>::SaveToFile()
 {
@@ -422,9 +438,17 @@ void ITMBasicEngine<TVoxel,TIndex>::GetImage(ITMUChar4Image *out, GetImageType g
 			renderState_freeview = ITMRenderStateFactory<TIndex>::CreateRenderState(out->noDims, scene->sceneParams, settings->GetMemoryType());
 		}
 
-		visualisationEngine->FindVisibleBlocks(scene, pose, intrinsics, renderState_freeview);
-		visualisationEngine->CreateExpectedDepths(scene, pose, intrinsics, renderState_freeview);
-		visualisationEngine->RenderImage(scene, pose, intrinsics, renderState_freeview, renderState_freeview->raycastImage, type);
+		if (settings->freeviewMaxSubsample > 1)
+		{
+			visualisationEngine->RenderImageProgressive(scene, pose, intrinsics, renderState_freeview, renderState_freeview->raycastImage, type,
+				settings->freeviewMaxSubsample, settings->freeviewTimeBudget);
+		}
+		else
+		{
+			visualisationEngine->FindVisibleBlocks(scene, pose, intrinsics, renderState_freeview);
+			visualisationEngine->CreateExpectedDepths(scene, pose, intrinsics, renderState_freeview);
+			visualisationEngine->RenderImage(scene, pose, intrinsics, renderState_freeview, renderState_freeview->raycastImage, type);
+		}
 
 		if (settings->deviceType == ITMLibSettings::DEVICE_CUDA)
 			out->SetFrom(renderState_freeview->raycastImage, ORUtils::MemoryBlock<Vector4u>::CUDA_TO_CPU);
@@ -54,7 +54,7 @@ namespace ITMLib
 
 		ITMTrackingState::TrackingResult ProcessFrame(ITMUChar4Image *rgbImage, ITMShortImage *rawDepthImage, ITMIMUMeasurement *imuMeasurement = NULL);
 
-		/// Extracts a mesh from the current scene and saves it to the model file specified by the file name
+		/// Saves the surfels in the current scene as a PLY point cloud, to the specified file name with its extension replaced by .ply
 		void SaveSceneToMesh(const char *fileName);
 
 		/// save and load the full scene and relocaliser (if any) to/from file
@@ -5,6 +5,7 @@
 #include "../Engines/LowLevel/ITMLowLevelEngineFactory.h"
 #include "../Engines/ViewBuilding/ITMViewBuilderFactory.h"
 #include "../Engines/Visualisation/ITMSurfelVisualisationEngineFactory.h"
+#include "../Objects/Scene/ITMSurfelSceneFile.h"
 #include "../Trackers/ITMTrackerFactory.h"
 
 #include "../../ORUtils/NVTimer.h"
@@ -90,19 +91,93 @@ ITMBasicSurfelEngine<TSurfel>::~ITMBasicSurfelEngine()
 template <typename TSurfel>
 void ITMBasicSurfelEngine<TSurfel>::SaveSceneToMesh(const char *objFileName)
 {
-	// Not yet implemented for surfel scenes
+	// surfel scenes are exported as point clouds (in PLY format) rather than as meshes, so make sure the file has a .ply extension
+	std::string plyFileName = objFileName;
+	size_t extensionPos = plyFileName.find_last_of("./\\");
+	if (extensionPos != std::string::npos && plyFileName[extensionPos] == '.') plyFileName.erase(extensionPos);
+	plyFileName += ".ply";
+
+	const int surfelCount = static_cast<int>(surfelScene->GetSurfelCount());
+	const size_t bufferSize = std::max(surfelCount, 1);
+	const bool useGPU = settings->GetMemoryType() == MEMORYDEVICE_CUDA;
+
+	// the point cloud is always written from the CPU, so only allocate a device copy if the scene is on the GPU
+	ORUtils::MemoryBlock<float> positions(bufferSize * 3, true, useGPU);
+	ORUtils::MemoryBlock<float> normals(bufferSize * 3, true, useGPU);
+	ORUtils::MemoryBlock<unsigned char> colours(TSurfel::hasColourInformation ? bufferSize * 3 : 1, true, useGPU);
+	ORUtils::MemoryBlock<float> radii(bufferSize, true, useGPU);
+
+	if (useGPU)
+	{
+#ifndef COMPILE_WITHOUT_CUDA
+		unsigned char *colourData = TSurfel::hasColourInformation ? colours.GetData(MEMORYDEVICE_CUDA) : NULL;
+		surfelVisualisationEngine->CopySceneToPointCloud(surfelScene, positions.GetData(MEMORYDEVICE_CUDA), normals.GetData(MEMORYDEVICE_CUDA), colourData, radii.GetData(MEMORYDEVICE_CUDA));
+
+		positions.UpdateHostFromDevice();
+		normals.UpdateHostFromDevice();
+		if (TSurfel::hasColourInformation) colours.UpdateHostFromDevice();
+		radii.UpdateHostFromDevice();
+#endif
+	}
+	else
+	{
+		unsigned char *colourData = TSurfel::hasColourInformation ? colours.GetData(MEMORYDEVICE_CPU) : NULL;
+		surfelVisualisationEngine->CopySceneToPointCloud(surfelScene, positions.GetData(MEMORYDEVICE_CPU), normals.GetData(MEMORYDEVICE_CPU), colourData, radii.GetData(MEMORYDEVICE_CPU));
+	}
+
+	ITMSurfelSceneFile::WritePointCloudPLY(plyFileName, surfelCount, positions.GetData(MEMORYDEVICE_CPU), normals.GetData(MEMORYDEVICE_CPU),
+		TSurfel::hasColourInformation ? colours.GetData(MEMORYDEVICE_CPU) : NULL, radii.GetData(MEMORYDEVICE_CPU));
 }
 
 template <typename TSurfel>
 void ITMBasicSurfelEngine<TSurfel>::SaveToFile()
 {
-	// Not yet implemented for surfel scenes
+	// throws error if any of the saves fail
+
+	std::string saveOutputDirectory = "State/";
+	std::string relocaliserOutputDirectory = saveOutputDirectory + "Relocaliser/", sceneOutputDirectory = saveOutputDirectory + "Scene/";
+
+	MakeDir(saveOutputDirectory.c_str());
+	MakeDir(relocaliserOutputDirectory.c_str());
+	MakeDir(sceneOutputDirectory.c_str());
+
+	if (relocaliser) relocaliser->SaveToDirectory(relocaliserOutputDirectory);
+
+	ITMSurfelSceneFile::SaveScene(surfelScene, sceneOutputDirectory + "surfels.dat", denseSurfelMapper->GetTimestamp(), settings->saveSurfelsAtHalfPrecision);
 }
 
 template <typename TSurfel>
 void ITMBasicSurfelEngine<TSurfel>::LoadFromFile()
 {
-	// Not yet implemented for surfel scenes
+	std::string saveInputDirectory = "State/";
+	std::string relocaliserInputDirectory = saveInputDirectory + "Relocaliser/", sceneInputDirectory = saveInputDirectory + "Scene/";
+
+	this->resetAll();
+
+	try // load relocaliser
+	{
+		FernRelocLib::Relocaliser<float> *relocaliser_temp = new FernRelocLib::Relocaliser<float>(view->depth->noDims, Vector2f(settings->sceneParams.viewFrustum_min, settings->sceneParams.viewFrustum_max), 0.2f, 500, 4);
+
+		relocaliser_temp->LoadFromDirectory(relocaliserInputDirectory);
+
+		delete relocaliser;
+		relocaliser = relocaliser_temp;
+	}
+	catch (std::runtime_error &e)
+	{
+		throw std::runtime_error("Could not load relocaliser: " + std::string(e.what()));
+	}
+
+	try // load scene
+	{
+		// restore the reconstruction's clock, against which the ages of the loaded surfels are measured
+		denseSurfelMapper->SetTimestamp(ITMSurfelSceneFile::LoadScene(surfelScene, sceneInputDirectory + "surfels.dat"));
+	}
+	catch (std::runtime_error &e)
+	{
+		surfelScene->Reset();
+		throw std::runtime_error("Could not load scene:" + std::string(e.what()));
+	}
 }
 
 template <typename TSurfel>
@@ -44,6 +44,13 @@ namespace ITMLib
 
     //#################### PUBLIC MEMBER FUNCTIONS ####################
   public:
+    /**
+     * \brief Gets the current timestamp (i.e. frame number) of the reconstruction.
+     *
+     * \return The current timestamp.
+     */
+    int GetTimestamp() const;
+
     /**
      * \brief Processes a frame from the input sequence.
      *
@@ -53,5 +60,12 @@ namespace ITMLib
      * \param liveRenderState The render state for the live camera.
      */
     void ProcessFrame(const ITMView *view, const ITMTrackingState *trackingState, ITMSurfelScene<TSurfel> *scene, ITMSurfelRenderState *liveRenderState) const;
+
+    /**
+     * \brief Sets the current timestamp (i.e. frame number) of the reconstruction.
+     *
+     * \param timestamp The new timestamp.
+     */
+    void SetTimestamp(int timestamp);
   };
 }
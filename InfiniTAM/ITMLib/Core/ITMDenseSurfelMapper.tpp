@@ -24,10 +24,22 @@ ITMDenseSurfelMapper<TSurfel>::~ITMDenseSurfelMapper()
 
 //#################### PUBLIC MEMBER FUNCTIONS ####################
 
+template <typename TSurfel>
+int ITMDenseSurfelMapper<TSurfel>::GetTimestamp() const
+{
+  return m_reconstructionEngine->GetTimestamp();
+}
+
 template <typename TSurfel>
 void ITMDenseSurfelMapper<TSurfel>::ProcessFrame(const ITMView *view, const ITMTrackingState *trackingState, ITMSurfelScene<TSurfel> *scene, ITMSurfelRenderState *liveRenderState) const
 {
   m_reconstructionEngine->IntegrateIntoScene(scene, view, trackingState, liveRenderState);
 }
 
+template <typename TSurfel>
+void ITMDenseSurfelMapper<TSurfel>::SetTimestamp(int timestamp)
+{
+  m_reconstructionEngine->SetTimestamp(timestamp);
+}
+
 }
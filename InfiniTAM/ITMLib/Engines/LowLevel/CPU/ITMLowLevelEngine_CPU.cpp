@@ -3,9 +3,173 @@
 #include "ITMLowLevelEngine_CPU.h"
 
 #include "../Shared/ITMLowLevelEngine_Shared.h"
+#include "../../../Utils/ITMSIMDUtils.h"
 
 using namespace ITMLib;
 
+// Row kernels shared by the single image methods and the pyramid builders. They produce the same results as the
+// per-pixel functions in ITMLowLevelEngine_Shared.h, which also handle whatever is left of a row after the SIMD batches.
+
+static void filterSubsampleWithHolesRow(float *imageData_out, int y, Vector2i newDims, const float *imageData_in, Vector2i oldDims)
+{
+	int x = 0;
+#if ITM_SIMD_WIDTH > 1
+	const float *row0 = imageData_in + 2 * y * oldDims.x, *row1 = row0 + oldDims.x;
+	const simd_float zero = simd_set(0.0f), one = simd_set(1.0f);
+
+	for (; x + ITM_SIMD_WIDTH <= newDims.x; x += ITM_SIMD_WIDTH)
+	{
+		simd_float pixels_in[4];
+		simd_load_even_odd(row0 + 2 * x, pixels_in[0], pixels_in[1]);
+		simd_load_even_odd(row1 + 2 * x, pixels_in[2], pixels_in[3]);
+
+		simd_float pixel_out = zero, no_good_pixels = zero;
+		for (int i = 0; i < 4; i++)
+		{
+			simd_mask good = pixels_in[i] > zero;
+			pixel_out = pixel_out + simd_select(good, pixels_in[i], zero);
+			no_good_pixels = no_good_pixels + simd_select(good, one, zero);
+		}
+
+		simd_store(imageData_out + x + y * newDims.x, simd_select(no_good_pixels > zero, pixel_out / no_good_pixels, pixel_out));
+	}
+#endif
+	for (; x < newDims.x; x++) filterSubsampleWithHoles(imageData_out, x, y, newDims, imageData_in, oldDims);
+}
+
+static void filterSubsampleWithHolesRow(Vector4f *imageData_out, int y, Vector2i newDims, const Vector4f *imageData_in, Vector2i oldDims)
+{
+	for (int x = 0; x < newDims.x; x++) filterSubsampleWithHoles(imageData_out, x, y, newDims, imageData_in, oldDims);
+}
+
+// the border of the subsampled image is left at zero
+static void filterSubsampleRow(float *imageData_out, int y, Vector2i newDims, const float *imageData_in, Vector2i oldDims)
+{
+	float *row_out = imageData_out + y * newDims.x;
+	if (y == 0 || y >= newDims.y - 1 || newDims.x < 2)
+	{
+		for (int x = 0; x < newDims.x; x++) row_out[x] = 0.0f;
+		return;
+	}
+
+	row_out[0] = 0.0f; row_out[newDims.x - 1] = 0.0f;
+
+	int x = 1;
+#if ITM_SIMD_WIDTH > 1
+	const float *row0 = imageData_in + 2 * y * oldDims.x, *row1 = row0 + oldDims.x;
+
+	for (; x + ITM_SIMD_WIDTH <= newDims.x - 1; x += ITM_SIMD_WIDTH)
+	{
+		simd_float a, b, c, d;
+		simd_load_even_odd(row0 + 2 * x, a, b);
+		simd_load_even_odd(row1 + 2 * x, c, d);
+		simd_store(row_out + x, (a + b + c + d) / simd_set(4.0f));
+	}
+#endif
+	for (; x < newDims.x - 1; x++) boxFilter2x2(imageData_out, x, y, newDims, imageData_in, x * 2, y * 2, oldDims);
+}
+
+// the two pixel wide border is left at zero
+static void filterIntensityRow(float *imageData_out, int y, Vector2i dims, const float *imageData_in)
+{
+	float *row_out = imageData_out + y * dims.x;
+	if (y < 2 || y >= dims.y - 2)
+	{
+		for (int x = 0; x < dims.x; x++) row_out[x] = 0.0f;
+		return;
+	}
+
+	for (int x = 0; x < 2 && x < dims.x; x++) row_out[x] = 0.0f;
+	for (int x = MAX(dims.x - 2, 2); x < dims.x; x++) row_out[x] = 0.0f;
+
+	int x = 2;
+#if ITM_SIMD_WIDTH > 1
+	const float *row0 = imageData_in + y * dims.x, *row1 = row0 + dims.x;
+
+	for (; x + ITM_SIMD_WIDTH <= dims.x - 2; x += ITM_SIMD_WIDTH)
+	{
+		simd_float sum = simd_load(row0 + x) + simd_load(row0 + x + 1) + simd_load(row1 + x) + simd_load(row1 + x + 1);
+		simd_store(row_out + x, sum / simd_set(4.0f));
+	}
+#endif
+	for (; x < dims.x - 2; x++) boxFilter2x2(imageData_out, x, y, dims, imageData_in, x, y, dims);
+}
+
+// the one pixel wide border is left at zero
+static void gradientXYRow(Vector2f *grad, int y, const float *image, Vector2i imgSize)
+{
+	Vector2f *row_out = grad + y * imgSize.x;
+	if (y == 0 || y >= imgSize.y - 1 || imgSize.x < 2)
+	{
+		for (int x = 0; x < imgSize.x; x++) row_out[x] = Vector2f(0.0f, 0.0f);
+		return;
+	}
+
+	row_out[0] = Vector2f(0.0f, 0.0f); row_out[imgSize.x - 1] = Vector2f(0.0f, 0.0f);
+
+	int x = 1;
+#if ITM_SIMD_WIDTH > 1
+	const float *row0 = image + (y - 1) * imgSize.x, *row1 = row0 + imgSize.x, *row2 = row1 + imgSize.x;
+	const simd_float two = simd_set(2.0f), eight = simd_set(8.0f);
+
+	for (; x + ITM_SIMD_WIDTH <= imgSize.x - 1; x += ITM_SIMD_WIDTH)
+	{
+		simd_float d1x = simd_load(row0 + x + 1) - simd_load(row0 + x - 1);
+		simd_float d2x = simd_load(row1 + x + 1) - simd_load(row1 + x - 1);
+		simd_float d3x = simd_load(row2 + x + 1) - simd_load(row2 + x - 1);
+
+		simd_float d1y = simd_load(row2 + x - 1) - simd_load(row0 + x - 1);
+		simd_float d2y = simd_load(row2 + x) - simd_load(row0 + x);
+		simd_float d3y = simd_load(row2 + x + 1) - simd_load(row0 + x + 1);
+
+		simd_store_pairs((float*)(row_out + x), (d1x + two * d2x + d3x) / eight, (d1y + two * d2y + d3y) / eight);
+	}
+#endif
+	for (; x < imgSize.x - 1; x++) gradientXY(grad, x, y, image, imgSize);
+}
+
+/**
+ * Builds levels 1 to noLevels - 1 of a pyramid, each from the level above it, in a single pass. The pass is split into
+ * bands, each covering one row of the coarsest level and the rows it is made from on all the finer levels, so a band's
+ * rows are still in cache when the next level down needs them. Rows that are not covered by any band, because some
+ * level has an odd number of rows, are filled in level by level afterwards.
+ */
+template<typename TPixel>
+static void filterSubsamplePyramid(ORUtils::Image<TPixel> *const *levels, int noLevels,
+	void (*filterRow)(TPixel *imageData_out, int y, Vector2i newDims, const TPixel *imageData_in, Vector2i oldDims))
+{
+	if (noLevels < 2) return;
+
+	for (int l = 1; l < noLevels; l++) levels[l]->ChangeDims(Vector2i(levels[l - 1]->noDims.x / 2, levels[l - 1]->noDims.y / 2));
+
+	const int noBands = levels[noLevels - 1]->noDims.y;
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int band = 0; band < noBands; band++)
+	{
+		for (int l = 1; l < noLevels; l++)
+		{
+			TPixel *imageData_out = levels[l]->GetData(MEMORYDEVICE_CPU);
+			const TPixel *imageData_in = levels[l - 1]->GetData(MEMORYDEVICE_CPU);
+
+			int noRowsPerBand = 1 << (noLevels - 1 - l);
+			for (int y = band * noRowsPerBand; y < (band + 1) * noRowsPerBand; y++)
+				filterRow(imageData_out, y, levels[l]->noDims, imageData_in, levels[l - 1]->noDims);
+		}
+	}
+
+	for (int l = 1; l < noLevels; l++)
+	{
+		TPixel *imageData_out = levels[l]->GetData(MEMORYDEVICE_CPU);
+		const TPixel *imageData_in = levels[l - 1]->GetData(MEMORYDEVICE_CPU);
+
+		for (int y = noBands << (noLevels - 1 - l); y < levels[l]->noDims.y; y++)
+			filterRow(imageData_out, y, levels[l]->noDims, imageData_in, levels[l - 1]->noDims);
+	}
+}
+
 ITMLowLevelEngine_CPU::ITMLowLevelEngine_CPU(void) { }
 ITMLowLevelEngine_CPU::~ITMLowLevelEngine_CPU(void) { }
 
@@ -41,6 +205,9 @@ void ITMLowLevelEngine_CPU::ConvertColourToIntensity(ITMFloatImage *image_out, c
 	float *dest = image_out->GetData(MEMORYDEVICE_CPU);
 	const Vector4u *src = image_in->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 0; y < dims.y; y++) for (int x = 0; x < dims.x; x++)
 		convertColourToIntensity(dest, x, y, dims, src);
 }
@@ -50,13 +217,14 @@ void ITMLowLevelEngine_CPU::FilterIntensity(ITMFloatImage *image_out, const ITMF
 	Vector2i dims = image_in->noDims;
 
 	image_out->ChangeDims(dims);
-	image_out->Clear(0);
 
 	const float *imageData_in = image_in->GetData(MEMORYDEVICE_CPU);
 	float *imageData_out = image_out->GetData(MEMORYDEVICE_CPU);
 
-	for (int y = 2; y < dims.y - 2; y++) for (int x = 2; x < dims.x - 2; x++)
-		boxFilter2x2(imageData_out, x, y, dims, imageData_in, x, y, dims);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < dims.y; y++) filterIntensityRow(imageData_out, y, dims, imageData_in);
 }
 
 void ITMLowLevelEngine_CPU::FilterSubsample(ITMUChar4Image *image_out, const ITMUChar4Image *image_in) const
@@ -69,6 +237,9 @@ void ITMLowLevelEngine_CPU::FilterSubsample(ITMUChar4Image *image_out, const ITM
 	const Vector4u *imageData_in = image_in->GetData(MEMORYDEVICE_CPU);
 	Vector4u *imageData_out = image_out->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 0; y < newDims.y; y++) for (int x = 0; x < newDims.x; x++)
 		filterSubsample(imageData_out, x, y, newDims, imageData_in, oldDims);
 }
@@ -79,13 +250,14 @@ void ITMLowLevelEngine_CPU::FilterSubsample(ITMFloatImage *image_out, const ITMF
 	Vector2i newDims(image_in->noDims.x / 2, image_in->noDims.y / 2);
 
 	image_out->ChangeDims(newDims);
-	image_out->Clear();
 
 	const float *imageData_in = image_in->GetData(MEMORYDEVICE_CPU);
 	float *imageData_out = image_out->GetData(MEMORYDEVICE_CPU);
 
-	for (int y = 1; y < newDims.y - 1; y++) for (int x = 1; x < newDims.x - 1; x++)
-		boxFilter2x2(imageData_out, x, y, newDims, imageData_in, x * 2, y * 2, oldDims);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < newDims.y; y++) filterSubsampleRow(imageData_out, y, newDims, imageData_in, oldDims);
 }
 
 void ITMLowLevelEngine_CPU::FilterSubsampleWithHoles(ITMFloatImage *image_out, const ITMFloatImage *image_in) const
@@ -98,8 +270,10 @@ void ITMLowLevelEngine_CPU::FilterSubsampleWithHoles(ITMFloatImage *image_out, c
 	const float *imageData_in = image_in->GetData(MEMORYDEVICE_CPU);
 	float *imageData_out = image_out->GetData(MEMORYDEVICE_CPU);
 
-	for (int y = 0; y < newDims.y; y++) for (int x = 0; x < newDims.x; x++)
-		filterSubsampleWithHoles(imageData_out, x, y, newDims, imageData_in, oldDims);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < newDims.y; y++) filterSubsampleWithHolesRow(imageData_out, y, newDims, imageData_in, oldDims);
 }
 
 void ITMLowLevelEngine_CPU::FilterSubsampleWithHoles(ITMFloat4Image *image_out, const ITMFloat4Image *image_in) const
@@ -112,8 +286,25 @@ void ITMLowLevelEngine_CPU::FilterSubsampleWithHoles(ITMFloat4Image *image_out,
 	const Vector4f *imageData_in = image_in->GetData(MEMORYDEVICE_CPU);
 	Vector4f *imageData_out = image_out->GetData(MEMORYDEVICE_CPU);
 
-	for (int y = 0; y < newDims.y; y++) for (int x = 0; x < newDims.x; x++)
-		filterSubsampleWithHoles(imageData_out, x, y, newDims, imageData_in, oldDims);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < newDims.y; y++) filterSubsampleWithHolesRow(imageData_out, y, newDims, imageData_in, oldDims);
+}
+
+void ITMLowLevelEngine_CPU::FilterSubsamplePyramid(ITMFloatImage *const *levels, int noLevels) const
+{
+	filterSubsamplePyramid<float>(levels, noLevels, filterSubsampleRow);
+}
+
+void ITMLowLevelEngine_CPU::FilterSubsampleWithHolesPyramid(ITMFloatImage *const *levels, int noLevels) const
+{
+	filterSubsamplePyramid<float>(levels, noLevels, filterSubsampleWithHolesRow);
+}
+
+void ITMLowLevelEngine_CPU::FilterSubsampleWithHolesPyramid(ITMFloat4Image *const *levels, int noLevels) const
+{
+	filterSubsamplePyramid<Vector4f>(levels, noLevels, filterSubsampleWithHolesRow);
 }
 
 void ITMLowLevelEngine_CPU::GradientX(ITMShort4Image *grad_out, const ITMUChar4Image *image_in) const
@@ -126,6 +317,9 @@ void ITMLowLevelEngine_CPU::GradientX(ITMShort4Image *grad_out, const ITMUChar4I
 
 	memset(grad, 0, imgSize.x * imgSize.y * sizeof(Vector4s));
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 1; y < imgSize.y - 1; y++) for (int x = 1; x < imgSize.x - 1; x++)
 		gradientX(grad, x, y, image, imgSize);
 }
@@ -140,6 +334,9 @@ void ITMLowLevelEngine_CPU::GradientY(ITMShort4Image *grad_out, const ITMUChar4I
 
 	memset(grad, 0, imgSize.x * imgSize.y * sizeof(Vector4s));
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 1; y < imgSize.y - 1; y++) for (int x = 1; x < imgSize.x - 1; x++)
 		gradientY(grad, x, y, image, imgSize);
 }
@@ -148,21 +345,35 @@ void ITMLowLevelEngine_CPU::GradientXY(ITMFloat2Image *grad_out, const ITMFloatI
 {
 	Vector2i imgSize = image_in->noDims;
 	grad_out->ChangeDims(imgSize);
-	grad_out->Clear();
 
 	Vector2f *grad = grad_out->GetData(MEMORYDEVICE_CPU);
 	const float *image = image_in->GetData(MEMORYDEVICE_CPU);
 
-	for (int y = 1; y < imgSize.y - 1; y++) for (int x = 1; x < imgSize.x - 1; x++)
-		gradientXY(grad, x, y, image, imgSize);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < imgSize.y; y++) gradientXYRow(grad, y, image, imgSize);
 }
 
 int ITMLowLevelEngine_CPU::CountValidDepths(const ITMFloatImage *image_in) const
 {
 	int noValidPoints = 0;
 	const float *imageData_in = image_in->GetData(MEMORYDEVICE_CPU);
+	const Vector2i dims = image_in->noDims;
 
-	for (int i = 0; i < image_in->noDims.x * image_in->noDims.y; ++i) if (imageData_in[i] > 0.0) noValidPoints++;
+#ifdef WITH_OPENMP
+	#pragma omp parallel for reduction(+:noValidPoints)
+#endif
+	for (int y = 0; y < dims.y; y++)
+	{
+		const float *row = imageData_in + y * dims.x;
+
+		int x = 0;
+#if ITM_SIMD_WIDTH > 1
+		for (; x + ITM_SIMD_WIDTH <= dims.x; x += ITM_SIMD_WIDTH) noValidPoints += simd_count(simd_load(row + x) > simd_set(0.0f));
+#endif
+		for (; x < dims.x; x++) if (row[x] > 0.0) noValidPoints++;
+	}
 
 	return noValidPoints;
 }
@@ -22,6 +22,10 @@ namespace ITMLib
 		void FilterSubsampleWithHoles(ITMFloatImage *image_out, const ITMFloatImage *image_in) const;
 		void FilterSubsampleWithHoles(ITMFloat4Image *image_out, const ITMFloat4Image *image_in) const;
 
+		void FilterSubsamplePyramid(ITMFloatImage *const *levels, int noLevels) const;
+		void FilterSubsampleWithHolesPyramid(ITMFloatImage *const *levels, int noLevels) const;
+		void FilterSubsampleWithHolesPyramid(ITMFloat4Image *const *levels, int noLevels) const;
+
 		void GradientX(ITMShort4Image *grad_out, const ITMUChar4Image *image_in) const;
 		void GradientY(ITMShort4Image *grad_out, const ITMUChar4Image *image_in) const;
 		void GradientXY(ITMFloat2Image *grad_out, const ITMFloatImage *image_in) const;
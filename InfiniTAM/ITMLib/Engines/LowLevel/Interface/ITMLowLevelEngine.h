@@ -23,6 +23,24 @@ namespace ITMLib
 		virtual void FilterSubsampleWithHoles(ITMFloatImage *image_out, const ITMFloatImage *image_in) const = 0;
 		virtual void FilterSubsampleWithHoles(ITMFloat4Image *image_out, const ITMFloat4Image *image_in) const = 0;
 
+		/** Fills levels 1 to noLevels - 1 of an image pyramid from levels[0], with the same results as calling
+		    FilterSubsample (or FilterSubsampleWithHoles) on each pair of consecutive levels. Engines can override
+		    these to build the whole pyramid in one pass. */
+		virtual void FilterSubsamplePyramid(ITMFloatImage *const *levels, int noLevels) const
+		{
+			for (int i = 1; i < noLevels; i++) FilterSubsample(levels[i], levels[i - 1]);
+		}
+
+		virtual void FilterSubsampleWithHolesPyramid(ITMFloatImage *const *levels, int noLevels) const
+		{
+			for (int i = 1; i < noLevels; i++) FilterSubsampleWithHoles(levels[i], levels[i - 1]);
+		}
+
+		virtual void FilterSubsampleWithHolesPyramid(ITMFloat4Image *const *levels, int noLevels) const
+		{
+			for (int i = 1; i < noLevels; i++) FilterSubsampleWithHoles(levels[i], levels[i - 1]);
+		}
+
 		virtual void GradientX(ITMShort4Image *grad_out, const ITMUChar4Image *image_in) const = 0;
 		virtual void GradientY(ITMShort4Image *grad_out, const ITMUChar4Image *image_in) const = 0;
 		virtual void GradientXY(ITMFloat2Image *grad_out, const ITMFloatImage *image_in) const = 0;
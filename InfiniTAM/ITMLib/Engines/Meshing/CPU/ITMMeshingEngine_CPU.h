@@ -18,6 +18,8 @@ namespace ITMLib
 	{
 	public:
 		void MeshScene(ITMMesh *mesh, const ITMScene<TVoxel, ITMVoxelBlockHash> *scene);
+		void MeshSceneLOD(ITMMesh *mesh, const ITMScene<TVoxel, ITMVoxelBlockHash> *scene, int stride);
+		void UpdateMesh(ITMBlockMeshCache *meshCache, ITMBlockMeshCache::Delta *delta, ITMScene<TVoxel, ITMVoxelBlockHash> *scene);
 
 		ITMMeshingEngine_CPU(void) { }
 		~ITMMeshingEngine_CPU(void) { }
@@ -3,46 +3,374 @@
 #include "ITMMeshingEngine_CPU.h"
 #include "../Shared/ITMMeshingEngine_Shared.h"
 
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 using namespace ITMLib;
 
+// a block plus one layer of voxels from its +x, +y and +z neighbours, which is all marching cubes needs for its cubes
+static const int meshingWindowSize = SDF_BLOCK_SIZE + 1;
+
+// corners of a cube, in the order used by findPointNeighbors
+static const int cubeCorners[8][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } };
+
+// the two corners of each of the twelve cube edges, in the order used by buildVertList
+static const int edgeCorners[12][2] = { { 0, 1 }, { 1, 2 }, { 2, 3 }, { 3, 0 }, { 4, 5 }, { 5, 6 }, { 6, 7 }, { 7, 4 }, { 0, 4 }, { 1, 5 }, { 2, 6 }, { 3, 7 } };
+
+template<bool hasColor, class TVoxel> struct MeshingColourReader;
+
+template<class TVoxel>
+struct MeshingColourReader<false, TVoxel> {
+	static Vector3f read(const TVoxel &voxel) { return Vector3f(0.0f); }
+
+	static Vector3f interpolate(const TVoxel *localVBA, const ITMHashEntry *hashTable, const Vector3f &point, ITMVoxelBlockHash::NeighbourIndexCache &cache)
+	{
+		return Vector3f(0.0f);
+	}
+};
+
+template<class TVoxel>
+struct MeshingColourReader<true, TVoxel> {
+	static Vector3f read(const TVoxel &voxel) { return voxel.clr.toFloat(); }
+
+	static Vector3f interpolate(const TVoxel *localVBA, const ITMHashEntry *hashTable, const Vector3f &point, ITMVoxelBlockHash::NeighbourIndexCache &cache)
+	{
+		return readFromSDF_color4u_interpolated(localVBA, hashTable, point, cache).toVector3() * 255.0f;
+	}
+};
+
+// Loads the sdf values (and colours) around a block with one hash lookup per neighbouring block. Voxels that are
+// missing or have not been observed (sdf == 1) are marked as unusable, which makes every cube touching them produce no
+// triangles.
+template<class TVoxel>
+static void LoadMeshingWindow(float *sdf, Vector3f *clr, bool *usable, const ITMHashEntry &hashEntry, const TVoxel *localVBA, const ITMHashEntry *hashTable)
+{
+	int blockPtrs[8];
+	for (int n = 0; n < 8; n++)
+	{
+		Vector3i neighbourPos = hashEntry.pos.toInt() + Vector3i(n & 1, (n >> 1) & 1, n >> 2);
+
+		int vmIndex = true;
+		blockPtrs[n] = n == 0 ? hashEntry.ptr * SDF_BLOCK_SIZE3 : findVoxel(hashTable, neighbourPos * SDF_BLOCK_SIZE, vmIndex);
+		if (!vmIndex) blockPtrs[n] = -1;
+	}
+
+	for (int z = 0, locId = 0; z < meshingWindowSize; z++) for (int y = 0; y < meshingWindowSize; y++) for (int x = 0; x < meshingWindowSize; x++, locId++)
+	{
+		int blockPtr = blockPtrs[(x / SDF_BLOCK_SIZE) + (y / SDF_BLOCK_SIZE) * 2 + (z / SDF_BLOCK_SIZE) * 4];
+		if (blockPtr < 0) { usable[locId] = false; continue; }
+
+		int voxelId = (x % SDF_BLOCK_SIZE) + (y % SDF_BLOCK_SIZE) * SDF_BLOCK_SIZE + (z % SDF_BLOCK_SIZE) * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
+		const TVoxel &voxel = localVBA[blockPtr + voxelId];
+		sdf[locId] = TVoxel::valueToFloat(voxel.sdf);
+		if (TVoxel::hasColorInformation) clr[locId] = MeshingColourReader<TVoxel::hasColorInformation, TVoxel>::read(voxel);
+		usable[locId] = sdf[locId] != 1.0f;
+	}
+}
+
+// Samples the sdf (and colours) around a block on a lattice of the given stride, which must divide SDF_BLOCK_SIZE.
+// Each sample is taken at the centre of the stride^3 voxels it stands for, so the trilinear interpolation also filters
+// the sdf a little. Samples next to unobserved voxels only are marked as unusable. The lattice is the same for all
+// blocks, so neighbouring blocks sample the same points along their common faces and their meshes join up.
+template<class TVoxel>
+static void LoadMeshingWindowLOD(float *sdf, Vector3f *clr, bool *usable, const ITMHashEntry &hashEntry, const TVoxel *localVBA, const ITMHashEntry *hashTable,
+	int stride)
+{
+	Vector3f firstSample = (hashEntry.pos.toInt() * SDF_BLOCK_SIZE).toFloat() + Vector3f((stride - 1) * 0.5f);
+	int noSamples = SDF_BLOCK_SIZE / stride + 1;
+
+	ITMVoxelBlockHash::NeighbourIndexCache cache;
+	for (int z = 0; z < noSamples; z++) for (int y = 0; y < noSamples; y++) for (int x = 0; x < noSamples; x++)
+	{
+		int locId = x + y * meshingWindowSize + z * meshingWindowSize * meshingWindowSize;
+		Vector3f point = firstSample + Vector3f((float)x, (float)y, (float)z) * (float)stride;
+
+		int vmIndex, maxW;
+		sdf[locId] = readFromSDF_float_interpolated(localVBA, hashTable, point, vmIndex, cache, maxW);
+		if (TVoxel::hasColorInformation) clr[locId] = MeshingColourReader<TVoxel::hasColorInformation, TVoxel>::interpolate(localVBA, hashTable, point, cache);
+		usable[locId] = maxW > 0;
+	}
+}
+
+// Identifies a cube edge in the whole scene by its lower corner, in voxels, and its axis, so that the cubes sharing an
+// edge also share the vertex on it.
+static inline unsigned long long edgeKey(const Vector3i &lowerCorner, int axis)
+{
+	const int offset = 1 << 19;
+	return ((unsigned long long)(lowerCorner.x + offset) & 0xfffff) | (((unsigned long long)(lowerCorner.y + offset) & 0xfffff) << 20) |
+		(((unsigned long long)(lowerCorner.z + offset) & 0xfffff) << 40) | ((unsigned long long)axis << 60);
+}
+
+// Vertices and triangles meshed by one thread or for one block, with vertex indices local to it.
+struct MeshingOutput
+{
+	std::vector<Vector3f> vertices;
+	std::vector<Vector3u> colours;
+	std::vector<unsigned long long> vertexKeys;
+	std::vector<uint> indices;
+	std::unordered_map<unsigned long long, uint> vertexIds;
+
+	void Clear(void) { vertices.clear(); colours.clear(); vertexKeys.clear(); indices.clear(); vertexIds.clear(); }
+};
+
+struct MeshingWindow
+{
+	float sdf[meshingWindowSize * meshingWindowSize * meshingWindowSize];
+	Vector3f clr[meshingWindowSize * meshingWindowSize * meshingWindowSize];
+	bool usable[meshingWindowSize * meshingWindowSize * meshingWindowSize];
+};
+
+// Runs marching cubes over the cubes of a block, which are single voxels at stride 1 and groups of stride^3 voxels else.
+template<class TVoxel>
+static void MeshBlock(MeshingOutput &output, MeshingWindow &window, const ITMHashEntry &hashEntry, const TVoxel *localVBA, const ITMHashEntry *hashTable,
+	float factor, int stride)
+{
+	Vector3i globalPos = hashEntry.pos.toInt() * SDF_BLOCK_SIZE;
+	Vector3f sampleOffset((stride - 1) * 0.5f);
+	int noCubes = SDF_BLOCK_SIZE / stride;
+
+	if (stride == 1) LoadMeshingWindow(window.sdf, window.clr, window.usable, hashEntry, localVBA, hashTable);
+	else LoadMeshingWindowLOD(window.sdf, window.clr, window.usable, hashEntry, localVBA, hashTable, stride);
+
+	for (int z = 0; z < noCubes; z++) for (int y = 0; y < noCubes; y++) for (int x = 0; x < noCubes; x++)
+	{
+		int locIds[8]; float sdfVals[8];
+
+		bool isValidCube = true;
+		for (int c = 0; c < 8; c++)
+		{
+			locIds[c] = (x + cubeCorners[c][0]) + (y + cubeCorners[c][1]) * meshingWindowSize + (z + cubeCorners[c][2]) * meshingWindowSize * meshingWindowSize;
+			if (!window.usable[locIds[c]]) { isValidCube = false; break; }
+
+			sdfVals[c] = window.sdf[locIds[c]];
+		}
+		if (!isValidCube) continue;
+
+		int cubeIndex = 0;
+		for (int c = 0; c < 8; c++) if (sdfVals[c] < 0) cubeIndex |= 1 << c;
+		if (edgeTable[cubeIndex] == 0) continue;
+
+		uint edgeVertexIds[12];
+		for (int e = 0; e < 12; e++)
+		{
+			if (!(edgeTable[cubeIndex] & (1 << e))) continue;
+
+			// always interpolate from the lower to the upper corner, so that the neighbouring cubes sharing the
+			// edge compute exactly the same vertex
+			int c0 = edgeCorners[e][0], c1 = edgeCorners[e][1];
+			Vector3i corner0(cubeCorners[c0][0], cubeCorners[c0][1], cubeCorners[c0][2]);
+			Vector3i corner1(cubeCorners[c1][0], cubeCorners[c1][1], cubeCorners[c1][2]);
+			if (corner1.x + corner1.y + corner1.z < corner0.x + corner0.y + corner0.z) { std::swap(c0, c1); std::swap(corner0, corner1); }
+
+			int axis = corner1.x != corner0.x ? 0 : (corner1.y != corner0.y ? 1 : 2);
+			Vector3i lowerCorner = globalPos + (Vector3i(x, y, z) + corner0) * stride;
+			unsigned long long key = edgeKey(lowerCorner, axis);
+
+			std::pair<std::unordered_map<unsigned long long, uint>::iterator, bool> result =
+				output.vertexIds.insert(std::make_pair(key, (uint)output.vertices.size()));
+			edgeVertexIds[e] = result.first->second;
+			if (!result.second) continue;
+
+			Vector3f p0 = lowerCorner.toFloat() + sampleOffset, p1 = (globalPos + (Vector3i(x, y, z) + corner1) * stride).toFloat() + sampleOffset;
+			output.vertices.push_back(sdfInterp(p0, p1, sdfVals[c0], sdfVals[c1]) * factor);
+			output.vertexKeys.push_back(key);
+
+			if (TVoxel::hasColorInformation)
+			{
+				Vector3f vertexClr = sdfInterp(window.clr[locIds[c0]], window.clr[locIds[c1]], sdfVals[c0], sdfVals[c1]);
+				output.colours.push_back(Vector3u((uchar)(vertexClr.x + 0.5f), (uchar)(vertexClr.y + 0.5f), (uchar)(vertexClr.z + 0.5f)));
+			}
+		}
+
+		for (int i = 0; triangleTable[cubeIndex][i] != -1; i++) output.indices.push_back(edgeVertexIds[triangleTable[cubeIndex][i]]);
+	}
+}
+
+// Returns the hash entry of the block at the given position, whether its voxels are resident or swapped out, or -1.
+static int findHashEntry(const ITMHashEntry *hashTable, const Vector3i &blockPos)
+{
+	int noBuckets = getHashBucketNum(hashTable);
+	int hashIdx = hashIndex(blockPos, noBuckets);
+
+	while (true)
+	{
+		const ITMHashEntry &hashEntry = hashTable[hashIdx];
+
+		if (IS_EQUAL3(hashEntry.pos, blockPos) && hashEntry.ptr >= -1) return hashIdx;
+
+		if (hashEntry.offset < 1) return -1;
+		hashIdx = noBuckets + hashEntry.offset - 1;
+	}
+}
+
 template<class TVoxel>
 void ITMMeshingEngine_CPU<TVoxel, ITMVoxelBlockHash>::MeshScene(ITMMesh *mesh, const ITMScene<TVoxel, ITMVoxelBlockHash> *scene)
 {
-	ITMMesh::Triangle *triangles = mesh->triangles->GetData(MEMORYDEVICE_CPU);
+	MeshSceneLOD(mesh, scene, 1);
+}
+
+template<class TVoxel>
+void ITMMeshingEngine_CPU<TVoxel, ITMVoxelBlockHash>::MeshSceneLOD(ITMMesh *mesh, const ITMScene<TVoxel, ITMVoxelBlockHash> *scene, int stride)
+{
+	if (stride < 1 || stride > SDF_BLOCK_SIZE || SDF_BLOCK_SIZE % stride != 0) DIEWITHEXCEPTION("The meshing stride must divide the voxel block size");
+
 	const TVoxel *localVBA = scene->localVBA.GetVoxelBlocks();
 	const ITMHashEntry *hashTable = scene->index.GetEntries();
 
-	int noTriangles = 0, noMaxTriangles = mesh->noMaxTriangles, noTotalEntries = scene->index.noTotalEntries;
+	int noTotalEntries = scene->index.noTotalEntries;
 	float factor = scene->sceneParams->voxelSize;
 
-	mesh->triangles->Clear();
+	std::vector<int> blockEntryIds;
+	for (int entryId = 0; entryId < noTotalEntries; entryId++) if (hashTable[entryId].ptr >= 0) blockEntryIds.push_back(entryId);
+	int noBlocks = (int)blockEntryIds.size();
 
-	for (int entryId = 0; entryId < noTotalEntries; entryId++)
+	// every thread meshes one contiguous range of blocks into its own buffers, and the buffers are concatenated in
+	// order, so the mesh comes out the same as from a serial walk over the hash table
+#ifdef WITH_OPENMP
+	std::vector<MeshingOutput> threadOutputs(omp_get_max_threads());
+
+	#pragma omp parallel
+	{
+		int noThreads = omp_get_num_threads(), threadId = omp_get_thread_num();
+#else
+	std::vector<MeshingOutput> threadOutputs(1);
+	{
+		int noThreads = 1, threadId = 0;
+#endif
+		int blockBegin = (int)((long long)noBlocks * threadId / noThreads);
+		int blockEnd = (int)((long long)noBlocks * (threadId + 1) / noThreads);
+
+		MeshingWindow window;
+		for (int blockId = blockBegin; blockId < blockEnd; blockId++)
+			MeshBlock(threadOutputs[threadId], window, hashTable[blockEntryIds[blockId]], localVBA, hashTable, factor, stride);
+	}
+
+	// merge the per thread vertices in thread order, so every vertex gets the index a serial run would have given it
+	mesh->Clear();
+
+	size_t noVertices = 0, noIndices = 0;
+	for (size_t threadId = 0; threadId < threadOutputs.size(); threadId++)
 	{
-		Vector3i globalPos;
-		const ITMHashEntry &currentHashEntry = hashTable[entryId];
+		noVertices += threadOutputs[threadId].vertices.size();
+		noIndices += threadOutputs[threadId].indices.size();
+	}
+	mesh->vertices.reserve(noVertices);
+	mesh->indices.reserve(noIndices);
+	if (TVoxel::hasColorInformation) mesh->colours.reserve(noVertices);
 
-		if (currentHashEntry.ptr < 0) continue;
+	std::unordered_map<unsigned long long, uint> vertexIds;
+	vertexIds.reserve(noVertices);
 
-		globalPos = currentHashEntry.pos.toInt() * SDF_BLOCK_SIZE;
+	for (size_t threadId = 0; threadId < threadOutputs.size(); threadId++)
+	{
+		MeshingOutput &output = threadOutputs[threadId];
 
-		for (int z = 0; z < SDF_BLOCK_SIZE; z++) for (int y = 0; y < SDF_BLOCK_SIZE; y++) for (int x = 0; x < SDF_BLOCK_SIZE; x++)
+		std::vector<uint> vertexRemap(output.vertices.size());
+		for (size_t i = 0; i < output.vertices.size(); i++)
 		{
-			Vector3f vertList[12];
-			int cubeIndex = buildVertList(vertList, globalPos, Vector3i(x, y, z), localVBA, hashTable);
-			
-			if (cubeIndex < 0) continue;
+			std::pair<std::unordered_map<unsigned long long, uint>::iterator, bool> result =
+				vertexIds.insert(std::make_pair(output.vertexKeys[i], (uint)mesh->vertices.size()));
+			vertexRemap[i] = result.first->second;
+			if (!result.second) continue;
 
-			for (int i = 0; triangleTable[cubeIndex][i] != -1; i += 3)
-			{
-				triangles[noTriangles].p0 = vertList[triangleTable[cubeIndex][i]] * factor;
-				triangles[noTriangles].p1 = vertList[triangleTable[cubeIndex][i + 1]] * factor;
-				triangles[noTriangles].p2 = vertList[triangleTable[cubeIndex][i + 2]] * factor;
+			mesh->vertices.push_back(output.vertices[i]);
+			if (TVoxel::hasColorInformation) mesh->colours.push_back(output.colours[i]);
+		}
 
-				if (noTriangles < noMaxTriangles - 1) noTriangles++;
-			}
+		for (size_t i = 0; i < output.indices.size(); i++) mesh->indices.push_back(vertexRemap[output.indices[i]]);
+	}
+
+	mesh->noTotalTriangles = (uint)(mesh->indices.size() / 3);
+}
+
+template<class TVoxel>
+void ITMMeshingEngine_CPU<TVoxel, ITMVoxelBlockHash>::UpdateMesh(ITMBlockMeshCache *meshCache, ITMBlockMeshCache::Delta *delta, ITMScene<TVoxel, ITMVoxelBlockHash> *scene)
+{
+	const TVoxel *localVBA = scene->localVBA.GetVoxelBlocks();
+	const ITMHashEntry *hashTable = scene->index.GetEntries();
+	float factor = scene->sceneParams->voxelSize;
+
+	delta->Clear();
+
+	std::vector<int> dirtyEntryIds;
+	scene->index.TakeDirtyEntries(dirtyEntryIds);
+	int noDirtyEntries = (int)dirtyEntryIds.size();
+
+	// the cubes of a block reach one voxel into its +x, +y and +z neighbours, so a changed block also changes the
+	// meshes of the seven blocks below it
+	std::vector<int> entryIds(noDirtyEntries * 8, -1);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int i = 0; i < noDirtyEntries; i++)
+	{
+		int entryId = dirtyEntryIds[i];
+		entryIds[i * 8] = entryId;
+		if (hashTable[entryId].ptr < -1) continue;
+
+		for (int n = 1; n < 8; n++)
+			entryIds[i * 8 + n] = findHashEntry(hashTable, hashTable[entryId].pos.toInt() - Vector3i(n & 1, (n >> 1) & 1, n >> 2));
+	}
+
+	entryIds.erase(std::remove(entryIds.begin(), entryIds.end(), -1), entryIds.end());
+	std::sort(entryIds.begin(), entryIds.end());
+	entryIds.erase(std::unique(entryIds.begin(), entryIds.end()), entryIds.end());
+	int noEntries = (int)entryIds.size();
+
+	// swapped out blocks keep the meshes they had when they were still resident
+	std::vector<MeshingOutput> blockOutputs(noEntries);
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel
+#endif
+	{
+		MeshingWindow window;
+
+#ifdef WITH_OPENMP
+		#pragma omp for schedule(dynamic, 16)
+#endif
+		for (int i = 0; i < noEntries; i++)
+		{
+			const ITMHashEntry &hashEntry = hashTable[entryIds[i]];
+			if (hashEntry.ptr >= 0) MeshBlock(blockOutputs[i], window, hashEntry, localVBA, hashTable, factor, 1);
 		}
 	}
 
-	mesh->noTotalTriangles = noTriangles;
-}
\ No newline at end of file
+	for (int i = 0; i < noEntries; i++)
+	{
+		int entryId = entryIds[i];
+		const ITMHashEntry &hashEntry = hashTable[entryId];
+		if (hashEntry.ptr == -1) continue;
+
+		std::map<int, ITMBlockMeshCache::BlockMesh>::iterator cached = meshCache->blocks.find(entryId);
+		MeshingOutput &output = blockOutputs[i];
+
+		if (output.indices.empty())
+		{
+			if (cached == meshCache->blocks.end()) continue;
+
+			meshCache->blocks.erase(cached);
+			delta->removed.push_back(entryId);
+			continue;
+		}
+
+		if (cached == meshCache->blocks.end())
+		{
+			cached = meshCache->blocks.insert(std::make_pair(entryId, ITMBlockMeshCache::BlockMesh())).first;
+			delta->added.push_back(entryId);
+		}
+		else delta->changed.push_back(entryId);
+
+		ITMBlockMeshCache::BlockMesh &blockMesh = cached->second;
+		blockMesh.blockPos = hashEntry.pos;
+		blockMesh.vertices.swap(output.vertices);
+		blockMesh.colours.swap(output.colours);
+		blockMesh.indices.swap(output.indices);
+	}
+}
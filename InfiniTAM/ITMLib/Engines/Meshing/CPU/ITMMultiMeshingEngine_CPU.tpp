@@ -4,6 +4,8 @@
 
 #include "../Shared/ITMMultiMeshingEngine_Shared.h"
 
+#include <vector>
+
 using namespace ITMLib;
 
 template<class TVoxel>
@@ -33,10 +35,9 @@ inline void ITMMultiMeshingEngine_CPU<TVoxel, ITMVoxelBlockHash>::MeshScene(ITMM
 		localVBAs.voxels[localMapId] = sceneManager.getLocalMap(localMapId)->scene->localVBA.GetVoxelBlocks();
 	}
 
-	ITMMesh::Triangle *triangles = mesh->triangles->GetData(MEMORYDEVICE_CPU);
-	mesh->triangles->Clear();
+	std::vector<ITMMesh::Triangle> triangles;
 
-	int noTriangles = 0, noMaxTriangles = mesh->noMaxTriangles, noTotalEntriesPerLocalMap = ITMVoxelBlockHash::noTotalEntries;
+	int noTotalEntriesPerLocalMap = sceneParams.noHashBuckets + sceneParams.noHashExcessEntries;
 	float factor = sceneParams.voxelSize;
 
 	// very dumb rendering -- likely to generate lots of duplicates
@@ -62,15 +63,16 @@ inline void ITMMultiMeshingEngine_CPU<TVoxel, ITMVoxelBlockHash>::MeshScene(ITMM
 
 				for (int i = 0; triangleTable[cubeIndex][i] != -1; i += 3)
 				{
-					triangles[noTriangles].p0 = vertList[triangleTable[cubeIndex][i]] * factor;
-					triangles[noTriangles].p1 = vertList[triangleTable[cubeIndex][i + 1]] * factor;
-					triangles[noTriangles].p2 = vertList[triangleTable[cubeIndex][i + 2]] * factor;
-
-					if (noTriangles < noMaxTriangles - 1) noTriangles++;
+					ITMMesh::Triangle triangle;
+					triangle.p0 = vertList[triangleTable[cubeIndex][i]] * factor;
+					triangle.p1 = vertList[triangleTable[cubeIndex][i + 1]] * factor;
+					triangle.p2 = vertList[triangleTable[cubeIndex][i + 2]] * factor;
+					triangles.push_back(triangle);
 				}
 			}
 		}
 	}
 
-	mesh->noTotalTriangles = noTriangles;
+	// the local maps overlap, so vertices can only be merged by position
+	mesh->SetFromTriangles(triangles.empty() ? NULL : &triangles[0], (uint)triangles.size());
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include <math.h>
 
+#include "../../../Objects/Meshing/ITMBlockMeshCache.h"
 #include "../../../Objects/Meshing/ITMMesh.h"
 #include "../../../Objects/Scene/ITMScene.h"
 
@@ -15,6 +16,28 @@ namespace ITMLib
 	public:
 		virtual void MeshScene(ITMMesh *mesh, const ITMScene<TVoxel,TIndex> *scene) = 0;
 
+		/** Extracts a coarser mesh, running marching cubes
+		    on the sdf sampled every stride voxels. The stride
+		    has to divide the voxel block size, i.e. be 1, 2, 4
+		    or 8, and 1 gives the same mesh as MeshScene.
+		*/
+		virtual void MeshSceneLOD(ITMMesh *mesh, const ITMScene<TVoxel,TIndex> *scene, int stride)
+		{
+			if (stride != 1) DIEWITHEXCEPTION("Level of detail meshing is not supported by this meshing engine");
+			MeshScene(mesh, scene);
+		}
+
+		/** Re-extracts the blocks that changed since the last
+		    update, and the neighbouring blocks whose meshes
+		    depend on them, into the block mesh cache. The
+		    hash entries of the blocks whose meshes were added,
+		    changed or removed are returned in the delta.
+		*/
+		virtual void UpdateMesh(ITMBlockMeshCache *meshCache, ITMBlockMeshCache::Delta *delta, ITMScene<TVoxel,TIndex> *scene)
+		{
+			DIEWITHEXCEPTION("Incremental meshing is not supported by this meshing engine");
+		}
+
 		ITMMeshingEngine(void) { }
 		virtual ~ITMMeshingEngine(void) { }
 	};
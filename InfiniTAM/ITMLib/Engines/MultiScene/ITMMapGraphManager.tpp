@@ -91,7 +91,7 @@ namespace ITMLib
 		if ((localMapId < 0) || ((unsigned)localMapId >= allData.size())) return -1;
 
 		ITMScene<TVoxel, TIndex> *scene = allData[localMapId]->scene;
-		return scene->index.getNumAllocatedVoxelBlocks() - scene->localVBA.lastFreeBlockId - 1;
+		return scene->localVBA.GetNoBlocks() - scene->localVBA.lastFreeBlockId - 1;
 	}
 
 	template<class TVoxel, class TIndex>
@@ -103,8 +103,8 @@ namespace ITMLib
 		if (invertIds) 
 		{
 			int tmp = minBlockId;
-			minBlockId = localMap->scene->index.getNumAllocatedVoxelBlocks() - maxBlockId - 1;
-			maxBlockId = localMap->scene->index.getNumAllocatedVoxelBlocks() - tmp - 1;
+			minBlockId = localMap->scene->localVBA.GetNoBlocks() - maxBlockId - 1;
+			maxBlockId = localMap->scene->localVBA.GetNoBlocks() - tmp - 1;
 		}
 
 		return visualisationEngine->CountVisibleBlocks(localMap->scene, localMap->renderState, minBlockId, maxBlockId);
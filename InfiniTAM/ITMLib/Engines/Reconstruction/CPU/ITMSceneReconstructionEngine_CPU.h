@@ -2,8 +2,11 @@
 
 #pragma once
 
+#include <vector>
+
 #include "../Interface/ITMSceneReconstructionEngine.h"
 #include "../../../Objects/Scene/ITMPlainVoxelArray.h"
+#include "../../../Objects/Scene/ITMVoxelBlockCuckooHash.h"
 
 namespace ITMLib
 {
@@ -18,6 +21,18 @@ namespace ITMLib
 		ORUtils::MemoryBlock<unsigned char> *entriesAllocType;
 		ORUtils::MemoryBlock<Vector4s> *blockCoords;
 
+		/** Per-thread lists of the hash entries for which an allocation was requested during the per-pixel pass. */
+		std::vector<std::vector<int> > allocationRequests;
+
+		/** The merged list of allocation requests, sorted by hash index. */
+		std::vector<int> allocationCandidates;
+
+		/** Ids of all entries with a non-zero visible type, gathered before the visible list is rebuilt. */
+		ORUtils::MemoryBlock<int> *visibleCandidates;
+
+		/** Grows the per-entry buffers above to cover a hash table with the given number of entries. */
+		void ResizeEntryBuffers(int noTotalEntries);
+
 	public:
 		void ResetScene(ITMScene<TVoxel, ITMVoxelBlockHash> *scene);
 
@@ -46,4 +61,42 @@ namespace ITMLib
 		ITMSceneReconstructionEngine_CPU(void);
 		~ITMSceneReconstructionEngine_CPU(void);
 	};
+
+	/** \brief
+	    Allocation and integration for ITMVoxelBlockCuckooHash.
+
+	    The blocks are integrated where the current depth image
+	    has allocated them, i.e. within the truncation band
+	    around the observed surface. The engine keeps that list
+	    itself, so the render state that is passed in is not used.
+	*/
+	template<class TVoxel>
+	class ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockCuckooHash> : public ITMSceneReconstructionEngine < TVoxel, ITMVoxelBlockCuckooHash >
+	{
+	protected:
+		/** One flag per entry of the table, set while the entry is known to be in the list of blocks to integrate. */
+		ORUtils::MemoryBlock<unsigned char> *entriesVisibleType;
+
+		/** Per-thread lists of the positions of blocks that were not in the table during the per-pixel pass. */
+		std::vector<std::vector<Vector3s> > allocationRequests;
+
+		/** The merged list of allocation requests, as packed block positions, sorted. */
+		std::vector<long long> allocationCandidates;
+
+		/** Ids of the entries of the blocks to integrate, and their number. */
+		ORUtils::MemoryBlock<int> *visibleEntryIds;
+		int noVisibleEntries;
+
+	public:
+		void ResetScene(ITMScene<TVoxel, ITMVoxelBlockCuckooHash> *scene);
+
+		void AllocateSceneFromDepth(ITMScene<TVoxel, ITMVoxelBlockCuckooHash> *scene, const ITMView *view, const ITMTrackingState *trackingState,
+			const ITMRenderState *renderState, bool onlyUpdateVisibleList = false, bool resetVisibleList = false);
+
+		void IntegrateIntoScene(ITMScene<TVoxel, ITMVoxelBlockCuckooHash> *scene, const ITMView *view, const ITMTrackingState *trackingState,
+			const ITMRenderState *renderState);
+
+		ITMSceneReconstructionEngine_CPU(void);
+		~ITMSceneReconstructionEngine_CPU(void);
+	};
 }
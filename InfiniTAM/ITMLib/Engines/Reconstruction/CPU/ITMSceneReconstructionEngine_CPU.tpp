@@ -4,14 +4,90 @@
 
 #include "../Shared/ITMSceneReconstructionEngine_Shared.h"
 #include "../../../Objects/RenderStates/ITMRenderState_VH.h"
+
+#include <algorithm>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 using namespace ITMLib;
 
+// Writes the ids of all entries with a non-zero type to entryIds, in ascending order, and returns their number.
+// Each thread compacts one contiguous range of the table, so the ordering matches that of a serial scan.
+static int CompactNonZeroEntries(const uchar *entryTypes, int noTotalEntries, int *entryIds)
+{
+#ifdef WITH_OPENMP
+	std::vector<int> chunkOffsets(omp_get_max_threads() + 1, 0);
+	int noEntries = 0;
+
+	#pragma omp parallel
+	{
+		int noThreads = omp_get_num_threads(), threadId = omp_get_thread_num();
+		int chunkBegin = (int)((long long)noTotalEntries * threadId / noThreads);
+		int chunkEnd = (int)((long long)noTotalEntries * (threadId + 1) / noThreads);
+
+		int noChunkEntries = 0;
+		for (int i = chunkBegin; i < chunkEnd; i++) if (entryTypes[i] > 0) noChunkEntries++;
+		chunkOffsets[threadId + 1] = noChunkEntries;
+
+		#pragma omp barrier
+		#pragma omp single
+		{
+			for (int t = 0; t < noThreads; t++) chunkOffsets[t + 1] += chunkOffsets[t];
+			noEntries = chunkOffsets[noThreads];
+		}
+
+		int offset = chunkOffsets[threadId];
+		for (int i = chunkBegin; i < chunkEnd; i++) if (entryTypes[i] > 0) entryIds[offset++] = i;
+	}
+
+	return noEntries;
+#else
+	int noEntries = 0;
+	for (int i = 0; i < noTotalEntries; i++) if (entryTypes[i] > 0) entryIds[noEntries++] = i;
+	return noEntries;
+#endif
+}
+
+// Fuses the view into the voxels of the block at blockPos, whose voxels start at localVoxelBlock.
+template<class TVoxel>
+static inline void IntegrateVoxelBlock(TVoxel *localVoxelBlock, const Vector3s &blockPos, float voxelSize, bool stopIntegratingAtMaxW,
+	const Matrix4f &M_d, const Vector4f &projParams_d, const Matrix4f &M_rgb, const Vector4f &projParams_rgb, float mu, int maxW,
+	const float *depth, const float *confidence, const Vector2i &depthImgSize, const Vector4u *rgb, const Vector2i &rgbImgSize)
+{
+	Vector3i globalPos;
+	globalPos.x = blockPos.x;
+	globalPos.y = blockPos.y;
+	globalPos.z = blockPos.z;
+	globalPos *= SDF_BLOCK_SIZE;
+
+	for (int z = 0; z < SDF_BLOCK_SIZE; z++) for (int y = 0; y < SDF_BLOCK_SIZE; y++) for (int x = 0; x < SDF_BLOCK_SIZE; x++)
+	{
+		Vector4f pt_model; int locId;
+
+		locId = x + y * SDF_BLOCK_SIZE + z * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
+
+		if (stopIntegratingAtMaxW) if (localVoxelBlock[locId].w_depth == maxW) continue;
+		//if (approximateIntegration) if (localVoxelBlock[locId].w_depth != 0) continue;
+
+		pt_model.x = (float)(globalPos.x + x) * voxelSize;
+		pt_model.y = (float)(globalPos.y + y) * voxelSize;
+		pt_model.z = (float)(globalPos.z + z) * voxelSize;
+		pt_model.w = 1.0f;
+
+		ComputeUpdatedVoxelInfo<TVoxel::hasColorInformation,TVoxel::hasConfidenceInformation, TVoxel>::compute(localVoxelBlock[locId], pt_model, M_d, 
+			projParams_d, M_rgb, projParams_rgb, mu, maxW, depth, confidence, depthImgSize, rgb, rgbImgSize);
+	}
+}
+
 template<class TVoxel>
 ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockHash>::ITMSceneReconstructionEngine_CPU(void) 
 {
-	int noTotalEntries = ITMVoxelBlockHash::noTotalEntries;
-	entriesAllocType = new ORUtils::MemoryBlock<unsigned char>(noTotalEntries, MEMORYDEVICE_CPU);
-	blockCoords = new ORUtils::MemoryBlock<Vector4s>(noTotalEntries, MEMORYDEVICE_CPU);
+	// sized to the hash table of the scene in AllocateSceneFromDepth
+	entriesAllocType = new ORUtils::MemoryBlock<unsigned char>(1, MEMORYDEVICE_CPU);
+	blockCoords = new ORUtils::MemoryBlock<Vector4s>(1, MEMORYDEVICE_CPU);
+	visibleCandidates = new ORUtils::MemoryBlock<int>(1, MEMORYDEVICE_CPU);
 }
 
 template<class TVoxel>
@@ -19,12 +95,24 @@ ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockHash>::~ITMSceneReconstruct
 {
 	delete entriesAllocType;
 	delete blockCoords;
+	delete visibleCandidates;
+}
+
+template<class TVoxel>
+void ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockHash>::ResizeEntryBuffers(int noTotalEntries)
+{
+	if (entriesAllocType->dataSize >= (size_t)noTotalEntries) return;
+
+	entriesAllocType->Resize(noTotalEntries);
+	entriesAllocType->Clear();
+	blockCoords->Resize(noTotalEntries);
+	visibleCandidates->Resize(noTotalEntries);
 }
 
 template<class TVoxel>
 void ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockHash>::ResetScene(ITMScene<TVoxel, ITMVoxelBlockHash> *scene)
 {
-	int numBlocks = scene->index.getNumAllocatedVoxelBlocks();
+	int numBlocks = scene->localVBA.GetNoBlocks();
 	int blockSize = scene->index.getVoxelBlockSize();
 
 	TVoxel *voxelBlocks_ptr = scene->localVBA.GetVoxelBlocks();
@@ -39,9 +127,11 @@ void ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockHash>::ResetScene(ITMS
 	ITMHashEntry *hashEntry_ptr = scene->index.GetEntries();
 	for (int i = 0; i < scene->index.noTotalEntries; ++i) hashEntry_ptr[i] = tmpEntry;
 	int *excessList_ptr = scene->index.GetExcessAllocationList();
-	for (int i = 0; i < SDF_EXCESS_LIST_SIZE; ++i) excessList_ptr[i] = i;
+	for (int i = 0; i < scene->index.noExcessEntries; ++i) excessList_ptr[i] = i;
 
-	scene->index.SetLastFreeExcessListId(SDF_EXCESS_LIST_SIZE - 1);
+	scene->index.SetLastFreeExcessListId(scene->index.noExcessEntries - 1);
+	scene->index.MarkAllEntriesDirty();
+	if (scene->index.GetBlockOccupancy() != NULL) scene->index.GetBlockOccupancy()->Clear();
 }
 
 template<class TVoxel>
@@ -77,40 +167,21 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::IntegrateIntoS
 	bool stopIntegratingAtMaxW = scene->sceneParams->stopIntegratingAtMaxW;
 	//bool approximateIntegration = !trackingState->requiresFullRendering;
 
+	// record the blocks that are about to change, so that updating their meshes does not have to scan the table
+	for (int entryId = 0; entryId < noVisibleEntries; entryId++)
+		if (hashTable[visibleEntryIds[entryId]].ptr >= 0) scene->index.MarkEntryDirty(visibleEntryIds[entryId]);
+
 #ifdef WITH_OPENMP
 	#pragma omp parallel for
 #endif
 	for (int entryId = 0; entryId < noVisibleEntries; entryId++)
 	{
-		Vector3i globalPos;
 		const ITMHashEntry &currentHashEntry = hashTable[visibleEntryIds[entryId]];
 
 		if (currentHashEntry.ptr < 0) continue;
 
-		globalPos.x = currentHashEntry.pos.x;
-		globalPos.y = currentHashEntry.pos.y;
-		globalPos.z = currentHashEntry.pos.z;
-		globalPos *= SDF_BLOCK_SIZE;
-
-		TVoxel *localVoxelBlock = &(localVBA[currentHashEntry.ptr * (SDF_BLOCK_SIZE3)]);
-
-		for (int z = 0; z < SDF_BLOCK_SIZE; z++) for (int y = 0; y < SDF_BLOCK_SIZE; y++) for (int x = 0; x < SDF_BLOCK_SIZE; x++)
-		{
-			Vector4f pt_model; int locId;
-
-			locId = x + y * SDF_BLOCK_SIZE + z * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
-
-			if (stopIntegratingAtMaxW) if (localVoxelBlock[locId].w_depth == maxW) continue;
-			//if (approximateIntegration) if (localVoxelBlock[locId].w_depth != 0) continue;
-
-			pt_model.x = (float)(globalPos.x + x) * voxelSize;
-			pt_model.y = (float)(globalPos.y + y) * voxelSize;
-			pt_model.z = (float)(globalPos.z + z) * voxelSize;
-			pt_model.w = 1.0f;
-
-			ComputeUpdatedVoxelInfo<TVoxel::hasColorInformation,TVoxel::hasConfidenceInformation, TVoxel>::compute(localVoxelBlock[locId], pt_model, M_d, 
-				projParams_d, M_rgb, projParams_rgb, mu, maxW, depth, confidence, depthImgSize, rgb, rgbImgSize);
-		}
+		IntegrateVoxelBlock(&(localVBA[currentHashEntry.ptr * (SDF_BLOCK_SIZE3)]), currentHashEntry.pos, voxelSize, stopIntegratingAtMaxW, M_d, projParams_d,
+			M_rgb, projParams_rgb, mu, maxW, depth, confidence, depthImgSize, rgb, rgbImgSize);
 	}
 }
 
@@ -136,18 +207,23 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::AllocateSceneF
 
 	float mu = scene->sceneParams->mu;
 
+	int noTotalEntries = scene->index.noTotalEntries;
+	ResizeEntryBuffers(noTotalEntries);
+
 	float *depth = view->depth->GetData(MEMORYDEVICE_CPU);
 	int *voxelAllocationList = scene->localVBA.GetAllocationList();
 	int *excessAllocationList = scene->index.GetExcessAllocationList();
 	ITMHashEntry *hashTable = scene->index.GetEntries();
+	ITMBlockOccupancy *occupancy = scene->index.GetBlockOccupancy();
 	ITMHashSwapState *swapStates = scene->globalCache != NULL ? scene->globalCache->GetSwapStates(false) : 0;
 	int *visibleEntryIDs = renderState_vh->GetVisibleEntryIDs();
 	uchar *entriesVisibleType = renderState_vh->GetEntriesVisibleType();
 	uchar *entriesAllocType = this->entriesAllocType->GetData(MEMORYDEVICE_CPU);
 	Vector4s *blockCoords = this->blockCoords->GetData(MEMORYDEVICE_CPU);
-	int noTotalEntries = scene->index.noTotalEntries;
+	int noBuckets = scene->index.noBuckets;
 
 	bool useSwapping = scene->globalCache != NULL;
+	bool queueSwapOutCandidates = renderState_vh->AreSwapOutCandidatesEnabled();
 
 	float oneOverVoxelSize = 1.0f / (voxelSize * SDF_BLOCK_SIZE);
 
@@ -156,31 +232,74 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::AllocateSceneF
 
 	int noVisibleEntries = 0;
 
-	memset(entriesAllocType, 0, noTotalEntries);
-
 	for (int i = 0; i < renderState_vh->noVisibleEntries; i++)
 		entriesVisibleType[visibleEntryIDs[i]] = 3; // visible at previous frame and unstreamed
 
+	// entriesAllocType is all zero on entry; every entry that gets marked for allocation below is recorded
+	// by the thread that marks it first, and reset again once the allocation pass is done
+#ifdef WITH_OPENMP
+	allocationRequests.resize(omp_get_max_threads());
+#else
+	allocationRequests.resize(1);
+#endif
+	for (size_t t = 0; t < allocationRequests.size(); t++) allocationRequests[t].clear();
+
 	//build hashVisibility
 #ifdef WITH_OPENMP
-	#pragma omp parallel for
+	#pragma omp parallel
 #endif
-	for (int locId = 0; locId < depthImgSize.x*depthImgSize.y; locId++)
 	{
-		int y = locId / depthImgSize.x;
-		int x = locId - y * depthImgSize.x;
-		buildHashAllocAndVisibleTypePP(entriesAllocType, entriesVisibleType, x, y, blockCoords, depth, invM_d,
-			invProjParams_d, mu, depthImgSize, oneOverVoxelSize, hashTable, scene->sceneParams->viewFrustum_min,
-			scene->sceneParams->viewFrustum_max);
+#ifdef WITH_OPENMP
+		std::vector<int> &threadAllocationRequests = allocationRequests[omp_get_thread_num()];
+		#pragma omp for
+#else
+		std::vector<int> &threadAllocationRequests = allocationRequests[0];
+#endif
+		for (int locId = 0; locId < depthImgSize.x*depthImgSize.y; locId++)
+		{
+			int y = locId / depthImgSize.x;
+			int x = locId - y * depthImgSize.x;
+
+			Vector3f point, direction;
+			int noSteps = computeHashAllocRaySegment(point, direction, x, y, depth, invM_d, invProjParams_d, mu, depthImgSize, oneOverVoxelSize,
+				scene->sceneParams->viewFrustum_min, scene->sceneParams->viewFrustum_max);
+
+			for (int i = 0; i < noSteps; i++)
+			{
+				Vector3s blockPos = TO_SHORT_FLOOR3(point);
+				int allocIdx = buildHashAllocAndVisibleTypeForBlock(entriesAllocType, entriesVisibleType, blockCoords, hashTable, blockPos);
+				if (allocIdx >= 0) threadAllocationRequests.push_back(allocIdx);
+				point += direction;
+			}
+		}
 	}
 
+	// merge the per-thread requests; two threads may both have recorded the same entry, and the allocation below
+	// has to visit the entries in ascending order so that block ids are handed out exactly as by a full table scan
+	allocationCandidates.clear();
+	for (size_t t = 0; t < allocationRequests.size(); t++)
+		allocationCandidates.insert(allocationCandidates.end(), allocationRequests[t].begin(), allocationRequests[t].end());
+	std::sort(allocationCandidates.begin(), allocationCandidates.end());
+	allocationCandidates.erase(std::unique(allocationCandidates.begin(), allocationCandidates.end()), allocationCandidates.end());
+
+	int noAllocationCandidates = (int)allocationCandidates.size();
+
 	if (onlyUpdateVisibleList) useSwapping = false;
 	if (!onlyUpdateVisibleList)
 	{
+		// grow the voxel block array first if the requests might not fit
+		if (scene->localVBA.lastFreeBlockId + 1 < noAllocationCandidates)
+		{
+			scene->localVBA.ReserveFreeBlocks(noAllocationCandidates);
+			voxelAllocationList = scene->localVBA.GetAllocationList();
+			lastFreeVoxelBlockId = scene->localVBA.lastFreeBlockId;
+		}
+
 		//allocate
-		for (int targetIdx = 0; targetIdx < noTotalEntries; targetIdx++)
+		for (int candidateIdx = 0; candidateIdx < noAllocationCandidates; candidateIdx++)
 		{
 			int vbaIdx, exlIdx;
+			int targetIdx = allocationCandidates[candidateIdx];
 			unsigned char hashChangeType = entriesAllocType[targetIdx];
 
 			switch (hashChangeType)
@@ -198,6 +317,7 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::AllocateSceneF
 					hashEntry.offset = 0;
 
 					hashTable[targetIdx] = hashEntry;
+					if (occupancy != NULL) occupancy->SetBlock(hashEntry.pos, true);
 				}
 				else
 				{
@@ -226,9 +346,10 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::AllocateSceneF
 
 					hashTable[targetIdx].offset = exlOffset + 1; //connect to child
 
-					hashTable[SDF_BUCKET_NUM + exlOffset] = hashEntry; //add child to the excess list
+					hashTable[noBuckets + exlOffset] = hashEntry; //add child to the excess list
+					if (occupancy != NULL) occupancy->SetBlock(hashEntry.pos, true);
 
-					entriesVisibleType[SDF_BUCKET_NUM + exlOffset] = 1; //make child visible and in memory
+					entriesVisibleType[noBuckets + exlOffset] = 1; //make child visible and in memory
 				}
 				else
 				{
@@ -243,9 +364,21 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::AllocateSceneF
 		}
 	}
 
+	for (int candidateIdx = 0; candidateIdx < noAllocationCandidates; candidateIdx++)
+		entriesAllocType[allocationCandidates[candidateIdx]] = 0;
+
+	// gather everything with a non-zero visible type: the previous visible list, the entries marked above and
+	// any entries marked by raycasts since the last call
+	int *visibleCandidates = this->visibleCandidates->GetData(MEMORYDEVICE_CPU);
+	int noVisibleCandidates = CompactNonZeroEntries(entriesVisibleType, noTotalEntries, visibleCandidates);
+
 	//build visible list
-	for (int targetIdx = 0; targetIdx < noTotalEntries; targetIdx++)
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int candidateIdx = 0; candidateIdx < noVisibleCandidates; candidateIdx++)
 	{
+		int targetIdx = visibleCandidates[candidateIdx];
 		unsigned char hashVisibleType = entriesVisibleType[targetIdx];
 		const ITMHashEntry &hashEntry = hashTable[targetIdx];
 		
@@ -263,40 +396,56 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockHash>::AllocateSceneF
 			}
 			entriesVisibleType[targetIdx] = hashVisibleType;
 		}
+	}
 
-		if (useSwapping)
-		{
-			if (hashVisibleType > 0 && swapStates[targetIdx].state != 2) swapStates[targetIdx].state = 1;
-		}
+	// the swapping engine only looks at the entries queued here, rather than scanning the whole table
+	std::vector<int> *swapInCandidates = useSwapping ? &scene->globalCache->GetSwapInCandidates() : NULL;
+	for (int candidateIdx = 0; candidateIdx < noVisibleCandidates; candidateIdx++)
+	{
+		int targetIdx = visibleCandidates[candidateIdx];
 
-		if (hashVisibleType > 0)
+		if (entriesVisibleType[targetIdx] > 0)
 		{	
 			visibleEntryIDs[noVisibleEntries] = targetIdx;
 			noVisibleEntries++;
-		}
 
-#if 0
-		// "active list", currently disabled
-		if (hashVisibleType == 1)
-		{
-			activeEntryIDs[noActiveEntries] = targetIdx;
-			noActiveEntries++;
+			if (useSwapping && swapStates[targetIdx].state == 0)
+			{
+				swapStates[targetIdx].state = 1;
+				swapInCandidates->push_back(targetIdx);
+			}
 		}
-#endif
+		else if (queueSwapOutCandidates) renderState_vh->AddSwapOutCandidate(targetIdx);
 	}
 
 	//reallocate deleted ones from previous swap operation
 	if (useSwapping)
 	{
-		for (int targetIdx = 0; targetIdx < noTotalEntries; targetIdx++)
+		int noSwappedOutEntries = 0;
+		for (int visibleIdx = 0; visibleIdx < noVisibleEntries; visibleIdx++)
+			if (hashTable[visibleEntryIDs[visibleIdx]].ptr == -1) noSwappedOutEntries++;
+
+		if (lastFreeVoxelBlockId + 1 < noSwappedOutEntries)
+		{
+			scene->localVBA.lastFreeBlockId = lastFreeVoxelBlockId;
+			scene->localVBA.ReserveFreeBlocks(noSwappedOutEntries);
+			voxelAllocationList = scene->localVBA.GetAllocationList();
+			lastFreeVoxelBlockId = scene->localVBA.lastFreeBlockId;
+		}
+
+		for (int visibleIdx = 0; visibleIdx < noVisibleEntries; visibleIdx++)
 		{
 			int vbaIdx;
-			ITMHashEntry hashEntry = hashTable[targetIdx];
+			int targetIdx = visibleEntryIDs[visibleIdx];
 
-			if (entriesVisibleType[targetIdx] > 0 && hashEntry.ptr == -1) 
+			if (hashTable[targetIdx].ptr == -1) 
 			{
 				vbaIdx = lastFreeVoxelBlockId; lastFreeVoxelBlockId--;
-				if (vbaIdx >= 0) hashTable[targetIdx].ptr = voxelAllocationList[vbaIdx];
+				if (vbaIdx >= 0)
+				{
+					hashTable[targetIdx].ptr = voxelAllocationList[vbaIdx];
+					if (occupancy != NULL) occupancy->SetBlock(hashTable[targetIdx].pos, true);
+				}
 				else lastFreeVoxelBlockId++; // Avoid leaks
 			}
 		}
@@ -385,3 +534,201 @@ void ITMSceneReconstructionEngine_CPU<TVoxel, ITMPlainVoxelArray>::IntegrateInto
 			depth, depthImgSize, rgb, rgbImgSize);
 	}
 }
+
+// Packs a block position into a key, ordered by the x, then the y, then the z coordinate of the position.
+static inline long long PackBlockPos(const Vector3s &blockPos)
+{
+	return ((long long)(unsigned short)blockPos.x << 32) | ((long long)(unsigned short)blockPos.y << 16) | (long long)(unsigned short)blockPos.z;
+}
+
+static inline Vector3s UnpackBlockPos(long long key)
+{
+	return Vector3s((short)(key >> 32), (short)(key >> 16), (short)key);
+}
+
+template<class TVoxel>
+ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockCuckooHash>::ITMSceneReconstructionEngine_CPU(void)
+{
+	// sized to the hash table of the scene in AllocateSceneFromDepth
+	entriesVisibleType = new ORUtils::MemoryBlock<unsigned char>(1, MEMORYDEVICE_CPU);
+	visibleEntryIds = new ORUtils::MemoryBlock<int>(1, MEMORYDEVICE_CPU);
+	noVisibleEntries = 0;
+}
+
+template<class TVoxel>
+ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockCuckooHash>::~ITMSceneReconstructionEngine_CPU(void)
+{
+	delete entriesVisibleType;
+	delete visibleEntryIds;
+}
+
+template<class TVoxel>
+void ITMSceneReconstructionEngine_CPU<TVoxel,ITMVoxelBlockCuckooHash>::ResetScene(ITMScene<TVoxel, ITMVoxelBlockCuckooHash> *scene)
+{
+	int numBlocks = scene->localVBA.GetNoBlocks();
+	int blockSize = scene->index.getVoxelBlockSize();
+
+	TVoxel *voxelBlocks_ptr = scene->localVBA.GetVoxelBlocks();
+	for (int i = 0; i < numBlocks * blockSize; ++i) voxelBlocks_ptr[i] = TVoxel();
+	int *vbaAllocationList_ptr = scene->localVBA.GetAllocationList();
+	for (int i = 0; i < numBlocks; ++i) vbaAllocationList_ptr[i] = i;
+	scene->localVBA.lastFreeBlockId = numBlocks - 1;
+
+	scene->index.Clear();
+	noVisibleEntries = 0;
+}
+
+template<class TVoxel>
+void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockCuckooHash>::AllocateSceneFromDepth(ITMScene<TVoxel, ITMVoxelBlockCuckooHash> *scene, const ITMView *view,
+	const ITMTrackingState *trackingState, const ITMRenderState *renderState, bool onlyUpdateVisibleList, bool resetVisibleList)
+{
+	if (scene->globalCache != NULL) throw std::runtime_error("The cuckoo hash does not support swapping");
+
+	Vector2i depthImgSize = view->depth->noDims;
+	float voxelSize = scene->sceneParams->voxelSize;
+
+	Matrix4f M_d, invM_d;
+	Vector4f projParams_d, invProjParams_d;
+
+	M_d = trackingState->pose_d->GetM(); M_d.inv(invM_d);
+
+	projParams_d = view->calib.intrinsics_d.projectionParamsSimple.all;
+	invProjParams_d = projParams_d;
+	invProjParams_d.x = 1.0f / invProjParams_d.x;
+	invProjParams_d.y = 1.0f / invProjParams_d.y;
+
+	float mu = scene->sceneParams->mu;
+
+	int noTotalEntries = scene->index.noTotalEntries;
+	if (entriesVisibleType->dataSize < (size_t)noTotalEntries)
+	{
+		entriesVisibleType->Resize(noTotalEntries);
+		entriesVisibleType->Clear();
+		visibleEntryIds->Resize(noTotalEntries);
+	}
+
+	float *depth = view->depth->GetData(MEMORYDEVICE_CPU);
+	const ITMCuckooHashBucket *buckets = scene->index.getIndexData();
+	uchar *entriesVisibleType = this->entriesVisibleType->GetData(MEMORYDEVICE_CPU);
+
+	float oneOverVoxelSize = 1.0f / (voxelSize * SDF_BLOCK_SIZE);
+
+#ifdef WITH_OPENMP
+	allocationRequests.resize(omp_get_max_threads());
+#else
+	allocationRequests.resize(1);
+#endif
+	for (size_t t = 0; t < allocationRequests.size(); t++) allocationRequests[t].clear();
+
+	// mark the blocks along the truncation band that are in the table already, and note the ones that are not
+#ifdef WITH_OPENMP
+	#pragma omp parallel
+#endif
+	{
+#ifdef WITH_OPENMP
+		std::vector<Vector3s> &threadAllocationRequests = allocationRequests[omp_get_thread_num()];
+		#pragma omp for
+#else
+		std::vector<Vector3s> &threadAllocationRequests = allocationRequests[0];
+#endif
+		for (int locId = 0; locId < depthImgSize.x*depthImgSize.y; locId++)
+		{
+			int y = locId / depthImgSize.x;
+			int x = locId - y * depthImgSize.x;
+
+			Vector3f point, direction;
+			int noSteps = computeHashAllocRaySegment(point, direction, x, y, depth, invM_d, invProjParams_d, mu, depthImgSize, oneOverVoxelSize,
+				scene->sceneParams->viewFrustum_min, scene->sceneParams->viewFrustum_max);
+
+			for (int i = 0; i < noSteps; i++)
+			{
+				Vector3s blockPos = TO_SHORT_FLOOR3(point);
+				int entryId = findCuckooHashEntry(buckets, blockPos.toInt());
+
+				if (entryId >= 0) entriesVisibleType[entryId] = 1;
+				else if (threadAllocationRequests.empty() || !(threadAllocationRequests.back() == blockPos)) threadAllocationRequests.push_back(blockPos);
+
+				point += direction;
+			}
+		}
+	}
+
+	// insert in the order of the positions, so that the table does not depend on the number of threads
+	allocationCandidates.clear();
+	for (size_t t = 0; t < allocationRequests.size(); t++)
+		for (size_t i = 0; i < allocationRequests[t].size(); i++) allocationCandidates.push_back(PackBlockPos(allocationRequests[t][i]));
+	std::sort(allocationCandidates.begin(), allocationCandidates.end());
+	allocationCandidates.erase(std::unique(allocationCandidates.begin(), allocationCandidates.end()), allocationCandidates.end());
+
+	int noAllocationCandidates = (int)allocationCandidates.size();
+
+	if (!onlyUpdateVisibleList)
+	{
+		if (scene->localVBA.lastFreeBlockId + 1 < noAllocationCandidates) scene->localVBA.ReserveFreeBlocks(noAllocationCandidates);
+
+		int *voxelAllocationList = scene->localVBA.GetAllocationList();
+		int lastFreeVoxelBlockId = scene->localVBA.lastFreeBlockId;
+
+		for (int candidateIdx = 0; candidateIdx < noAllocationCandidates && lastFreeVoxelBlockId >= 0; candidateIdx++)
+		{
+			ITMHashEntry hashEntry;
+			hashEntry.pos = UnpackBlockPos(allocationCandidates[candidateIdx]);
+			hashEntry.ptr = voxelAllocationList[lastFreeVoxelBlockId];
+			hashEntry.offset = 0;
+
+			// the marks move along with the entries that are displaced
+			int entryId = scene->index.InsertEntry(hashEntry, entriesVisibleType);
+			if (entryId < 0) continue;
+
+			entriesVisibleType[entryId] = 1;
+			lastFreeVoxelBlockId--;
+		}
+
+		scene->localVBA.lastFreeBlockId = lastFreeVoxelBlockId;
+	}
+
+	int *visibleEntryIds = this->visibleEntryIds->GetData(MEMORYDEVICE_CPU);
+	noVisibleEntries = CompactNonZeroEntries(entriesVisibleType, noTotalEntries, visibleEntryIds);
+	for (int i = 0; i < noVisibleEntries; i++) entriesVisibleType[visibleEntryIds[i]] = 0;
+}
+
+template<class TVoxel>
+void ITMSceneReconstructionEngine_CPU<TVoxel, ITMVoxelBlockCuckooHash>::IntegrateIntoScene(ITMScene<TVoxel, ITMVoxelBlockCuckooHash> *scene, const ITMView *view,
+	const ITMTrackingState *trackingState, const ITMRenderState *renderState)
+{
+	Vector2i rgbImgSize = view->rgb->noDims;
+	Vector2i depthImgSize = view->depth->noDims;
+	float voxelSize = scene->sceneParams->voxelSize;
+
+	Matrix4f M_d, M_rgb;
+	Vector4f projParams_d, projParams_rgb;
+
+	M_d = trackingState->pose_d->GetM();
+	if (TVoxel::hasColorInformation) M_rgb = view->calib.trafo_rgb_to_depth.calib_inv * M_d;
+
+	projParams_d = view->calib.intrinsics_d.projectionParamsSimple.all;
+	projParams_rgb = view->calib.intrinsics_rgb.projectionParamsSimple.all;
+
+	float mu = scene->sceneParams->mu; int maxW = scene->sceneParams->maxW;
+
+	float *depth = view->depth->GetData(MEMORYDEVICE_CPU);
+	float *confidence = view->depthConfidence->GetData(MEMORYDEVICE_CPU);
+	Vector4u *rgb = view->rgb->GetData(MEMORYDEVICE_CPU);
+	TVoxel *localVBA = scene->localVBA.GetVoxelBlocks();
+	const ITMHashEntry *hashTable = scene->index.GetEntries();
+	const int *visibleEntryIds = this->visibleEntryIds->GetData(MEMORYDEVICE_CPU);
+
+	bool stopIntegratingAtMaxW = scene->sceneParams->stopIntegratingAtMaxW;
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int entryId = 0; entryId < noVisibleEntries; entryId++)
+	{
+		const ITMHashEntry &currentHashEntry = hashTable[visibleEntryIds[entryId]];
+		if (currentHashEntry.ptr < 0) continue;
+
+		IntegrateVoxelBlock(&(localVBA[currentHashEntry.ptr * (SDF_BLOCK_SIZE3)]), currentHashEntry.pos, voxelSize, stopIntegratingAtMaxW, M_d, projParams_d,
+			M_rgb, projParams_rgb, mu, maxW, depth, confidence, depthImgSize, rgb, rgbImgSize);
+	}
+}
@@ -2,6 +2,13 @@
 
 #include "ITMSurfelSceneReconstructionEngine_CPU.h"
 
+#include <algorithm>
+#include <vector>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 #include "../Shared/ITMSurfelSceneReconstructionEngine_Shared.h"
 
 namespace ITMLib
@@ -32,8 +39,8 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::AddNewSurfels(ITMSurfelSce
 
   // Add the new surfels to the scene.
   const size_t newSurfelCount = static_cast<size_t>(newPointsPrefixSum[pixelCount]);
-  TSurfel *newSurfels = scene->AllocateSurfels(newSurfelCount);
-  if(newSurfels == NULL) return;
+  const int firstNewSurfelId = scene->AllocateSurfels(newSurfelCount);
+  if(firstNewSurfelId == -1) return;
 
   const Vector4u *colourMap = view->rgb->GetData(MEMORYDEVICE_CPU);
   const Matrix4f& depthToRGB = view->calib.trafo_rgb_to_depth.calib_inv;
@@ -41,6 +48,7 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::AddNewSurfels(ITMSurfelSce
   const Vector4f& projParamsRGB = view->calib.intrinsics_rgb.projectionParamsSimple.all;
   const float *radiusMap = this->m_radiusMapMB->GetData(MEMORYDEVICE_CPU);
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
+  const ITMSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
   const Matrix4f T = trackingState->pose_d->GetInvM();
   const Vector4f *vertexMap = this->m_vertexMapMB->GetData(MEMORYDEVICE_CPU);
 
@@ -53,7 +61,7 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::AddNewSurfels(ITMSurfelSce
       locId, T, this->m_timestamp, newPointsMask, newPointsPrefixSum, vertexMap, normalMap, radiusMap, colourMap,
       view->depth->noDims.x, view->depth->noDims.y, view->rgb->noDims.x, view->rgb->noDims.y,
       depthToRGB, projParamsRGB, sceneParams.useGaussianSampleConfidence, sceneParams.gaussianConfidenceSigma,
-      sceneParams.maxSurfelRadius, newSurfels
+      sceneParams.maxSurfelRadius, surfels, firstNewSurfelId
     );
   }
 }
@@ -71,7 +79,7 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::FindCorrespondingSurfels(c
   const Vector3f *normalMap = this->m_normalMapMB->GetData(MEMORYDEVICE_CPU);
   const int pixelCount = static_cast<int>(view->depth->dataSize);
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
 #ifdef WITH_OPENMP
   #pragma omp parallel for
@@ -97,9 +105,10 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::FuseMatchedPoints(ITMSurfe
   const Vector4f& projParamsRGB = view->calib.intrinsics_rgb.projectionParamsSimple.all;
   const float *radiusMap = this->m_radiusMapMB->GetData(MEMORYDEVICE_CPU);
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
-  TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
   const Matrix4f T = trackingState->pose_d->GetInvM();
   const Vector4f *vertexMap = this->m_vertexMapMB->GetData(MEMORYDEVICE_CPU);
+  unsigned char *surfelBlockDirtyFlags = scene->GetSurfelBlockDirtyFlags()->GetData(MEMORYDEVICE_CPU);
 
 #ifdef WITH_OPENMP
   #pragma omp parallel for
@@ -111,6 +120,10 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::FuseMatchedPoints(ITMSurfe
       depthToRGB, projParamsRGB, sceneParams.deltaRadius, sceneParams.useGaussianSampleConfidence, sceneParams.gaussianConfidenceSigma, sceneParams.maxSurfelRadius,
       surfels
     );
+
+    // Fusion moves the surfel, so its block's bounding box in the spatial index needs to be recalculated.
+    const int surfelIndex = static_cast<int>(correspondenceMap[locId]) - 1;
+    if(surfelIndex >= 0) surfelBlockDirtyFlags[surfelIndex / SURFEL_BLOCK_SIZE] = 1;
   }
 }
 
@@ -124,7 +137,7 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::MarkBadSurfels(ITMSurfelSc
 
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
   unsigned int *surfelRemovalMask = this->m_surfelRemovalMaskMB->GetData(MEMORYDEVICE_CPU);
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
   // Clear the surfel removal mask.
 #ifdef WITH_OPENMP
@@ -162,8 +175,9 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::MergeSimilarSurfels(ITMSur
   unsigned int *mergeTargetMap = this->m_mergeTargetMapMB->GetData(MEMORYDEVICE_CPU);
   const int pixelCount = static_cast<int>(renderState->GetIndexImage()->dataSize);
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
-  TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
   unsigned int *surfelRemovalMask = this->m_surfelRemovalMaskMB->GetData(MEMORYDEVICE_CPU);
+  unsigned char *surfelBlockDirtyFlags = scene->GetSurfelBlockDirtyFlags()->GetData(MEMORYDEVICE_CPU);
 
   // Clear the merge target map.
 #ifdef WITH_OPENMP
@@ -181,7 +195,7 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::MergeSimilarSurfels(ITMSur
   for(int locId = 0; locId < pixelCount; ++locId)
   {
     find_mergeable_surfel(
-      locId, indexImage, indexImageWidth, indexImageHeight, correspondenceMap, surfels,
+      locId, indexImage, indexImageWidth, indexImageHeight, correspondenceMap, ITMConstSurfelArray<TSurfel>(surfels),
       sceneParams.stableSurfelConfidence, sceneParams.maxMergeDist, sceneParams.maxMergeAngle,
       sceneParams.minRadiusOverlapFactor, mergeTargetMap
     );
@@ -203,6 +217,11 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::MergeSimilarSurfels(ITMSur
   for(int locId = 0; locId < pixelCount; ++locId)
   {
     perform_surfel_merge(locId, mergeTargetMap, surfels, surfelRemovalMask, indexImage, sceneParams.maxSurfelRadius);
+
+    // Merging moves the target surfel, so its block's bounding box in the spatial index needs to be recalculated.
+    const int mergeTarget = static_cast<int>(mergeTargetMap[locId]) - 1;
+    const int targetSurfelIndex = mergeTarget >= 0 ? static_cast<int>(indexImage[mergeTarget]) - 1 : -1;
+    if(targetSurfelIndex >= 0) surfelBlockDirtyFlags[targetSurfelIndex / SURFEL_BLOCK_SIZE] = 1;
   }
 }
 
@@ -249,9 +268,116 @@ void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::PreprocessDepthMap(const I
 template <typename TSurfel>
 void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::RemoveMarkedSurfels(ITMSurfelScene<TSurfel> *scene) const
 {
-  // Remove marked surfels from the scene.
-  // TODO: This is is currently unimplemented on CPU. It's not worth implementing it at the moment,
-  // because we're going to need to change the scene representation to something better anyway.
+  const int surfelCount = static_cast<int>(scene->GetSurfelCount());
+
+  // If the scene is empty, early out.
+  if(surfelCount == 0) return;
+
+  const unsigned int *surfelRemovalMask = this->m_surfelRemovalMaskMB->GetData(MEMORYDEVICE_CPU);
+  const ITMSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
+
+  // Split the surfels into one contiguous chunk per thread.
+#ifdef WITH_OPENMP
+  const int chunkCount = omp_get_max_threads();
+#else
+  const int chunkCount = 1;
+#endif
+  const int chunkSize = (surfelCount + chunkCount - 1) / chunkCount;
+  std::vector<int> keptSurfelCounts(chunkCount);
+  std::vector<int> firstRemovedSurfelIds(chunkCount);
+
+  // Count the surfels in each chunk that are not marked for removal, and find the first surfel in each chunk that is.
+#ifdef WITH_OPENMP
+  #pragma omp parallel for schedule(static, 1)
+#endif
+  for(int chunkId = 0; chunkId < chunkCount; ++chunkId)
+  {
+    const int chunkBegin = std::min(chunkId * chunkSize, surfelCount);
+    const int chunkEnd = std::min(chunkBegin + chunkSize, surfelCount);
+
+    int keptSurfelCount = 0, firstRemovedSurfelId = surfelCount;
+    for(int surfelId = chunkBegin; surfelId < chunkEnd; ++surfelId)
+    {
+      if(!surfelRemovalMask[surfelId]) ++keptSurfelCount;
+      else if(firstRemovedSurfelId == surfelCount) firstRemovedSurfelId = surfelId;
+    }
+
+    keptSurfelCounts[chunkId] = keptSurfelCount;
+    firstRemovedSurfelIds[chunkId] = firstRemovedSurfelId;
+  }
+
+  // Calculate the final offset of each chunk's surfels (the exclusive prefix sum of the per-chunk counts).
+  std::vector<int> chunkOffsets(chunkCount);
+  int keptSurfelCount = 0;
+  for(int chunkId = 0; chunkId < chunkCount; ++chunkId)
+  {
+    chunkOffsets[chunkId] = keptSurfelCount;
+    keptSurfelCount += keptSurfelCounts[chunkId];
+  }
+
+  // If no surfels are marked for removal, early out.
+  const int firstRemovedSurfelId = *std::min_element(firstRemovedSurfelIds.begin(), firstRemovedSurfelIds.end());
+  if(firstRemovedSurfelId == surfelCount) return;
+
+  // The surfels before the first removed surfel stay where they are. Scatter the kept surfels after it into a scratch
+  // buffer at their final offsets, and then copy them back. Since the destinations of different chunks cannot overlap
+  // in the scratch buffer, both steps can be done in parallel.
+  std::vector<TSurfel> movedSurfels(keptSurfelCount - firstRemovedSurfelId);
+
+#ifdef WITH_OPENMP
+  #pragma omp parallel for schedule(static, 1)
+#endif
+  for(int chunkId = 0; chunkId < chunkCount; ++chunkId)
+  {
+    const int chunkBegin = std::min(chunkId * chunkSize, surfelCount);
+    const int chunkEnd = std::min(chunkBegin + chunkSize, surfelCount);
+    if(chunkEnd <= firstRemovedSurfelId) continue;
+
+    // All of the surfels in the chunk before the first removed surfel are kept.
+    const int scatterBegin = std::max(chunkBegin, firstRemovedSurfelId);
+    int targetId = chunkOffsets[chunkId] + (scatterBegin - chunkBegin) - firstRemovedSurfelId;
+    for(int surfelId = scatterBegin; surfelId < chunkEnd; ++surfelId)
+    {
+      if(!surfelRemovalMask[surfelId]) movedSurfels[targetId++] = surfels.Get(surfelId);
+    }
+  }
+
+  const int movedSurfelCount = static_cast<int>(movedSurfels.size());
+
+#ifdef WITH_OPENMP
+  #pragma omp parallel for
+#endif
+  for(int i = 0; i < movedSurfelCount; ++i)
+  {
+    surfels.Set(firstRemovedSurfelId + i, movedSurfels[i]);
+  }
+
+  // The removed surfels are now all at the end of the surfel array, so we can simply deallocate them.
+  scene->DeallocateRemovedSurfels(static_cast<size_t>(surfelCount - keptSurfelCount), static_cast<size_t>(firstRemovedSurfelId));
+}
+
+template <typename TSurfel>
+void ITMSurfelSceneReconstructionEngine_CPU<TSurfel>::UpdateSpatialIndex(ITMSurfelScene<TSurfel> *scene) const
+{
+  const int surfelCount = static_cast<int>(scene->GetSurfelCount());
+  const int blockCount = (surfelCount + SURFEL_BLOCK_SIZE - 1) / SURFEL_BLOCK_SIZE;
+  const int indexedBlockCount = scene->GetIndexedSurfelBlockCount();
+  ITMSurfelBlockBounds *blockBounds = scene->GetSurfelBlockBounds()->GetData(MEMORYDEVICE_CPU);
+  unsigned char *surfelBlockDirtyFlags = scene->GetSurfelBlockDirtyFlags()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
+
+  // Recalculate the bounding boxes of the blocks that the index does not cover and of the covered blocks that are dirty.
+#ifdef WITH_OPENMP
+  #pragma omp parallel for
+#endif
+  for(int blockId = 0; blockId < blockCount; ++blockId)
+  {
+    if(blockId < indexedBlockCount && !surfelBlockDirtyFlags[blockId]) continue;
+    calculate_surfel_block_bounds(blockId, surfels, surfelCount, blockBounds);
+    surfelBlockDirtyFlags[blockId] = 0;
+  }
+
+  scene->SetSpatialIndexUpToDate();
 }
 
 }
@@ -19,6 +19,7 @@ namespace ITMLib
 		void *allocationTempData_host;
 		unsigned char *entriesAllocType_device;
 		Vector4s *blockCoords_device;
+		int noEntriesAllocated;
 
 	public:
 		void ResetScene(ITMScene<TVoxel, ITMVoxelBlockHash> *scene);
@@ -44,5 +44,8 @@ namespace ITMLib
 
     /** Override */
     virtual void RemoveMarkedSurfels(ITMSurfelScene<TSurfel> *scene) const;
+
+    /** Override */
+    virtual void UpdateSpatialIndex(ITMSurfelScene<TSurfel> *scene) const;
   };
 }
@@ -136,8 +136,22 @@ namespace ITMLib
      */
     virtual void RemoveMarkedSurfels(ITMSurfelScene<TSurfel> *scene) const = 0;
 
+    /**
+     * \brief Updates the scene's spatial index to cover the surfels that are currently in the scene.
+     *
+     * \param scene The surfel scene.
+     */
+    virtual void UpdateSpatialIndex(ITMSurfelScene<TSurfel> *scene) const = 0;
+
     //#################### PUBLIC MEMBER FUNCTIONS ####################
   public:
+    /**
+     * \brief Gets the current timestamp (i.e. frame number), against which the ages of the surfels in the scene are measured.
+     *
+     * \return The current timestamp.
+     */
+    int GetTimestamp() const;
+
     /**
      * \brief Updates the specified surfel-based scene by integrating depth and possibly colour information from the given view.
      *
@@ -154,5 +168,12 @@ namespace ITMLib
      * \param scene The scene to reset.
      */
     void ResetScene(ITMSurfelScene<TSurfel> *scene) const;
+
+    /**
+     * \brief Sets the current timestamp (e.g. to continue the reconstruction of a scene that has been loaded from a file).
+     *
+     * \param timestamp The new timestamp.
+     */
+    void SetTimestamp(int timestamp);
   };
 }
@@ -43,6 +43,12 @@ ITMSurfelSceneReconstructionEngine<TSurfel>::~ITMSurfelSceneReconstructionEngine
 
 //#################### PUBLIC MEMBER FUNCTIONS ####################
 
+template <typename TSurfel>
+int ITMSurfelSceneReconstructionEngine<TSurfel>::GetTimestamp() const
+{
+  return m_timestamp;
+}
+
 template <typename TSurfel>
 void ITMSurfelSceneReconstructionEngine<TSurfel>::IntegrateIntoScene(ITMSurfelScene<TSurfel> *scene, const ITMView *view, const ITMTrackingState *trackingState,
                                                                      const ITMSurfelRenderState *renderState)
@@ -54,6 +60,7 @@ void ITMSurfelSceneReconstructionEngine<TSurfel>::IntegrateIntoScene(ITMSurfelSc
   MarkBadSurfels(scene);
   if(scene->GetParams().useSurfelMerging) MergeSimilarSurfels(scene, renderState);
   RemoveMarkedSurfels(scene);
+  UpdateSpatialIndex(scene);
 
   ++m_timestamp;
 }
@@ -64,4 +71,10 @@ void ITMSurfelSceneReconstructionEngine<TSurfel>::ResetScene(ITMSurfelScene<TSur
   scene->Reset();
 }
 
+template <typename TSurfel>
+void ITMSurfelSceneReconstructionEngine<TSurfel>::SetTimestamp(int timestamp)
+{
+  m_timestamp = timestamp;
+}
+
 }
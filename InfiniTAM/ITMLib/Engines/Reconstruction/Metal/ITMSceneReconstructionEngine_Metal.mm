@@ -63,7 +63,7 @@ void ITMSceneReconstructionEngine_Metal<TVoxel,ITMVoxelBlockHash>::IntegrateInto
 
     [commandEncoder setComputePipelineState:sr_metalBits.p_integrateIntoScene_vh_device];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) scene->localVBA.GetVoxelBlocks_MB()      offset:0 atIndex:0];
-    [commandEncoder setBuffer:(__bridge id<MTLBuffer>) scene->index.GetEntries_MB()             offset:0 atIndex:1];
+    [commandEncoder setBuffer:(__bridge id<MTLBuffer>) scene->index.GetEntries_MB()             offset:ITMVoxelBlockHash::entries_MB_offset atIndex:1];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) renderState_vh->GetVisibleEntryIDs_MB()  offset:0 atIndex:2];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) view->rgb->GetMetalBuffer()              offset:0 atIndex:3];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) view->depth->GetMetalBuffer()            offset:0 atIndex:4];
@@ -106,6 +106,7 @@ void ITMSceneReconstructionEngine_Metal<TVoxel,ITMVoxelBlockHash>::BuildAllocAnd
     params->others.z = scene->sceneParams->viewFrustum_min;
     params->others.w = scene->sceneParams->viewFrustum_max;
 
+    this->ResizeEntryBuffers(scene->index.noTotalEntries);
     memset(this->entriesAllocType->GetData(MEMORYDEVICE_CPU), 0, scene->index.noTotalEntries);
     memset(this->blockCoords->GetData(MEMORYDEVICE_CPU), 0, scene->index.noTotalEntries * sizeof(Vector4s));
 
@@ -118,7 +119,7 @@ void ITMSceneReconstructionEngine_Metal<TVoxel,ITMVoxelBlockHash>::BuildAllocAnd
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) this->entriesAllocType->GetMetalBuffer()     offset:0 atIndex:0];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) renderState_vh->GetEntriesVisibleType_MB()   offset:0 atIndex:1];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) this->blockCoords->GetMetalBuffer()          offset:0 atIndex:2];
-    [commandEncoder setBuffer:(__bridge id<MTLBuffer>) scene->index.GetEntries_MB()                 offset:0 atIndex:3];
+    [commandEncoder setBuffer:(__bridge id<MTLBuffer>) scene->index.GetEntries_MB()                 offset:ITMVoxelBlockHash::entries_MB_offset atIndex:3];
     [commandEncoder setBuffer:(__bridge id<MTLBuffer>) view->depth->GetMetalBuffer()                offset:0 atIndex:4];
     [commandEncoder setBuffer:sr_metalBits.paramsBuffer                                             offset:0 atIndex:5];
 
@@ -157,6 +158,11 @@ void ITMSceneReconstructionEngine_Metal<TVoxel, ITMVoxelBlockHash>::AllocateScen
 
     float mu = scene->sceneParams->mu;
 
+    this->ResizeEntryBuffers(scene->index.noTotalEntries);
+
+    // keep a chunk of free blocks in reserve, as on CUDA
+    if (!onlyUpdateVisibleList) scene->localVBA.ReserveFreeBlocks(scene->localVBA.GetNoBlocksPerChunk());
+
     float *depth = view->depth->GetData(MEMORYDEVICE_CPU);
     int *voxelAllocationList = scene->localVBA.GetAllocationList();
     int *excessAllocationList = scene->index.GetExcessAllocationList();
@@ -167,6 +173,7 @@ void ITMSceneReconstructionEngine_Metal<TVoxel, ITMVoxelBlockHash>::AllocateScen
     uchar *entriesAllocType = this->entriesAllocType->GetData(MEMORYDEVICE_CPU);
     Vector4s *blockCoords = this->blockCoords->GetData(MEMORYDEVICE_CPU);
     int noTotalEntries = scene->index.noTotalEntries;
+    int noBuckets = scene->index.noBuckets;
 
     bool useSwapping = scene->useSwapping;
 
@@ -229,9 +236,9 @@ void ITMSceneReconstructionEngine_Metal<TVoxel, ITMVoxelBlockHash>::AllocateScen
 
                         hashTable[targetIdx].offset = exlOffset + 1; //connect to child
 
-                        hashTable[SDF_BUCKET_NUM + exlOffset] = hashEntry; //add child to the excess list
+                        hashTable[noBuckets + exlOffset] = hashEntry; //add child to the excess list
 
-                        entriesVisibleType[SDF_BUCKET_NUM + exlOffset] = 1; //make child visible and in memory
+                        entriesVisibleType[noBuckets + exlOffset] = 1; //make child visible and in memory
                     }
 
                     break;
@@ -181,15 +181,17 @@ struct ComputeUpdatedVoxelInfo<true, true, TVoxel> {
 	}
 };
 
-_CPU_AND_GPU_CODE_ inline void buildHashAllocAndVisibleTypePP(DEVICEPTR(uchar) *entriesAllocType, DEVICEPTR(uchar) *entriesVisibleType, int x, int y,
-	DEVICEPTR(Vector4s) *blockCoords, const CONSTPTR(float) *depth, Matrix4f invM_d, Vector4f projParams_d, float mu, Vector2i imgSize,
-	float oneOverVoxelSize, const CONSTPTR(ITMHashEntry) *hashTable, float viewFrustum_min, float viewFrustum_max)
+// computes the part of the ray through pixel (x,y) that lies within the truncation band of the measured depth, in block coordinates;
+// returns the number of blocks to visit along the ray, or 0 if the depth measurement is not usable
+_CPU_AND_GPU_CODE_ inline int computeHashAllocRaySegment(THREADPTR(Vector3f) &point, THREADPTR(Vector3f) &direction, int x, int y,
+	const CONSTPTR(float) *depth, Matrix4f invM_d, Vector4f projParams_d, float mu, Vector2i imgSize, float oneOverVoxelSize,
+	float viewFrustum_min, float viewFrustum_max)
 {
-	float depth_measure; unsigned int hashIdx; int noSteps;
-	Vector4f pt_camera_f; Vector3f point_e, point, direction; Vector3s blockPos;
+	float depth_measure; int noSteps;
+	Vector4f pt_camera_f; Vector3f point_e;
 
 	depth_measure = depth[x + y * imgSize.x];
-	if (depth_measure <= 0 || (depth_measure - mu) < 0 || (depth_measure - mu) < viewFrustum_min || (depth_measure + mu) > viewFrustum_max) return;
+	if (depth_measure <= 0 || (depth_measure - mu) < 0 || (depth_measure - mu) < viewFrustum_min || (depth_measure + mu) > viewFrustum_max) return 0;
 
 	pt_camera_f.z = depth_measure;
 	pt_camera_f.x = pt_camera_f.z * ((float(x) - projParams_d.z) * projParams_d.x);
@@ -211,59 +213,72 @@ _CPU_AND_GPU_CODE_ inline void buildHashAllocAndVisibleTypePP(DEVICEPTR(uchar) *
 
 	direction /= (float)(noSteps - 1);
 
-	//add neighbouring blocks
-	for (int i = 0; i < noSteps; i++)
-	{
-		blockPos = TO_SHORT_FLOOR3(point);
+	return noSteps;
+}
 
-		//compute index in hash table
-		hashIdx = hashIndex(blockPos);
+// marks the hash entry of the given block as visible, or requests its allocation if the block is not in the hash table;
+// returns the hash index if this call is the first one to request an allocation for that entry, or -1 otherwise
+_CPU_AND_GPU_CODE_ inline int buildHashAllocAndVisibleTypeForBlock(DEVICEPTR(uchar) *entriesAllocType, DEVICEPTR(uchar) *entriesVisibleType,
+	DEVICEPTR(Vector4s) *blockCoords, const CONSTPTR(ITMHashEntry) *hashTable, const THREADPTR(Vector3s) &blockPos)
+{
+	//compute index in hash table
+	int noBuckets = getHashBucketNum(hashTable);
+	unsigned int hashIdx = hashIndex(blockPos, noBuckets);
 
-		//check if hash table contains entry
-		bool isFound = false;
+	//check if hash table contains entry
+	ITMHashEntry hashEntry = hashTable[hashIdx];
 
-		ITMHashEntry hashEntry = hashTable[hashIdx];
+	if (IS_EQUAL3(hashEntry.pos, blockPos) && hashEntry.ptr >= -1)
+	{
+		//entry has been streamed out but is visible or in memory and visible
+		entriesVisibleType[hashIdx] = (hashEntry.ptr == -1) ? 2 : 1;
+		return -1;
+	}
 
-		if (IS_EQUAL3(hashEntry.pos, blockPos) && hashEntry.ptr >= -1)
+	bool isExcess = false;
+	if (hashEntry.ptr >= -1) //seach excess list only if there is no room in ordered part
+	{
+		while (hashEntry.offset >= 1)
 		{
-			//entry has been streamed out but is visible or in memory and visible
-			entriesVisibleType[hashIdx] = (hashEntry.ptr == -1) ? 2 : 1;
-
-			isFound = true;
-		}
+			hashIdx = noBuckets + hashEntry.offset - 1;
+			hashEntry = hashTable[hashIdx];
 
-		if (!isFound)
-		{
-			bool isExcess = false;
-			if (hashEntry.ptr >= -1) //seach excess list only if there is no room in ordered part
+			if (IS_EQUAL3(hashEntry.pos, blockPos) && hashEntry.ptr >= -1)
 			{
-				while (hashEntry.offset >= 1)
-				{
-					hashIdx = SDF_BUCKET_NUM + hashEntry.offset - 1;
-					hashEntry = hashTable[hashIdx];
-
-					if (IS_EQUAL3(hashEntry.pos, blockPos) && hashEntry.ptr >= -1)
-					{
-						//entry has been streamed out but is visible or in memory and visible
-						entriesVisibleType[hashIdx] = (hashEntry.ptr == -1) ? 2 : 1;
-
-						isFound = true;
-						break;
-					}
-				}
-
-				isExcess = true;
+				//entry has been streamed out but is visible or in memory and visible
+				entriesVisibleType[hashIdx] = (hashEntry.ptr == -1) ? 2 : 1;
+				return -1;
 			}
+		}
 
-			if (!isFound) //still not found
-			{
-				entriesAllocType[hashIdx] = isExcess ? 2 : 1; //needs allocation 
-				if (!isExcess) entriesVisibleType[hashIdx] = 1; //new entry is visible
+		isExcess = true;
+	}
 
-				blockCoords[hashIdx] = Vector4s(blockPos.x, blockPos.y, blockPos.z, 1);
-			}
-		}
+	//still not found
+	int newAllocIdx = entriesAllocType[hashIdx] == 0 ? (int)hashIdx : -1;
+
+	entriesAllocType[hashIdx] = isExcess ? 2 : 1; //needs allocation 
+	if (!isExcess) entriesVisibleType[hashIdx] = 1; //new entry is visible
+
+	blockCoords[hashIdx] = Vector4s(blockPos.x, blockPos.y, blockPos.z, 1);
 
+	return newAllocIdx;
+}
+
+_CPU_AND_GPU_CODE_ inline void buildHashAllocAndVisibleTypePP(DEVICEPTR(uchar) *entriesAllocType, DEVICEPTR(uchar) *entriesVisibleType, int x, int y,
+	DEVICEPTR(Vector4s) *blockCoords, const CONSTPTR(float) *depth, Matrix4f invM_d, Vector4f projParams_d, float mu, Vector2i imgSize,
+	float oneOverVoxelSize, const CONSTPTR(ITMHashEntry) *hashTable, float viewFrustum_min, float viewFrustum_max)
+{
+	Vector3f point, direction; Vector3s blockPos;
+
+	int noSteps = computeHashAllocRaySegment(point, direction, x, y, depth, invM_d, projParams_d, mu, imgSize, oneOverVoxelSize,
+		viewFrustum_min, viewFrustum_max);
+
+	//add neighbouring blocks
+	for (int i = 0; i < noSteps; i++)
+	{
+		blockPos = TO_SHORT_FLOOR3(point);
+		buildHashAllocAndVisibleTypeForBlock(entriesAllocType, entriesVisibleType, blockCoords, hashTable, blockPos);
 		point += direction;
 	}
 }
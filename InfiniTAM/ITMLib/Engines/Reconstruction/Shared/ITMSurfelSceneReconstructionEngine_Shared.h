@@ -4,6 +4,7 @@
 
 #include "../../../Objects/Camera/ITMIntrinsics.h"
 #include "../../../Objects/Scene/ITMRepresentationAccess.h"
+#include "../../../Objects/Scene/ITMSurfelScene.h"
 
 namespace ITMLib
 {
@@ -262,7 +263,8 @@ inline bool try_read_vertex(int x, int y, const Vector4f *vertexMap, int width,
  * \param useGaussianSampleConfidence Whether or not to use a Gaussian-weighted sample confidence as described in the Keller paper.
  * \param gaussianConfidenceSigma     The sigma value for the Gaussian used when calculating the sample confidence.
  * \param maxSurfelRadius             The maximum radius a surfel is allowed to have.
- * \param newSurfels                  The start of the chunk of memory allocated for the new surfels in the surfel scene.
+ * \param surfels                     The surfels in the scene.
+ * \param firstNewSurfelId            The ID of the first of the surfels allocated in the scene for the new surfels.
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
@@ -270,7 +272,7 @@ inline void add_new_surfel(int locId, const Matrix4f& T, int timestamp, const un
                            const Vector4f *vertexMap, const Vector3f *normalMap, const float *radiusMap, const Vector4u *colourMap,
                            int depthMapWidth, int depthMapHeight, int colourMapWidth, int colourMapHeight, const Matrix4f& depthToRGB,
                            const Vector4f& projParamsRGB, bool useGaussianSampleConfidence, float gaussianConfidenceSigma, float maxSurfelRadius,
-                           TSurfel *newSurfels)
+                           const ITMSurfelArray<TSurfel>& surfels, int firstNewSurfelId)
 {
   // If a new surfel is to be added for this pixel in the live 2D depth image:
   if(newPointsMask[locId])
@@ -281,8 +283,8 @@ inline void add_new_surfel(int locId, const Matrix4f& T, int timestamp, const un
       depthToRGB, projParamsRGB, useGaussianSampleConfidence, gaussianConfidenceSigma, maxSurfelRadius, timestamp
     );
 
-    // Write it into the correct position in the chunk of memory allocated for new surfels.
-    newSurfels[newPointsPrefixSum[locId]] = surfel;
+    // Write it into the correct position in the range of surfels allocated for new surfels.
+    surfels.Set(firstNewSurfelId + newPointsPrefixSum[locId], surfel);
   }
 }
 
@@ -351,6 +353,37 @@ inline void calculate_radius(int locId, const float *depthMap, const Vector3f *n
   radiusMap[locId] = r;
 }
 
+/**
+ * \brief Calculates the bounding box of the positions of the surfels in a block of the scene's spatial index.
+ *
+ * \param blockId       The ID of the block.
+ * \param surfels       The surfels in the scene.
+ * \param surfelCount   The number of surfels in the scene.
+ * \param blockBounds   The bounding boxes of the blocks of surfels in the spatial index.
+ */
+template <typename TSurfel>
+_CPU_AND_GPU_CODE_
+inline void calculate_surfel_block_bounds(int blockId, const ITMConstSurfelArray<TSurfel>& surfels, int surfelCount, ITMSurfelBlockBounds *blockBounds)
+{
+  const int blockBegin = blockId * SURFEL_BLOCK_SIZE;
+  const int blockEnd = blockBegin + SURFEL_BLOCK_SIZE < surfelCount ? blockBegin + SURFEL_BLOCK_SIZE : surfelCount;
+
+  Vector3f minPos = surfels.GetPosition(blockBegin), maxPos = minPos;
+  for(int surfelId = blockBegin + 1; surfelId < blockEnd; ++surfelId)
+  {
+    const Vector3f p = surfels.GetPosition(surfelId);
+    if(p.x < minPos.x) minPos.x = p.x;
+    if(p.y < minPos.y) minPos.y = p.y;
+    if(p.z < minPos.z) minPos.z = p.z;
+    if(p.x > maxPos.x) maxPos.x = p.x;
+    if(p.y > maxPos.y) maxPos.y = p.y;
+    if(p.z > maxPos.z) maxPos.z = p.z;
+  }
+
+  blockBounds[blockId].minPos = minPos;
+  blockBounds[blockId].maxPos = maxPos;
+}
+
 /**
  * \brief Back-projects a point in the live 2D depth image to find its position in live 3D depth coordinates.
  *
@@ -430,7 +463,7 @@ inline void clear_removal_mask_entry(int surfelId, unsigned int *surfelRemovalMa
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
 inline void find_corresponding_surfel(int locId, const Matrix4f& invT, const float *depthMap, int depthMapWidth, const Vector3f *normalMap, const unsigned int *indexImage,
-                                      int supersamplingFactor, const TSurfel *surfels, unsigned int *correspondenceMap, unsigned short *newPointsMask)
+                                      int supersamplingFactor, const ITMConstSurfelArray<TSurfel>& surfels, unsigned int *correspondenceMap, unsigned short *newPointsMask)
 {
   // If the depth pixel or normal is invalid, early out.
   const float EPSILON = 1e-3f;
@@ -456,15 +489,15 @@ inline void find_corresponding_surfel(int locId, const Matrix4f& invT, const flo
       if(surfelIndex >= 0)
       {
         // TODO: Make this slightly more sophisticated, as per the paper.
-        TSurfel surfel = surfels[surfelIndex];
-        Vector3f liveSurfelPos = transform_point(invT, surfel.position);
+        Vector3f liveSurfelPos = transform_point(invT, surfels.GetPosition(surfelIndex));
         float surfelDepth = liveSurfelPos.z;
+        float surfelConfidence = surfels.GetConfidence(surfelIndex);
 
         const float deltaDepth = 0.01f;
-        if(surfel.confidence > bestSurfelConfidence && fabs(surfelDepth - depth) <= deltaDepth)
+        if(surfelConfidence > bestSurfelConfidence && fabs(surfelDepth - depth) <= deltaDepth)
         {
           bestSurfelIndex = surfelIndex;
-          bestSurfelConfidence = surfel.confidence;
+          bestSurfelConfidence = surfelConfidence;
         }
       }
     }
@@ -492,13 +525,13 @@ inline void find_corresponding_surfel(int locId, const Matrix4f& invT, const flo
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline void find_mergeable_surfel(int locId, const unsigned int *indexImage, int indexImageWidth, int indexImageHeight, const unsigned int *correspondenceMap, const TSurfel *surfels,
+inline void find_mergeable_surfel(int locId, const unsigned int *indexImage, int indexImageWidth, int indexImageHeight, const unsigned int *correspondenceMap, const ITMConstSurfelArray<TSurfel>& surfels,
                                   float stableSurfelConfidence, float maxMergeDist, float maxMergeAngle, float minRadiusOverlapFactor, unsigned int *mergeTargetMap)
 {
   // Look up the surfel at the current location. If there isn't one, early out.
   int surfelIndex = indexImage[locId] - 1;
   if(surfelIndex == -1) return;
-  const TSurfel surfel = surfels[surfelIndex];
+  const TSurfel surfel = surfels.Get(surfelIndex);
 
   // Determine whether the surfel itself can justify the merge (it needs to be stable and to have been updated this frame).
   bool surfelCanJustify = surfel.confidence >= stableSurfelConfidence && correspondenceMap[locId] > 0;
@@ -518,7 +551,7 @@ inline void find_mergeable_surfel(int locId, const unsigned int *indexImage, int
     int neighbourLocId = neighbourY[i] * indexImageWidth + neighbourX[i];
     int neighbourSurfelIndex = indexImage[neighbourLocId] - 1;
     if(neighbourSurfelIndex == -1 || neighbourSurfelIndex == surfelIndex) continue;
-    const TSurfel neighbourSurfel = surfels[neighbourSurfelIndex];
+    const TSurfel neighbourSurfel = surfels.Get(neighbourSurfelIndex);
 
     // If the merge cannot be justified, continue.
     if(!surfelCanJustify && !(neighbourSurfel.confidence >= stableSurfelConfidence && correspondenceMap[neighbourLocId] > 0)) continue;
@@ -566,12 +599,12 @@ inline void fuse_matched_point(int locId, const unsigned int *correspondenceMap,
                                int depthMapWidth, int depthMapHeight, int colourMapWidth, int colourMapHeight,
                                const Matrix4f& depthToRGB, const Vector4f& projParamsRGB, float deltaRadius,
                                bool useGaussianSampleConfidence, float gaussianConfidenceSigma, float maxSurfelRadius,
-                               TSurfel *surfels)
+                               const ITMSurfelArray<TSurfel>& surfels)
 {
   int surfelIndex = correspondenceMap[locId] - 1;
   if(surfelIndex >= 0)
   {
-    TSurfel surfel = surfels[surfelIndex];
+    TSurfel surfel = surfels.Get(surfelIndex);
     TSurfel newSurfel = make_surfel<TSurfel>(
       locId, T, vertexMap, normalMap, radiusMap, colourMap, depthMapWidth, depthMapHeight, colourMapWidth, colourMapHeight,
       depthToRGB, projParamsRGB, useGaussianSampleConfidence, gaussianConfidenceSigma, maxSurfelRadius, timestamp
@@ -580,7 +613,7 @@ inline void fuse_matched_point(int locId, const unsigned int *correspondenceMap,
     bool shouldMergeProperties = newSurfel.radius <= (1.0f + deltaRadius) * surfel.radius;
     surfel = merge_surfels(surfel, newSurfel, maxSurfelRadius, shouldMergeProperties, RCM_CONFIDENCEWEIGHTEDAVERAGE);
 
-    surfels[surfelIndex] = surfel;
+    surfels.Set(surfelIndex, surfel);
   }
 }
 
@@ -596,11 +629,10 @@ inline void fuse_matched_point(int locId, const unsigned int *correspondenceMap,
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline void mark_for_removal_if_unstable(int surfelId, const TSurfel *surfels, int timestamp, float stableSurfelConfidence,
+inline void mark_for_removal_if_unstable(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, int timestamp, float stableSurfelConfidence,
                                          int unstableSurfelPeriod, unsigned int *surfelRemovalMask)
 {
-  TSurfel surfel = surfels[surfelId];
-  if(surfel.confidence < stableSurfelConfidence && timestamp - surfel.timestamp > unstableSurfelPeriod)
+  if(surfels.GetConfidence(surfelId) < stableSurfelConfidence && timestamp - surfels.GetTimestamp(surfelId) > unstableSurfelPeriod)
   {
     surfelRemovalMask[surfelId] = 1;
   }
@@ -618,7 +650,7 @@ inline void mark_for_removal_if_unstable(int surfelId, const TSurfel *surfels, i
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline void perform_surfel_merge(int locId, unsigned int *mergeTargetMap, TSurfel *surfels, unsigned int *surfelRemovalMask, const unsigned int *indexImage, float maxSurfelRadius)
+inline void perform_surfel_merge(int locId, unsigned int *mergeTargetMap, const ITMSurfelArray<TSurfel>& surfels, unsigned int *surfelRemovalMask, const unsigned int *indexImage, float maxSurfelRadius)
 {
   // If there's no target for the merge, early out.
   int mergeTarget = mergeTargetMap[locId] - 1;
@@ -630,9 +662,9 @@ inline void perform_surfel_merge(int locId, unsigned int *mergeTargetMap, TSurfe
 
   // Merge the source surfel into the target surfel.
   bool shouldMergeProperties = true;
-  TSurfel source = surfels[sourceSurfelIndex], target = surfels[targetSurfelIndex];
+  TSurfel source = surfels.Get(sourceSurfelIndex), target = surfels.Get(targetSurfelIndex);
   TSurfel merged = merge_surfels(target, source, maxSurfelRadius, shouldMergeProperties, RCM_CONFIDENCEWEIGHTEDAVERAGE);
-  surfels[targetSurfelIndex] = merged;
+  surfels.Set(targetSurfelIndex, merged);
 
   // Mark the source surfel for removal.
   surfelRemovalMask[sourceSurfelIndex] = 1;
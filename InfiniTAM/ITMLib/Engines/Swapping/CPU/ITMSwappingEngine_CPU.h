@@ -2,6 +2,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "../Interface/ITMSwappingEngine.h"
 
 namespace ITMLib
@@ -19,6 +21,13 @@ namespace ITMLib
 	class ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash> : public ITMSwappingEngine < TVoxel, ITMVoxelBlockHash >
 	{
 	private:
+		/** Entries being cleaned by CleanLocalMemory, which has no global cache to borrow this list from. */
+		ORUtils::MemoryBlock<int> *neededEntryIDs;
+
+		/** Scratch lists of the blocks being transferred: their host copies and their local VBA blocks. */
+		std::vector<TVoxel*> storedBlocks;
+		std::vector<int> localPtrs;
+
 		int LoadFromGlobalMemory(ITMScene<TVoxel, ITMVoxelBlockHash> *scene);
 
 	public:
@@ -4,16 +4,83 @@
 
 #include "../Shared/ITMSwappingEngine_Shared.h"
 #include "../../../Objects/RenderStates/ITMRenderState_VH.h"
+
+#include <algorithm>
+
 using namespace ITMLib;
 
+namespace
+{
+	enum SwapCandidateAction { SWAPCANDIDATE_KEEP, SWAPCANDIDATE_TAKE, SWAPCANDIDATE_DROP };
+
+	// Entries queued for swapping in are taken while their swap state is still 1.
+	struct SwapInCandidateClassifier
+	{
+		const ITMHashSwapState *swapStates;
+		SwapInCandidateClassifier(const ITMHashSwapState *swapStates) : swapStates(swapStates) {}
+
+		SwapCandidateAction operator()(int entryId) const { return swapStates[entryId].state == 1 ? SWAPCANDIDATE_TAKE : SWAPCANDIDATE_DROP; }
+	};
+
+	// Entries queued for swapping out are dropped once they are back in view or no longer allocated. With swap states
+	// given, they are only taken once their data is on the device (state 2), and kept while still being swapped in.
+	struct SwapOutCandidateClassifier
+	{
+		const ITMHashEntry *hashTable; const uchar *entriesVisibleType; const ITMHashSwapState *swapStates;
+		SwapOutCandidateClassifier(const ITMHashEntry *hashTable, const uchar *entriesVisibleType, const ITMHashSwapState *swapStates)
+			: hashTable(hashTable), entriesVisibleType(entriesVisibleType), swapStates(swapStates) {}
+
+		SwapCandidateAction operator()(int entryId) const
+		{
+			if (hashTable[entryId].ptr < 0 || entriesVisibleType[entryId] != 0) return SWAPCANDIDATE_DROP;
+			if (swapStates == NULL || swapStates[entryId].state == 2) return SWAPCANDIDATE_TAKE;
+			return swapStates[entryId].state == 1 ? SWAPCANDIDATE_KEEP : SWAPCANDIDATE_DROP;
+		}
+	};
+
+	// Takes up to maxEntries entries from the front of a candidate queue, oldest first, so that a backlog
+	// is worked off in turn rather than always favouring low hash indices. The taken entries are sorted, which keeps
+	// the transfer order the same as that of a full table scan.
+	template<class TClassifier>
+	int TakeSwapCandidates(std::vector<int> &candidates, int *neededEntryIDs, int maxEntries, const TClassifier &classify, ITMRenderState_VH *renderState_vh)
+	{
+		int noNeededEntries = 0;
+		size_t readIdx = 0, writeIdx = 0;
+
+		for (; readIdx < candidates.size() && noNeededEntries < maxEntries; readIdx++)
+		{
+			int entryId = candidates[readIdx];
+
+			switch (classify(entryId))
+			{
+			case SWAPCANDIDATE_KEEP: candidates[writeIdx++] = entryId; continue;
+			case SWAPCANDIDATE_TAKE: neededEntryIDs[noNeededEntries++] = entryId; break;
+			case SWAPCANDIDATE_DROP: break;
+			}
+
+			if (renderState_vh != NULL) renderState_vh->ReleaseSwapOutCandidate(entryId);
+		}
+
+		for (; readIdx < candidates.size(); readIdx++) candidates[writeIdx++] = candidates[readIdx];
+		candidates.resize(writeIdx);
+
+		std::sort(neededEntryIDs, neededEntryIDs + noNeededEntries);
+
+		return noNeededEntries;
+	}
+}
+
 template<class TVoxel>
 ITMSwappingEngine_CPU<TVoxel,ITMVoxelBlockHash>::ITMSwappingEngine_CPU(void)
 {
+	// sized to the transfer batch of the first scene seen in CleanLocalMemory
+	neededEntryIDs = new ORUtils::MemoryBlock<int>(1, MEMORYDEVICE_CPU);
 }
 
 template<class TVoxel>
 ITMSwappingEngine_CPU<TVoxel,ITMVoxelBlockHash>::~ITMSwappingEngine_CPU(void)
 {
+	delete neededEntryIDs;
 }
 
 template<class TVoxel>
@@ -21,7 +88,7 @@ int ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::LoadFromGlobalMemory(ITMSc
 {
 	ITMGlobalCache<TVoxel> *globalCache = scene->globalCache;
 
-	ITMHashSwapState *swapStates = globalCache->GetSwapStates(false);
+	const ITMHashSwapState *swapStates = globalCache->GetSwapStates(false);
 
 	int *neededEntryIDs_local = globalCache->GetNeededEntryIDs(false);
 
@@ -29,34 +96,27 @@ int ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::LoadFromGlobalMemory(ITMSc
 	bool *hasSyncedData_global = globalCache->GetHasSyncedData(false);
 	int *neededEntryIDs_global = globalCache->GetNeededEntryIDs(false);
 
-	int noTotalEntries = globalCache->noTotalEntries;
-
-	int noNeededEntries = 0;
-	for (int entryId = 0; entryId < noTotalEntries; entryId++)
-	{
-		if (noNeededEntries >= SDF_TRANSFER_BLOCK_NUM) break;
-		if (swapStates[entryId].state == 1)
-		{
-			neededEntryIDs_local[noNeededEntries] = entryId;
-			noNeededEntries++;
-		}
-	}
+	int noNeededEntries = TakeSwapCandidates(globalCache->GetSwapInCandidates(), neededEntryIDs_local, globalCache->noTransferBlocks, SwapInCandidateClassifier(swapStates), NULL);
 
 	// would copy neededEntryIDs_local into neededEntryIDs_global here
 
 	if (noNeededEntries > 0)
 	{
-		memset(syncedVoxelBlocks_global, 0, noNeededEntries * SDF_BLOCK_SIZE3 * sizeof(TVoxel));
-		memset(hasSyncedData_global, 0, noNeededEntries * sizeof(bool));
+		// looking blocks up in the global cache is not thread safe, copying them is
+		storedBlocks.resize(noNeededEntries);
 		for (int i = 0; i < noNeededEntries; i++)
 		{
 			int entryId = neededEntryIDs_global[i];
+			storedBlocks[i] = globalCache->HasStoredData(entryId) ? globalCache->GetStoredVoxelBlock(entryId) : NULL;
+		}
 
-			if (globalCache->HasStoredData(entryId))
-			{
-				hasSyncedData_global[i] = true;
-				memcpy(syncedVoxelBlocks_global + i * SDF_BLOCK_SIZE3, globalCache->GetStoredVoxelBlock(entryId), SDF_BLOCK_SIZE3 * sizeof(TVoxel));
-			}
+#ifdef WITH_OPENMP
+		#pragma omp parallel for
+#endif
+		for (int i = 0; i < noNeededEntries; i++)
+		{
+			hasSyncedData_global[i] = storedBlocks[i] != NULL;
+			if (storedBlocks[i] != NULL) memcpy(syncedVoxelBlocks_global + i * SDF_BLOCK_SIZE3, storedBlocks[i], SDF_BLOCK_SIZE3 * sizeof(TVoxel));
 		}
 	}
 
@@ -84,6 +144,9 @@ void ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::IntegrateGlobalIntoLocal(
 
 	int maxW = scene->sceneParams->maxW;
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int i = 0; i < noNeededEntries; i++)
 	{
 		int entryDestId = neededEntryIDs_local[i];
@@ -110,8 +173,11 @@ void ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::SaveToGlobalMemory(ITMSce
 
 	ITMHashSwapState *swapStates = globalCache->GetSwapStates(false);
 
+	ITMRenderState_VH *renderState_vh = (ITMRenderState_VH*)renderState;
+	renderState_vh->EnableSwapOutCandidates();
 	ITMHashEntry *hashTable = scene->index.GetEntries();
-	uchar *entriesVisibleType = ((ITMRenderState_VH*)renderState)->GetEntriesVisibleType();
+	ITMBlockOccupancy *occupancy = scene->index.GetBlockOccupancy();
+	uchar *entriesVisibleType = renderState_vh->GetEntriesVisibleType();
 
 	TVoxel *syncedVoxelBlocks_local = globalCache->GetSyncedVoxelBlocks(false);
 	bool *hasSyncedData_local = globalCache->GetHasSyncedData(false);
@@ -124,45 +190,47 @@ void ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::SaveToGlobalMemory(ITMSce
 	TVoxel *localVBA = scene->localVBA.GetVoxelBlocks();
 	int *voxelAllocationList = scene->localVBA.GetAllocationList();
 
-	int noTotalEntries = globalCache->noTotalEntries;
-	
-	int noNeededEntries = 0;
+	int noNeededEntries = TakeSwapCandidates(renderState_vh->GetSwapOutCandidates(), neededEntryIDs_local, globalCache->noTransferBlocks,
+		SwapOutCandidateClassifier(hashTable, entriesVisibleType, swapStates), renderState_vh);
+
 	int noAllocatedVoxelEntries = scene->localVBA.lastFreeBlockId;
+	int noVoxelBlocks = scene->localVBA.GetNoBlocks();
 
-	for (int entryDestId = 0; entryDestId < noTotalEntries; entryDestId++)
+	// hand the blocks back to the allocation list in order, then copy them out and clear them in parallel
+	localPtrs.resize(noNeededEntries);
+	for (int i = 0; i < noNeededEntries; i++)
 	{
-		if (noNeededEntries >= SDF_TRANSFER_BLOCK_NUM) break;
-
+		int entryDestId = neededEntryIDs_local[i];
 		int localPtr = hashTable[entryDestId].ptr;
-		ITMHashSwapState &swapState = swapStates[entryDestId];
-
-		if (swapState.state == 2 && localPtr >= 0 && entriesVisibleType[entryDestId] == 0)
-		{
-			TVoxel *localVBALocation = localVBA + localPtr * SDF_BLOCK_SIZE3;
 
-			neededEntryIDs_local[noNeededEntries] = entryDestId;
+		swapStates[entryDestId].state = 0;
+		localPtrs[i] = localPtr;
 
-			hasSyncedData_local[noNeededEntries] = true;
-			memcpy(syncedVoxelBlocks_local + noNeededEntries * SDF_BLOCK_SIZE3, localVBALocation, SDF_BLOCK_SIZE3 * sizeof(TVoxel));
+		int vbaIdx = noAllocatedVoxelEntries;
+		if (vbaIdx < noVoxelBlocks - 1)
+		{
+			noAllocatedVoxelEntries++;
+			voxelAllocationList[vbaIdx + 1] = localPtr;
+			hashTable[entryDestId].ptr = -1;
+			if (occupancy != NULL) occupancy->SetBlock(hashTable[entryDestId].pos, false);
+		}
+	}
 
-			swapStates[entryDestId].state = 0;
+	scene->localVBA.lastFreeBlockId = noAllocatedVoxelEntries;
 
-			int vbaIdx = noAllocatedVoxelEntries;
-			if (vbaIdx < SDF_BUCKET_NUM - 1)
-			{
-				noAllocatedVoxelEntries++;
-				voxelAllocationList[vbaIdx + 1] = localPtr;
-				hashTable[entryDestId].ptr = -1;
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int i = 0; i < noNeededEntries; i++)
+	{
+		TVoxel *localVBALocation = localVBA + localPtrs[i] * SDF_BLOCK_SIZE3;
 
-				for (int i = 0; i < SDF_BLOCK_SIZE3; i++) localVBALocation[i] = TVoxel();
-			}
+		hasSyncedData_local[i] = true;
+		memcpy(syncedVoxelBlocks_local + i * SDF_BLOCK_SIZE3, localVBALocation, SDF_BLOCK_SIZE3 * sizeof(TVoxel));
 
-			noNeededEntries++;
-		}
+		if (hashTable[neededEntryIDs_local[i]].ptr == -1) for (int vIdx = 0; vIdx < SDF_BLOCK_SIZE3; vIdx++) localVBALocation[vIdx] = TVoxel();
 	}
 
-	scene->localVBA.lastFreeBlockId = noAllocatedVoxelEntries;
-
 	// would copy neededEntryIDs_local, hasSyncedData_local and syncedVoxelBlocks_local into *_global here
 
 	if (noNeededEntries > 0)
@@ -178,40 +246,54 @@ void ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::SaveToGlobalMemory(ITMSce
 template<class TVoxel>
 void ITMSwappingEngine_CPU<TVoxel, ITMVoxelBlockHash>::CleanLocalMemory(ITMScene<TVoxel, ITMVoxelBlockHash> *scene, ITMRenderState *renderState)
 {
+	ITMRenderState_VH *renderState_vh = (ITMRenderState_VH*)renderState;
+	renderState_vh->EnableSwapOutCandidates();
 	ITMHashEntry *hashTable = scene->index.GetEntries();
-	uchar *entriesVisibleType = ((ITMRenderState_VH*)renderState)->GetEntriesVisibleType();
+	ITMBlockOccupancy *occupancy = scene->index.GetBlockOccupancy();
+	uchar *entriesVisibleType = renderState_vh->GetEntriesVisibleType();
 
 	TVoxel *localVBA = scene->localVBA.GetVoxelBlocks();
 	int *voxelAllocationList = scene->localVBA.GetAllocationList();
 
-	int noTotalEntries = scene->index.noTotalEntries;
+	// every allocated block that is out of view is deleted, whatever its swap state
+	int noTransferBlocks = scene->sceneParams->noSwapTransferBlocks;
+	if (this->neededEntryIDs->dataSize < (size_t)noTransferBlocks) this->neededEntryIDs->Resize(noTransferBlocks);
+
+	int *neededEntryIDs = this->neededEntryIDs->GetData(MEMORYDEVICE_CPU);
+	int noNeededEntries = TakeSwapCandidates(renderState_vh->GetSwapOutCandidates(), neededEntryIDs, noTransferBlocks,
+		SwapOutCandidateClassifier(hashTable, entriesVisibleType, NULL), renderState_vh);
 
-	int noNeededEntries = 0;
 	int noAllocatedVoxelEntries = scene->localVBA.lastFreeBlockId;
+	int noVoxelBlocks = scene->localVBA.GetNoBlocks();
 
-	for (int entryDestId = 0; entryDestId < noTotalEntries; entryDestId++)
+	localPtrs.resize(noNeededEntries);
+	for (int i = 0; i < noNeededEntries; i++)
 	{
-		if (noNeededEntries >= SDF_TRANSFER_BLOCK_NUM) break;
-
+		int entryDestId = neededEntryIDs[i];
 		int localPtr = hashTable[entryDestId].ptr;
 
-		if (localPtr >= 0 && entriesVisibleType[entryDestId] == 0)
-		{
-			TVoxel *localVBALocation = localVBA + localPtr * SDF_BLOCK_SIZE3;
-
-			int vbaIdx = noAllocatedVoxelEntries;
-			if (vbaIdx < SDF_BUCKET_NUM - 1)
-			{
-				noAllocatedVoxelEntries++;
-				voxelAllocationList[vbaIdx + 1] = localPtr;
-				hashTable[entryDestId].ptr = -1;
+		localPtrs[i] = localPtr;
 
-				for (int i = 0; i < SDF_BLOCK_SIZE3; i++) localVBALocation[i] = TVoxel();
-			}
-
-			noNeededEntries++;
+		int vbaIdx = noAllocatedVoxelEntries;
+		if (vbaIdx < noVoxelBlocks - 1)
+		{
+			noAllocatedVoxelEntries++;
+			voxelAllocationList[vbaIdx + 1] = localPtr;
+			hashTable[entryDestId].ptr = -1;
+			if (occupancy != NULL) occupancy->SetBlock(hashTable[entryDestId].pos, false);
 		}
 	}
 
 	scene->localVBA.lastFreeBlockId = noAllocatedVoxelEntries;
-}
\ No newline at end of file
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int i = 0; i < noNeededEntries; i++)
+	{
+		if (hashTable[neededEntryIDs[i]].ptr != -1) continue;
+
+		TVoxel *localVBALocation = localVBA + localPtrs[i] * SDF_BLOCK_SIZE3;
+		for (int vIdx = 0; vIdx < SDF_BLOCK_SIZE3; vIdx++) localVBALocation[vIdx] = TVoxel();
+	}
+}
@@ -21,6 +21,7 @@ namespace ITMLib
 	private:
 		int *noNeededEntries_device, *noAllocatedVoxelEntries_device;
 		int *entriesToClean_device;
+		int noEntriesToClean;
 
 		int LoadFromGlobalMemory(ITMScene<TVoxel, ITMVoxelBlockHash> *scene);
 
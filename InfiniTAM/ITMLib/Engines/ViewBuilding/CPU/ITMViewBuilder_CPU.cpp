@@ -5,9 +5,127 @@
 #include "../Shared/ITMViewBuilder_Shared.h"
 #include "../../../../ORUtils/MetalContext.h"
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 using namespace ITMLib;
 using namespace ORUtils;
 
+// The depth image goes through one conversion stage and, with bilateral filtering, five filtering stages.
+static const int noFilteringSteps = 5;
+static const int noRingRows = 5;
+
+static inline float *RingRow(float *ring, int stage, int y, int width)
+{
+	return ring + (stage * noRingRows + y % noRingRows) * width;
+}
+
+// Builds the rows [rowBegin, rowEnd) of the depth image, and of the normals and uncertainties if normal_out is not NULL,
+// in a single sweep. Each stage keeps its last few rows in a ring buffer and produces a row as soon as the rows it reads
+// from the previous stage are ready, so the intermediate images never leave the cache. The rows just outside the band
+// are recomputed locally rather than shared, which lets bands run independently and gives the same results as the
+// separate full-image passes.
+static void BuildViewRows(float *depth_out, Vector4f *normal_out, float *sigmaZ_out, const short *rawDepth, const float *depth_in,
+	ITMDisparityCalib::TrafoType trafoType, Vector2f calibParams, float fx_depth, Vector4f intrinsics, Vector2i imgSize,
+	bool useBilateralFilter, int rowBegin, int rowEnd, float *ring)
+{
+	const int width = imgSize.x, height = imgSize.y;
+	const int noStages = useBilateralFilter ? noFilteringSteps + 1 : 1, lastStage = noStages - 1;
+	const bool computeNormals = normal_out != NULL;
+
+	// rows of each stage needed by the band, working backwards from the last one
+	int stageBegin[noFilteringSteps + 1], stageEnd[noFilteringSteps + 1], nextRow[noFilteringSteps + 1];
+	stageBegin[lastStage] = std::max(0, rowBegin - (computeNormals ? 1 : 0));
+	stageEnd[lastStage] = std::min(height, rowEnd + (computeNormals ? 1 : 0));
+	for (int stage = lastStage - 1; stage >= 0; stage--)
+	{
+		stageBegin[stage] = std::max(0, stageBegin[stage + 1] - 2);
+		stageEnd[stage] = std::min(height, stageEnd[stage + 1] + 2);
+	}
+	for (int stage = 0; stage < noStages; stage++) nextRow[stage] = stageBegin[stage];
+	int nextNormalRow = rowBegin;
+
+	bool progress = true;
+	while (progress)
+	{
+		progress = false;
+
+		for (int stage = 0; stage < noStages; stage++) while (nextRow[stage] < stageEnd[stage])
+		{
+			int y = nextRow[stage];
+
+			// wait for the input rows y - 2 to y + 2
+			if (stage > 0 && nextRow[stage - 1] <= std::min(y + 2, stageEnd[stage - 1] - 1)) break;
+
+			// do not overwrite a row that the next stage still reads
+			if (stage < lastStage && nextRow[stage + 1] < stageEnd[stage + 1] && y >= nextRow[stage + 1] + noRingRows - 2) break;
+			if (stage == lastStage && computeNormals && nextNormalRow < rowEnd && y >= nextNormalRow + noRingRows - 1) break;
+
+			float *row_out = RingRow(ring, stage, y, width);
+
+			if (stage == 0)
+			{
+				const short *rawRow = rawDepth + y * width;
+
+				switch (trafoType)
+				{
+				case ITMDisparityCalib::TRAFO_KINECT:
+					for (int x = 0; x < width; x++) convertDisparityToDepth(row_out, x, 0, rawRow, calibParams, fx_depth, imgSize);
+					break;
+				case ITMDisparityCalib::TRAFO_AFFINE:
+					for (int x = 0; x < width; x++) convertDepthAffineToFloat(row_out, x, 0, rawRow, imgSize, calibParams);
+					break;
+				default:
+					memcpy(row_out, depth_in + y * width, width * sizeof(float));
+					break;
+				}
+			}
+			else
+			{
+				// the filter leaves a two pixel border of zeros
+				std::fill(row_out, row_out + width, 0.0f);
+
+				if (y >= 2 && y < height - 2)
+				{
+					const float *rows_in[5];
+					for (int i = 0; i < 5; i++) rows_in[i] = RingRow(ring, stage - 1, y + i - 2, width);
+
+					for (int x = 2; x < width - 2; x++) row_out[x] = filterDepth(rows_in, x);
+				}
+			}
+
+			if (stage == lastStage && y >= rowBegin && y < rowEnd) memcpy(depth_out + y * width, row_out, width * sizeof(float));
+
+			nextRow[stage]++;
+			progress = true;
+		}
+
+		if (computeNormals) while (nextNormalRow < rowEnd)
+		{
+			int y = nextNormalRow;
+			if (nextRow[lastStage] <= std::min(y + 1, stageEnd[lastStage] - 1)) break;
+
+			if (y >= 2 && y < height - 2)
+			{
+				const float *depth_ym1 = RingRow(ring, lastStage, y - 1, width);
+				const float *depth_y = RingRow(ring, lastStage, y, width);
+				const float *depth_yp1 = RingRow(ring, lastStage, y + 1, width);
+
+				for (int x = 2; x < width - 2; x++)
+					computeNormalAndWeight(depth_ym1, depth_y, depth_yp1, normal_out[x + y * width], sigmaZ_out[x + y * width], x, y, intrinsics);
+			}
+
+			nextNormalRow++;
+			progress = true;
+		}
+	}
+}
+
 ITMViewBuilder_CPU::ITMViewBuilder_CPU(const ITMRGBDCalib& calib):ITMViewBuilder(calib) { }
 ITMViewBuilder_CPU::~ITMViewBuilder_CPU(void) { }
 
@@ -16,8 +134,6 @@ void ITMViewBuilder_CPU::UpdateView(ITMView **view_ptr, ITMUChar4Image *rgbImage
 	if (*view_ptr == NULL)
 	{
 		*view_ptr = new ITMView(calib, rgbImage->noDims, rawDepthImage->noDims, false);
-		if (this->shortImage != NULL) delete this->shortImage;
-		this->shortImage = new ITMShortImage(rawDepthImage->noDims, true, false);
 		if (this->floatImage != NULL) delete this->floatImage;
 		this->floatImage = new ITMFloatImage(rawDepthImage->noDims, true, false);
 
@@ -36,34 +152,42 @@ void ITMViewBuilder_CPU::UpdateView(ITMView **view_ptr, ITMUChar4Image *rgbImage
 	}
 
 	view->rgb->SetFrom(rgbImage, MemoryBlock<Vector4u>::CPU_TO_CPU);
-	this->shortImage->SetFrom(rawDepthImage, MemoryBlock<short>::CPU_TO_CPU);
 
-	switch (view->calib.disparityCalib.GetType())
-	{
-	case ITMDisparityCalib::TRAFO_KINECT:
-		this->ConvertDisparityToDepth(view->depth, this->shortImage, &(view->calib.intrinsics_d), view->calib.disparityCalib.GetParams());
-		break;
-	case ITMDisparityCalib::TRAFO_AFFINE:
-		this->ConvertDepthAffineToFloat(view->depth, this->shortImage, view->calib.disparityCalib.GetParams());
-		break;
-	default:
-		break;
-	}
+	// conversion, bilateral filtering and normal estimation run as one fused pass over horizontal bands of the image
+	Vector2i imgSize = rawDepthImage->noDims;
+	ITMDisparityCalib::TrafoType trafoType = view->calib.disparityCalib.GetType();
 
-	if (useBilateralFilter)
+	// without a known conversion, the previous depth image is filtered in place, so read it from a copy
+	const float *depth_in = NULL;
+	if (trafoType != ITMDisparityCalib::TRAFO_KINECT && trafoType != ITMDisparityCalib::TRAFO_AFFINE)
 	{
-		//5 steps of bilateral filtering
-		this->DepthFiltering(this->floatImage, view->depth);
-		this->DepthFiltering(view->depth, this->floatImage);
-		this->DepthFiltering(this->floatImage, view->depth);
-		this->DepthFiltering(view->depth, this->floatImage);
-		this->DepthFiltering(this->floatImage, view->depth);
-		view->depth->SetFrom(this->floatImage, MemoryBlock<float>::CPU_TO_CPU);
+		this->floatImage->SetFrom(view->depth, MemoryBlock<float>::CPU_TO_CPU);
+		depth_in = this->floatImage->GetData(MEMORYDEVICE_CPU);
 	}
 
-	if (modelSensorNoise)
+	const short *rawDepth = rawDepthImage->GetData(MEMORYDEVICE_CPU);
+	float *depth_out = view->depth->GetData(MEMORYDEVICE_CPU);
+	Vector4f *normal_out = modelSensorNoise ? view->depthNormal->GetData(MEMORYDEVICE_CPU) : NULL;
+	float *sigmaZ_out = modelSensorNoise ? view->depthUncertainty->GetData(MEMORYDEVICE_CPU) : NULL;
+
+	Vector2f calibParams = view->calib.disparityCalib.GetParams();
+	float fx_depth = view->calib.intrinsics_d.projectionParamsSimple.fx;
+	Vector4f intrinsics = view->calib.intrinsics_d.projectionParamsSimple.all;
+	int noRingFloats = (noFilteringSteps + 1) * noRingRows * imgSize.x;
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel
 	{
-		this->ComputeNormalAndWeights(view->depthNormal, view->depthUncertainty, view->depth, view->calib.intrinsics_d.projectionParamsSimple.all);
+		int noThreads = omp_get_num_threads(), threadId = omp_get_thread_num();
+#else
+	{
+		int noThreads = 1, threadId = 0;
+#endif
+		int rowBegin = imgSize.y * threadId / noThreads, rowEnd = imgSize.y * (threadId + 1) / noThreads;
+		std::vector<float> ring(noRingFloats);
+
+		BuildViewRows(depth_out, normal_out, sigmaZ_out, rawDepth, depth_in, trafoType, calibParams, fx_depth, intrinsics, imgSize,
+			useBilateralFilter, rowBegin, rowEnd, &ring[0]);
 	}
 }
 
@@ -72,8 +196,6 @@ void ITMViewBuilder_CPU::UpdateView(ITMView **view_ptr, ITMUChar4Image *rgbImage
 	if (*view_ptr == NULL)
 	{
 		*view_ptr = new ITMViewIMU(calib, rgbImage->noDims, depthImage->noDims, false);
-		if (this->shortImage != NULL) delete this->shortImage;
-		this->shortImage = new ITMShortImage(depthImage->noDims, true, false);
 		if (this->floatImage != NULL) delete this->floatImage;
 		this->floatImage = new ITMFloatImage(depthImage->noDims, true, false);
 
@@ -100,6 +222,9 @@ void ITMViewBuilder_CPU::ConvertDisparityToDepth(ITMFloatImage *depth_out, const
 
 	float fx_depth = depthIntrinsics->projectionParamsSimple.fx;
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 0; y < imgSize.y; y++) for (int x = 0; x < imgSize.x; x++)
 		convertDisparityToDepth(d_out, x, y, d_in, disparityCalibParams, fx_depth, imgSize);
 }
@@ -111,6 +236,9 @@ void ITMViewBuilder_CPU::ConvertDepthAffineToFloat(ITMFloatImage *depth_out, con
 	const short *d_in = depth_in->GetData(MEMORYDEVICE_CPU);
 	float *d_out = depth_out->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 0; y < imgSize.y; y++) for (int x = 0; x < imgSize.x; x++)
 		convertDepthAffineToFloat(d_out, x, y, d_in, imgSize, depthCalibParams);
 }
@@ -124,6 +252,9 @@ void ITMViewBuilder_CPU::DepthFiltering(ITMFloatImage *image_out, const ITMFloat
 	float *imout = image_out->GetData(MEMORYDEVICE_CPU);
 	const float *imin = image_in->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 2; y < imgSize.y - 2; y++) for (int x = 2; x < imgSize.x - 2; x++)
 		filterDepth(imout, imin, x, y, imgSize);
 }
@@ -137,6 +268,9 @@ void ITMViewBuilder_CPU::ComputeNormalAndWeights(ITMFloat4Image *normal_out, ITM
 	float *sigmaZData_out = sigmaZ_out->GetData(MEMORYDEVICE_CPU);
 	Vector4f *normalData_out = normal_out->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 2; y < imgDims.y - 2; y++) for (int x = 2; x < imgDims.x - 2; x++)
 		computeNormalAndWeight(depthData_in, normalData_out, sigmaZData_out, x, y, imgDims, intrinsic);
 }
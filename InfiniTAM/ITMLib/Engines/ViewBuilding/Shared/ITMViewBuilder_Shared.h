@@ -31,18 +31,19 @@ _CPU_AND_GPU_CODE_ inline void convertDepthAffineToFloat(DEVICEPTR(float) *d_out
 }
 
 #define MEAN_SIGMA_L 1.2232f
-_CPU_AND_GPU_CODE_ inline void filterDepth(DEVICEPTR(float) *imageData_out, const CONSTPTR(float) *imageData_in, int x, int y, Vector2i imgDims)
+/// Bilateral filter of pixel x, given pointers to the input rows y - 2 to y + 2.
+_CPU_AND_GPU_CODE_ inline float filterDepth(const CONSTPTR(float) *const *rows_in, int x)
 {
 	float z, tmpz, dz, final_depth = 0.0f, w, w_sum = 0.0f;
 
-	z = imageData_in[x + y * imgDims.x];
-	if (z < 0.0f) { imageData_out[x + y * imgDims.x] = -1.0f; return; }
+	z = rows_in[2][x];
+	if (z < 0.0f) return -1.0f;
 
 	float sigma_z = 1.0f / (0.0012f + 0.0019f*(z - 0.4f)*(z - 0.4f) + 0.0001f / sqrt(z) * 0.25f);
 
-	for (int i = -2, count = 0; i <= 2; i++) for (int j = -2; j <= 2; j++, count++)
+	for (int i = -2; i <= 2; i++) for (int j = -2; j <= 2; j++)
 	{
-		tmpz = imageData_in[(x + j) + (y + i) * imgDims.x];
+		tmpz = rows_in[i + 2][x + j];
 		if (tmpz < 0.0f) continue;
 		dz = (tmpz - z); dz *= dz;
 		w = exp(-0.5f * ((abs(i) + abs(j))*MEAN_SIGMA_L*MEAN_SIGMA_L + dz * sigma_z * sigma_z));
@@ -51,21 +52,28 @@ _CPU_AND_GPU_CODE_ inline void filterDepth(DEVICEPTR(float) *imageData_out, cons
 	}
 
 	final_depth /= w_sum;
-	imageData_out[x + y*imgDims.x] = final_depth;
+	return final_depth;
 }
 
+_CPU_AND_GPU_CODE_ inline void filterDepth(DEVICEPTR(float) *imageData_out, const CONSTPTR(float) *imageData_in, int x, int y, Vector2i imgDims)
+{
+	const CONSTPTR(float) *rows_in[5];
+	for (int i = 0; i < 5; i++) rows_in[i] = imageData_in + (y + i - 2) * imgDims.x;
 
-_CPU_AND_GPU_CODE_ inline void computeNormalAndWeight(const CONSTPTR(float) *depth_in, DEVICEPTR(Vector4f) *normal_out, DEVICEPTR(float) *sigmaZ_out, int x, int y, Vector2i imgDims, Vector4f intrinparam)
+	imageData_out[x + y * imgDims.x] = filterDepth(rows_in, x);
+}
+
+/// Normal and depth uncertainty of pixel (x, y), given pointers to the depth rows y - 1, y and y + 1.
+_CPU_AND_GPU_CODE_ inline void computeNormalAndWeight(const CONSTPTR(float) *depth_ym1, const CONSTPTR(float) *depth_y, const CONSTPTR(float) *depth_yp1,
+	DEVICEPTR(Vector4f) &normal_out, DEVICEPTR(float) &sigmaZ_out, int x, int y, Vector4f intrinparam)
 {
 	Vector3f outNormal;
 
-	int idx = x + y * imgDims.x;
-
-	float z = depth_in[x + y * imgDims.x];
+	float z = depth_y[x];
 	if (z < 0.0f)
 	{
-		normal_out[idx].w = -1.0f;
-		sigmaZ_out[idx] = -1;
+		normal_out.w = -1.0f;
+		sigmaZ_out = -1;
 		return;
 	}
 
@@ -73,13 +81,13 @@ _CPU_AND_GPU_CODE_ inline void computeNormalAndWeight(const CONSTPTR(float) *dep
 	Vector3f xp1_y, xm1_y, x_yp1, x_ym1;
 	Vector3f diff_x(0.0f, 0.0f, 0.0f), diff_y(0.0f, 0.0f, 0.0f);
 
-	xp1_y.z = depth_in[(x + 1) + y * imgDims.x], x_yp1.z = depth_in[x + (y + 1) * imgDims.x];
-	xm1_y.z = depth_in[(x - 1) + y * imgDims.x], x_ym1.z = depth_in[x + (y - 1) * imgDims.x];
+	xp1_y.z = depth_y[x + 1], x_yp1.z = depth_yp1[x];
+	xm1_y.z = depth_y[x - 1], x_ym1.z = depth_ym1[x];
 
 	if (xp1_y.z <= 0 || x_yp1.z <= 0 || xm1_y.z <= 0 || x_ym1.z <= 0)
 	{
-		normal_out[idx].w = -1.0f;
-		sigmaZ_out[idx] = -1;
+		normal_out.w = -1.0f;
+		sigmaZ_out = -1;
 		return;
 	}
 
@@ -99,21 +107,29 @@ _CPU_AND_GPU_CODE_ inline void computeNormalAndWeight(const CONSTPTR(float) *dep
 
 	if (outNormal.x == 0.0f && outNormal.y == 0 && outNormal.z == 0)
 	{
-		normal_out[idx].w = -1.0f;
-		sigmaZ_out[idx] = -1;
+		normal_out.w = -1.0f;
+		sigmaZ_out = -1;
 		return;
 	}
 
     float norm = 1.0f / sqrt(outNormal.x * outNormal.x + outNormal.y * outNormal.y + outNormal.z * outNormal.z);
     outNormal *= norm;
     
-	normal_out[idx].x = outNormal.x; normal_out[idx].y = outNormal.y; normal_out[idx].z = outNormal.z; normal_out[idx].w = 1.0f;
+	normal_out.x = outNormal.x; normal_out.y = outNormal.y; normal_out.z = outNormal.z; normal_out.w = 1.0f;
 
 	// now compute weight
 	float theta = acos(outNormal.z);
 	float theta_diff = theta / (PI*0.5f - theta);
 
-	sigmaZ_out[idx] = (0.0012f + 0.0019f * (z - 0.4f) * (z - 0.4f) + 0.0001f / sqrt(z) * theta_diff * theta_diff);
+	sigmaZ_out = (0.0012f + 0.0019f * (z - 0.4f) * (z - 0.4f) + 0.0001f / sqrt(z) * theta_diff * theta_diff);
+}
+
+_CPU_AND_GPU_CODE_ inline void computeNormalAndWeight(const CONSTPTR(float) *depth_in, DEVICEPTR(Vector4f) *normal_out, DEVICEPTR(float) *sigmaZ_out, int x, int y, Vector2i imgDims, Vector4f intrinparam)
+{
+	int idx = x + y * imgDims.x;
+
+	computeNormalAndWeight(depth_in + (y - 1) * imgDims.x, depth_in + y * imgDims.x, depth_in + (y + 1) * imgDims.x,
+		normal_out[idx], sigmaZ_out[idx], x, y, intrinparam);
 }
 
 #endif
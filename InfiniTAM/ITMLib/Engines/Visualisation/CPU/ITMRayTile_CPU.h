@@ -0,0 +1,195 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "../Shared/ITMVisualisationEngine_Shared.h"
+
+#define RAY_TILE_SIZE 8					// Number of pixels along each side of a raycast tile
+#define RAY_TILE_SIZE2 64				// RAY_TILE_SIZE2 = RAY_TILE_SIZE * RAY_TILE_SIZE
+#define RAY_TILE_CACHE_SIZE 8			// Number of blocks along each side of the region a tile cache holds at once
+
+namespace ITMLib
+{
+	/** \brief
+	    The block lookups of all the rays of a raycast tile, see
+	    castRayTile. Blocks are kept by their position modulo
+	    RAY_TILE_CACHE_SIZE, so that the blocks around the rays'
+	    current points never evict each other, and blocks that
+	    are not allocated or not in memory are kept as well.
+
+	    The cache is valid for as long as the hash does not
+	    change, i.e. for one raycast.
+	*/
+	struct ITMRayTileCache_CPU
+	{
+		static const int noEntries = RAY_TILE_CACHE_SIZE * RAY_TILE_CACHE_SIZE * RAY_TILE_CACHE_SIZE;
+
+		Vector3i blockPos[noEntries];
+		/** Offset of the block's first voxel, or -1 if the block is not in memory. */
+		int blockPtr[noEntries];
+		/** The hash entry of the block plus 1, or 0 if the block is not in memory. */
+		int vmIndex[noEntries];
+
+		ITMRayTileCache_CPU(void)
+		{
+			// no block lies this far out, and the other fields are filled in along with the position
+			for (int i = 0; i < noEntries; i++) blockPos[i] = Vector3i(0x7fffffff);
+		}
+
+		/** Looks up the block at @p blockPos in the hash, unless it is cached already, and returns its cache entry. */
+		int FindBlock(const ITMHashEntry *voxelIndex, const Vector3i &blockPos)
+		{
+			int entryIdx = (blockPos.x & (RAY_TILE_CACHE_SIZE - 1)) + (blockPos.y & (RAY_TILE_CACHE_SIZE - 1)) * RAY_TILE_CACHE_SIZE +
+				(blockPos.z & (RAY_TILE_CACHE_SIZE - 1)) * RAY_TILE_CACHE_SIZE * RAY_TILE_CACHE_SIZE;
+			if IS_EQUAL3(blockPos, this->blockPos[entryIdx]) return entryIdx;
+
+			this->blockPos[entryIdx] = blockPos;
+			blockPtr[entryIdx] = findVoxelBlock(voxelIndex, blockPos, vmIndex[entryIdx]);
+			return entryIdx;
+		}
+	};
+
+	/** readVoxel for the rays of a tile, found by the SDF readers in ITMRepresentationAccess.h for this cache type. */
+	template<class TVoxel>
+	inline TVoxel readVoxel(const TVoxel *voxelData, const ITMHashEntry *voxelIndex, const Vector3i &point, int &vmIndex, ITMRayTileCache_CPU &cache)
+	{
+		Vector3i blockPos;
+		int linearIdx = pointToVoxelBlockPos(point, blockPos);
+		int entryIdx = cache.FindBlock(voxelIndex, blockPos);
+
+		vmIndex = cache.vmIndex[entryIdx];
+		return vmIndex ? voxelData[cache.blockPtr[entryIdx] + linearIdx] : TVoxel();
+	}
+
+	/** Reads the 8 voxels from @p pos to pos + (1, 1, 1), in the order of readFromSDF_float_interpolated, with a single block lookup unless they span several blocks. */
+	template<class TVoxel>
+	inline void readVoxelCorners(TVoxel *corners, const TVoxel *voxelData, const ITMHashEntry *voxelIndex, const Vector3i &pos, ITMRayTileCache_CPU &cache)
+	{
+		Vector3i blockPos;
+		int linearIdx = pointToVoxelBlockPos(pos, blockPos);
+		Vector3i localPos = pos - blockPos * SDF_BLOCK_SIZE;
+
+		if (localPos.x < SDF_BLOCK_SIZE - 1 && localPos.y < SDF_BLOCK_SIZE - 1 && localPos.z < SDF_BLOCK_SIZE - 1)
+		{
+			int entryIdx = cache.FindBlock(voxelIndex, blockPos);
+			if (cache.vmIndex[entryIdx] == 0) { for (int i = 0; i < 8; i++) corners[i] = TVoxel(); return; }
+
+			const TVoxel *corner = voxelData + cache.blockPtr[entryIdx] + linearIdx;
+			const int dy = SDF_BLOCK_SIZE, dz = SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
+			corners[0] = corner[0]; corners[1] = corner[1]; corners[2] = corner[dy]; corners[3] = corner[dy + 1];
+			corners[4] = corner[dz]; corners[5] = corner[dz + 1]; corners[6] = corner[dz + dy]; corners[7] = corner[dz + dy + 1];
+			return;
+		}
+
+		int vmIndex;
+		for (int i = 0; i < 8; i++) corners[i] = readVoxel(voxelData, voxelIndex, pos + Vector3i(i & 1, (i >> 1) & 1, i >> 2), vmIndex, cache);
+	}
+
+	/** readFromSDF_float_interpolated for the rays of a tile, see readVoxelCorners. */
+	template<class TVoxel, class TIndex>
+	inline float readFromSDF_float_interpolated(const TVoxel *voxelData, const TIndex *voxelIndex, Vector3f point, int &vmIndex, ITMRayTileCache_CPU &cache)
+	{
+		TVoxel v[8];
+		Vector3f coeff; Vector3i pos; TO_INT_FLOOR3(pos, coeff, point);
+		readVoxelCorners(v, voxelData, voxelIndex, pos, cache);
+
+		float res1 = (1.0f - coeff.x) * v[0].sdf + coeff.x * v[1].sdf;
+		res1 = (1.0f - coeff.y) * res1 + coeff.y * ((1.0f - coeff.x) * v[2].sdf + coeff.x * v[3].sdf);
+		float res2 = (1.0f - coeff.x) * v[4].sdf + coeff.x * v[5].sdf;
+		res2 = (1.0f - coeff.y) * res2 + coeff.y * ((1.0f - coeff.x) * v[6].sdf + coeff.x * v[7].sdf);
+
+		vmIndex = true;
+		return TVoxel::valueToFloat((1.0f - coeff.z) * res1 + coeff.z * res2);
+	}
+
+	/** readWithConfidenceFromSDF_float_interpolated for the rays of a tile, see readVoxelCorners. */
+	template<class TVoxel, class TIndex>
+	inline float readWithConfidenceFromSDF_float_interpolated(float &confidence, const TVoxel *voxelData, const TIndex *voxelIndex, Vector3f point,
+		int &vmIndex, ITMRayTileCache_CPU &cache)
+	{
+		TVoxel v[8];
+		Vector3f coeff; Vector3i pos; TO_INT_FLOOR3(pos, coeff, point);
+		readVoxelCorners(v, voxelData, voxelIndex, pos, cache);
+
+		float res1 = (1.0f - coeff.x) * v[0].sdf + coeff.x * v[1].sdf;
+		float res1_c = (1.0f - coeff.x) * v[0].w_depth + coeff.x * v[1].w_depth;
+		res1 = (1.0f - coeff.y) * res1 + coeff.y * ((1.0f - coeff.x) * v[2].sdf + coeff.x * v[3].sdf);
+		res1_c = (1.0f - coeff.y) * res1_c + coeff.y * ((1.0f - coeff.x) * v[2].w_depth + coeff.x * v[3].w_depth);
+
+		float res2 = (1.0f - coeff.x) * v[4].sdf + coeff.x * v[5].sdf;
+		float res2_c = (1.0f - coeff.x) * v[4].w_depth + coeff.x * v[5].w_depth;
+		res2 = (1.0f - coeff.y) * res2 + coeff.y * ((1.0f - coeff.x) * v[6].sdf + coeff.x * v[7].sdf);
+		res2_c = (1.0f - coeff.y) * res2_c + coeff.y * ((1.0f - coeff.x) * v[6].w_depth + coeff.x * v[7].w_depth);
+
+		vmIndex = true;
+		confidence = (1.0f - coeff.z) * res1_c + coeff.z * res2_c;
+		return TVoxel::valueToFloat((1.0f - coeff.z) * res1 + coeff.z * res2);
+	}
+
+	/** \brief
+	    Casts the rays of the RAY_TILE_SIZE x RAY_TILE_SIZE tile
+	    of pixels starting at (tileX, tileY) as one packet, with
+	    the same steps as castRay.
+
+	    The rays are marched in lockstep, one step each in turn,
+	    so that neighbouring rays pass through the same blocks and
+	    voxels at about the same time: the blocks are looked up
+	    in the hash once per tile rather than once per ray, see
+	    ITMRayTileCache_CPU, and the voxels tend to still be in
+	    the processor's caches when the next ray reads them.
+	*/
+	template<class TVoxel, bool modifyVisibleEntries>
+	inline void castRayTile(Vector4f *pointsRay, uchar *entriesVisibleType, int tileX, int tileY, const Vector2i &imgSize,
+		const TVoxel *voxelData, const ITMHashEntry *voxelIndex, const Matrix4f &invM, const Vector4f &invProjParams,
+		float oneOverVoxelSize, float mu, const Vector2f *minmaximg, const ITMBlockOccupancyCell *occupancy)
+	{
+		ITMRayTileCache_CPU cache;
+		float stepScale = mu * oneOverVoxelSize;
+
+		Vector3f pt_result[RAY_TILE_SIZE2], rayDirection[RAY_TILE_SIZE2], invRayDirection[RAY_TILE_SIZE2];
+		float totalLength[RAY_TILE_SIZE2], totalLengthMax[RAY_TILE_SIZE2], sdfValue[RAY_TILE_SIZE2];
+		bool isSkipping[RAY_TILE_SIZE2];
+		int locIds[RAY_TILE_SIZE2], activeRays[RAY_TILE_SIZE2];
+		int noRays = 0;
+
+		for (int y = tileY; y < MIN(tileY + RAY_TILE_SIZE, imgSize.y); y++) for (int x = tileX; x < MIN(tileX + RAY_TILE_SIZE, imgSize.x); x++)
+		{
+			int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+
+			initRay(pt_result[noRays], rayDirection[noRays], totalLength[noRays], totalLengthMax[noRays], x, y, invM, invProjParams,
+				oneOverVoxelSize, minmaximg[locId2]);
+
+			const Vector3f &direction = rayDirection[noRays];
+			invRayDirection[noRays] = Vector3f(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+			sdfValue[noRays] = 1.0f; isSkipping[noRays] = false;
+
+			locIds[noRays] = x + y * imgSize.x;
+			activeRays[noRays] = noRays;
+			noRays++;
+		}
+
+		// every round moves each ray that is still marching on by one step, and drops the ones that have stopped
+		int noActiveRays = noRays;
+		while (noActiveRays > 0)
+		{
+			int noStillActive = 0;
+			for (int i = 0; i < noActiveRays; i++)
+			{
+				int rayId = activeRays[i];
+				if (totalLength[rayId] < totalLengthMax[rayId] && marchRay<TVoxel, ITMVoxelBlockHash, modifyVisibleEntries>(pt_result[rayId],
+					totalLength[rayId], sdfValue[rayId], isSkipping[rayId], rayDirection[rayId], invRayDirection[rayId], stepScale,
+					entriesVisibleType, voxelData, voxelIndex, occupancy, cache))
+				{
+					activeRays[noStillActive++] = rayId;
+				}
+			}
+			noActiveRays = noStillActive;
+		}
+
+		for (int rayId = 0; rayId < noRays; rayId++)
+		{
+			finishRay<TVoxel, ITMVoxelBlockHash>(pointsRay[locIds[rayId]], pt_result[rayId], sdfValue[rayId], rayDirection[rayId], stepScale,
+				voxelData, voxelIndex, cache);
+		}
+	}
+}
@@ -17,6 +17,29 @@ namespace ITMLib
     typedef ITMSurfelVisualisationEngine<TSurfel> Base;
     using typename Base::RenderImageType;
 
+    //#################### NESTED TYPES ####################
+  private:
+    /**
+     * \brief The splat of a surfel in an index image (see calculate_surfel_splat).
+     */
+    struct SurfelSplat
+    {
+      /** The ID of the surfel. */
+      int surfelId;
+
+      /** The integer depth value of the splat. */
+      int scaledZ;
+
+      /** The pixel in the index image to which the surfel's centre projects. */
+      int cx, cy;
+
+      /** The square of the radius of the splat in the index image. */
+      int projectedRadiusSquared;
+
+      /** The bounds of the splat in the index image. */
+      int minX, minY, maxX, maxY;
+    };
+
     //#################### PUBLIC MEMBER FUNCTIONS ####################
   public:
     /** Override */
@@ -25,6 +48,9 @@ namespace ITMLib
     /** Override */
     virtual void CopySceneToBuffers(const ITMSurfelScene<TSurfel> *scene, float *positions, unsigned char *normals, unsigned char *colours) const;
 
+    /** Override */
+    virtual void CopySceneToPointCloud(const ITMSurfelScene<TSurfel> *scene, float *positions, float *normals, unsigned char *colours, float *radii) const;
+
     /** Override */
     virtual void CreateICPMaps(const ITMSurfelScene<TSurfel> *scene, const ITMSurfelRenderState *renderState, ITMTrackingState *trackingState) const;
 
@@ -2,20 +2,31 @@
 
 #include "ITMSurfelVisualisationEngine_CPU.h"
 
+#include <algorithm>
 #include <stdexcept>
+#include <vector>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
 
 #include "../Shared/ITMSurfelVisualisationEngine_Shared.h"
 
 namespace ITMLib
 {
 
+//#################### CONSTANTS ####################
+
+/** The number of rows in each of the bands of the index image that MakeIndexImage renders independently. */
+const int SURFEL_SPLAT_BAND_HEIGHT = 16;
+
 //#################### PUBLIC MEMBER FUNCTIONS ####################
 
 template <typename TSurfel>
 void ITMSurfelVisualisationEngine_CPU<TSurfel>::CopyCorrespondencesToBuffers(const ITMSurfelScene<TSurfel> *scene, float *newPositions, float *oldPositions, float *correspondences) const
 {
   const int surfelCount = static_cast<int>(scene->GetSurfelCount());
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
 #ifdef WITH_OPENMP
   #pragma omp parallel for
@@ -30,7 +41,7 @@ template <typename TSurfel>
 void ITMSurfelVisualisationEngine_CPU<TSurfel>::CopySceneToBuffers(const ITMSurfelScene<TSurfel> *scene, float *positions, unsigned char *normals, unsigned char *colours) const
 {
   const int surfelCount = static_cast<int>(scene->GetSurfelCount());
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
 #ifdef WITH_OPENMP
   #pragma omp parallel for
@@ -41,6 +52,21 @@ void ITMSurfelVisualisationEngine_CPU<TSurfel>::CopySceneToBuffers(const ITMSurf
   }
 }
 
+template <typename TSurfel>
+void ITMSurfelVisualisationEngine_CPU<TSurfel>::CopySceneToPointCloud(const ITMSurfelScene<TSurfel> *scene, float *positions, float *normals, unsigned char *colours, float *radii) const
+{
+  const int surfelCount = static_cast<int>(scene->GetSurfelCount());
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
+
+#ifdef WITH_OPENMP
+  #pragma omp parallel for
+#endif
+  for(int surfelId = 0; surfelId < surfelCount; ++surfelId)
+  {
+    copy_surfel_to_point_cloud(surfelId, surfels, positions, normals, colours, radii);
+  }
+}
+
 template <typename TSurfel>
 void ITMSurfelVisualisationEngine_CPU<TSurfel>::CreateICPMaps(const ITMSurfelScene<TSurfel> *scene, const ITMSurfelRenderState *renderState, ITMTrackingState *trackingState) const
 {
@@ -50,7 +76,7 @@ void ITMSurfelVisualisationEngine_CPU<TSurfel>::CreateICPMaps(const ITMSurfelSce
   Vector4f *pointsMap = trackingState->pointCloud->locations->GetData(MEMORYDEVICE_CPU);
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
   const unsigned int *surfelIndexImage = renderState->GetIndexImage()->GetData(MEMORYDEVICE_CPU);
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
 #ifdef WITH_OPENMP
   #pragma omp parallel for
@@ -69,7 +95,7 @@ void ITMSurfelVisualisationEngine_CPU<TSurfel>::RenderDepthImage(const ITMSurfel
   float *outputImagePtr = outputImage->GetData(MEMORYDEVICE_CPU);
   const int pixelCount = static_cast<int>(outputImage->dataSize);
   const unsigned int *surfelIndexImagePtr = renderState->GetIndexImage()->GetData(MEMORYDEVICE_CPU);
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
 #ifdef WITH_OPENMP
   #pragma omp parallel for
@@ -91,7 +117,7 @@ void ITMSurfelVisualisationEngine_CPU<TSurfel>::RenderImage(const ITMSurfelScene
   const int pixelCount = static_cast<int>(outputImage->dataSize);
   const ITMSurfelSceneParams& sceneParams = scene->GetParams();
   const unsigned int *surfelIndexImagePtr = renderState->GetIndexImage()->GetData(MEMORYDEVICE_CPU);
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
 
   switch(type)
   {
@@ -169,37 +195,149 @@ void ITMSurfelVisualisationEngine_CPU<TSurfel>::MakeIndexImage(const ITMSurfelSc
                                                                int width, int height, int scaleFactor, unsigned int *surfelIndexImage, bool useRadii,
                                                                UnstableSurfelRenderingMode unstableSurfelRenderingMode, int *depthBuffer) const
 {
-  const int pixelCount = width * height;
+  const Matrix4f& invT = pose->GetM();
+  const ITMSurfelSceneParams& sceneParams = scene->GetParams();
+  const int surfelCount = static_cast<int>(scene->GetSurfelCount());
+  const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
+
+  // Find the blocks of surfels that could be in view, using the scene's spatial index. The blocks that the index
+  // does not cover (i.e. ones to which surfels have been added since the index was last updated), and the blocks
+  // whose surfels have been updated in place since then, are always kept.
+  Vector4f frustumPlanes[5];
+  calculate_index_image_frustum(invT, *intrinsics, width, height, scaleFactor, frustumPlanes);
+
+  const ITMSurfelBlockBounds *blockBounds = scene->GetSurfelBlockBounds()->GetData(MEMORYDEVICE_CPU);
+  const int blockCount = (surfelCount + SURFEL_BLOCK_SIZE - 1) / SURFEL_BLOCK_SIZE;
+  const int indexedBlockCount = scene->GetIndexedSurfelBlockCount();
+  const unsigned char *surfelBlockDirtyFlags = scene->GetSurfelBlockDirtyFlags()->GetData(MEMORYDEVICE_CPU);
+
+  std::vector<int> visibleBlocks;
+  visibleBlocks.reserve(blockCount);
+  for(int blockId = 0; blockId < blockCount; ++blockId)
+  {
+    if(blockId >= indexedBlockCount || surfelBlockDirtyFlags[blockId] || surfel_block_intersects_frustum(blockBounds[blockId], frustumPlanes))
+    {
+      visibleBlocks.push_back(blockId);
+    }
+  }
 
+  // The index image is rendered in horizontal bands of rows, each of which is rendered by a single thread, so that no
+  // synchronisation is needed. To do this, the visible blocks are first split into one contiguous chunk per thread, and each
+  // thread calculates the splats of the surfels in its chunk that need to be rendered and counts them for each band.
 #ifdef WITH_OPENMP
-  #pragma omp parallel for
+  const int chunkCount = omp_get_max_threads();
+#else
+  const int chunkCount = 1;
 #endif
-  for(int locId = 0; locId < pixelCount; ++locId)
+  const int bandCount = (height + SURFEL_SPLAT_BAND_HEIGHT - 1) / SURFEL_SPLAT_BAND_HEIGHT;
+  const int visibleBlockCount = static_cast<int>(visibleBlocks.size());
+  std::vector<std::vector<SurfelSplat> > chunkSplats(chunkCount);
+  std::vector<int> bandSplatOffsets(bandCount * chunkCount + 1, 0);
+
+#ifdef WITH_OPENMP
+  #pragma omp parallel for schedule(static, 1)
+#endif
+  for(int chunkId = 0; chunkId < chunkCount; ++chunkId)
+  {
+    const int chunkBegin = visibleBlockCount * chunkId / chunkCount;
+    const int chunkEnd = visibleBlockCount * (chunkId + 1) / chunkCount;
+    std::vector<SurfelSplat>& splats = chunkSplats[chunkId];
+
+    for(int i = chunkBegin; i < chunkEnd; ++i)
+    {
+      const int blockBegin = visibleBlocks[i] * SURFEL_BLOCK_SIZE;
+      const int blockEnd = std::min(blockBegin + SURFEL_BLOCK_SIZE, surfelCount);
+
+      for(int surfelId = blockBegin; surfelId < blockEnd; ++surfelId)
+      {
+        SurfelSplat splat;
+        if(!calculate_surfel_splat(
+          surfelId, surfels, invT, *intrinsics, width, height, scaleFactor, useRadii, unstableSurfelRenderingMode,
+          sceneParams.stableSurfelConfidence, sceneParams.unstableSurfelZOffset, splat.cx, splat.cy, splat.projectedRadiusSquared,
+          splat.minX, splat.minY, splat.maxX, splat.maxY, splat.scaledZ
+        )) continue;
+
+        splat.surfelId = surfelId;
+        splats.push_back(splat);
+
+        for(int bandId = splat.minY / SURFEL_SPLAT_BAND_HEIGHT; bandId <= splat.maxY / SURFEL_SPLAT_BAND_HEIGHT; ++bandId)
+        {
+          ++bandSplatOffsets[bandId * chunkCount + chunkId + 1];
+        }
+      }
+    }
+  }
+
+  // Turn the per-band counts into offsets into a single array of the splats that overlap each band, and fill in that array.
+  for(int i = 1; i <= bandCount * chunkCount; ++i)
   {
-    clear_surfel_index_image(locId, surfelIndexImage, depthBuffer);
+    bandSplatOffsets[i] += bandSplatOffsets[i-1];
   }
 
-  const Matrix4f& invT = pose->GetM();
-  const ITMSurfelSceneParams& sceneParams = scene->GetParams();
-  const int surfelCount = static_cast<int>(scene->GetSurfelCount());
-  const TSurfel *surfels = scene->GetSurfels()->GetData(MEMORYDEVICE_CPU);
+  std::vector<const SurfelSplat*> bandSplats(bandSplatOffsets[bandCount * chunkCount]);
 
-  // Note: This is deliberately not parallelised (it would be slower due to the synchronisation needed).
-  for(int surfelId = 0; surfelId < surfelCount; ++surfelId)
+#ifdef WITH_OPENMP
+  #pragma omp parallel for schedule(static, 1)
+#endif
+  for(int chunkId = 0; chunkId < chunkCount; ++chunkId)
   {
-    update_depth_buffer_for_surfel(
-      surfelId, surfels, invT, *intrinsics, width, height, scaleFactor, useRadii, unstableSurfelRenderingMode,
-      sceneParams.stableSurfelConfidence, sceneParams.unstableSurfelZOffset, depthBuffer
-    );
+    std::vector<int> nextBandSplat(bandCount);
+    for(int bandId = 0; bandId < bandCount; ++bandId)
+    {
+      nextBandSplat[bandId] = bandSplatOffsets[bandId * chunkCount + chunkId];
+    }
+
+    const std::vector<SurfelSplat>& splats = chunkSplats[chunkId];
+    for(size_t i = 0, size = splats.size(); i < size; ++i)
+    {
+      for(int bandId = splats[i].minY / SURFEL_SPLAT_BAND_HEIGHT; bandId <= splats[i].maxY / SURFEL_SPLAT_BAND_HEIGHT; ++bandId)
+      {
+        bandSplats[nextBandSplat[bandId]++] = &splats[i];
+      }
+    }
   }
 
-  // Note: This is deliberately not parallelised (it would be slower due to the synchronisation needed).
-  for(int surfelId = 0; surfelId < surfelCount; ++surfelId)
+  // Render each band of the index image. For each pixel, we keep the nearest surfel, and of the surfels at the same depth,
+  // the one with the largest ID, so the index image is the same as the one produced by update_depth_buffer_for_surfel and
+  // update_index_image_for_surfel. Bands vary a lot in the number of surfels they contain, hence the dynamic schedule.
+#ifdef WITH_OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for(int bandId = 0; bandId < bandCount; ++bandId)
   {
-    update_index_image_for_surfel(
-      surfelId, surfels, invT, *intrinsics, width, height, scaleFactor, depthBuffer, useRadii, unstableSurfelRenderingMode,
-      sceneParams.stableSurfelConfidence, sceneParams.unstableSurfelZOffset, surfelIndexImage
-    );
+    const int rowBegin = bandId * SURFEL_SPLAT_BAND_HEIGHT;
+    const int rowEnd = std::min(rowBegin + SURFEL_SPLAT_BAND_HEIGHT, height);
+
+    for(int locId = rowBegin * width; locId < rowEnd * width; ++locId)
+    {
+      clear_surfel_index_image(locId, surfelIndexImage, depthBuffer);
+    }
+
+    for(int i = bandSplatOffsets[bandId * chunkCount], end = bandSplatOffsets[(bandId + 1) * chunkCount]; i < end; ++i)
+    {
+      const SurfelSplat& splat = *bandSplats[i];
+      const unsigned int surfelIdPlusOne = static_cast<unsigned int>(splat.surfelId + 1);
+
+      for(int y = std::max(splat.minY, rowBegin), maxY = std::min(splat.maxY, rowEnd - 1); y <= maxY; ++y)
+      {
+        int yOffset = y - splat.cy;
+        int yOffsetSquared = yOffset * yOffset;
+
+        for(int x = splat.minX; x <= splat.maxX; ++x)
+        {
+          int xOffset = x - splat.cx;
+          int xOffsetSquared = xOffset * xOffset;
+          if(xOffsetSquared + yOffsetSquared > splat.projectedRadiusSquared) continue;
+
+          int offset = y * width + x;
+          if(splat.scaledZ < depthBuffer[offset] || (splat.scaledZ == depthBuffer[offset] && surfelIdPlusOne > surfelIndexImage[offset]))
+          {
+            depthBuffer[offset] = splat.scaledZ;
+            surfelIndexImage[offset] = surfelIdPlusOne;
+          }
+        }
+      }
+    }
   }
 }
 
@@ -9,8 +9,12 @@ namespace ITMLib
 	template<class TVoxel, class TIndex>
 	class ITMVisualisationEngine_CPU : public ITMVisualisationEngine < TVoxel, TIndex >
 	{
+	private:
+		bool useTiledRaycast;
+
 	public:
-		explicit ITMVisualisationEngine_CPU(void) { }
+		/** With @p useTiledRaycast, raycasts march the rays of 8x8 pixel tiles together, see castRayTile. */
+		explicit ITMVisualisationEngine_CPU(bool useTiledRaycast = false) : useTiledRaycast(useTiledRaycast) { }
 		~ITMVisualisationEngine_CPU(void) { }
 
 		ITMRenderState* CreateRenderState(const ITMScene<TVoxel, TIndex> *scene, const Vector2i & imgSize) const;
@@ -20,6 +24,8 @@ namespace ITMLib
 		void RenderImage(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, const ITMRenderState *renderState,
 			ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type = IITMVisualisationEngine::RENDER_SHADED_GREYSCALE,
 			IITMVisualisationEngine::RenderRaycastSelection raycastType = IITMVisualisationEngine::RENDER_FROM_NEW_RAYCAST) const;
+		bool RenderImageProgressive(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, ITMRenderState *renderState,
+			ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type, int maxSubsample, float timeBudget) const;
 		void FindSurface(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, const ITMRenderState *renderState) const;
 		void CreatePointCloud(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState, bool skipPoints) const;
 		void CreateICPMaps(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState) const;
@@ -29,8 +35,12 @@ namespace ITMLib
 	template<class TVoxel>
 	class ITMVisualisationEngine_CPU<TVoxel, ITMVoxelBlockHash> : public ITMVisualisationEngine < TVoxel, ITMVoxelBlockHash >
 	{
+	private:
+		bool useTiledRaycast;
+
 	public:
-		explicit ITMVisualisationEngine_CPU(void) { }
+		/** With @p useTiledRaycast, raycasts march the rays of 8x8 pixel tiles together, see castRayTile. */
+		explicit ITMVisualisationEngine_CPU(bool useTiledRaycast = false) : useTiledRaycast(useTiledRaycast) { }
 		~ITMVisualisationEngine_CPU(void) { }
 
 		ITMRenderState_VH* CreateRenderState(const ITMScene<TVoxel, ITMVoxelBlockHash> *scene, const Vector2i & imgSize) const;
@@ -40,6 +50,8 @@ namespace ITMLib
 		void RenderImage(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, const ITMRenderState *renderState,
 			ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type = IITMVisualisationEngine::RENDER_SHADED_GREYSCALE,
 			IITMVisualisationEngine::RenderRaycastSelection raycastType = IITMVisualisationEngine::RENDER_FROM_NEW_RAYCAST) const;
+		bool RenderImageProgressive(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, ITMRenderState *renderState,
+			ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type, int maxSubsample, float timeBudget) const;
 		void FindSurface(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, const ITMRenderState *renderState) const;
 		void CreatePointCloud(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState, bool skipPoints) const;
 		void CreateICPMaps(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState) const;
@@ -1,12 +1,18 @@
 // Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
 
 #include "ITMVisualisationEngine_CPU.h"
+#include "ITMRayTile_CPU.h"
 
 #include "../Shared/ITMVisualisationEngine_Shared.h"
 #include "../../Reconstruction/Shared/ITMSceneReconstructionEngine_Shared.h"
+#include "../../../../ORUtils/NVTimer.h"
 
 #include <vector>
 
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
 using namespace ITMLib;
 
 template<class TVoxel, class TIndex>
@@ -14,6 +20,14 @@ static int RenderPointCloud(Vector4u *outRendering, Vector4f *locations, Vector4
 	const TVoxel *voxelData, const typename TIndex::IndexData *voxelIndex, bool skipPoints, float voxelSize, 
 	Vector2i imgSize, Vector3f lightSource);
 
+/** The cells of the block occupancy map of the index, or NULL if it keeps none. */
+template<class TIndex>
+static const ITMBlockOccupancyCell *GetOccupancyCells(const TIndex &index)
+{
+	const ITMBlockOccupancy *occupancy = index.GetBlockOccupancy();
+	return occupancy != NULL ? occupancy->GetCells() : NULL;
+}
+
 template<class TVoxel, class TIndex>
 ITMRenderState* ITMVisualisationEngine_CPU<TVoxel, TIndex>::CreateRenderState(const ITMScene<TVoxel, TIndex> *scene, const Vector2i & imgSize) const
 {
@@ -26,7 +40,7 @@ template<class TVoxel>
 ITMRenderState_VH* ITMVisualisationEngine_CPU<TVoxel, ITMVoxelBlockHash>::CreateRenderState(const ITMScene<TVoxel, ITMVoxelBlockHash> *scene, const Vector2i & imgSize) const
 {
 	return new ITMRenderState_VH(
-		ITMVoxelBlockHash::noTotalEntries, imgSize, scene->sceneParams->viewFrustum_min, scene->sceneParams->viewFrustum_max, MEMORYDEVICE_CPU
+		scene->index.noTotalEntries, scene->localVBA.GetMaxNoBlocks(), imgSize, scene->sceneParams->viewFrustum_min, scene->sceneParams->viewFrustum_max, MEMORYDEVICE_CPU
 	);
 }
 
@@ -119,6 +133,9 @@ void ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::CreateExpectedDepths(
 	Vector2i imgSize = renderState->renderingRangeImage->noDims;
 	Vector2f *minmaxData = renderState->renderingRangeImage->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int locId = 0; locId < imgSize.x*imgSize.y; ++locId) {
 		Vector2f & pixel = minmaxData[locId];
 		pixel.x = FAR_AWAY;
@@ -126,55 +143,88 @@ void ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::CreateExpectedDepths(
 	}
 
 	float voxelSize = scene->sceneParams->voxelSize;
-
-	std::vector<RenderingBlock> renderingBlocks(MAX_RENDERING_BLOCKS);
-	int numRenderingBlocks = 0;
+	Matrix4f M = pose->GetM();
+	Vector4f projParams = intrinsics->projectionParamsSimple.all;
 
 	ITMRenderState_VH* renderState_vh = (ITMRenderState_VH*)renderState;
 
+	const ITMHashEntry *hashTable = scene->index.GetEntries();
 	const int *visibleEntryIDs = renderState_vh->GetVisibleEntryIDs();
 	int noVisibleEntries = renderState_vh->noVisibleEntries;
 
 	//go through list of visible 8x8x8 blocks
+	std::vector<Vector2i> upperLefts(noVisibleEntries), lowerRights(noVisibleEntries);
+	std::vector<Vector2f> zRanges(noVisibleEntries);
+	std::vector<int> requiredNumBlocks(noVisibleEntries);
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int blockNo = 0; blockNo < noVisibleEntries; ++blockNo) {
-		const ITMHashEntry & blockData(scene->index.GetEntries()[visibleEntryIDs[blockNo]]);
+		const ITMHashEntry & blockData(hashTable[visibleEntryIDs[blockNo]]);
 
 		Vector2i upperLeft, lowerRight;
 		Vector2f zRange;
 		bool validProjection = false;
 		if (blockData.ptr>=0) {
-			validProjection = ProjectSingleBlock(blockData.pos, pose->GetM(), intrinsics->projectionParamsSimple.all, imgSize, voxelSize, upperLeft, lowerRight, zRange);
+			validProjection = ProjectSingleBlock(blockData.pos, M, projParams, imgSize, voxelSize, upperLeft, lowerRight, zRange);
 		}
+		requiredNumBlocks[blockNo] = 0;
 		if (!validProjection) continue;
 
 		Vector2i requiredRenderingBlocks((int)ceilf((float)(lowerRight.x - upperLeft.x + 1) / (float)renderingBlockSizeX), 
 			(int)ceilf((float)(lowerRight.y - upperLeft.y + 1) / (float)renderingBlockSizeY));
-		int requiredNumBlocks = requiredRenderingBlocks.x * requiredRenderingBlocks.y;
+		requiredNumBlocks[blockNo] = requiredRenderingBlocks.x * requiredRenderingBlocks.y;
+		upperLefts[blockNo] = upperLeft; lowerRights[blockNo] = lowerRight; zRanges[blockNo] = zRange;
+	}
 
-		if (numRenderingBlocks + requiredNumBlocks >= MAX_RENDERING_BLOCKS) continue;
-		int offset = numRenderingBlocks;
-		numRenderingBlocks += requiredNumBlocks;
+	// hand out the rendering blocks in the order of the visible list, skipping the blocks that do not fit any more
+	std::vector<int> offsets(noVisibleEntries);
+	int numRenderingBlocks = 0;
+	for (int blockNo = 0; blockNo < noVisibleEntries; ++blockNo) {
+		offsets[blockNo] = -1;
+		if (requiredNumBlocks[blockNo] == 0 || numRenderingBlocks + requiredNumBlocks[blockNo] >= MAX_RENDERING_BLOCKS) continue;
+		offsets[blockNo] = numRenderingBlocks;
+		numRenderingBlocks += requiredNumBlocks[blockNo];
+	}
+
+	std::vector<RenderingBlock> renderingBlocks(MAX_RENDERING_BLOCKS);
 
-		CreateRenderingBlocks(&(renderingBlocks[0]), offset, upperLeft, lowerRight, zRange);
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int blockNo = 0; blockNo < noVisibleEntries; ++blockNo) {
+		if (offsets[blockNo] >= 0) CreateRenderingBlocks(&(renderingBlocks[0]), offsets[blockNo], upperLefts[blockNo], lowerRights[blockNo], zRanges[blockNo]);
 	}
 
-	// go through rendering blocks
-	for (int blockNo = 0; blockNo < numRenderingBlocks; ++blockNo) {
-		// fill minmaxData
-		const RenderingBlock & b(renderingBlocks[blockNo]);
+	// go through rendering blocks, every thread filling its own band of rows of minmaxData
+#ifdef WITH_OPENMP
+	#pragma omp parallel
+	{
+		int noThreads = omp_get_num_threads(), threadId = omp_get_thread_num();
+#else
+	{
+		int noThreads = 1, threadId = 0;
+#endif
+		int rowBegin = imgSize.y * threadId / noThreads, rowEnd = imgSize.y * (threadId + 1) / noThreads;
+
+		for (int blockNo = 0; blockNo < numRenderingBlocks; ++blockNo) {
+			const RenderingBlock & b(renderingBlocks[blockNo]);
 
-		for (int y = b.upperLeft.y; y <= b.lowerRight.y; ++y) {
-			for (int x = b.upperLeft.x; x <= b.lowerRight.x; ++x) {
-				Vector2f & pixel(minmaxData[x + y*imgSize.x]);
-				if (pixel.x > b.zRange.x) pixel.x = b.zRange.x;
-				if (pixel.y < b.zRange.y) pixel.y = b.zRange.y;
+			for (int y = MAX(b.upperLeft.y, rowBegin); y <= MIN(b.lowerRight.y, rowEnd - 1); ++y) {
+				for (int x = b.upperLeft.x; x <= b.lowerRight.x; ++x) {
+					Vector2f & pixel(minmaxData[x + y*imgSize.x]);
+					if (pixel.x > b.zRange.x) pixel.x = b.zRange.x;
+					if (pixel.y < b.zRange.y) pixel.y = b.zRange.y;
+				}
 			}
 		}
 	}
 }
 
 template<class TVoxel, class TIndex>
-static void GenericRaycast(const ITMScene<TVoxel, TIndex> *scene, const Vector2i& imgSize, const Matrix4f& invM, const Vector4f& projParams, const ITMRenderState *renderState, bool updateVisibleList)
+static void GenericRaycast(const ITMScene<TVoxel, TIndex> *scene, const Vector2i& imgSize, const Matrix4f& invM, const Vector4f& projParams, const ITMRenderState *renderState, bool updateVisibleList,
+	bool useTiledRaycast)
 {
 	const Vector2f *minmaximg = renderState->renderingRangeImage->GetData(MEMORYDEVICE_CPU);
 	float mu = scene->sceneParams->mu;
@@ -182,52 +232,88 @@ static void GenericRaycast(const ITMScene<TVoxel, TIndex> *scene, const Vector2i
 	Vector4f *pointsRay = renderState->raycastResult->GetData(MEMORYDEVICE_CPU);
 	const TVoxel *voxelData = scene->localVBA.GetVoxelBlocks();
 	const typename ITMVoxelBlockHash::IndexData *voxelIndex = scene->index.getIndexData();
+	const ITMBlockOccupancyCell *occupancy = GetOccupancyCells(scene->index);
 	uchar *entriesVisibleType = NULL;
 	if (updateVisibleList&&(dynamic_cast<const ITMRenderState_VH*>(renderState)!=NULL))
 	{
 		entriesVisibleType = ((ITMRenderState_VH*)renderState)->GetEntriesVisibleType();
 	}
 
+	if (useTiledRaycast)
+	{
+		Vector2i noTiles((imgSize.x + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE, (imgSize.y + RAY_TILE_SIZE - 1) / RAY_TILE_SIZE);
+		Vector4f invProjParams = InvertProjectionParams(projParams);
+
+		// tiles that see the surface up close take far fewer steps than the ones that look past it
 #ifdef WITH_OPENMP
-	#pragma omp parallel for
+		#pragma omp parallel for schedule(dynamic)
+#endif
+		for (int tileId = 0; tileId < noTiles.x * noTiles.y; ++tileId)
+		{
+			int tileX = (tileId % noTiles.x) * RAY_TILE_SIZE, tileY = (tileId / noTiles.x) * RAY_TILE_SIZE;
+
+			if (entriesVisibleType != NULL) castRayTile<TVoxel, true>(pointsRay, entriesVisibleType, tileX, tileY, imgSize, voxelData, voxelIndex,
+				invM, invProjParams, oneOverVoxelSize, mu, minmaximg, occupancy);
+			else castRayTile<TVoxel, false>(pointsRay, NULL, tileX, tileY, imgSize, voxelData, voxelIndex,
+				invM, invProjParams, oneOverVoxelSize, mu, minmaximg, occupancy);
+		}
+
+		return;
+	}
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel
 #endif
-	for (int locId = 0; locId < imgSize.x*imgSize.y; ++locId)
 	{
-		int y = locId/imgSize.x;
-		int x = locId - y*imgSize.x;
-		int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+		// neighbouring rays pass through mostly the same blocks, so each thread keeps its block lookups from one ray to the next
+		typename TIndex::NeighbourIndexCache cache;
 
-		if (entriesVisibleType!=NULL) castRay<TVoxel, TIndex, true>(
-				pointsRay[locId],
-				entriesVisibleType,
-				x, y,
-				voxelData,
-				voxelIndex,
-				invM,
-				InvertProjectionParams(projParams),
-				oneOverVoxelSize,
-				mu,
-				minmaximg[locId2]
-			);
-		else castRay<TVoxel, TIndex, false>(
-				pointsRay[locId],
-				NULL,
-				x, y,
-				voxelData,
-				voxelIndex,
-				invM,
-				InvertProjectionParams(projParams),
-				oneOverVoxelSize,
-				mu,
-				minmaximg[locId2]
-			);
+#ifdef WITH_OPENMP
+		#pragma omp for
+#endif
+		for (int locId = 0; locId < imgSize.x*imgSize.y; ++locId)
+		{
+			int y = locId/imgSize.x;
+			int x = locId - y*imgSize.x;
+			int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+
+			if (entriesVisibleType!=NULL) castRay<TVoxel, TIndex, true>(
+					pointsRay[locId],
+					entriesVisibleType,
+					x, y,
+					voxelData,
+					voxelIndex,
+					invM,
+					InvertProjectionParams(projParams),
+					oneOverVoxelSize,
+					mu,
+					minmaximg[locId2],
+					occupancy,
+					cache
+				);
+			else castRay<TVoxel, TIndex, false>(
+					pointsRay[locId],
+					NULL,
+					x, y,
+					voxelData,
+					voxelIndex,
+					invM,
+					InvertProjectionParams(projParams),
+					oneOverVoxelSize,
+					mu,
+					minmaximg[locId2],
+					occupancy,
+					cache
+				);
+		}
 	}
 }
 
 
 template<class TVoxel, class TIndex>
 static void RenderImage_common(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics,
-	const ITMRenderState *renderState, ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type, IITMVisualisationEngine::RenderRaycastSelection raycastType)
+	const ITMRenderState *renderState, ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type, IITMVisualisationEngine::RenderRaycastSelection raycastType,
+	bool useTiledRaycast)
 {
 	Vector2i imgSize = outputImage->noDims;
 	Matrix4f invM = pose->GetInvM();
@@ -243,7 +329,7 @@ static void RenderImage_common(const ITMScene<TVoxel,TIndex> *scene, const ORUti
         {
             // this one is generally done for freeview visualisation, so
             // no, do not update the list of visible blocks
-            GenericRaycast(scene, imgSize, invM, intrinsics->projectionParamsSimple.all, renderState, false);
+            GenericRaycast(scene, imgSize, invM, intrinsics->projectionParamsSimple.all, renderState, false, useTiledRaycast);
             pointsRay = renderState->raycastResult->GetData(MEMORYDEVICE_CPU);
         }
     }
@@ -319,16 +405,207 @@ static void RenderImage_common(const ITMScene<TVoxel,TIndex> *scene, const ORUti
 	}
 }
 
+/** Raycasts the pixels in rows rowBegin, rowBegin + stride, ... before rowEnd whose columns are multiples of stride as well, except the ones on the grid of every skipStride-th pixel, if skipStride is not 0. Returns the number of rays cast. */
+template<class TVoxel, class TIndex>
+static int RaycastPixelGrid(const ITMScene<TVoxel, TIndex> *scene, Vector4f *samples, const Vector2i &imgSize, const Matrix4f &invM, const Vector4f &projParams,
+	const Vector2f *minmaximg, int stride, int rowBegin, int rowEnd, int skipStride)
+{
+	float mu = scene->sceneParams->mu;
+	float oneOverVoxelSize = 1.0f / scene->sceneParams->voxelSize;
+	const TVoxel *voxelData = scene->localVBA.GetVoxelBlocks();
+	const typename TIndex::IndexData *voxelIndex = scene->index.getIndexData();
+	const ITMBlockOccupancyCell *occupancy = GetOccupancyCells(scene->index);
+	Vector4f invProjParams = InvertProjectionParams(projParams);
+
+	int noCols = (imgSize.x + stride - 1) / stride, noRows = (rowEnd - rowBegin + stride - 1) / stride;
+	int noRays = 0;
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for reduction(+:noRays)
+#endif
+	for (int i = 0; i < noCols * noRows; i++)
+	{
+		int x = (i % noCols) * stride, y = rowBegin + (i / noCols) * stride;
+		if (skipStride > 0 && x % skipStride == 0 && y % skipStride == 0) continue;
+
+		int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+		typename TIndex::NeighbourIndexCache cache;
+		castRay<TVoxel, TIndex, false>(samples[x + y * imgSize.x], NULL, x, y, voxelData, voxelIndex, invM, invProjParams, oneOverVoxelSize, mu,
+			minmaximg[locId2], occupancy, cache);
+		noRays++;
+	}
+
+	return noRays;
+}
+
+/** \brief
+    Fills in the raycast result of a progressively refined image
+    from its samples: every stride-th pixel along both axes has
+    been raycast, and so have the pixels on the grid of every
+    fineStride-th pixel in the rows before fineRowEnd. The other
+    pixels are interpolated bilinearly from the four nearest
+    pixels of the coarse grid, leaving out the ones that lie
+    behind a depth edge, so that the interpolation does not
+    blend foreground and background.
+*/
+static void UpsampleRefinementSamples(Vector4f *pointsRay, const Vector4f *samples, const Vector2i &imgSize, const Matrix4f &M, float voxelSize,
+	int stride, int fineStride, int fineRowEnd)
+{
+	int lastCol = (imgSize.x - 1) / stride * stride, lastRow = (imgSize.y - 1) / stride * stride;
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int locId = 0; locId < imgSize.x * imgSize.y; locId++)
+	{
+		int y = locId / imgSize.x, x = locId - y * imgSize.x;
+
+		bool isSample = (x % stride == 0 && y % stride == 0) || (fineStride > 0 && x % fineStride == 0 && y % fineStride == 0 && y < fineRowEnd);
+		if (isSample) { pointsRay[locId] = samples[locId]; continue; }
+
+		int x0 = x - x % stride, y0 = y - y % stride;
+		int x1 = MIN(x0 + stride, lastCol), y1 = MIN(y0 + stride, lastRow);
+		float fx = x1 > x0 ? (float)(x - x0) / (float)(x1 - x0) : 0.0f, fy = y1 > y0 ? (float)(y - y0) / (float)(y1 - y0) : 0.0f;
+
+		Vector4f corners[4] = { samples[x0 + y0 * imgSize.x], samples[x1 + y0 * imgSize.x], samples[x0 + y1 * imgSize.x], samples[x1 + y1 * imgSize.x] };
+		float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+
+		// depths of the corners that hit the surface, in metres, and FAR_AWAY for the ones that missed it
+		float depths[4] = { FAR_AWAY, FAR_AWAY, FAR_AWAY, FAR_AWAY }, minDepth = FAR_AWAY;
+		for (int i = 0; i < 4; i++)
+		{
+			if (corners[i].w <= 0) continue;
+			depths[i] = (M * Vector4f(corners[i].x * voxelSize, corners[i].y * voxelSize, corners[i].z * voxelSize, 1.0f)).z;
+			if (depths[i] < minDepth) minDepth = depths[i];
+		}
+
+		if (minDepth >= FAR_AWAY) { pointsRay[locId] = Vector4f(0.0f); continue; }
+
+		// corners more than 5% behind the nearest one are on the far side of an edge, as are the ones that missed the surface
+		Vector4f result(0.0f); float totalWeight = 0.0f; int fallback = -1;
+		for (int i = 0; i < 4; i++)
+		{
+			if (depths[i] > minDepth * 1.05f) continue;
+			result += corners[i] * weights[i]; totalWeight += weights[i];
+			if (fallback < 0 || weights[i] > weights[fallback]) fallback = i;
+		}
+
+		if (totalWeight > 0.0f) pointsRay[locId] = result / totalWeight;
+		else pointsRay[locId] = fallback >= 0 ? corners[fallback] : Vector4f(0.0f);
+	}
+}
+
+template<class TVoxel, class TIndex>
+static bool RenderImageProgressive_common(const ITMVisualisationEngine<TVoxel, TIndex> *engine, const ITMScene<TVoxel, TIndex> *scene,
+	const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics, ITMRenderState *renderState, ITMUChar4Image *outputImage,
+	IITMVisualisationEngine::RenderImageType type, int maxSubsample, float timeBudget)
+{
+	Vector2i imgSize = renderState->raycastResult->noDims;
+	const Matrix4f &M = pose->GetM();
+	Matrix4f invM = pose->GetInvM();
+	const Vector4f &projParams = intrinsics->projectionParamsSimple.all;
+	const Vector2f *minmaximg = renderState->renderingRangeImage->GetData(MEMORYDEVICE_CPU);
+
+	StopWatchInterface *timer;
+	sdkCreateTimer(&timer);
+	sdkStartTimer(&timer);
+
+	if (renderState->refinementSamples == NULL) renderState->refinementSamples = new ORUtils::Image<Vector4f>(imgSize, MEMORYDEVICE_CPU);
+	Vector4f *samples = renderState->refinementSamples->GetData(MEMORYDEVICE_CPU);
+
+	int coarsestStride = 1;
+	while (coarsestStride * 2 <= maxSubsample) coarsestStride *= 2;
+
+	bool isSameView = memcmp(M.m, renderState->refinementPose.m, sizeof(M.m)) == 0 && projParams == renderState->refinementProjParams;
+	bool isNewView = !isSameView || renderState->refinementStride == 0 || renderState->refinementStride > coarsestStride;
+	bool wasComplete = !isNewView && renderState->refinementStride == 1, hasRefreshed = false, hasProgressed = isNewView;
+
+	// the raycasts get what is left of the budget once the image has been upsampled and shaded
+	float rayBudget = timeBudget > 0.0f ? MAX(timeBudget - renderState->refinementShadingTime, 0.0f) : 0.0f;
+
+	if (isNewView)
+	{
+		engine->FindVisibleBlocks(scene, pose, intrinsics, renderState);
+		engine->CreateExpectedDepths(scene, pose, intrinsics, renderState);
+
+		// start at the finest level that is expected to fit into the budget
+		int stride = timeBudget > 0.0f ? coarsestStride : 1;
+		float timePerRay = renderState->refinementTimePerRay;
+		while (stride > 1 && timePerRay > 0.0f && timePerRay * (float)(imgSize.x * imgSize.y) / (float)(stride * stride / 4) <= rayBudget) stride /= 2;
+
+		float startTime = sdkGetTimerValue(&timer);
+		int noRays = RaycastPixelGrid(scene, samples, imgSize, invM, projParams, minmaximg, stride, 0, imgSize.y, 0);
+		float rayTime = (sdkGetTimerValue(&timer) - startTime) / (float)MAX(noRays, 1);
+		renderState->refinementTimePerRay = timePerRay > 0.0f ? 0.5f * (timePerRay + rayTime) : rayTime;
+
+		renderState->refinementPose = M;
+		renderState->refinementProjParams = projParams;
+		renderState->refinementStride = stride;
+		renderState->refinementRow = 0;
+	}
+
+	// raycast the missing pixels one level after the other, and a complete image again row by row, until the budget is spent,
+	// but at least a row per call, so that the image gets refined even if shading alone takes up the budget
+	while (true)
+	{
+		float elapsed = sdkGetTimerValue(&timer);
+		int stride = renderState->refinementStride, rowBegin = renderState->refinementRow;
+
+		if (timeBudget > 0.0f ? (hasProgressed && elapsed >= rayBudget) : (stride == 1 && (!wasComplete || hasRefreshed))) break;
+
+		// a new pass over the complete image should see the scene as it is now
+		if (stride == 1 && rowBegin == 0)
+		{
+			engine->FindVisibleBlocks(scene, pose, intrinsics, renderState);
+			engine->CreateExpectedDepths(scene, pose, intrinsics, renderState);
+		}
+
+		int fineStride = MAX(stride / 2, 1);
+		int noRowsLeft = (imgSize.y - rowBegin + fineStride - 1) / fineStride, noRows = noRowsLeft;
+		float timePerRow = renderState->refinementTimePerRay * (float)(imgSize.x / fineStride);
+		if (timeBudget > 0.0f && timePerRow > 0.0f) noRows = CLAMP((int)((rayBudget - elapsed) / timePerRow), 1, noRowsLeft);
+		int rowEnd = MIN(rowBegin + noRows * fineStride, imgSize.y);
+
+		float startTime = sdkGetTimerValue(&timer);
+		int noRays = RaycastPixelGrid(scene, samples, imgSize, invM, projParams, minmaximg, fineStride, rowBegin, rowEnd, stride > 1 ? stride : 0);
+		hasProgressed = true;
+		if (noRays > 0)
+		{
+			float rayTime = (sdkGetTimerValue(&timer) - startTime) / (float)noRays;
+			renderState->refinementTimePerRay = renderState->refinementTimePerRay > 0.0f ? 0.5f * (renderState->refinementTimePerRay + rayTime) : rayTime;
+		}
+
+		if (rowEnd < imgSize.y) renderState->refinementRow = rowEnd;
+		else
+		{
+			if (stride == 1) hasRefreshed = true;
+			renderState->refinementStride = fineStride;
+			renderState->refinementRow = 0;
+		}
+	}
+
+	float shadingStart = sdkGetTimerValue(&timer);
+	int stride = renderState->refinementStride;
+	UpsampleRefinementSamples(renderState->raycastResult->GetData(MEMORYDEVICE_CPU), samples, imgSize, M, scene->sceneParams->voxelSize,
+		stride, stride > 1 ? stride / 2 : 0, renderState->refinementRow);
+	RenderImage_common(scene, pose, intrinsics, renderState, outputImage, type, IITMVisualisationEngine::RENDER_FROM_OLD_RAYCAST, false);
+	renderState->refinementShadingTime = sdkGetTimerValue(&timer) - shadingStart;
+
+	sdkDeleteTimer(&timer);
+
+	return stride == 1;
+}
+
 template<class TVoxel, class TIndex>
 static void CreatePointCloud_common(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, 
-	ITMRenderState *renderState, bool skipPoints)
+	ITMRenderState *renderState, bool skipPoints, bool useTiledRaycast)
 {
 	Vector2i imgSize = renderState->raycastResult->noDims;
 	Matrix4f invM = trackingState->pose_d->GetInvM() * view->calib.trafo_rgb_to_depth.calib;
 
 	// this one is generally done for the colour tracker, so yes, update
 	// the list of visible blocks if possible
-	GenericRaycast(scene, imgSize, invM, view->calib.intrinsics_rgb.projectionParamsSimple.all, renderState, true);
+	GenericRaycast(scene, imgSize, invM, view->calib.intrinsics_rgb.projectionParamsSimple.all, renderState, true, useTiledRaycast);
 	trackingState->pose_pointCloud->SetFrom(trackingState->pose_d);
 
 	trackingState->pointCloud->noTotalPoints = RenderPointCloud<TVoxel, TIndex>(
@@ -345,14 +622,15 @@ static void CreatePointCloud_common(const ITMScene<TVoxel,TIndex> *scene, const
 }
 
 template<class TVoxel, class TIndex>
-static void CreateICPMaps_common(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState)
+static void CreateICPMaps_common(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState,
+	bool useTiledRaycast)
 {
 	Vector2i imgSize = renderState->raycastResult->noDims;
 	Matrix4f invM = trackingState->pose_d->GetInvM();
 
 	// this one is generally done for the ICP tracker, so yes, update
 	// the list of visible blocks if possible
-	GenericRaycast(scene, imgSize, invM, view->calib.intrinsics_d.projectionParamsSimple.all, renderState, true);
+	GenericRaycast(scene, imgSize, invM, view->calib.intrinsics_d.projectionParamsSimple.all, renderState, true, useTiledRaycast);
 	trackingState->pose_pointCloud->SetFrom(trackingState->pose_d);
 
 	Vector3f lightSource = -Vector3f(invM.getColumn(2));
@@ -394,47 +672,91 @@ static void ForwardRender_common(const ITMScene<TVoxel, TIndex> *scene, const IT
 	float voxelSize = scene->sceneParams->voxelSize;
 	const TVoxel *voxelData = scene->localVBA.GetVoxelBlocks();
 	const typename TIndex::IndexData *voxelIndex = scene->index.getIndexData();
+	const ITMBlockOccupancyCell *occupancy = GetOccupancyCells(scene->index);
+
+	int noPixels = imgSize.x * imgSize.y;
 
 	renderState->forwardProjection->Clear();
 
-	for (int y = 0; y < imgSize.y; y++) for (int x = 0; x < imgSize.x; x++)
-	{
-		int locId = x + y * imgSize.x;
-		Vector4f pixel = pointsRay[locId];
+	// find where every raycast point lands in the new view, using fwdProjMissingPoints to hold the targets for now
+	int *targetIds = fwdProjMissingPoints;
 
-		int locId_new = forwardProjectPixel(pixel * voxelSize, M, projParams, imgSize);
-		if (locId_new >= 0) forwardProjection[locId_new] = pixel;
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int locId = 0; locId < noPixels; locId++)
+	{
+		targetIds[locId] = forwardProjectPixel(pointsRay[locId] * voxelSize, M, projParams, imgSize);
 	}
 
-	int noMissingPoints = 0;
-	for (int y = 0; y < imgSize.y; y++) for (int x = 0; x < imgSize.x; x++)
+	// every thread writes the targets in its own band of rows, walking the points in order so that, as in a serial
+	// loop, the last point projected onto a pixel wins, and then collects the missing points of its band
+#ifdef WITH_OPENMP
+	std::vector<int> noThreadMissingPoints(omp_get_max_threads() + 1, 0);
+
+	#pragma omp parallel
 	{
-		int locId = x + y * imgSize.x;
-		int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+		int noThreads = omp_get_num_threads(), threadId = omp_get_thread_num();
+#else
+	std::vector<int> noThreadMissingPoints(2, 0);
+	{
+		int noThreads = 1, threadId = 0;
+#endif
+		int locBegin = imgSize.y * threadId / noThreads * imgSize.x, locEnd = imgSize.y * (threadId + 1) / noThreads * imgSize.x;
 
-		Vector4f fwdPoint = forwardProjection[locId];
-		Vector2f minmaxval = minmaximg[locId2];
-		float depth = currentDepth[locId];
+		for (int locId = 0; locId < noPixels; locId++)
+		{
+			int locId_new = targetIds[locId];
+			if (locId_new >= locBegin && locId_new < locEnd) forwardProjection[locId_new] = pointsRay[locId];
+		}
 
-		if ((fwdPoint.w <= 0) && ((fwdPoint.x == 0 && fwdPoint.y == 0 && fwdPoint.z == 0) || (depth >= 0)) && (minmaxval.x < minmaxval.y))
-		//if ((fwdPoint.w <= 0) && (minmaxval.x < minmaxval.y))
+		std::vector<int> missingPoints;
+		for (int locId = locBegin; locId < locEnd; locId++)
 		{
-			fwdProjMissingPoints[noMissingPoints] = locId;
-			noMissingPoints++;
+			int y = locId / imgSize.x, x = locId - y * imgSize.x;
+			int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
+
+			Vector4f fwdPoint = forwardProjection[locId];
+			Vector2f minmaxval = minmaximg[locId2];
+			float depth = currentDepth[locId];
+
+			if ((fwdPoint.w <= 0) && ((fwdPoint.x == 0 && fwdPoint.y == 0 && fwdPoint.z == 0) || (depth >= 0)) && (minmaxval.x < minmaxval.y))
+			//if ((fwdPoint.w <= 0) && (minmaxval.x < minmaxval.y))
+			{
+				missingPoints.push_back(locId);
+			}
 		}
+		noThreadMissingPoints[threadId + 1] = (int)missingPoints.size();
+
+		// once all targets have been read, the bands are appended to the list in order
+#ifdef WITH_OPENMP
+		#pragma omp barrier
+#endif
+
+		int offset = 0;
+		for (int i = 0; i <= threadId; i++) offset += noThreadMissingPoints[i];
+		if (!missingPoints.empty()) memcpy(fwdProjMissingPoints + offset, &missingPoints[0], missingPoints.size() * sizeof(int));
 	}
 
+	int noMissingPoints = 0;
+	for (size_t i = 0; i < noThreadMissingPoints.size(); i++) noMissingPoints += noThreadMissingPoints[i];
+
 	renderState->noFwdProjMissingPoints = noMissingPoints;
 	const Vector4f invProjParams = InvertProjectionParams(projParams);
-    
+	float oneOverVoxelSize = 1.0f / scene->sceneParams->voxelSize, mu = scene->sceneParams->mu;
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for schedule(dynamic, 64)
+#endif
 	for (int pointId = 0; pointId < noMissingPoints; pointId++)
 	{
 		int locId = fwdProjMissingPoints[pointId];
 		int y = locId / imgSize.x, x = locId - y*imgSize.x;
 		int locId2 = (int)floor((float)x / minmaximg_subsample) + (int)floor((float)y / minmaximg_subsample) * imgSize.x;
 
+		typename TIndex::NeighbourIndexCache cache;
 		castRay<TVoxel, TIndex, false>(forwardProjection[locId], NULL, x, y, voxelData, voxelIndex, invM, invProjParams,
-			1.0f / scene->sceneParams->voxelSize, scene->sceneParams->mu, minmaximg[locId2]);
+			oneOverVoxelSize, mu, minmaximg[locId2], occupancy, cache);
 	}
 }
 
@@ -443,7 +765,7 @@ void ITMVisualisationEngine_CPU<TVoxel,TIndex>::RenderImage(const ITMScene<TVoxe
 	const ITMRenderState *renderState, ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type,
 	IITMVisualisationEngine::RenderRaycastSelection raycastType) const
 {
-	RenderImage_common(scene, pose, intrinsics, renderState, outputImage, type, raycastType);
+	RenderImage_common(scene, pose, intrinsics, renderState, outputImage, type, raycastType, useTiledRaycast);
 }
 
 template<class TVoxel>
@@ -451,7 +773,22 @@ void ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::RenderImage(const ITM
 	const ITMRenderState *renderState, ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type,
 	IITMVisualisationEngine::RenderRaycastSelection raycastType) const
 {
-	RenderImage_common(scene, pose, intrinsics, renderState, outputImage, type, raycastType);
+	RenderImage_common(scene, pose, intrinsics, renderState, outputImage, type, raycastType, useTiledRaycast);
+}
+
+template<class TVoxel, class TIndex>
+bool ITMVisualisationEngine_CPU<TVoxel,TIndex>::RenderImageProgressive(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics,
+	ITMRenderState *renderState, ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type, int maxSubsample, float timeBudget) const
+{
+	return RenderImageProgressive_common(this, scene, pose, intrinsics, renderState, outputImage, type, maxSubsample, timeBudget);
+}
+
+template<class TVoxel>
+bool ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::RenderImageProgressive(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ORUtils::SE3Pose *pose,
+	const ITMIntrinsics *intrinsics, ITMRenderState *renderState, ITMUChar4Image *outputImage, IITMVisualisationEngine::RenderImageType type, int maxSubsample,
+	float timeBudget) const
+{
+	return RenderImageProgressive_common(this, scene, pose, intrinsics, renderState, outputImage, type, maxSubsample, timeBudget);
 }
 
 template<class TVoxel, class TIndex>
@@ -459,7 +796,7 @@ void ITMVisualisationEngine_CPU<TVoxel, TIndex>::FindSurface(const ITMScene<TVox
 {
 	// this one is generally done for freeview visualisation, so no, do not
 	// update the list of visible blocks
-	GenericRaycast(scene, renderState->raycastResult->noDims, pose->GetInvM(), intrinsics->projectionParamsSimple.all, renderState, false);
+	GenericRaycast(scene, renderState->raycastResult->noDims, pose->GetInvM(), intrinsics->projectionParamsSimple.all, renderState, false, useTiledRaycast);
 }
 
 template<class TVoxel>
@@ -468,34 +805,34 @@ void ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::FindSurface(const ITM
 {
 	// this one is generally done for freeview visualisation, so no, do not
 	// update the list of visible blocks
-	GenericRaycast(scene, renderState->raycastResult->noDims, pose->GetInvM(), intrinsics->projectionParamsSimple.all, renderState, false);
+	GenericRaycast(scene, renderState->raycastResult->noDims, pose->GetInvM(), intrinsics->projectionParamsSimple.all, renderState, false, useTiledRaycast);
 }
 
 template<class TVoxel, class TIndex>
 void ITMVisualisationEngine_CPU<TVoxel,TIndex>::CreatePointCloud(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, 
 	ITMRenderState *renderState, bool skipPoints) const
 { 
-	CreatePointCloud_common(scene, view, trackingState, renderState, skipPoints);
+	CreatePointCloud_common(scene, view, trackingState, renderState, skipPoints, useTiledRaycast);
 }
 
 template<class TVoxel>
 void ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::CreatePointCloud(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene,const ITMView *view, ITMTrackingState *trackingState,
 	ITMRenderState *renderState, bool skipPoints) const
 {
-	CreatePointCloud_common(scene, view, trackingState, renderState, skipPoints);
+	CreatePointCloud_common(scene, view, trackingState, renderState, skipPoints, useTiledRaycast);
 }
 
 template<class TVoxel, class TIndex>
 void ITMVisualisationEngine_CPU<TVoxel,TIndex>::CreateICPMaps(const ITMScene<TVoxel,TIndex> *scene, const ITMView *view, ITMTrackingState *trackingState, ITMRenderState *renderState) const
 {
-	CreateICPMaps_common(scene, view, trackingState, renderState);
+	CreateICPMaps_common(scene, view, trackingState, renderState, useTiledRaycast);
 }
 
 template<class TVoxel>
 void ITMVisualisationEngine_CPU<TVoxel,ITMVoxelBlockHash>::CreateICPMaps(const ITMScene<TVoxel,ITMVoxelBlockHash> *scene, const ITMView *view, ITMTrackingState *trackingState, 
 	ITMRenderState *renderState) const
 {
-	CreateICPMaps_common(scene, view, trackingState, renderState);
+	CreateICPMaps_common(scene, view, trackingState, renderState, useTiledRaycast);
 }
 
 template<class TVoxel, class TIndex>
@@ -25,6 +25,9 @@ namespace ITMLib
     /** Override */
     virtual void CopySceneToBuffers(const ITMSurfelScene<TSurfel> *scene, float *positions, unsigned char *normals, unsigned char *colours) const;
 
+    /** Override */
+    virtual void CopySceneToPointCloud(const ITMSurfelScene<TSurfel> *scene, float *positions, float *normals, unsigned char *colours, float *radii) const;
+
     /** Override */
     virtual void CreateICPMaps(const ITMSurfelScene<TSurfel> *scene, const ITMSurfelRenderState *renderState, ITMTrackingState *trackingState) const;
 
@@ -23,17 +23,18 @@ struct ITMVisualisationEngineFactory
   /**
    * \brief Makes a visualisation engine.
    *
-   * \param deviceType  The device on which the visualisation engine should operate.
+   * \param deviceType       The device on which the visualisation engine should operate.
+   * \param useTiledRaycast  Whether a CPU engine should raycast tiles of pixels as packets of rays.
    */
   template <typename TVoxel, typename TIndex>
-  static ITMVisualisationEngine<TVoxel,TIndex> *MakeVisualisationEngine(ITMLibSettings::DeviceType deviceType)
+  static ITMVisualisationEngine<TVoxel,TIndex> *MakeVisualisationEngine(ITMLibSettings::DeviceType deviceType, bool useTiledRaycast = false)
   {
     ITMVisualisationEngine<TVoxel,TIndex> *visualisationEngine = NULL;
 
     switch(deviceType)
     {
       case ITMLibSettings::DEVICE_CPU:
-        visualisationEngine = new ITMVisualisationEngine_CPU<TVoxel,TIndex>;
+        visualisationEngine = new ITMVisualisationEngine_CPU<TVoxel,TIndex>(useTiledRaycast);
         break;
       case ITMLibSettings::DEVICE_CUDA:
 #ifndef COMPILE_WITHOUT_CUDA
@@ -63,6 +63,19 @@ namespace ITMLib
      */
     virtual void CopySceneToBuffers(const ITMSurfelScene<TSurfel> *scene, float *positions, unsigned char *normals, unsigned char *colours) const = 0;
 
+    /**
+     * \brief Copies the geometry and colours of all the surfels in the scene into property-specific buffers (these can be used for exporting the scene as a point cloud).
+     *
+     * Unlike CopySceneToBuffers, this writes the surfels' actual normals rather than colourised ones, together with their radii.
+     *
+     * \param scene     The scene.
+     * \param positions A buffer into which to write the surfels' positions.
+     * \param normals   A buffer into which to write the surfels' normals.
+     * \param colours   A buffer into which to write the surfels' colours (may be NULL).
+     * \param radii     A buffer into which to write the surfels' radii.
+     */
+    virtual void CopySceneToPointCloud(const ITMSurfelScene<TSurfel> *scene, float *positions, float *normals, unsigned char *colours, float *radii) const = 0;
+
     /**
      * \brief Copies the positions and normals of the surfels in the index image into buffers that can be passed to the ICP tracker.
      *
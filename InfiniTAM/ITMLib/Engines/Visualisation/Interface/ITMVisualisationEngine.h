@@ -7,6 +7,8 @@
 #include "../../../Objects/Tracking/ITMTrackingState.h"
 #include "../../../Objects/Views/ITMView.h"
 
+#include <climits>
+
 namespace ITMLib
 {
 	class IITMVisualisationEngine
@@ -70,7 +72,7 @@ namespace ITMLib
 		/** Given a render state, Count the number of visible blocks
 		with minBlockId <= blockID <= maxBlockId .
 		*/
-		virtual int CountVisibleBlocks(const ITMScene<TVoxel,TIndex> *scene, const ITMRenderState *renderState, int minBlockId = 0, int maxBlockId = SDF_LOCAL_BLOCK_NUM) const = 0;
+		virtual int CountVisibleBlocks(const ITMScene<TVoxel,TIndex> *scene, const ITMRenderState *renderState, int minBlockId = 0, int maxBlockId = INT_MAX) const = 0;
 
 		/** Given scene, pose and intrinsics, create an estimate
 		of the minimum and maximum depths at each pixel of
@@ -83,6 +85,35 @@ namespace ITMLib
 		virtual void RenderImage(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics,
 			const ITMRenderState *renderState, ITMUChar4Image *outputImage, RenderImageType type = RENDER_SHADED_GREYSCALE, RenderRaycastSelection raycastType = RENDER_FROM_NEW_RAYCAST) const = 0;
 
+		/** \brief
+		    Renders a freeview image that starts out coarse and is
+		    refined over the following calls for as long as the pose
+		    stays the same, for viewers that can live with a rough
+		    image while the camera moves.
+
+		    After a change of pose only every @p maxSubsample-th
+		    pixel along both axes is raycast, and the image is
+		    upsampled from those. Each call then raycasts as many of
+		    the missing pixels as fit into @p timeBudget
+		    milliseconds, finishing one level of resolution after
+		    the other. Once the image is complete, later calls
+		    raycast it again row by row, to pick up changes of the
+		    scene. The coarsest level is always completed, however
+		    long it takes, and a @p timeBudget that is not positive
+		    means no limit.
+
+		    Returns whether the image is at full resolution. This
+		    default implementation renders every image in full.
+		*/
+		virtual bool RenderImageProgressive(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics,
+			ITMRenderState *renderState, ITMUChar4Image *outputImage, RenderImageType type, int maxSubsample, float timeBudget) const
+		{
+			FindVisibleBlocks(scene, pose, intrinsics, renderState);
+			CreateExpectedDepths(scene, pose, intrinsics, renderState);
+			RenderImage(scene, pose, intrinsics, renderState, outputImage, type);
+			return true;
+		}
+
 		/** Finds the scene surface using raycasting. */
 		virtual void FindSurface(const ITMScene<TVoxel,TIndex> *scene, const ORUtils::SE3Pose *pose, const ITMIntrinsics *intrinsics,
 			const ITMRenderState *renderState) const = 0;
@@ -6,6 +6,7 @@
 
 #include "ITMSurfelVisualisationEngine_Settings.h"
 #include "../../../Objects/Scene/ITMRepresentationAccess.h"
+#include "../../../Objects/Scene/ITMSurfelScene.h"
 
 namespace ITMLib
 {
@@ -76,7 +77,7 @@ inline Vector4u colourise_normal(const Vector3f& n)
 /**
  * \brief Projects a surfel into an index image.
  *
- * \param surfel            The surfel to project.
+ * \param position          The position of the surfel to project (in global coordinates).
  * \param invT              A transformation mapping global coordinates to live 3D depth coordinates.
  * \param intrinsics        The intrinsic parameters of the depth camera.
  * \param indexImageWidth   The width of the index image.
@@ -87,15 +88,13 @@ inline Vector4u colourise_normal(const Vector3f& n)
  * \param scaledZ           An integer representation of the depth value for storage in the depth buffer.
  * \return                  true, if the surfel projected to a pixel within the bounds of the index image, or false otherwise.
  */
-template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline bool project_surfel_to_index_image(const TSurfel& surfel, const Matrix4f& invT, const ITMIntrinsics& intrinsics,
+inline bool project_surfel_to_index_image(const Vector3f& position, const Matrix4f& invT, const ITMIntrinsics& intrinsics,
                                           int indexImageWidth, int indexImageHeight, int scaleFactor,
                                           int& locId, float& z, int& scaledZ)
 {
   // Convert the surfel point into the coordinates of the current frame using v_i = T_i^{-1} v_i^g.
-  Vector3f p = surfel.position;
-  Vector4f vg(p.x, p.y, p.z, 1.0f);
+  Vector4f vg(position.x, position.y, position.z, 1.0f);
   Vector4f v = invT * vg;
 
   // If the point isn't in front of the viewer, early out.
@@ -122,6 +121,140 @@ inline bool project_surfel_to_index_image(const TSurfel& surfel, const Matrix4f&
   return true;
 }
 
+/**
+ * \brief Calculates the splat of a surfel in an index image, i.e. the region of the image that the surfel covers and the depth at which it does so.
+ *
+ * The splat covers exactly the pixels that update_depth_buffer_for_surfel and update_index_image_for_surfel would write for the surfel.
+ * When rendering surfels as points, it is the single pixel to which the surfel's centre projects.
+ *
+ * \param surfelId                    The ID of the surfel.
+ * \param surfels                     The surfels in the scene.
+ * \param invT                        A transformation mapping global coordinates to live 3D depth coordinates.
+ * \param intrinsics                  The intrinsic parameters of the depth camera.
+ * \param indexImageWidth             The width of the index image.
+ * \param indexImageHeight            The height of the index image.
+ * \param scaleFactor                 The scale factor by which the index image is supersampled with respect to the depth image.
+ * \param useRadii                    Whether or not to render each surfel as a circle rather than a point.
+ * \param unstableSurfelRenderingMode Whether to always/never render unstable surfels, or render them only if there's no stable alternative.
+ * \param stableSurfelConfidence      The confidence value a surfel must have in order for it to be considered "stable".
+ * \param unstableSurfelZOffset       The z offset to apply to unstable surfels when trying to ensure that they are only rendered if there is no stable alternative.
+ * \param cx                          The x coordinate of the pixel in the index image to which the surfel's centre projects.
+ * \param cy                          The y coordinate of the pixel in the index image to which the surfel's centre projects.
+ * \param projectedRadiusSquared      The square of the radius of the circle to use to represent the projected surfel in the index image.
+ * \param minX                        The lower x bound of the splat (clamped to the image bounds).
+ * \param minY                        The lower y bound of the splat (clamped to the image bounds).
+ * \param maxX                        The upper x bound of the splat (clamped to the image bounds).
+ * \param maxY                        The upper y bound of the splat (clamped to the image bounds).
+ * \param scaledZ                     The integer depth value to write into the depth buffer for the splat.
+ * \return                            true, if the surfel should be rendered into the index image, or false otherwise.
+ */
+template <typename TSurfel>
+_CPU_AND_GPU_CODE_TEMPLATE_
+inline bool calculate_surfel_splat(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, const Matrix4f& invT, const ITMIntrinsics& intrinsics, int indexImageWidth, int indexImageHeight,
+                                   int scaleFactor, bool useRadii, UnstableSurfelRenderingMode unstableSurfelRenderingMode, float stableSurfelConfidence,
+                                   int unstableSurfelZOffset, int& cx, int& cy, int& projectedRadiusSquared, int& minX, int& minY, int& maxX, int& maxY,
+                                   int& scaledZ)
+{
+  // Check whether the surfel is unstable. If it is, and we're not rendering unstable surfels, early out.
+  bool unstableSurfel = surfels.GetConfidence(surfelId) < stableSurfelConfidence;
+  if(unstableSurfel && unstableSurfelRenderingMode == USR_DONOTRENDER) return false;
+
+  // If the projection of the surfel falls outside the bounds of the index image, early out.
+  int locId;
+  float z;
+  if(!project_surfel_to_index_image(surfels.GetPosition(surfelId), invT, intrinsics, indexImageWidth, indexImageHeight, scaleFactor, locId, z, scaledZ)) return false;
+
+  // If the surfel's unstable and we're giving preference to stable surfels, add a z offset to ensure that
+  // it will only be rendered if there's no stable alternative along the same ray.
+  if(unstableSurfel && unstableSurfelRenderingMode == USR_FAUTEDEMIEUX) scaledZ += unstableSurfelZOffset;
+
+  if(useRadii)
+  {
+    calculate_projected_surfel_bounds(
+      locId, indexImageWidth, indexImageHeight, intrinsics, surfels.GetRadius(surfelId), z,
+      cx, cy, projectedRadiusSquared, minX, minY, maxX, maxY
+    );
+  }
+  else
+  {
+    cx = minX = maxX = locId % indexImageWidth;
+    cy = minY = maxY = locId / indexImageWidth;
+    projectedRadiusSquared = 0;
+  }
+
+  return true;
+}
+
+/**
+ * \brief Calculates the planes bounding the region of space whose points project into an index image (see project_surfel_to_index_image).
+ *
+ * A point is in the region if it is on the non-negative side of all of the planes. The planes are widened by a pixel on each side,
+ * so that no point that projects into the index image is missed due to rounding.
+ *
+ * \param invT              A transformation mapping global coordinates to live 3D depth coordinates.
+ * \param intrinsics        The intrinsic parameters of the depth camera.
+ * \param indexImageWidth   The width of the index image.
+ * \param indexImageHeight  The height of the index image.
+ * \param scaleFactor       The scale factor by which the index image is supersampled with respect to the depth image.
+ * \param planes            An array of 5 planes (in global coordinates) into which to store the result.
+ */
+_CPU_AND_GPU_CODE_
+inline void calculate_index_image_frustum(const Matrix4f& invT, const ITMIntrinsics& intrinsics, int indexImageWidth, int indexImageHeight, int scaleFactor,
+                                          Vector4f *planes)
+{
+  const float fx = intrinsics.projectionParamsSimple.fx, fy = intrinsics.projectionParamsSimple.fy;
+  const float px = intrinsics.projectionParamsSimple.px, py = intrinsics.projectionParamsSimple.py;
+
+  // Calculate the bounds of the image coordinates that round to pixels within the index image, with a pixel to spare.
+  const float minU = -2.5f / scaleFactor, maxU = (indexImageWidth + 0.5f) / scaleFactor;
+  const float minV = -2.5f / scaleFactor, maxV = (indexImageHeight + 0.5f) / scaleFactor;
+
+  // Calculate the planes in live 3D depth coordinates: in front of the camera, and between the image bounds.
+  Vector4f cameraPlanes[5] = {
+    Vector4f(0.0f, 0.0f, 1.0f, 0.0f),
+    Vector4f(fx, 0.0f, px - minU, 0.0f),
+    Vector4f(-fx, 0.0f, maxU - px, 0.0f),
+    Vector4f(0.0f, fy, py - minV, 0.0f),
+    Vector4f(0.0f, -fy, maxV - py, 0.0f)
+  };
+
+  // Transform the planes into global coordinates.
+  for(int i = 0; i < 5; ++i)
+  {
+    const Vector4f& c = cameraPlanes[i];
+    for(int j = 0; j < 4; ++j)
+    {
+      planes[i][j] = c.x * invT.m[j * 4] + c.y * invT.m[j * 4 + 1] + c.z * invT.m[j * 4 + 2] + c.w * invT.m[j * 4 + 3];
+    }
+  }
+}
+
+/**
+ * \brief Determines whether any of the surfels in a block of the scene's spatial index could project into an index image.
+ *
+ * \param bounds  The bounding box of the positions of the surfels in the block.
+ * \param planes  The planes bounding the region of space whose points project into the index image (see calculate_index_image_frustum).
+ * \return        false, if the bounding box is entirely outside the region, or true otherwise.
+ */
+_CPU_AND_GPU_CODE_
+inline bool surfel_block_intersects_frustum(const ITMSurfelBlockBounds& bounds, const Vector4f *planes)
+{
+  for(int i = 0; i < 5; ++i)
+  {
+    // Test the corner of the bounding box that is furthest along the plane's normal.
+    const Vector4f& plane = planes[i];
+    Vector3f corner(
+      plane.x >= 0.0f ? bounds.maxPos.x : bounds.minPos.x,
+      plane.y >= 0.0f ? bounds.maxPos.y : bounds.minPos.y,
+      plane.z >= 0.0f ? bounds.maxPos.z : bounds.minPos.z
+    );
+
+    if(plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.0f) return false;
+  }
+
+  return true;
+}
+
 //#################### MAIN FUNCTIONS ####################
 
 /**
@@ -149,10 +282,10 @@ inline void clear_surfel_index_image(int locId, unsigned int *surfelIndexImage,
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline void copy_correspondences_to_buffers(int surfelId, const TSurfel *surfels, float *newPositions, float *oldPositions, float *correspondences)
+inline void copy_correspondences_to_buffers(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, float *newPositions, float *oldPositions, float *correspondences)
 {
 #if DEBUG_CORRESPONDENCES
-  TSurfel surfel = surfels[surfelId];
+  TSurfel surfel = surfels.Get(surfelId);
   Vector3f np = surfel.newPosition;
   Vector3f op = surfel.oldPosition;
 
@@ -188,7 +321,7 @@ inline void copy_correspondences_to_buffers(int surfelId, const TSurfel *surfels
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline void copy_surfel_data_to_icp_maps(int locId, const TSurfel *surfels, const unsigned int *surfelIndexImage, const Matrix4f& invT,
+inline void copy_surfel_data_to_icp_maps(int locId, const ITMConstSurfelArray<TSurfel>& surfels, const unsigned int *surfelIndexImage, const Matrix4f& invT,
                                          float trackingSurfelMaxDepth, float trackingSurfelMinConfidence, Vector4f *pointsMap, Vector4f *normalsMap)
 {
   int surfelIndex = surfelIndexImage[locId] - 1;
@@ -196,14 +329,14 @@ inline void copy_surfel_data_to_icp_maps(int locId, const TSurfel *surfels, cons
   // If the specified raster position in the index image refers to a valid surfel:
   if(surfelIndex >= 0)
   {
-    TSurfel surfel = surfels[surfelIndex];
-    const Vector3f& p = surfel.position;
-    const Vector3f& n = surfel.normal;
+    const Vector3f p = surfels.GetPosition(surfelIndex);
 
     // If the surfel is sufficiently close to the camera and has a sufficiently high confidence value:
     Vector3f v = transform_point(invT, p);
-    if(v.z <= trackingSurfelMaxDepth || surfel.confidence >= trackingSurfelMinConfidence)
+    if(v.z <= trackingSurfelMaxDepth || surfels.GetConfidence(surfelIndex) >= trackingSurfelMinConfidence)
     {
+      const Vector3f n = surfels.GetNormal(surfelIndex);
+
       // Write the surfel's position and normal into the buffers.
       pointsMap[locId] = Vector4f(p.x, p.y, p.z, 1.0f);
       normalsMap[locId] = Vector4f(n.x, n.y, n.z, 0.0f);
@@ -229,30 +362,66 @@ inline void copy_surfel_data_to_icp_maps(int locId, const TSurfel *surfels, cons
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-inline void copy_surfel_to_buffers(int surfelId, const TSurfel *surfels, float *positions, unsigned char *normals, unsigned char *colours)
+inline void copy_surfel_to_buffers(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, float *positions, unsigned char *normals, unsigned char *colours)
 {
-  TSurfel surfel = surfels[surfelId];
   int offset = surfelId * 3;
 
-  Vector3f p = surfel.position;
+  Vector3f p = surfels.GetPosition(surfelId);
   positions[offset] = p.x;
   positions[offset+1] = p.y;
   positions[offset+2] = p.z;
 
-  Vector4u n = colourise_normal(surfel.normal);
+  Vector4u n = colourise_normal(surfels.GetNormal(surfelId));
   normals[offset] = n.x;
   normals[offset+1] = n.y;
   normals[offset+2] = n.z;
 
   if(colours != NULL)
   {
-    Vector3u c = SurfelColourManipulator<TSurfel::hasColourInformation>::read(surfel);
+    Vector3u c = surfels.GetColour(surfelId);
     colours[offset] = c.r;
     colours[offset+1] = c.g;
     colours[offset+2] = c.b;
   }
 }
 
+/**
+ * \brief Copies a surfel's geometry and colour into property-specific buffers (these can be used for exporting the surfel scene as a point cloud).
+ *
+ * \param surfelId  The ID of the surfel whose information is to be copied.
+ * \param surfels   The surfels in the scene.
+ * \param positions A buffer into which to write the surfel's position.
+ * \param normals   A buffer into which to write the surfel's normal.
+ * \param colours   A buffer into which to write the surfel's colour (may be NULL).
+ * \param radii     A buffer into which to write the surfel's radius.
+ */
+template <typename TSurfel>
+_CPU_AND_GPU_CODE_
+inline void copy_surfel_to_point_cloud(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, float *positions, float *normals, unsigned char *colours, float *radii)
+{
+  int offset = surfelId * 3;
+
+  Vector3f p = surfels.GetPosition(surfelId);
+  positions[offset] = p.x;
+  positions[offset+1] = p.y;
+  positions[offset+2] = p.z;
+
+  Vector3f n = surfels.GetNormal(surfelId);
+  normals[offset] = n.x;
+  normals[offset+1] = n.y;
+  normals[offset+2] = n.z;
+
+  if(colours != NULL)
+  {
+    Vector3u c = surfels.GetColour(surfelId);
+    colours[offset] = c.r;
+    colours[offset+1] = c.g;
+    colours[offset+2] = c.b;
+  }
+
+  radii[surfelId] = surfels.GetRadius(surfelId);
+}
+
 /**
  * \brief Writes the colour of the surfel at a particular raster position in the index image to an output image.
  *
@@ -263,14 +432,14 @@ inline void copy_surfel_to_buffers(int surfelId, const TSurfel *surfels, float *
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-void shade_pixel_colour(int locId, const unsigned int *surfelIndexImage, const TSurfel *surfels, Vector4u *outputImage)
+void shade_pixel_colour(int locId, const unsigned int *surfelIndexImage, const ITMConstSurfelArray<TSurfel>& surfels, Vector4u *outputImage)
 {
   Vector4u col4(0, 255, 255, 255);
 
   int surfelIndex = surfelIndexImage[locId] - 1;
   if(surfelIndex >= 0)
   {
-    Vector3u col3 = SurfelColourManipulator<TSurfel::hasColourInformation>::read(surfels[surfelIndex]);
+    Vector3u col3 = surfels.GetColour(surfelIndex);
     col4 = Vector4u(col3.x, col3.y, col3.z, 255);
   }
 
@@ -288,14 +457,14 @@ void shade_pixel_colour(int locId, const unsigned int *surfelIndexImage, const T
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-void shade_pixel_confidence(int locId, const unsigned int *surfelIndexImage, const TSurfel *surfels, float stableSurfelConfidence, Vector4u *outputImage)
+void shade_pixel_confidence(int locId, const unsigned int *surfelIndexImage, const ITMConstSurfelArray<TSurfel>& surfels, float stableSurfelConfidence, Vector4u *outputImage)
 {
   Vector4u col4(0, 0, 0, 255);
 
   int surfelIndex = surfelIndexImage[locId] - 1;
   if(surfelIndex >= 0)
   {
-    float confidence = surfels[surfelIndex].confidence;
+    float confidence = surfels.GetConfidence(surfelIndex);
     if(confidence > stableSurfelConfidence) confidence = stableSurfelConfidence;
 
     // Colourise the surfel's confidence value (red = unstable, green = stable).
@@ -317,7 +486,7 @@ void shade_pixel_confidence(int locId, const unsigned int *surfelIndexImage, con
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-void shade_pixel_depth(int locId, const unsigned int *surfelIndexImage, const TSurfel *surfels, const Vector3f& cameraPosition,
+void shade_pixel_depth(int locId, const unsigned int *surfelIndexImage, const ITMConstSurfelArray<TSurfel>& surfels, const Vector3f& cameraPosition,
                        float *outputImage)
 {
   // FIXME: This should be set to a less arbitrary value.
@@ -326,7 +495,7 @@ void shade_pixel_depth(int locId, const unsigned int *surfelIndexImage, const TS
   int surfelIndex = surfelIndexImage[locId] - 1;
   if(surfelIndex >= 0)
   {
-    Vector3f p = surfels[surfelIndex].position;
+    Vector3f p = surfels.GetPosition(surfelIndex);
     float dx = fabs(cameraPosition.x - p.x);
     float dy = fabs(cameraPosition.y - p.y);
     float dz = fabs(cameraPosition.z - p.z);
@@ -349,7 +518,7 @@ void shade_pixel_depth(int locId, const unsigned int *surfelIndexImage, const TS
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-void shade_pixel_grey(int locId, const unsigned int *surfelIndexImage, const TSurfel *surfels, const Vector3f& lightPos, const Vector3f& viewerPos,
+void shade_pixel_grey(int locId, const unsigned int *surfelIndexImage, const ITMConstSurfelArray<TSurfel>& surfels, const Vector3f& lightPos, const Vector3f& viewerPos,
                       SurfelLightingType lightingType, Vector4u *outputImage)
 {
   const float ambient = lightingType == SLT_PHONG ? 0.3f : 0.2f;
@@ -362,11 +531,11 @@ void shade_pixel_grey(int locId, const unsigned int *surfelIndexImage, const TSu
   int surfelIndex = surfelIndexImage[locId] - 1;
   if(surfelIndex >= 0)
   {
-    TSurfel surfel = surfels[surfelIndex];
+    const Vector3f p = surfels.GetPosition(surfelIndex);
 
     // Calculate the Lambertian lighting term.
-    Vector3f L = normalize(lightPos - surfel.position);
-    Vector3f N = surfel.normal;
+    Vector3f L = normalize(lightPos - p);
+    Vector3f N = surfels.GetNormal(surfelIndex);
     float NdotL = ORUtils::dot(N, L);
     float lambertian = CLAMP(NdotL, 0.0f, 1.0f);
 
@@ -378,7 +547,7 @@ void shade_pixel_grey(int locId, const unsigned int *surfelIndexImage, const TSu
     {
       // Calculate the Phong lighting term.
       Vector3f R = 2.0f * N * NdotL - L;
-      Vector3f V = normalize(viewerPos - surfel.position);
+      Vector3f V = normalize(viewerPos - p);
       float phong = pow(CLAMP(dot(R,V), 0.0f, 1.0f), phongExponent);
 
       // Add the Phong lighting term to the intensity.
@@ -402,14 +571,14 @@ void shade_pixel_grey(int locId, const unsigned int *surfelIndexImage, const TSu
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_
-void shade_pixel_normal(int locId, const unsigned int *surfelIndexImage, const TSurfel *surfels, Vector4u *outputImage)
+void shade_pixel_normal(int locId, const unsigned int *surfelIndexImage, const ITMConstSurfelArray<TSurfel>& surfels, Vector4u *outputImage)
 {
   Vector4u value((uchar)0);
 
   int surfelIndex = surfelIndexImage[locId] - 1;
   if(surfelIndex >= 0)
   {
-    value = colourise_normal(surfels[surfelIndex].normal);
+    value = colourise_normal(surfels.GetNormal(surfelIndex));
   }
 
   outputImage[locId] = value;
@@ -437,21 +606,19 @@ void shade_pixel_normal(int locId, const unsigned int *surfelIndexImage, const T
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_TEMPLATE_
-inline void update_depth_buffer_for_surfel(int surfelId, const TSurfel *surfels, const Matrix4f& invT, const ITMIntrinsics& intrinsics,
+inline void update_depth_buffer_for_surfel(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, const Matrix4f& invT, const ITMIntrinsics& intrinsics,
                                            int indexImageWidth, int indexImageHeight, int scaleFactor, bool useRadii,
                                            UnstableSurfelRenderingMode unstableSurfelRenderingMode, float stableSurfelConfidence,
                                            int unstableSurfelZOffset, int *depthBuffer)
 {
-  const TSurfel surfel = surfels[surfelId];
-
   // Check whether the surfel is unstable. If it is, and we're not rendering unstable surfels, early out.
-  bool unstableSurfel = surfel.confidence < stableSurfelConfidence;
+  bool unstableSurfel = surfels.GetConfidence(surfelId) < stableSurfelConfidence;
   if(unstableSurfel && unstableSurfelRenderingMode == USR_DONOTRENDER) return;
 
   // If the projection of the surfel falls within the bounds of the index image:
   int locId, scaledZ;
   float z;
-  if(project_surfel_to_index_image(surfel, invT, intrinsics, indexImageWidth, indexImageHeight, scaleFactor, locId, z, scaledZ))
+  if(project_surfel_to_index_image(surfels.GetPosition(surfelId), invT, intrinsics, indexImageWidth, indexImageHeight, scaleFactor, locId, z, scaledZ))
   {
     // If the surfel's unstable and we're giving preference to stable surfels, add a z offset to ensure that
     // it will only be rendered if there's no stable alternative along the same ray.
@@ -463,7 +630,7 @@ inline void update_depth_buffer_for_surfel(int surfelId, const TSurfel *surfels,
       // surfel and its bounds within the index image.
       int cx, cy, minX, minY, maxX, maxY, projectedRadiusSquared;
       calculate_projected_surfel_bounds(
-        locId, indexImageWidth, indexImageHeight, intrinsics, surfel.radius, z,
+        locId, indexImageWidth, indexImageHeight, intrinsics, surfels.GetRadius(surfelId), z,
         cx, cy, projectedRadiusSquared, minX, minY, maxX, maxY
       );
 
@@ -484,7 +651,7 @@ inline void update_depth_buffer_for_surfel(int surfelId, const TSurfel *surfels,
 #if defined(__CUDACC__) && defined(__CUDA_ARCH__)
           atomicMin(&depthBuffer[offset], scaledZ);
 #else
-          // Note: No synchronisation is needed for the CPU version because it's not parallelised.
+          // Note: The CPU version does not use this function, so no synchronisation is needed here.
           if(scaledZ < depthBuffer[offset]) depthBuffer[offset] = scaledZ;
 #endif
         }
@@ -496,7 +663,7 @@ inline void update_depth_buffer_for_surfel(int surfelId, const TSurfel *surfels,
 #if defined(__CUDACC__) && defined(__CUDA_ARCH__)
       atomicMin(&depthBuffer[locId], scaledZ);
 #else
-      // Note: No synchronisation is needed for the CPU version because it's not parallelised.
+      // Note: The CPU version does not use this function, so no synchronisation is needed here.
       if(scaledZ < depthBuffer[locId]) depthBuffer[locId] = scaledZ;
 #endif
     }
@@ -522,21 +689,19 @@ inline void update_depth_buffer_for_surfel(int surfelId, const TSurfel *surfels,
  */
 template <typename TSurfel>
 _CPU_AND_GPU_CODE_TEMPLATE_
-inline void update_index_image_for_surfel(int surfelId, const TSurfel *surfels, const Matrix4f& invT, const ITMIntrinsics& intrinsics,
+inline void update_index_image_for_surfel(int surfelId, const ITMConstSurfelArray<TSurfel>& surfels, const Matrix4f& invT, const ITMIntrinsics& intrinsics,
                                           int indexImageWidth, int indexImageHeight, int scaleFactor, const int *depthBuffer, bool useRadii,
                                           UnstableSurfelRenderingMode unstableSurfelRenderingMode, float stableSurfelConfidence,
                                           int unstableSurfelZOffset, unsigned int *surfelIndexImage)
 {
-  const TSurfel surfel = surfels[surfelId];
-
   // Check whether the surfel is unstable. If it is, and we're not rendering unstable surfels, early out.
-  bool unstableSurfel = surfel.confidence < stableSurfelConfidence;
+  bool unstableSurfel = surfels.GetConfidence(surfelId) < stableSurfelConfidence;
   if(unstableSurfel && unstableSurfelRenderingMode == USR_DONOTRENDER) return;
 
   // If the projection of the surfel falls within the bounds of the index image:
   int locId, scaledZ;
   float z;
-  if(project_surfel_to_index_image(surfel, invT, intrinsics, indexImageWidth, indexImageHeight, scaleFactor, locId, z, scaledZ))
+  if(project_surfel_to_index_image(surfels.GetPosition(surfelId), invT, intrinsics, indexImageWidth, indexImageHeight, scaleFactor, locId, z, scaledZ))
   {
     // If the surfel's unstable and we're giving preference to stable surfels, add a z offset to ensure that
     // it will only be rendered if there's no stable alternative along the same ray.
@@ -550,7 +715,7 @@ inline void update_index_image_for_surfel(int surfelId, const TSurfel *surfels,
       // surfel and its bounds within the index image.
       int cx, cy, minX, minY, maxX, maxY, projectedRadiusSquared;
       calculate_projected_surfel_bounds(
-        locId, indexImageWidth, indexImageHeight, intrinsics, surfel.radius, z,
+        locId, indexImageWidth, indexImageHeight, intrinsics, surfels.GetRadius(surfelId), z,
         cx, cy, projectedRadiusSquared, minX, minY, maxX, maxY
       );
 
@@ -573,7 +738,7 @@ inline void update_index_image_for_surfel(int surfelId, const TSurfel *surfels,
 #if defined(__CUDACC__) && defined(__CUDA_ARCH__)
             atomicMax(&surfelIndexImage[offset], surfelIdPlusOne);
 #else
-            // Note: No synchronisation is needed for the CPU version because it's not parallelised.
+            // Note: The CPU version does not use this function, so no synchronisation is needed here.
             if(surfelIdPlusOne > surfelIndexImage[offset]) surfelIndexImage[offset] = surfelIdPlusOne;
 #endif
           }
@@ -588,7 +753,7 @@ inline void update_index_image_for_surfel(int surfelId, const TSurfel *surfels,
 #if defined(__CUDACC__) && defined(__CUDA_ARCH__)
         atomicMax(&surfelIndexImage[locId], surfelIdPlusOne);
 #else
-        // Note: No synchronisation is needed for the CPU version because it's not parallelised.
+        // Note: The CPU version does not use this function, so no synchronisation is needed here.
         if(surfelIdPlusOne > surfelIndexImage[locId]) surfelIndexImage[locId] = surfelIdPlusOne;
 #endif
       }
@@ -98,18 +98,97 @@ _CPU_AND_GPU_CODE_ inline void CreateRenderingBlocks(DEVICEPTR(RenderingBlock) *
 
 #endif
 
-template<class TVoxel, class TIndex, bool modifyVisibleEntries>
-_CPU_AND_GPU_CODE_ inline bool castRay(DEVICEPTR(Vector4f) &pt_out, DEVICEPTR(uchar) *entriesVisibleType, 
-	int x, int y, const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(typename TIndex::IndexData) *voxelIndex, 
-	Matrix4f invM, Vector4f invProjParams, float oneOverVoxelSize, float mu, const CONSTPTR(Vector2f) & viewFrustum_minmax)
+/** \brief
+    How far a ray at @p point (in voxels) can walk through the
+    children of size @p childSize of an occupancy cell, with a
+    3D-DDA on the cell's occupancy bits, before it enters an
+    occupied child or leaves the cell. The cell's lower corner
+    is @p cellCorner, and @p childPos is the child the ray is in.
+*/
+_CPU_AND_GPU_CODE_ inline float occupancyCellSkipLength(const THREADPTR(Vector3f) & point, const THREADPTR(Vector3f) & rayDirection,
+	const THREADPTR(Vector3f) & invRayDirection, const THREADPTR(Vector3f) & cellCorner, float childSize, const THREADPTR(uint) *mask,
+	Vector3i childPos)
 {
-	Vector4f pt_camera_f; Vector3f pt_block_s, pt_block_e, rayDirection, pt_result;
-	bool pt_found;
-	int vmIndex;
-	float sdfValue = 1.0f, confidence;
-	float totalLength, stepLength, totalLengthMax, stepScale;
+	// an empty cell is left in one go, as if it were a single child
+	int noChildren = OCCUPANCY_CELL_SIZE;
+	if (mask[0] == 0 && mask[1] == 0) { childSize *= OCCUPANCY_CELL_SIZE; noChildren = 1; childPos = Vector3i(0, 0, 0); }
 
-	stepScale = mu * oneOverVoxelSize;
+	Vector3i childStep; Vector3f nextLength, deltaLength;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (rayDirection[axis] > 0.0f)
+		{
+			childStep[axis] = 1; deltaLength[axis] = childSize * invRayDirection[axis];
+			nextLength[axis] = (cellCorner[axis] + (childPos[axis] + 1) * childSize - point[axis]) * invRayDirection[axis];
+		}
+		else if (rayDirection[axis] < 0.0f)
+		{
+			childStep[axis] = -1; deltaLength[axis] = -childSize * invRayDirection[axis];
+			nextLength[axis] = (cellCorner[axis] + childPos[axis] * childSize - point[axis]) * invRayDirection[axis];
+		}
+		else { childStep[axis] = 0; deltaLength[axis] = 0.0f; nextLength[axis] = FAR_AWAY; }
+	}
+
+	while (true)
+	{
+		int axis = nextLength.x < nextLength.y ? (nextLength.x < nextLength.z ? 0 : 2) : (nextLength.y < nextLength.z ? 1 : 2);
+
+		// step just past the boundary, so that the next lookup lands in the next child
+		float skipLength = MAX(nextLength[axis], 0.0f) + 0.01f;
+
+		childPos[axis] += childStep[axis];
+		if (childPos[axis] < 0 || childPos[axis] >= noChildren) return skipLength;
+		if (isOccupancyBitSet(mask, occupancyBitIndex(childPos))) return skipLength;
+
+		nextLength[axis] += deltaLength[axis];
+	}
+}
+
+/** \brief
+    How far a ray at @p point (in voxels) can leap through empty
+    space, using the two levels of the block occupancy pyramid,
+    or zero if its block is allocated and has to be read. With
+    @p isBlockEmpty, the caller has found the block unallocated
+    already, and the ray leaps on regardless of its bit.
+*/
+_CPU_AND_GPU_CODE_ inline float emptySpaceSkipLength(const CONSTPTR(ITMBlockOccupancyCell) *occupancy, const THREADPTR(Vector3f) & point,
+	const THREADPTR(Vector3f) & rayDirection, const THREADPTR(Vector3f) & invRayDirection, bool isBlockEmpty)
+{
+	const int cellSize = SDF_BLOCK_SIZE * OCCUPANCY_CELL_SIZE;
+
+	// the same voxel and block the SDF reads would look at
+	Vector3i voxelPos = TO_INT_ROUND3(point), blockPos, cellPos, superCellPos;
+	pointToVoxelBlockPos(voxelPos, blockPos);
+	occupancyParentPos(blockPos, cellPos);
+	occupancyParentPos(cellPos, superCellPos);
+
+	uint mask[2];
+	readOccupancyMask(occupancy, superCellPos, 2, mask);
+	Vector3i childPos = cellPos - superCellPos * OCCUPANCY_CELL_SIZE;
+
+	// voxel v covers the points within half a voxel of it, so the cells start half a voxel below their first voxel
+	if (!isOccupancyBitSet(mask, occupancyBitIndex(childPos)))
+		return occupancyCellSkipLength(point, rayDirection, invRayDirection, TO_FLOAT3(superCellPos * (cellSize * OCCUPANCY_CELL_SIZE)) - Vector3f(0.5f),
+			(float)cellSize, mask, childPos);
+
+	readOccupancyMask(occupancy, cellPos, 1, mask);
+	childPos = blockPos - cellPos * OCCUPANCY_CELL_SIZE;
+	if (!isBlockEmpty && isOccupancyBitSet(mask, occupancyBitIndex(childPos))) return 0.0f;
+
+	return occupancyCellSkipLength(point, rayDirection, invRayDirection, TO_FLOAT3(cellPos * cellSize) - Vector3f(0.5f),
+		(float)SDF_BLOCK_SIZE, mask, childPos);
+}
+
+/** \brief
+    Sets up the ray through pixel (x, y): its start point and
+    direction in voxels, and the length at which it starts and
+    ends, given the depth range of the pixel.
+*/
+_CPU_AND_GPU_CODE_ inline void initRay(THREADPTR(Vector3f) &pt_result, THREADPTR(Vector3f) &rayDirection, THREADPTR(float) &totalLength,
+	THREADPTR(float) &totalLengthMax, int x, int y, const THREADPTR(Matrix4f) &invM, const THREADPTR(Vector4f) &invProjParams,
+	float oneOverVoxelSize, const CONSTPTR(Vector2f) & viewFrustum_minmax)
+{
+	Vector4f pt_camera_f; Vector3f pt_block_s, pt_block_e;
 
 	pt_camera_f.z = viewFrustum_minmax.x;
 	pt_camera_f.x = pt_camera_f.z * ((float(x) + invProjParams.z) * invProjParams.x);
@@ -130,30 +209,65 @@ _CPU_AND_GPU_CODE_ inline bool castRay(DEVICEPTR(Vector4f) &pt_out, DEVICEPTR(uc
 	rayDirection *= direction_norm;
 
 	pt_result = pt_block_s;
+}
 
-	typename TIndex::IndexCache cache;
+/** \brief
+    Takes one step of a ray: reads the SDF at the ray's point
+    and moves the point on by the distance that is safe to
+    skip. Returns false, leaving the point where it is, once
+    the ray has crossed the surface.
+*/
+template<class TVoxel, class TIndex, bool modifyVisibleEntries, class TCache>
+_CPU_AND_GPU_CODE_ inline bool marchRay(THREADPTR(Vector3f) &pt_result, THREADPTR(float) &totalLength, THREADPTR(float) &sdfValue,
+	THREADPTR(bool) &isSkipping, const THREADPTR(Vector3f) &rayDirection, const THREADPTR(Vector3f) &invRayDirection, float stepScale,
+	DEVICEPTR(uchar) *entriesVisibleType, const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(typename TIndex::IndexData) *voxelIndex,
+	const CONSTPTR(ITMBlockOccupancyCell) *occupancy, THREADPTR(TCache) &cache)
+{
+	float stepLength;
+	int vmIndex;
 
-	while (totalLength < totalLengthMax) {
-		sdfValue = readFromSDF_float_uninterpolated(voxelData, voxelIndex, pt_result, vmIndex, cache);
+	if (isSkipping)
+	{
+		stepLength = emptySpaceSkipLength(occupancy, pt_result, rayDirection, invRayDirection, false);
+		if (stepLength > 0.0f) { pt_result += stepLength * rayDirection; totalLength += stepLength; return true; }
+		isSkipping = false;
+	}
 
-		if (modifyVisibleEntries)
-		{
-			if (vmIndex) entriesVisibleType[vmIndex - 1] = 1;
-		}
+	sdfValue = readFromSDF_float_uninterpolated(voxelData, voxelIndex, pt_result, vmIndex, cache);
 
-		if (!vmIndex) {
-			stepLength = SDF_BLOCK_SIZE;
-		} else {
-			if ((sdfValue <= 0.1f) && (sdfValue >= -0.5f)) {
-				sdfValue = readFromSDF_float_interpolated(voxelData, voxelIndex, pt_result, vmIndex, cache);
-			}
-			if (sdfValue <= 0.0f) break;
-			stepLength = MAX(sdfValue * stepScale, 1.0f);
-		}
+	if (modifyVisibleEntries)
+	{
+		if (vmIndex) entriesVisibleType[vmIndex - 1] = 1;
+	}
 
-		pt_result += stepLength * rayDirection; totalLength += stepLength;
+	if (!vmIndex) {
+		if (occupancy != NULL) { isSkipping = true; stepLength = emptySpaceSkipLength(occupancy, pt_result, rayDirection, invRayDirection, true); }
+		else stepLength = SDF_BLOCK_SIZE;
+	} else {
+		if ((sdfValue <= 0.1f) && (sdfValue >= -0.5f)) {
+			sdfValue = readFromSDF_float_interpolated(voxelData, voxelIndex, pt_result, vmIndex, cache);
+		}
+		if (sdfValue <= 0.0f) return false;
+		stepLength = MAX(sdfValue * stepScale, 1.0f);
 	}
 
+	pt_result += stepLength * rayDirection; totalLength += stepLength;
+	return true;
+}
+
+/** \brief
+    Writes the result of a ray that has stopped marching with
+    the given SDF value: if the value is not positive, the ray
+    has crossed the surface, and its point is moved onto it.
+*/
+template<class TVoxel, class TIndex, class TCache>
+_CPU_AND_GPU_CODE_ inline bool finishRay(DEVICEPTR(Vector4f) &pt_out, Vector3f pt_result, float sdfValue, const THREADPTR(Vector3f) &rayDirection,
+	float stepScale, const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(typename TIndex::IndexData) *voxelIndex, THREADPTR(TCache) &cache)
+{
+	float stepLength, confidence;
+	int vmIndex;
+	bool pt_found;
+
 	if (sdfValue <= 0.0f)
 	{
 		stepLength = sdfValue * stepScale;
@@ -173,6 +287,49 @@ _CPU_AND_GPU_CODE_ inline bool castRay(DEVICEPTR(Vector4f) &pt_out, DEVICEPTR(uc
 	return pt_found;
 }
 
+/** \brief
+    Casts the ray through pixel (x, y) until it crosses the
+    surface. With an @p occupancy map, see ITMBlockOccupancy,
+    the ray leaps over runs of unallocated blocks rather than
+    stepping through them one block length at a time.
+
+    Blocks are looked up through @p cache, which may be kept
+    from one ray to the next for as long as the hash does not
+    change.
+*/
+template<class TVoxel, class TIndex, bool modifyVisibleEntries, class TCache>
+_CPU_AND_GPU_CODE_ inline bool castRay(DEVICEPTR(Vector4f) &pt_out, DEVICEPTR(uchar) *entriesVisibleType, 
+	int x, int y, const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(typename TIndex::IndexData) *voxelIndex, 
+	Matrix4f invM, Vector4f invProjParams, float oneOverVoxelSize, float mu, const CONSTPTR(Vector2f) & viewFrustum_minmax,
+	const CONSTPTR(ITMBlockOccupancyCell) *occupancy, THREADPTR(TCache) &cache)
+{
+	Vector3f pt_result, rayDirection;
+	float sdfValue = 1.0f, totalLength, totalLengthMax, stepScale = mu * oneOverVoxelSize;
+
+	initRay(pt_result, rayDirection, totalLength, totalLengthMax, x, y, invM, invProjParams, oneOverVoxelSize, viewFrustum_minmax);
+
+	Vector3f invRayDirection(1.0f / rayDirection.x, 1.0f / rayDirection.y, 1.0f / rayDirection.z);
+	bool isSkipping = false;
+
+	while (totalLength < totalLengthMax) {
+		if (!marchRay<TVoxel, TIndex, modifyVisibleEntries>(pt_result, totalLength, sdfValue, isSkipping, rayDirection, invRayDirection, stepScale,
+			entriesVisibleType, voxelData, voxelIndex, occupancy, cache)) break;
+	}
+
+	return finishRay<TVoxel, TIndex>(pt_out, pt_result, sdfValue, rayDirection, stepScale, voxelData, voxelIndex, cache);
+}
+
+template<class TVoxel, class TIndex, bool modifyVisibleEntries>
+_CPU_AND_GPU_CODE_ inline bool castRay(DEVICEPTR(Vector4f) &pt_out, DEVICEPTR(uchar) *entriesVisibleType, 
+	int x, int y, const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(typename TIndex::IndexData) *voxelIndex, 
+	Matrix4f invM, Vector4f invProjParams, float oneOverVoxelSize, float mu, const CONSTPTR(Vector2f) & viewFrustum_minmax,
+	const CONSTPTR(ITMBlockOccupancyCell) *occupancy = NULL)
+{
+	typename TIndex::IndexCache cache;
+	return castRay<TVoxel, TIndex, modifyVisibleEntries>(pt_out, entriesVisibleType, x, y, voxelData, voxelIndex, invM, invProjParams,
+		oneOverVoxelSize, mu, viewFrustum_minmax, occupancy, cache);
+}
+
 _CPU_AND_GPU_CODE_ inline int forwardProjectPixel(Vector4f pixel, const CONSTPTR(Matrix4f) &M, const CONSTPTR(Vector4f) &projParams,
 	const THREADPTR(Vector2i) &imgSize)
 {
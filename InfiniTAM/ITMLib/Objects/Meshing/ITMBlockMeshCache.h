@@ -0,0 +1,66 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "ITMMesh.h"
+
+#include <map>
+#include <vector>
+
+namespace ITMLib
+{
+	/** \brief
+	    Keeps the mesh of every voxel block of a scene
+	    separately, so that a live view of the scene can be
+	    updated by re-extracting just the blocks that changed,
+	    see ITMMeshingEngine::UpdateMesh.
+
+	    Blocks are identified by their hash entry. Vertices are
+	    shared within a block but not between blocks.
+	*/
+	class ITMBlockMeshCache
+	{
+	public:
+		struct BlockMesh
+		{
+			Vector3s blockPos;
+			std::vector<Vector3f> vertices;
+			std::vector<Vector3u> colours;
+			std::vector<uint> indices;
+
+			BlockMesh(void) : blockPos((short)0) {}
+		};
+
+		/** Hash entries whose block meshes were added, changed or removed by an update. */
+		struct Delta
+		{
+			std::vector<int> added, changed, removed;
+
+			void Clear(void) { added.clear(); changed.clear(); removed.clear(); }
+		};
+
+		/** The meshes of all blocks with at least one triangle, ordered by hash entry. */
+		std::map<int, BlockMesh> blocks;
+
+		void Clear(void) { blocks.clear(); }
+
+		/** Replaces the contents of the mesh with all the block meshes in the cache. */
+		void GetMesh(ITMMesh *mesh) const
+		{
+			mesh->Clear();
+
+			for (std::map<int, BlockMesh>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+			{
+				const BlockMesh &blockMesh = it->second;
+				uint firstVertex = mesh->GetNoVertices();
+
+				mesh->vertices.insert(mesh->vertices.end(), blockMesh.vertices.begin(), blockMesh.vertices.end());
+				mesh->colours.insert(mesh->colours.end(), blockMesh.colours.begin(), blockMesh.colours.end());
+				for (size_t i = 0; i < blockMesh.indices.size(); i++) mesh->indices.push_back(blockMesh.indices[i] + firstVertex);
+			}
+
+			if (mesh->colours.size() != mesh->vertices.size()) mesh->colours.clear();
+			mesh->noTotalTriangles = (uint)(mesh->indices.size() / 3);
+		}
+	};
+}
@@ -5,10 +5,29 @@
 #include "../Scene/ITMVoxelBlockHash.h"
 #include "../../../ORUtils/Image.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
 
 namespace ITMLib
 {
+	/** \brief
+	    An indexed triangle mesh: vertices are shared between the
+	    triangles that use them, and each triangle is stored as
+	    three indices into the vertex list.
+
+	    The mesh lives on the CPU and grows as the mesher adds to
+	    it. Per-vertex normals and colours are optional; they are
+	    either empty or have one entry per vertex.
+
+	    Meshers that run on the GPU cannot grow their output, so
+	    meshes on the GPU also hold a preallocated triangle soup,
+	    which IndexTriangleSoup turns into the indexed form.
+	*/
 	class ITMMesh
 	{
 	public:
@@ -16,105 +35,241 @@ namespace ITMLib
 
 		MemoryDeviceType memoryType;
 
+		std::vector<Vector3f> vertices;
+		std::vector<Vector3f> normals;
+		std::vector<Vector3u> colours;
+		std::vector<uint> indices;
+
+		/** Number of triangles, i.e. a third of the number of indices once the mesh is indexed. */
 		uint noTotalTriangles;
+
+		/** Capacity of the triangle soup of meshes on the GPU. */
 		static const uint noMaxTriangles_default = SDF_LOCAL_BLOCK_NUM * 32 * 16;
 		uint noMaxTriangles;
 
+		/** Triangle soup written by the GPU meshers, NULL for meshes on the CPU. */
 		ORUtils::MemoryBlock<Triangle> *triangles;
 
+	private:
+		struct VertexKey
+		{
+			uint bits[3];
+			bool operator==(const VertexKey &other) const { return memcmp(bits, other.bits, sizeof(bits)) == 0; }
+		};
+
+		struct VertexKeyHash
+		{
+			size_t operator()(const VertexKey &key) const { return ((size_t)key.bits[0] * 73856093u) ^ ((size_t)key.bits[1] * 19349669u) ^ ((size_t)key.bits[2] * 83492791u); }
+		};
+
+		/** Number of triangles per chunk that the STL writer formats before writing it out in one go; the OBJ writer uses chunks of about the same size. */
+		static const uint noTrianglesPerWriteChunk = 1 << 16;
+
+		void WriteBytes(std::vector<char> &buffer, const void *data, size_t size)
+		{
+			buffer.insert(buffer.end(), (const char*)data, (const char*)data + size);
+		}
+
+	public:
 		explicit ITMMesh(MemoryDeviceType memoryType, uint maxTriangles = noMaxTriangles_default)
 		{
 			this->memoryType = memoryType;
 			this->noTotalTriangles = 0;
 			this->noMaxTriangles = maxTriangles;
 
-			triangles = new ORUtils::MemoryBlock<Triangle>(noMaxTriangles, memoryType);
+			triangles = memoryType == MEMORYDEVICE_CUDA ? new ORUtils::MemoryBlock<Triangle>(noMaxTriangles, memoryType) : NULL;
 		}
 
-		void WriteOBJ(const char *fileName)
+		uint GetNoVertices(void) const { return (uint)vertices.size(); }
+
+		void Clear(void)
+		{
+			vertices.clear(); normals.clear(); colours.clear(); indices.clear();
+			noTotalTriangles = 0;
+		}
+
+		/** Replaces the contents of the mesh with the given triangles, merging vertices at bitwise identical positions. */
+		void SetFromTriangles(const Triangle *triangleArray, uint noTriangles)
 		{
-			ORUtils::MemoryBlock<Triangle> *cpu_triangles; bool shoulDelete = false;
-			if (memoryType == MEMORYDEVICE_CUDA)
+			Clear();
+			indices.reserve(noTriangles * 3);
+
+			std::unordered_map<VertexKey, uint, VertexKeyHash> vertexIds;
+			vertexIds.reserve(noTriangles);
+
+			for (uint i = 0; i < noTriangles; i++)
 			{
-				cpu_triangles = new ORUtils::MemoryBlock<Triangle>(noMaxTriangles, MEMORYDEVICE_CPU);
-				cpu_triangles->SetFrom(triangles, ORUtils::MemoryBlock<Triangle>::CUDA_TO_CPU);
-				shoulDelete = true;
+				const Vector3f *points[3] = { &triangleArray[i].p0, &triangleArray[i].p1, &triangleArray[i].p2 };
+				for (int j = 0; j < 3; j++)
+				{
+					VertexKey key; memcpy(key.bits, points[j]->v, sizeof(key.bits));
+
+					std::pair<std::unordered_map<VertexKey, uint, VertexKeyHash>::iterator, bool> result = vertexIds.insert(std::make_pair(key, (uint)vertices.size()));
+					if (result.second) vertices.push_back(*points[j]);
+					indices.push_back(result.first->second);
+				}
 			}
-			else cpu_triangles = triangles;
 
-			Triangle *triangleArray = cpu_triangles->GetData(MEMORYDEVICE_CPU);
+			noTotalTriangles = noTriangles;
+		}
+
+		/** Builds the indexed mesh from the first noTotalTriangles triangles of the soup of a GPU mesh. */
+		void IndexTriangleSoup(void)
+		{
+			if (triangles == NULL) return;
+
+			// only the used part of the soup is copied over
+			std::vector<Triangle> cpu_triangles(noTotalTriangles);
+#ifndef COMPILE_WITHOUT_CUDA
+			if (noTotalTriangles > 0) ORcudaSafeCall(cudaMemcpy(&cpu_triangles[0], triangles->GetData(MEMORYDEVICE_CUDA),
+				noTotalTriangles * sizeof(Triangle), cudaMemcpyDeviceToHost));
+#endif
+			SetFromTriangles(cpu_triangles.empty() ? NULL : &cpu_triangles[0], noTotalTriangles);
+		}
+
+		/** Fills the per-vertex normals with the area weighted normals of the adjacent triangles. */
+		void ComputeNormals(void)
+		{
+			normals.assign(vertices.size(), Vector3f(0.0f));
+
+			for (uint i = 0; i < noTotalTriangles; i++)
+			{
+				uint i0 = indices[i * 3], i1 = indices[i * 3 + 1], i2 = indices[i * 3 + 2];
 
+				// the files store triangles as (p2, p1, p0), see below
+				Vector3f faceNormal = cross(vertices[i1] - vertices[i2], vertices[i0] - vertices[i2]);
+				normals[i0] += faceNormal; normals[i1] += faceNormal; normals[i2] += faceNormal;
+			}
+
+			for (size_t i = 0; i < normals.size(); i++)
+			{
+				float length = sqrtf(dot(normals[i], normals[i]));
+				if (length > 0.0f) normals[i] /= length;
+			}
+		}
+
+		/** Writes the mesh as a binary PLY file, with normals and colours if the mesh has them. */
+		void WritePLY(const char *fileName)
+		{
+			FILE *f = fopen(fileName, "wb");
+			if (f == NULL) return;
+
+			bool withNormals = !vertices.empty() && normals.size() == vertices.size();
+			bool withColours = !vertices.empty() && colours.size() == vertices.size();
+
+			// the data is written in host byte order, so the header has to say which one that is
+			const unsigned int one = 1;
+			bool littleEndian = *(const unsigned char*)&one == 1;
+
+			fprintf(f, "ply\nformat %s 1.0\nelement vertex %u\nproperty float x\nproperty float y\nproperty float z\n",
+				littleEndian ? "binary_little_endian" : "binary_big_endian", GetNoVertices());
+			if (withNormals) fprintf(f, "property float nx\nproperty float ny\nproperty float nz\n");
+			if (withColours) fprintf(f, "property uchar red\nproperty uchar green\nproperty uchar blue\n");
+			fprintf(f, "element face %u\nproperty list uchar uint vertex_indices\nend_header\n", noTotalTriangles);
+
+			std::vector<char> buffer;
+			buffer.reserve(vertices.size() * (3 * sizeof(float) + (withNormals ? 3 * sizeof(float) : 0) + (withColours ? 3 : 0)));
+			for (size_t i = 0; i < vertices.size(); i++)
+			{
+				WriteBytes(buffer, vertices[i].v, 3 * sizeof(float));
+				if (withNormals) WriteBytes(buffer, normals[i].v, 3 * sizeof(float));
+				if (withColours) WriteBytes(buffer, colours[i].v, 3);
+			}
+			if (!buffer.empty()) fwrite(&buffer[0], 1, buffer.size(), f);
+
+			buffer.clear();
+			buffer.reserve((size_t)noTotalTriangles * (1 + 3 * sizeof(uint)));
+			for (uint i = 0; i < noTotalTriangles; i++)
+			{
+				unsigned char noCorners = 3;
+				uint face[3] = { indices[i * 3 + 2], indices[i * 3 + 1], indices[i * 3] };
+				WriteBytes(buffer, &noCorners, 1);
+				WriteBytes(buffer, face, sizeof(face));
+			}
+			if (!buffer.empty()) fwrite(&buffer[0], 1, buffer.size(), f);
+
+			fclose(f);
+		}
+
+		void WriteOBJ(const char *fileName)
+		{
 			FILE *f = fopen(fileName, "w+");
 			if (f != NULL)
 			{
+				// format the lines a chunk at a time, as for STL, rather than with one fprintf per line
+				std::vector<char> buffer;
+				buffer.reserve((size_t)noTrianglesPerWriteChunk * 64);
+				char line[160];
+
+				for (size_t i = 0; i < vertices.size(); i++)
+				{
+					WriteBytes(buffer, line, snprintf(line, sizeof(line), "v %f %f %f\n", vertices[i].x, vertices[i].y, vertices[i].z));
+					if (buffer.size() >= (size_t)noTrianglesPerWriteChunk * 32) { fwrite(&buffer[0], 1, buffer.size(), f); buffer.clear(); }
+				}
+
 				for (uint i = 0; i < noTotalTriangles; i++)
 				{
-					fprintf(f, "v %f %f %f\n", triangleArray[i].p0.x, triangleArray[i].p0.y, triangleArray[i].p0.z);
-					fprintf(f, "v %f %f %f\n", triangleArray[i].p1.x, triangleArray[i].p1.y, triangleArray[i].p1.z);
-					fprintf(f, "v %f %f %f\n", triangleArray[i].p2.x, triangleArray[i].p2.y, triangleArray[i].p2.z);
+					WriteBytes(buffer, line, snprintf(line, sizeof(line), "f %u %u %u\n", indices[i * 3 + 2] + 1, indices[i * 3 + 1] + 1, indices[i * 3] + 1));
+					if (buffer.size() >= (size_t)noTrianglesPerWriteChunk * 32) { fwrite(&buffer[0], 1, buffer.size(), f); buffer.clear(); }
 				}
 
-				for (uint i = 0; i<noTotalTriangles; i++) fprintf(f, "f %d %d %d\n", i * 3 + 2 + 1, i * 3 + 1 + 1, i * 3 + 0 + 1);
+				if (!buffer.empty()) fwrite(&buffer[0], 1, buffer.size(), f);
 				fclose(f);
 			}
-
-			if (shoulDelete) delete cpu_triangles;
 		}
 
 		void WriteSTL(const char *fileName)
 		{
-			ORUtils::MemoryBlock<Triangle> *cpu_triangles; bool shoulDelete = false;
-			if (memoryType == MEMORYDEVICE_CUDA)
-			{
-				cpu_triangles = new ORUtils::MemoryBlock<Triangle>(noMaxTriangles, MEMORYDEVICE_CPU);
-				cpu_triangles->SetFrom(triangles, ORUtils::MemoryBlock<Triangle>::CUDA_TO_CPU);
-				shoulDelete = true;
-			}
-			else cpu_triangles = triangles;
-
-			Triangle *triangleArray = cpu_triangles->GetData(MEMORYDEVICE_CPU);
-
 			FILE *f = fopen(fileName, "wb+");
 
 			if (f != NULL) {
-				for (int i = 0; i < 80; i++) fwrite(" ", sizeof(char), 1, f);
+				char header[80]; memset(header, ' ', sizeof(header));
+				fwrite(header, sizeof(char), 80, f);
 
 				fwrite(&noTotalTriangles, sizeof(int), 1, f);
 
-				float zero = 0.0f; short attribute = 0;
+				// STL stores every triangle with its own corners, 50 bytes each; format them a chunk at a time
+				std::vector<char> buffer;
+				buffer.reserve(std::min(noTotalTriangles, noTrianglesPerWriteChunk) * 50);
+
+				float zero[3] = { 0.0f, 0.0f, 0.0f }; short attribute = 0;
 				for (uint i = 0; i < noTotalTriangles; i++)
 				{
-					fwrite(&zero, sizeof(float), 1, f); fwrite(&zero, sizeof(float), 1, f); fwrite(&zero, sizeof(float), 1, f);
+					WriteBytes(buffer, zero, sizeof(zero));
+					WriteBytes(buffer, vertices[indices[i * 3 + 2]].v, 3 * sizeof(float));
+					WriteBytes(buffer, vertices[indices[i * 3 + 1]].v, 3 * sizeof(float));
+					WriteBytes(buffer, vertices[indices[i * 3]].v, 3 * sizeof(float));
+					WriteBytes(buffer, &attribute, sizeof(short));
 
-					fwrite(&triangleArray[i].p2.x, sizeof(float), 1, f); 
-					fwrite(&triangleArray[i].p2.y, sizeof(float), 1, f); 
-					fwrite(&triangleArray[i].p2.z, sizeof(float), 1, f);
-
-					fwrite(&triangleArray[i].p1.x, sizeof(float), 1, f); 
-					fwrite(&triangleArray[i].p1.y, sizeof(float), 1, f); 
-					fwrite(&triangleArray[i].p1.z, sizeof(float), 1, f);
-
-					fwrite(&triangleArray[i].p0.x, sizeof(float), 1, f);
-					fwrite(&triangleArray[i].p0.y, sizeof(float), 1, f);
-					fwrite(&triangleArray[i].p0.z, sizeof(float), 1, f);
-
-					fwrite(&attribute, sizeof(short), 1, f);
-
-					//fprintf(f, "v %f %f %f\n", triangleArray[i].p0.x, triangleArray[i].p0.y, triangleArray[i].p0.z);
-					//fprintf(f, "v %f %f %f\n", triangleArray[i].p1.x, triangleArray[i].p1.y, triangleArray[i].p1.z);
-					//fprintf(f, "v %f %f %f\n", triangleArray[i].p2.x, triangleArray[i].p2.y, triangleArray[i].p2.z);
+					if (buffer.size() >= (size_t)noTrianglesPerWriteChunk * 50 || i == noTotalTriangles - 1)
+					{
+						fwrite(&buffer[0], 1, buffer.size(), f);
+						buffer.clear();
+					}
 				}
 
-				//for (uint i = 0; i<noTotalTriangles; i++) fprintf(f, "f %d %d %d\n", i * 3 + 2 + 1, i * 3 + 1 + 1, i * 3 + 0 + 1);
 				fclose(f);
 			}
+		}
 
-			if (shoulDelete) delete cpu_triangles;
+		/** Writes the mesh in the format given by the extension of the file name: .ply, .obj, or STL otherwise. */
+		void Write(const char *fileName)
+		{
+			size_t length = strlen(fileName);
+			const char *extension = length >= 4 ? fileName + length - 4 : "";
+
+			if (strcmp(extension, ".ply") == 0 || strcmp(extension, ".PLY") == 0)
+			{
+				if (normals.size() != vertices.size()) ComputeNormals();
+				WritePLY(fileName);
+			}
+			else if (strcmp(extension, ".obj") == 0 || strcmp(extension, ".OBJ") == 0) WriteOBJ(fileName);
+			else WriteSTL(fileName);
 		}
 
 		~ITMMesh()
 		{
-			delete triangles;
+			if (triangles != NULL) delete triangles;
 		}
 
 		// Suppress the default copy constructor and assignment operator
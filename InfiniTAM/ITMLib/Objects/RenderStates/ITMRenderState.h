@@ -44,6 +44,25 @@ namespace ITMLib
 
 		ORUtils::Image<Vector4u> *raycastImage;
 
+		/** @brief
+		Raycast points of the pixels done so far for a freeview
+		image that is refined over several frames, see
+		ITMVisualisationEngine::RenderImageProgressive, or NULL
+		until the first such image.
+		*/
+		ORUtils::Image<Vector4f> *refinementSamples;
+		/** The pose and intrinsics the refinement samples were raycast for. */
+		Matrix4f refinementPose;
+		Vector4f refinementProjParams;
+		/** Every refinementStride-th pixel along both axes has been raycast, or 0 if the samples are out of date. */
+		int refinementStride;
+		/** Next row of the finer level of pixels, or of the full resolution image once refined, to be raycast. */
+		int refinementRow;
+		/** Measured cost of a ray in milliseconds, used to plan the refinement within its time budget. */
+		float refinementTimePerRay;
+		/** Measured time in milliseconds of upsampling and shading a refined image, which the refinement leaves room for. */
+		float refinementShadingTime;
+
 		ITMRenderState(const Vector2i &imgSize, float vf_min, float vf_max, MemoryDeviceType memoryType)
 		{
 			renderingRangeImage = new ORUtils::Image<Vector2f>(imgSize, memoryType);
@@ -68,6 +87,14 @@ namespace ITMLib
 			delete buffImage;
 
 			noFwdProjMissingPoints = 0;
+
+			refinementSamples = NULL;
+			refinementPose.setZeros();
+			refinementProjParams = Vector4f(0.0f);
+			refinementStride = 0;
+			refinementRow = 0;
+			refinementTimePerRay = 0.0f;
+			refinementShadingTime = 0.0f;
 		}
 
 		virtual ~ITMRenderState()
@@ -77,6 +104,7 @@ namespace ITMLib
 			delete forwardProjection;
 			delete fwdProjMissingPoints;
 			delete raycastImage;
+			if (refinementSamples != NULL) delete refinementSamples;
 		}
 	};
 }
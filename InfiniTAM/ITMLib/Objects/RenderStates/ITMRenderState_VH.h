@@ -3,6 +3,7 @@
 #pragma once
 
 #include <stdlib.h>
+#include <vector>
 
 #include "ITMRenderState.h"
 #include "../Scene/ITMVoxelBlockHash.h"
@@ -29,20 +30,35 @@ namespace ITMLib
 		and tracker.
 		*/
 		ORUtils::MemoryBlock<uchar> *entriesVisibleType;
+
+		/** Host-side list of entries that have dropped out
+		of the visible list and have not yet been swapped
+		out, oldest first. Only maintained by the CPU engines.
+		*/
+		std::vector<int> swapOutCandidates;
+		std::vector<bool> isSwapOutCandidate;
+
+		/** Whether the list of swap-out candidates is
+		maintained at all. Nothing drains it unless a
+		swapping engine is in use, so it stays off until
+		a swapping engine asks for it.
+		*/
+		bool swapOutCandidatesEnabled;
            
 	public:
 		/** Number of entries in the live list. */
 		int noVisibleEntries;
            
-		ITMRenderState_VH(int noTotalEntries, const Vector2i & imgSize, float vf_min, float vf_max, MemoryDeviceType memoryType = MEMORYDEVICE_CPU)
+		ITMRenderState_VH(int noTotalEntries, int noVoxelBlocks, const Vector2i & imgSize, float vf_min, float vf_max, MemoryDeviceType memoryType = MEMORYDEVICE_CPU)
 			: ITMRenderState(imgSize, vf_min, vf_max, memoryType)
 		{
 			this->memoryType = memoryType;
 
-			visibleEntryIDs = new ORUtils::MemoryBlock<int>(SDF_LOCAL_BLOCK_NUM, memoryType);
+			visibleEntryIDs = new ORUtils::MemoryBlock<int>(noVoxelBlocks, memoryType);
 			entriesVisibleType = new ORUtils::MemoryBlock<uchar>(noTotalEntries, memoryType);
 
 			noVisibleEntries = 0;
+			swapOutCandidatesEnabled = false;
 		}
 		~ITMRenderState_VH()
 		{
@@ -60,6 +76,27 @@ namespace ITMLib
 		*/
 		uchar *GetEntriesVisibleType(void) { return entriesVisibleType->GetData(memoryType); }
 
+		/** Starts maintaining the list of swap-out candidates. */
+		void EnableSwapOutCandidates(void) { swapOutCandidatesEnabled = true; }
+
+		/** Whether entries that drop out of the visible list should be passed to AddSwapOutCandidate. */
+		bool AreSwapOutCandidatesEnabled(void) const { return swapOutCandidatesEnabled; }
+
+		/** Queues an entry that has just dropped out of the visible list, unless it is queued already. */
+		void AddSwapOutCandidate(int entryId)
+		{
+			if (isSwapOutCandidate.empty()) isSwapOutCandidate.resize(entriesVisibleType->dataSize, false);
+			if (isSwapOutCandidate[entryId]) return;
+
+			isSwapOutCandidate[entryId] = true;
+			swapOutCandidates.push_back(entryId);
+		}
+
+		/** Must be called for every entry the swapping engine removes from the list returned by GetSwapOutCandidates. */
+		void ReleaseSwapOutCandidate(int entryId) { isSwapOutCandidate[entryId] = false; }
+
+		std::vector<int>& GetSwapOutCandidates(void) { return swapOutCandidates; }
+
 #ifdef COMPILE_WITH_METAL
 		const void* GetVisibleEntryIDs_MB(void) { return visibleEntryIDs->GetMetalBuffer(); }
 		const void* GetEntriesVisibleType_MB(void) { return entriesVisibleType->GetMetalBuffer(); }
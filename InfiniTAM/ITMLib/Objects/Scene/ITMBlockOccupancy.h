@@ -0,0 +1,208 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "../../Utils/ITMMath.h"
+#ifndef __METALC__
+#include <vector>
+#endif
+
+#define OCCUPANCY_CELL_SIZE 4			// Number of children along each side of an occupancy cell
+#define OCCUPANCY_CELL_SIZE3 64			// OCCUPANCY_CELL_SIZE3 = OCCUPANCY_CELL_SIZE * OCCUPANCY_CELL_SIZE * OCCUPANCY_CELL_SIZE
+
+/** \brief
+	A cell of the block occupancy pyramid. On level 1 a cell
+	covers 4x4x4 voxel blocks and has one bit per block, set
+	while the block is allocated and in memory. On level 2 a
+	cell covers 4x4x4 level 1 cells and has one bit per cell,
+	set while any of the cell's blocks is.
+*/
+struct ITMBlockOccupancyCell
+{
+	/** Position of the cell, in units of cells of its level. */
+	Vector3s pos;
+	/** Level of the cell, or 0 if the cell is unused. */
+	short level;
+	/** The 64 occupancy bits, indexed x + 4 * y + 16 * z within the cell. */
+	uint mask[2];
+};
+
+_CPU_AND_GPU_CODE_ inline int occupancyCellIndex(const THREADPTR(Vector3i) & cellPos, int level, int noCells) {
+	return (((uint)cellPos.x * 73856093u) ^ ((uint)cellPos.y * 19349669u) ^ ((uint)cellPos.z * 83492791u) ^ ((uint)level * 2654435761u)) & (uint)(noCells - 1);
+}
+
+/** Position of the cell one level up that contains the block or cell at @p pos. */
+_CPU_AND_GPU_CODE_ inline void occupancyParentPos(const THREADPTR(Vector3i) & pos, THREADPTR(Vector3i) &parentPos) {
+	parentPos.x = ((pos.x < 0) ? pos.x - OCCUPANCY_CELL_SIZE + 1 : pos.x) / OCCUPANCY_CELL_SIZE;
+	parentPos.y = ((pos.y < 0) ? pos.y - OCCUPANCY_CELL_SIZE + 1 : pos.y) / OCCUPANCY_CELL_SIZE;
+	parentPos.z = ((pos.z < 0) ? pos.z - OCCUPANCY_CELL_SIZE + 1 : pos.z) / OCCUPANCY_CELL_SIZE;
+}
+
+_CPU_AND_GPU_CODE_ inline int occupancyBitIndex(const THREADPTR(Vector3i) & childPos) {
+	return childPos.x + childPos.y * OCCUPANCY_CELL_SIZE + childPos.z * OCCUPANCY_CELL_SIZE * OCCUPANCY_CELL_SIZE;
+}
+
+_CPU_AND_GPU_CODE_ inline bool isOccupancyBitSet(const THREADPTR(uint) *mask, int bitIdx) {
+	return (mask[bitIdx >> 5] & (1u << (bitIdx & 31))) != 0;
+}
+
+// the cell in front of the occupancy cells records their number, see ITMBlockOccupancy
+_CPU_AND_GPU_CODE_ inline int getOccupancyCellNum(const CONSTPTR(ITMBlockOccupancyCell) *cells) {
+	return (int)cells[-1].mask[0];
+}
+
+/** Index of the cell at the given position and level, or -1 if the cell has never been occupied. */
+_CPU_AND_GPU_CODE_ inline int findOccupancyCell(const CONSTPTR(ITMBlockOccupancyCell) *cells, const THREADPTR(Vector3i) & cellPos, int level)
+{
+	int noCells = getOccupancyCellNum(cells);
+	int cellIdx = occupancyCellIndex(cellPos, level, noCells);
+
+	// linear probing; the table is never full, so there always is an unused cell to stop at
+	while (cells[cellIdx].level != 0)
+	{
+		if (cells[cellIdx].level == level && cells[cellIdx].pos.x == cellPos.x && cells[cellIdx].pos.y == cellPos.y && cells[cellIdx].pos.z == cellPos.z) return cellIdx;
+		cellIdx = (cellIdx + 1) & (noCells - 1);
+	}
+
+	return -1;
+}
+
+/** Reads the occupancy bits of a cell, all clear if the cell has never been occupied. */
+_CPU_AND_GPU_CODE_ inline void readOccupancyMask(const CONSTPTR(ITMBlockOccupancyCell) *cells, const THREADPTR(Vector3i) & cellPos, int level, THREADPTR(uint) *mask)
+{
+	int cellIdx = findOccupancyCell(cells, cellPos, level);
+	mask[0] = cellIdx >= 0 ? cells[cellIdx].mask[0] : 0;
+	mask[1] = cellIdx >= 0 ? cells[cellIdx].mask[1] : 0;
+}
+
+#ifndef __METALC__
+namespace ITMLib
+{
+	/** \brief
+	    A coarse map of which voxel blocks of a hash are allocated
+	    and in memory, so that raycasts can leap over empty space
+	    without looking up every block along the way.
+
+	    The map is a two level pyramid of ITMBlockOccupancyCell,
+	    kept in a single hash table with linear probing that grows
+	    as cells are added. As with the voxel block hash, the
+	    table is preceded by one cell that records its size.
+
+	    The map lives on the CPU only, so the table is kept in a
+	    std::vector rather than a MemoryBlock, and the cells are
+	    cleared by assignment rather than with memset.
+	*/
+	class ITMBlockOccupancy
+	{
+	private:
+		std::vector<ITMBlockOccupancyCell> cells;
+		int noCells, noUsedCells;
+
+		void Allocate(int noCells)
+		{
+			this->noCells = noCells;
+
+			cells.resize(noCells + 1);
+			Clear();
+
+			ITMBlockOccupancyCell &header = cells[0];
+			header = GetCells()[0];
+			header.mask[0] = (uint)noCells;
+		}
+
+		int ClaimCell(const Vector3i &cellPos, int level)
+		{
+			ITMBlockOccupancyCell *cellData = GetCells();
+			int cellIdx = occupancyCellIndex(cellPos, level, noCells);
+			while (cellData[cellIdx].level != 0) cellIdx = (cellIdx + 1) & (noCells - 1);
+
+			ITMBlockOccupancyCell &cell = cellData[cellIdx];
+			cell.pos = Vector3s((short)cellPos.x, (short)cellPos.y, (short)cellPos.z);
+			cell.level = (short)level;
+			noUsedCells++;
+
+			return cellIdx;
+		}
+
+		/** Moves the cells that still have bits set into a table of twice the size. */
+		void Grow(void)
+		{
+			std::vector<ITMBlockOccupancyCell> oldCells;
+			oldCells.swap(cells);
+			const ITMBlockOccupancyCell *oldCellData = &oldCells[1];
+			int oldNoCells = noCells;
+
+			Allocate(oldNoCells * 2);
+
+			for (int i = 0; i < oldNoCells; i++)
+			{
+				const ITMBlockOccupancyCell &oldCell = oldCellData[i];
+				if (oldCell.level == 0 || (oldCell.mask[0] == 0 && oldCell.mask[1] == 0)) continue;
+
+				ITMBlockOccupancyCell &cell = GetCells()[ClaimCell(oldCell.pos.toInt(), oldCell.level)];
+				cell.mask[0] = oldCell.mask[0];
+				cell.mask[1] = oldCell.mask[1];
+			}
+		}
+
+		/** Sets or clears the bit of @p childPos in the cell at @p cellPos, and returns whether the cell had any bits set before and after. */
+		void SetBit(const Vector3i &cellPos, int level, const Vector3i &childPos, bool isSet, bool &wasOccupied, bool &isOccupied)
+		{
+			int cellIdx = findOccupancyCell(GetCells(), cellPos, level);
+			if (cellIdx < 0)
+			{
+				wasOccupied = isOccupied = false;
+				if (!isSet) return;
+
+				// keep the table at most three quarters full, so that probing stays short
+				if ((noUsedCells + 1) * 4 > noCells * 3) Grow();
+				cellIdx = ClaimCell(cellPos, level);
+			}
+
+			ITMBlockOccupancyCell &cell = GetCells()[cellIdx];
+			int bitIdx = occupancyBitIndex(childPos - cellPos * OCCUPANCY_CELL_SIZE);
+
+			wasOccupied = cell.mask[0] != 0 || cell.mask[1] != 0;
+			if (isSet) cell.mask[bitIdx >> 5] |= 1u << (bitIdx & 31);
+			else cell.mask[bitIdx >> 5] &= ~(1u << (bitIdx & 31));
+			isOccupied = cell.mask[0] != 0 || cell.mask[1] != 0;
+		}
+
+	public:
+		/** @p noCells is the initial size of the table and has to be a power of two. */
+		explicit ITMBlockOccupancy(int noCells) { Allocate(noCells); }
+
+		const ITMBlockOccupancyCell *GetCells(void) const { return &cells[1]; }
+		ITMBlockOccupancyCell *GetCells(void) { return &cells[1]; }
+
+		void Clear(void)
+		{
+			ITMBlockOccupancyCell emptyCell;
+			emptyCell.pos = Vector3s(0, 0, 0);
+			emptyCell.level = 0;
+			emptyCell.mask[0] = emptyCell.mask[1] = 0;
+
+			ITMBlockOccupancyCell *cellData = GetCells();
+			for (int i = 0; i < noCells; i++) cellData[i] = emptyCell;
+			noUsedCells = 0;
+		}
+
+		/** Records whether the block at @p blockPos is allocated and in memory. */
+		void SetBlock(const Vector3s &blockPos, bool isOccupied)
+		{
+			Vector3i blockPos_i = blockPos.toInt(), cellPos, superCellPos;
+			occupancyParentPos(blockPos_i, cellPos);
+			occupancyParentPos(cellPos, superCellPos);
+
+			// the level 2 bit of a cell only changes when the cell gains its first block or loses its last
+			bool wasCellOccupied, isCellOccupied, wasSuperCellOccupied, isSuperCellOccupied;
+			SetBit(cellPos, 1, blockPos_i, isOccupied, wasCellOccupied, isCellOccupied);
+			if (wasCellOccupied != isCellOccupied) SetBit(superCellPos, 2, cellPos, isCellOccupied, wasSuperCellOccupied, isSuperCellOccupied);
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		ITMBlockOccupancy(const ITMBlockOccupancy&);
+		ITMBlockOccupancy& operator=(const ITMBlockOccupancy&);
+	};
+}
+#endif
@@ -4,7 +4,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <vector>
 
+#include "ITMVoxelBlockFile.h"
 #include "ITMVoxelBlockHash.h"
 #include "../../../ORUtils/CUDADefines.h"
 
@@ -25,70 +27,246 @@ namespace ITMLib
 	class ITMGlobalCache
 	{
 	private:
-		bool *hasStoredData;
-		TVoxel *storedVoxelBlocks;
+		/** Number of voxel blocks held by each slab of the host block store. */
+		static const int noBlocksPerSlab = 1024;
+
+		/** For each hash entry, the slot of the host block store
+		    that holds its voxel block, or -1 if it has none yet.
+		*/
+		int *storedBlockSlots;
+
+		/** The host block store: slabs of noBlocksPerSlab voxel
+		    blocks, allocated only once the previous ones are full.
+		*/
+		std::vector<TVoxel*> storedBlockSlabs;
+		int noStoredBlocks;
+
+		/** Optional disk tier. If present, at most maxResidentBlocks
+		    blocks are kept in host memory and the least recently used
+		    ones are written to this file when more room is needed.
+		*/
+		ITMVoxelBlockFile *blockFile;
+		int maxResidentBlocks;
+
+		/** For each hash entry, the block of blockFile that holds its
+		    voxel block, or -1 if it has never been written to disk.
+		*/
+		int *fileBlockSlots;
+
+		/** Per host slot: owning hash entry, LRU links, and whether
+		    the slot is newer than the copy in blockFile.
+		*/
+		std::vector<int> slotEntries, slotPrev, slotNext;
+		std::vector<bool> slotDirty;
+		std::vector<int> freeSlots;
+		int lruHead, lruTail;
+
 		ITMHashSwapState *swapStates_host, *swapStates_device;
 
+		/** Entries whose swap state went from 0 to 1 and that
+		    have not been swapped in yet, oldest first. Only
+		    maintained by the CPU engines.
+		*/
+		std::vector<int> swapInCandidates;
+
 		bool *hasSyncedData_host, *hasSyncedData_device;
 		TVoxel *syncedVoxelBlocks_host, *syncedVoxelBlocks_device;
 
 		int *neededEntryIDs_host, *neededEntryIDs_device;
+
+		inline TVoxel *GetStoredBlockSlot(int slot) const
+		{
+			return storedBlockSlabs[slot / noBlocksPerSlab] + (slot % noBlocksPerSlab) * SDF_BLOCK_SIZE3;
+		}
+
+		int AllocateStoredBlockSlot(void)
+		{
+			if (noStoredBlocks == (int)storedBlockSlabs.size() * noBlocksPerSlab)
+			{
+				TVoxel *slab = (TVoxel*)malloc(noBlocksPerSlab * sizeof(TVoxel) * SDF_BLOCK_SIZE3);
+				if (slab == NULL) DIEWITHEXCEPTION("Could not allocate host memory for the global voxel block cache");
+				storedBlockSlabs.push_back(slab);
+			}
+
+			if (blockFile != NULL)
+			{
+				slotEntries.push_back(-1); slotPrev.push_back(-1); slotNext.push_back(-1);
+				slotDirty.push_back(false);
+			}
+
+			return noStoredBlocks++;
+		}
+
+		void UnlinkSlot(int slot)
+		{
+			if (slotPrev[slot] >= 0) slotNext[slotPrev[slot]] = slotNext[slot]; else lruHead = slotNext[slot];
+			if (slotNext[slot] >= 0) slotPrev[slotNext[slot]] = slotPrev[slot]; else lruTail = slotPrev[slot];
+		}
+
+		void LinkSlotAsMostRecent(int slot)
+		{
+			slotPrev[slot] = -1; slotNext[slot] = lruHead;
+			if (lruHead >= 0) slotPrev[lruHead] = slot;
+			lruHead = slot;
+			if (lruTail < 0) lruTail = slot;
+		}
+
+		void WriteSlotToFile(int slot)
+		{
+			int address = slotEntries[slot];
+			if (fileBlockSlots[address] < 0) fileBlockSlots[address] = blockFile->AllocateBlock();
+
+			memcpy(blockFile->GetBlock(fileBlockSlots[address]), GetStoredBlockSlot(slot), sizeof(TVoxel) * SDF_BLOCK_SIZE3);
+			slotDirty[slot] = false;
+		}
+
+		/** Finds a host slot for a new block, evicting the least recently used block to disk if the host tier is full. */
+		int AcquireStoredBlockSlot(int address)
+		{
+			if (blockFile == NULL) return AllocateStoredBlockSlot();
+
+			int slot;
+			if (!freeSlots.empty()) { slot = freeSlots.back(); freeSlots.pop_back(); }
+			else if (noStoredBlocks < maxResidentBlocks) slot = AllocateStoredBlockSlot();
+			else
+			{
+				slot = lruTail;
+				UnlinkSlot(slot);
+				if (slotDirty[slot]) WriteSlotToFile(slot);
+				storedBlockSlots[slotEntries[slot]] = -1;
+			}
+
+			slotEntries[slot] = address;
+			LinkSlotAsMostRecent(slot);
+
+			return slot;
+		}
+
 	public:
 		inline void SetStoredData(int address, TVoxel *data) 
 		{ 
-			hasStoredData[address] = true; 
-			memcpy(storedVoxelBlocks + address * SDF_BLOCK_SIZE3, data, sizeof(TVoxel) * SDF_BLOCK_SIZE3);
+			int slot = storedBlockSlots[address];
+			if (slot < 0) storedBlockSlots[address] = slot = AcquireStoredBlockSlot(address);
+			else if (blockFile != NULL) { UnlinkSlot(slot); LinkSlotAsMostRecent(slot); }
+
+			memcpy(GetStoredBlockSlot(slot), data, sizeof(TVoxel) * SDF_BLOCK_SIZE3);
+			if (blockFile != NULL) slotDirty[slot] = true;
+		}
+		inline bool HasStoredData(int address) const
+		{
+			return storedBlockSlots[address] >= 0 || (blockFile != NULL && fileBlockSlots[address] >= 0);
+		}
+		inline TVoxel *GetStoredVoxelBlock(int address)
+		{
+			int slot = storedBlockSlots[address];
+			if (slot >= 0)
+			{
+				if (blockFile != NULL) { UnlinkSlot(slot); LinkSlotAsMostRecent(slot); }
+				return GetStoredBlockSlot(slot);
+			}
+
+			// blocks that only live on disk are read straight from the mapping
+			if (blockFile != NULL && fileBlockSlots[address] >= 0) return (TVoxel*)blockFile->GetBlock(fileBlockSlots[address]);
+
+			return NULL;
+		}
+
+		/** Number of voxel blocks currently held in host memory. */
+		int GetNoStoredBlocks(void) const { return noStoredBlocks - (int)freeSlots.size(); }
+
+		/** Number of voxel blocks that have been written to the disk tier. */
+		int GetNoSpilledBlocks(void) const { return blockFile != NULL ? blockFile->GetNoBlocks() : 0; }
+
+		/** Host memory used by the stored voxel blocks and their index, in bytes. */
+		size_t GetResidentBytes(void) const
+		{
+			size_t indexBytes = noTotalEntries * sizeof(int) * (blockFile != NULL ? 2 : 1);
+			return storedBlockSlabs.size() * noBlocksPerSlab * sizeof(TVoxel) * SDF_BLOCK_SIZE3 + indexBytes;
+		}
+
+		/** Writes all host blocks that changed since they were last spilled to the disk tier, and waits for the file to reach the disk. */
+		void Flush(void)
+		{
+			if (blockFile == NULL) return;
+
+			for (int slot = lruHead; slot >= 0; slot = slotNext[slot])
+				if (slotDirty[slot]) WriteSlotToFile(slot);
+
+			blockFile->Flush();
 		}
-		inline bool HasStoredData(int address) const { return hasStoredData[address]; }
-		inline TVoxel *GetStoredVoxelBlock(int address) { return storedVoxelBlocks + address * SDF_BLOCK_SIZE3; }
 
 		bool *GetHasSyncedData(bool useGPU) const { return useGPU ? hasSyncedData_device : hasSyncedData_host; }
 		TVoxel *GetSyncedVoxelBlocks(bool useGPU) const { return useGPU ? syncedVoxelBlocks_device : syncedVoxelBlocks_host; }
 
 		ITMHashSwapState *GetSwapStates(bool useGPU) { return useGPU ? swapStates_device : swapStates_host; }
+		std::vector<int>& GetSwapInCandidates(void) { return swapInCandidates; }
 		int *GetNeededEntryIDs(bool useGPU) { return useGPU ? neededEntryIDs_device : neededEntryIDs_host; }
 
 		int noTotalEntries; 
 
-		ITMGlobalCache() : noTotalEntries(SDF_BUCKET_NUM + SDF_EXCESS_LIST_SIZE)
+		/** Maximum number of blocks transferred in one swap operation. */
+		int noTransferBlocks;
+
+		/** If blockFileName is given, swapped-out blocks beyond the
+		    first maxResidentBlocks are kept in a memory-mapped file
+		    of that name instead of in host memory.
+		*/
+		ITMGlobalCache(const ITMSceneParams *sceneParams, const char *blockFileName = NULL, int maxResidentBlocks = 0)
+			: noStoredBlocks(0), blockFile(NULL), maxResidentBlocks(maxResidentBlocks), fileBlockSlots(NULL), lruHead(-1), lruTail(-1),
+			noTotalEntries(sceneParams->noHashBuckets + sceneParams->noHashExcessEntries), noTransferBlocks(sceneParams->noSwapTransferBlocks)
 		{	
-			hasStoredData = (bool*)malloc(noTotalEntries * sizeof(bool));
-			storedVoxelBlocks = (TVoxel*)malloc(noTotalEntries * sizeof(TVoxel) * SDF_BLOCK_SIZE3);
-			memset(hasStoredData, 0, noTotalEntries);
+			storedBlockSlots = (int*)malloc(noTotalEntries * sizeof(int));
+			for (int i = 0; i < noTotalEntries; i++) storedBlockSlots[i] = -1;
+
+			if (blockFileName != NULL)
+			{
+				if (maxResidentBlocks <= 0) DIEWITHEXCEPTION("The disk tier of the global cache needs room for at least one block in host memory");
+
+				blockFile = new ITMVoxelBlockFile(blockFileName, sizeof(TVoxel) * SDF_BLOCK_SIZE3);
+				fileBlockSlots = (int*)malloc(noTotalEntries * sizeof(int));
+				for (int i = 0; i < noTotalEntries; i++) fileBlockSlots[i] = -1;
+			}
 
 			swapStates_host = (ITMHashSwapState *)malloc(noTotalEntries * sizeof(ITMHashSwapState));
 			memset(swapStates_host, 0, sizeof(ITMHashSwapState) * noTotalEntries);
 
 #ifndef COMPILE_WITHOUT_CUDA
-			ORcudaSafeCall(cudaMallocHost((void**)&syncedVoxelBlocks_host, SDF_TRANSFER_BLOCK_NUM * sizeof(TVoxel) * SDF_BLOCK_SIZE3));
-			ORcudaSafeCall(cudaMallocHost((void**)&hasSyncedData_host, SDF_TRANSFER_BLOCK_NUM * sizeof(bool)));
-			ORcudaSafeCall(cudaMallocHost((void**)&neededEntryIDs_host, SDF_TRANSFER_BLOCK_NUM * sizeof(int)));
+			ORcudaSafeCall(cudaMallocHost((void**)&syncedVoxelBlocks_host, noTransferBlocks * sizeof(TVoxel) * SDF_BLOCK_SIZE3));
+			ORcudaSafeCall(cudaMallocHost((void**)&hasSyncedData_host, noTransferBlocks * sizeof(bool)));
+			ORcudaSafeCall(cudaMallocHost((void**)&neededEntryIDs_host, noTransferBlocks * sizeof(int)));
 
 			ORcudaSafeCall(cudaMalloc((void**)&swapStates_device, noTotalEntries * sizeof(ITMHashSwapState)));
 			ORcudaSafeCall(cudaMemset(swapStates_device, 0, noTotalEntries * sizeof(ITMHashSwapState)));
 
-			ORcudaSafeCall(cudaMalloc((void**)&syncedVoxelBlocks_device, SDF_TRANSFER_BLOCK_NUM * sizeof(TVoxel) * SDF_BLOCK_SIZE3));
-			ORcudaSafeCall(cudaMalloc((void**)&hasSyncedData_device, SDF_TRANSFER_BLOCK_NUM * sizeof(bool)));
+			ORcudaSafeCall(cudaMalloc((void**)&syncedVoxelBlocks_device, noTransferBlocks * sizeof(TVoxel) * SDF_BLOCK_SIZE3));
+			ORcudaSafeCall(cudaMalloc((void**)&hasSyncedData_device, noTransferBlocks * sizeof(bool)));
 
-			ORcudaSafeCall(cudaMalloc((void**)&neededEntryIDs_device, SDF_TRANSFER_BLOCK_NUM * sizeof(int)));
+			ORcudaSafeCall(cudaMalloc((void**)&neededEntryIDs_device, noTransferBlocks * sizeof(int)));
 #else
-			syncedVoxelBlocks_host = (TVoxel *)malloc(SDF_TRANSFER_BLOCK_NUM * sizeof(TVoxel) * SDF_BLOCK_SIZE3);
-			hasSyncedData_host = (bool*)malloc(SDF_TRANSFER_BLOCK_NUM * sizeof(bool));
-			neededEntryIDs_host = (int*)malloc(SDF_TRANSFER_BLOCK_NUM * sizeof(int));
+			syncedVoxelBlocks_host = (TVoxel *)malloc(noTransferBlocks * sizeof(TVoxel) * SDF_BLOCK_SIZE3);
+			hasSyncedData_host = (bool*)malloc(noTransferBlocks * sizeof(bool));
+			neededEntryIDs_host = (int*)malloc(noTransferBlocks * sizeof(int));
 #endif
 		}
 
 		void SaveToFile(char *fileName) const
 		{
-			TVoxel *storedData = storedVoxelBlocks;
+			// the file keeps the dense layout: one flag per entry, followed by one voxel block per entry
+			std::vector<TVoxel> emptyBlock(SDF_BLOCK_SIZE3);
+
+			std::vector<char> hasStoredData(noTotalEntries);
+			for (int i = 0; i < noTotalEntries; i++) hasStoredData[i] = HasStoredData(i);
 
 			FILE *f = fopen(fileName, "wb");
 
-			fwrite(hasStoredData, sizeof(bool), noTotalEntries, f);
+			fwrite(&hasStoredData[0], sizeof(char), noTotalEntries, f);
+
 			for (int i = 0; i < noTotalEntries; i++)
 			{
+				const TVoxel *storedData = &emptyBlock[0];
+				if (storedBlockSlots[i] >= 0) storedData = GetStoredBlockSlot(storedBlockSlots[i]);
+				else if (HasStoredData(i)) storedData = (const TVoxel*)blockFile->GetBlock(fileBlockSlots[i]);
 				fwrite(storedData, sizeof(TVoxel) * SDF_BLOCK_SIZE3, 1, f);
-				storedData += SDF_BLOCK_SIZE3;
 			}
 
 			fclose(f);
@@ -96,25 +274,28 @@ namespace ITMLib
 
 		void ReadFromFile(char *fileName)
 		{
-			TVoxel *storedData = storedVoxelBlocks;
 			FILE *f = fopen(fileName, "rb");
 
+			bool *hasStoredData = (bool*)malloc(noTotalEntries * sizeof(bool));
 			size_t tmp = fread(hasStoredData, sizeof(bool), noTotalEntries, f);
 			if (tmp == (size_t)noTotalEntries) {
+				std::vector<TVoxel> storedData(SDF_BLOCK_SIZE3);
 				for (int i = 0; i < noTotalEntries; i++)
 				{
-					fread(storedData, sizeof(TVoxel) * SDF_BLOCK_SIZE3, 1, f);
-					storedData += SDF_BLOCK_SIZE3;
+					if (fread(&storedData[0], sizeof(TVoxel) * SDF_BLOCK_SIZE3, 1, f) != 1) break;
+					if (hasStoredData[i]) SetStoredData(i, &storedData[0]);
 				}
 			}
 
+			free(hasStoredData);
 			fclose(f);
 		}
 
 		~ITMGlobalCache(void) 
 		{
-			free(hasStoredData);
-			free(storedVoxelBlocks);
+			free(storedBlockSlots);
+			if (blockFile != NULL) { delete blockFile; free(fileBlockSlots); }
+			for (size_t i = 0; i < storedBlockSlabs.size(); i++) free(storedBlockSlabs[i]);
 
 			free(swapStates_host);
 
@@ -2,6 +2,10 @@
 
 #pragma once
 
+#include <cstdio>
+#include <new>
+#include <vector>
+
 #include "../../../ORUtils/MemoryBlock.h"
 #include "../../../ORUtils/MemoryBlockPersister.h"
 
@@ -10,16 +14,103 @@ namespace ITMLib
 	/** \brief
 	Stores the actual voxel content that is referred to by a
 	ITMLib::ITMHashTable.
+
+	The array can grow in chunks of blocks, up to a high-water
+	mark, when its free blocks run out. Blocks are referred to by
+	their index, which stays valid when the array grows; pointers
+	into the array do not.
 	*/
 	template<class TVoxel>
 	class ITMLocalVBA
 	{
+	public:
+		/** Called after the array has grown from @p oldNoBlocks to @p newNoBlocks blocks. */
+		typedef void (*GrowthCallback)(int oldNoBlocks, int newNoBlocks, void *userData);
+
 	private:
 		ORUtils::MemoryBlock<TVoxel> *voxelBlocks;
 		ORUtils::MemoryBlock<int> *allocationList;
 
 		MemoryDeviceType memoryType;
 
+		int noBlocks, blockSize;
+		int noBlocksPerChunk, maxNoBlocks;
+
+		GrowthCallback growthCallback;
+		void *growthCallbackData;
+
+		/** Whether the warning that the array cannot provide enough free blocks has been printed yet. */
+		bool reportedOutOfBlocks;
+
+		/** Returns false, leaving the array as it is, if the memory for the larger array cannot be allocated. */
+		bool Grow(int newNoBlocks)
+		{
+			int oldNoBlocks = noBlocks, noNewBlocks = newNoBlocks - oldNoBlocks, noFreeBlocks = lastFreeBlockId + 1;
+			size_t oldSize = (size_t)oldNoBlocks * blockSize, newSize = (size_t)newNoBlocks * blockSize;
+
+			// MemoryBlock exits when cudaMalloc fails, so first check with cudaMalloc itself that the device memory is available
+			if (memoryType == MEMORYDEVICE_CUDA)
+			{
+#ifndef COMPILE_WITHOUT_CUDA
+				void *voxelProbe = NULL, *allocationProbe = NULL;
+				bool isAvailable = cudaMalloc(&voxelProbe, newSize * sizeof(TVoxel)) == cudaSuccess &&
+					cudaMalloc(&allocationProbe, newNoBlocks * sizeof(int)) == cudaSuccess;
+
+				if (voxelProbe != NULL) ORcudaSafeCall(cudaFree(voxelProbe));
+				if (allocationProbe != NULL) ORcudaSafeCall(cudaFree(allocationProbe));
+				if (!isAvailable) { cudaGetLastError(); return false; }
+#endif
+			}
+
+			ORUtils::MemoryBlock<TVoxel> *newVoxelBlocks = NULL;
+			ORUtils::MemoryBlock<int> *newAllocationList = NULL;
+			try
+			{
+				newVoxelBlocks = new ORUtils::MemoryBlock<TVoxel>(newSize, memoryType);
+				newAllocationList = new ORUtils::MemoryBlock<int>(newNoBlocks, memoryType);
+			}
+			catch (std::bad_alloc&)
+			{
+				delete newVoxelBlocks;
+				return false;
+			}
+
+			TVoxel *newVoxelData = newVoxelBlocks->GetData(memoryType);
+			int *newAllocationData = newAllocationList->GetData(memoryType);
+
+			// the new blocks go on top of the free list, in the order ResetScene would put them there
+			if (memoryType == MEMORYDEVICE_CUDA)
+			{
+#ifndef COMPILE_WITHOUT_CUDA
+				std::vector<TVoxel> clearedVoxels(newSize - oldSize);
+				std::vector<int> newFreeBlocks(noNewBlocks);
+				for (int i = 0; i < noNewBlocks; i++) newFreeBlocks[i] = oldNoBlocks + i;
+
+				ORcudaSafeCall(cudaMemcpy(newVoxelData, voxelBlocks->GetData(memoryType), oldSize * sizeof(TVoxel), cudaMemcpyDeviceToDevice));
+				ORcudaSafeCall(cudaMemcpy(newVoxelData + oldSize, &clearedVoxels[0], (newSize - oldSize) * sizeof(TVoxel), cudaMemcpyHostToDevice));
+				ORcudaSafeCall(cudaMemcpy(newAllocationData, allocationList->GetData(memoryType), noFreeBlocks * sizeof(int), cudaMemcpyDeviceToDevice));
+				ORcudaSafeCall(cudaMemcpy(newAllocationData + noFreeBlocks, &newFreeBlocks[0], noNewBlocks * sizeof(int), cudaMemcpyHostToDevice));
+#endif
+			}
+			else
+			{
+				memcpy(newVoxelData, voxelBlocks->GetData(memoryType), oldSize * sizeof(TVoxel));
+				for (size_t i = oldSize; i < newSize; i++) newVoxelData[i] = TVoxel();
+				memcpy(newAllocationData, allocationList->GetData(memoryType), noFreeBlocks * sizeof(int));
+				for (int i = 0; i < noNewBlocks; i++) newAllocationData[noFreeBlocks + i] = oldNoBlocks + i;
+			}
+
+			delete voxelBlocks; voxelBlocks = newVoxelBlocks;
+			delete allocationList; allocationList = newAllocationList;
+
+			noBlocks = newNoBlocks;
+			allocatedSize = (int)newSize;
+			lastFreeBlockId += noNewBlocks;
+
+			if (growthCallback != NULL) growthCallback(oldNoBlocks, newNoBlocks, growthCallbackData);
+			return true;
+		}
+
 	public:
 		inline TVoxel *GetVoxelBlocks(void) { return voxelBlocks->GetData(memoryType); }
 		inline const TVoxel *GetVoxelBlocks(void) const { return voxelBlocks->GetData(memoryType); }
@@ -33,6 +124,54 @@ namespace ITMLib
 
 		int allocatedSize;
 
+		/** Number of blocks the array currently holds. */
+		int GetNoBlocks(void) const { return noBlocks; }
+
+		/** Number of blocks the array may grow to. */
+		int GetMaxNoBlocks(void) const { return maxNoBlocks; }
+
+		/** Number of blocks the array grows by at a time, zero if it does not grow. */
+		int GetNoBlocksPerChunk(void) const { return noBlocksPerChunk; }
+
+		void SetGrowthCallback(GrowthCallback callback, void *userData)
+		{
+			growthCallback = callback;
+			growthCallbackData = userData;
+		}
+
+		/** Grows the array by whole chunks until at least @p noRequiredFreeBlocks
+		    blocks are free, without going past the high-water mark. This
+		    invalidates the pointers returned by GetVoxelBlocks and
+		    GetAllocationList. Returns whether enough blocks are free; the
+		    first time they are not, a warning is printed, since the blocks
+		    that do not fit will not be allocated.
+		*/
+		bool ReserveFreeBlocks(int noRequiredFreeBlocks)
+		{
+			int noMissingBlocks = noRequiredFreeBlocks - (lastFreeBlockId + 1);
+			if (noMissingBlocks <= 0) return true;
+
+			bool grown = false;
+			if (noBlocksPerChunk > 0 && noBlocks < maxNoBlocks)
+			{
+				long long noChunks = (noMissingBlocks + noBlocksPerChunk - 1) / noBlocksPerChunk;
+				long long newNoBlocks = noBlocks + noChunks * noBlocksPerChunk;
+				grown = Grow(newNoBlocks < maxNoBlocks ? (int)newNoBlocks : maxNoBlocks);
+				if (grown && lastFreeBlockId + 1 >= noRequiredFreeBlocks) return true;
+			}
+
+			if (!reportedOutOfBlocks)
+			{
+				if (noBlocksPerChunk > 0 && noBlocks < maxNoBlocks && !grown)
+					fprintf(stderr, "warning: could not allocate memory to grow the voxel block array beyond %d blocks, voxel blocks that do not fit will be dropped\n", noBlocks);
+				else
+					fprintf(stderr, "warning: the voxel block array cannot grow beyond %d blocks, voxel blocks that do not fit will be dropped\n", noBlocks);
+				reportedOutOfBlocks = true;
+			}
+
+			return false;
+		}
+
 		void SaveToDirectory(const std::string &outputDirectory) const
 		{
 			std::string VBFileName = outputDirectory + "voxel.dat";
@@ -61,12 +200,25 @@ namespace ITMLib
 			if (!ifs) throw std::runtime_error("Could not open " + AllocSizeFileName + " for reading");
 
 			ifs >> lastFreeBlockId >> allocatedSize;
+
+			noBlocks = (int)allocationList->dataSize;
+			if (maxNoBlocks < noBlocks) maxNoBlocks = noBlocks;
 		}
 
-		ITMLocalVBA(MemoryDeviceType memoryType, int noBlocks, int blockSize)
+		ITMLocalVBA(MemoryDeviceType memoryType, int noBlocks, int blockSize, int noBlocksPerChunk = 0, int maxNoBlocks = 0)
 		{
 			this->memoryType = memoryType;
 
+			this->noBlocks = noBlocks;
+			this->blockSize = blockSize;
+			this->noBlocksPerChunk = noBlocksPerChunk;
+			this->maxNoBlocks = maxNoBlocks < noBlocks ? noBlocks : maxNoBlocks;
+
+			growthCallback = NULL;
+			growthCallbackData = NULL;
+
+			reportedOutOfBlocks = false;
+
 			allocatedSize = noBlocks * blockSize;
 
 			voxelBlocks = new ORUtils::MemoryBlock<TVoxel>(allocatedSize, memoryType);
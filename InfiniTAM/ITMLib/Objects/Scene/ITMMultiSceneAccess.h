@@ -15,6 +15,7 @@ namespace ITMLib {
 	public:
 		typedef TIndex IndexType;
 		typedef ITMMultiCache IndexCache;
+		typedef ITMMultiCache NeighbourIndexCache;
 
 		struct IndexData
 		{
@@ -51,7 +52,11 @@ _CPU_AND_GPU_CODE_ inline float readFromSDF_float_uninterpolated(const TMultiVox
 		Vector3f point_local = voxelIndex->poses_vs[localMapId] * point;
 
 		int vmIndex_tmp;
+#if (defined(__CUDACC__) && defined(__CUDA_ARCH__)) || (defined(__METALC__))
 		typename TIndex::IndexCache cache;
+#else
+		typename TIndex::NeighbourIndexCache cache;
+#endif
 		const TVoxel & v = readVoxel(voxelData->voxels[localMapId], voxelIndex->index[localMapId], Vector3i((int)ROUND(point_local.x), (int)ROUND(point_local.y), (int)ROUND(point_local.z)), vmIndex_tmp, cache);
 		if (!vmIndex_tmp) continue;
 
@@ -77,7 +82,11 @@ _CPU_AND_GPU_CODE_ inline float readFromSDF_float_interpolated(const TMultiVoxel
 		Vector3f point_local = voxelIndex->poses_vs[localMapId] * point;
 
 		int vmIndex_tmp, maxW;
+#if (defined(__CUDACC__) && defined(__CUDA_ARCH__)) || (defined(__METALC__))
 		typename TIndex::IndexCache cache;
+#else
+		typename TIndex::NeighbourIndexCache cache;
+#endif
 		
 		float sdf = readFromSDF_float_interpolated(voxelData->voxels[localMapId], voxelIndex->index[localMapId], point_local, vmIndex_tmp, cache, maxW);
 		if (!vmIndex_tmp) continue;
@@ -104,7 +113,11 @@ _CPU_AND_GPU_CODE_ inline Vector4f readFromSDF_color4u_interpolated(const TMulti
 		Vector3f point_local = voxelIndex->poses_vs[localMapId] * point;
 
 		int maxW;
+#if (defined(__CUDACC__) && defined(__CUDA_ARCH__)) || (defined(__METALC__))
 		typename TIndex::IndexCache cache;
+#else
+		typename TIndex::NeighbourIndexCache cache;
+#endif
 		Vector4f val = readFromSDF_color4u_interpolated(voxelData->voxels[localMapId], voxelIndex->index[localMapId], point_local, cache, maxW);
 
 		accu += (float)maxW * val;
@@ -128,7 +141,11 @@ _CPU_AND_GPU_CODE_ inline float readWithConfidenceFromSDF_float_interpolated(THR
 		Vector3f point_local = voxelIndex->poses_vs[localMapId] * point;
 
 		int vmIndex_tmp;
+#if (defined(__CUDACC__) && defined(__CUDA_ARCH__)) || (defined(__METALC__))
 		typename TIndex::IndexCache cache;
+#else
+		typename TIndex::NeighbourIndexCache cache;
+#endif
 
 		float conf;
 		float sdf = readWithConfidenceFromSDF_float_interpolated(conf, voxelData->voxels[localMapId], voxelIndex->index[localMapId], point_local, vmIndex_tmp, cache);
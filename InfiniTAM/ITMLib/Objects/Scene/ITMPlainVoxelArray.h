@@ -5,6 +5,8 @@
 #ifndef __METALC__
 
 #include "../../Utils/ITMMath.h"
+#include "../../Utils/ITMSceneParams.h"
+#include "ITMBlockOccupancy.h"
 #include "../../../ORUtils/MemoryBlock.h"
 
 namespace ITMLib
@@ -34,6 +36,7 @@ namespace ITMLib
 
 		typedef ITMVoxelArrayInfo IndexData;
 		struct IndexCache {};
+		typedef IndexCache NeighbourIndexCache;
 
 	private:
 		ORUtils::MemoryBlock<IndexData> *indexData;
@@ -41,7 +44,7 @@ namespace ITMLib
 		MemoryDeviceType memoryType;
 
 	public:
-		ITMPlainVoxelArray(MemoryDeviceType memoryType)
+		ITMPlainVoxelArray(const ITMSceneParams *sceneParams, MemoryDeviceType memoryType)
 		{
 			this->memoryType = memoryType;
 
@@ -70,6 +73,9 @@ namespace ITMLib
 
 		const IndexData* getIndexData(void) const { return indexData->GetData(memoryType); }
 
+		/** The plain array has no blocks to skip, see ITMVoxelBlockHash::GetBlockOccupancy. */
+		const ITMBlockOccupancy *GetBlockOccupancy(void) const { return NULL; }
+
 		void SaveToDirectory(const std::string &outputDirectory) const
 		{
 		}
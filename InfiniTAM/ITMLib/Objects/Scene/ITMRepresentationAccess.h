@@ -4,8 +4,13 @@
 
 #include "ITMVoxelBlockHash.h"
 
-template<typename T> _CPU_AND_GPU_CODE_ inline int hashIndex(const THREADPTR(T) & blockPos) {
-	return (((uint)blockPos.x * 73856093u) ^ ((uint)blockPos.y * 19349669u) ^ ((uint)blockPos.z * 83492791u)) & (uint)SDF_HASH_MASK;
+template<typename T> _CPU_AND_GPU_CODE_ inline int hashIndex(const THREADPTR(T) & blockPos, int noBuckets) {
+	return (((uint)blockPos.x * 73856093u) ^ ((uint)blockPos.y * 19349669u) ^ ((uint)blockPos.z * 83492791u)) & (uint)(noBuckets - 1);
+}
+
+// the entry in front of a voxel block hash table records the number of buckets, see ITMVoxelBlockHash
+_CPU_AND_GPU_CODE_ inline int getHashBucketNum(const CONSTPTR(ITMHashEntry) *hashTable) {
+	return hashTable[-1].offset;
 }
 
 _CPU_AND_GPU_CODE_ inline int pointToVoxelBlockPos(const THREADPTR(Vector3i) & point, THREADPTR(Vector3i) &blockPos) {
@@ -30,7 +35,8 @@ _CPU_AND_GPU_CODE_ inline int findVoxel(const CONSTPTR(ITMLib::ITMVoxelBlockHash
 		return cache.blockPtr + linearIdx;
 	}
 
-	int hashIdx = hashIndex(blockPos);
+	int noBuckets = getHashBucketNum(voxelIndex);
+	int hashIdx = hashIndex(blockPos, noBuckets);
 
 	while (true)
 	{
@@ -44,7 +50,7 @@ _CPU_AND_GPU_CODE_ inline int findVoxel(const CONSTPTR(ITMLib::ITMVoxelBlockHash
 		}
 
 		if (hashEntry.offset < 1) break;
-		hashIdx = SDF_BUCKET_NUM + hashEntry.offset - 1;
+		hashIdx = noBuckets + hashEntry.offset - 1;
 	}
 
 	vmIndex = false;
@@ -79,7 +85,8 @@ _CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, co
 		return voxelData[cache.blockPtr + linearIdx];
 	}
 
-	int hashIdx = hashIndex(blockPos);
+	int noBuckets = getHashBucketNum(voxelIndex);
+	int hashIdx = hashIndex(blockPos, noBuckets);
 
 	while (true)
 	{
@@ -94,7 +101,7 @@ _CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, co
 		}
 
 		if (hashEntry.offset < 1) break;
-		hashIdx = SDF_BUCKET_NUM + hashEntry.offset - 1;
+		hashIdx = noBuckets + hashEntry.offset - 1;
 	}
 
 	vmIndex = false;
@@ -120,6 +127,66 @@ _CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, co
 	return result;
 }
 
+/** Looks up the block at @p blockPos in the hash. Returns the offset of the block's first voxel and sets @p vmIndex to its entry plus 1, or returns -1 and sets @p vmIndex to 0 if the block is not in memory. */
+_CPU_AND_GPU_CODE_ inline int findVoxelBlock(const CONSTPTR(ITMLib::ITMVoxelBlockHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & blockPos,
+	THREADPTR(int) &vmIndex)
+{
+	int noBuckets = getHashBucketNum(voxelIndex);
+	int hashIdx = hashIndex(blockPos, noBuckets);
+
+	while (true)
+	{
+		ITMHashEntry hashEntry = voxelIndex[hashIdx];
+
+		if (IS_EQUAL3(hashEntry.pos, blockPos) && hashEntry.ptr >= 0)
+		{
+			vmIndex = hashIdx + 1;
+			return hashEntry.ptr * SDF_BLOCK_SIZE3;
+		}
+
+		if (hashEntry.offset < 1) break;
+		hashIdx = noBuckets + hashEntry.offset - 1;
+	}
+
+	vmIndex = 0;
+	return -1;
+}
+
+/** Returns the entry of @p cache that holds the block at @p blockPos, after looking the block up in the hash unless it is cached already. */
+_CPU_AND_GPU_CODE_ inline int findCachedVoxelBlock(const CONSTPTR(ITMLib::ITMVoxelBlockHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & blockPos,
+	THREADPTR(ITMLib::ITMVoxelBlockHash::NeighbourIndexCache) & cache)
+{
+	int entryIdx = (blockPos.x & 1) + (blockPos.y & 1) * 2 + (blockPos.z & 1) * 4;
+	if IS_EQUAL3(blockPos, cache.blockPos[entryIdx]) return entryIdx;
+
+	cache.blockPos[entryIdx] = blockPos;
+	cache.blockPtr[entryIdx] = findVoxelBlock(voxelIndex, blockPos, cache.vmIndex[entryIdx]);
+	return entryIdx;
+}
+
+_CPU_AND_GPU_CODE_ inline int findVoxel(const CONSTPTR(ITMLib::ITMVoxelBlockHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & point,
+	THREADPTR(int) &vmIndex, THREADPTR(ITMLib::ITMVoxelBlockHash::NeighbourIndexCache) & cache)
+{
+	Vector3i blockPos;
+	int linearIdx = pointToVoxelBlockPos(point, blockPos);
+	int entryIdx = findCachedVoxelBlock(voxelIndex, blockPos, cache);
+
+	vmIndex = cache.vmIndex[entryIdx];
+	return vmIndex ? cache.blockPtr[entryIdx] + linearIdx : -1;
+}
+
+template<class TVoxel>
+_CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(ITMLib::ITMVoxelBlockHash::IndexData) *voxelIndex,
+	const THREADPTR(Vector3i) & point, THREADPTR(int) &vmIndex, THREADPTR(ITMLib::ITMVoxelBlockHash::NeighbourIndexCache) & cache)
+{
+	Vector3i blockPos;
+	int linearIdx = pointToVoxelBlockPos(point, blockPos);
+	int entryIdx = findCachedVoxelBlock(voxelIndex, blockPos, cache);
+
+	vmIndex = cache.vmIndex[entryIdx];
+	return vmIndex ? voxelData[cache.blockPtr[entryIdx] + linearIdx] : TVoxel();
+}
+
 template<class TVoxel, class TIndex>
 _CPU_AND_GPU_CODE_ inline float readFromSDF_float_uninterpolated(const CONSTPTR(TVoxel) *voxelData,
 	const CONSTPTR(TIndex) *voxelIndex, Vector3f point, THREADPTR(int) &vmIndex)
@@ -519,6 +586,89 @@ _CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, co
 	return readVoxel(voxelData, voxelIndex, point_orig, vmIndex);
 }
 
+#include "ITMVoxelBlockCuckooHash.h"
+
+/** Looks up the block at @p blockPos in the cuckoo hash, see the findVoxelBlock of ITMVoxelBlockHash. */
+_CPU_AND_GPU_CODE_ inline int findVoxelBlock(const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & blockPos,
+	THREADPTR(int) &vmIndex)
+{
+	int entryId = findCuckooHashEntry(voxelIndex, blockPos);
+	vmIndex = entryId + 1;
+	return entryId >= 0 ? voxelIndex[entryId / CUCKOO_BUCKET_SIZE].entries[entryId % CUCKOO_BUCKET_SIZE].ptr * SDF_BLOCK_SIZE3 : -1;
+}
+
+_CPU_AND_GPU_CODE_ inline int findCachedVoxelBlock(const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & blockPos,
+	THREADPTR(ITMLib::ITMVoxelBlockCuckooHash::NeighbourIndexCache) & cache)
+{
+	int entryIdx = (blockPos.x & 1) + (blockPos.y & 1) * 2 + (blockPos.z & 1) * 4;
+	if IS_EQUAL3(blockPos, cache.blockPos[entryIdx]) return entryIdx;
+
+	cache.blockPos[entryIdx] = blockPos;
+	cache.blockPtr[entryIdx] = findVoxelBlock(voxelIndex, blockPos, cache.vmIndex[entryIdx]);
+	return entryIdx;
+}
+
+_CPU_AND_GPU_CODE_ inline int findVoxel(const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & point,
+	THREADPTR(int) &vmIndex, THREADPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexCache) & cache)
+{
+	Vector3i blockPos;
+	int linearIdx = pointToVoxelBlockPos(point, blockPos);
+
+	if IS_EQUAL3(blockPos, cache.blockPos)
+	{
+		vmIndex = true;
+		return cache.blockPtr + linearIdx;
+	}
+
+	int blockPtr = findVoxelBlock(voxelIndex, blockPos, vmIndex);
+	if (!vmIndex) return -1;
+
+	cache.blockPos = blockPos; cache.blockPtr = blockPtr;
+	return blockPtr + linearIdx;
+}
+
+_CPU_AND_GPU_CODE_ inline int findVoxel(const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & point,
+	THREADPTR(int) &vmIndex, THREADPTR(ITMLib::ITMVoxelBlockCuckooHash::NeighbourIndexCache) & cache)
+{
+	Vector3i blockPos;
+	int linearIdx = pointToVoxelBlockPos(point, blockPos);
+	int entryIdx = findCachedVoxelBlock(voxelIndex, blockPos, cache);
+
+	vmIndex = cache.vmIndex[entryIdx];
+	return vmIndex ? cache.blockPtr[entryIdx] + linearIdx : -1;
+}
+
+_CPU_AND_GPU_CODE_ inline int findVoxel(const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex, const THREADPTR(Vector3i) & point,
+	THREADPTR(int) &vmIndex)
+{
+	ITMLib::ITMVoxelBlockCuckooHash::IndexCache cache;
+	return findVoxel(voxelIndex, point, vmIndex, cache);
+}
+
+template<class TVoxel>
+_CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex,
+	const THREADPTR(Vector3i) & point, THREADPTR(int) &vmIndex, THREADPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexCache) & cache)
+{
+	int voxelAddress = findVoxel(voxelIndex, point, vmIndex, cache);
+	return vmIndex ? voxelData[voxelAddress] : TVoxel();
+}
+
+template<class TVoxel>
+_CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex,
+	const THREADPTR(Vector3i) & point, THREADPTR(int) &vmIndex, THREADPTR(ITMLib::ITMVoxelBlockCuckooHash::NeighbourIndexCache) & cache)
+{
+	int voxelAddress = findVoxel(voxelIndex, point, vmIndex, cache);
+	return vmIndex ? voxelData[voxelAddress] : TVoxel();
+}
+
+template<class TVoxel>
+_CPU_AND_GPU_CODE_ inline TVoxel readVoxel(const CONSTPTR(TVoxel) *voxelData, const CONSTPTR(ITMLib::ITMVoxelBlockCuckooHash::IndexData) *voxelIndex,
+	const THREADPTR(Vector3i) & point, THREADPTR(int) &vmIndex)
+{
+	ITMLib::ITMVoxelBlockCuckooHash::IndexCache cache;
+	return readVoxel(voxelData, voxelIndex, point, vmIndex, cache);
+}
+
 /**
 * \brief The specialisations of this struct template can be used to write/read colours to/from surfels.
 *
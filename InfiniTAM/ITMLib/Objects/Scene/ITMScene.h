@@ -40,10 +40,11 @@ namespace ITMLib
 			index.LoadFromDirectory(outputDirectory);			
 		}
 
-		ITMScene(const ITMSceneParams *_sceneParams, bool _useSwapping, MemoryDeviceType _memoryType)
-			: sceneParams(_sceneParams), index(_memoryType), localVBA(_memoryType, index.getNumAllocatedVoxelBlocks(), index.getVoxelBlockSize())
+		ITMScene(const ITMSceneParams *_sceneParams, bool _useSwapping, MemoryDeviceType _memoryType,
+			const char *_swappingBlockFile = NULL, int _swappingMaxResidentBlocks = 0)
+			: sceneParams(_sceneParams), index(_sceneParams, _memoryType), localVBA(_memoryType, index.getNumAllocatedVoxelBlocks(), index.getVoxelBlockSize(), _sceneParams->noVoxelBlocksPerChunk, _sceneParams->maxVoxelBlocks)
 		{
-			if (_useSwapping) globalCache = new ITMGlobalCache<TVoxel>();
+			if (_useSwapping) globalCache = new ITMGlobalCache<TVoxel>(_sceneParams, _swappingBlockFile, _swappingMaxResidentBlocks);
 			else globalCache = NULL;
 		}
 
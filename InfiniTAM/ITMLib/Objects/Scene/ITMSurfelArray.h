@@ -0,0 +1,484 @@
+// InfiniTAM: Surffuse. Copyright (c) Torr Vision Group and the authors of InfiniTAM, 2016.
+
+#pragma once
+
+#include "../../../ORUtils/MemoryBlock.h"
+#include "../../Utils/ITMMath.h"
+#include "ITMRepresentationAccess.h"
+#include "ITMSurfelTypes.h"
+
+namespace ITMLib
+{
+  //#################### TYPES ####################
+
+  /**
+   * \brief The specialisations of this struct template determine how the surfels of a scene are laid out in memory.
+   *
+   * By default, surfels are stored as a structure of arrays, with one array per field. The passes over all of the
+   * surfels in a scene (e.g. projecting them into an index image) only need a few of the fields of each surfel,
+   * so this saves them from pulling the other fields through the cache. A surfel type can be stored as an array
+   * of structures instead by specialising this template.
+   *
+   * \tparam TSurfel  The type of surfel.
+   */
+  template <typename TSurfel>
+  struct ITMSurfelStorageTraits
+  {
+    /** Whether or not to store the surfels as a structure of arrays. */
+    static const bool useSoA = true;
+  };
+
+  /**
+   * \brief The specialisations of this struct template give the type of a pointer to the elements of one of the arrays in which surfels are stored.
+   *
+   * \tparam T        The type of the elements.
+   * \tparam isConst  Whether the elements are read-only (true) or can be written (false).
+   */
+  template <typename T, bool isConst> struct ITMSurfelFieldPointer { typedef T *Type; };
+  template <typename T> struct ITMSurfelFieldPointer<T,true> { typedef const T *Type; };
+
+  /**
+   * \brief An instance of an instantiation of this class template points at the surfels of a scene in one type of memory.
+   *
+   * Surfels can be read as a whole, or, for the fields that the passes over all surfels need, one field at a time.
+   * This is the part that the read-only and read-write views of the surfels share; they only differ in whether their
+   * pointers are const.
+   *
+   * \tparam TSurfel  The type of surfel.
+   * \tparam useSoA   Whether the surfels are stored as a structure of arrays (true) or an array of structures (false).
+   * \tparam isConst  Whether the surfels are read-only (true) or can be written (false).
+   */
+  template <typename TSurfel, bool useSoA, bool isConst> class ITMSurfelArrayBase;
+
+  /**
+   * \brief An instance of an instantiation of this class template points at surfels that are stored as an array of structures.
+   */
+  template <typename TSurfel, bool isConst>
+  class ITMSurfelArrayBase<TSurfel,false,isConst>
+  {
+    //#################### PUBLIC VARIABLES ####################
+  public:
+    /** The surfels. */
+    typename ITMSurfelFieldPointer<TSurfel,isConst>::Type surfels;
+
+    //#################### PUBLIC MEMBER FUNCTIONS ####################
+  public:
+    _CPU_AND_GPU_CODE_ TSurfel Get(int surfelId) const { return surfels[surfelId]; }
+    _CPU_AND_GPU_CODE_ Vector3u GetColour(int surfelId) const { return SurfelColourManipulator<TSurfel::hasColourInformation>::read(surfels[surfelId]); }
+    _CPU_AND_GPU_CODE_ float GetConfidence(int surfelId) const { return surfels[surfelId].confidence; }
+    _CPU_AND_GPU_CODE_ Vector3f GetNormal(int surfelId) const { return surfels[surfelId].normal; }
+    _CPU_AND_GPU_CODE_ Vector3f GetPosition(int surfelId) const { return surfels[surfelId].position; }
+    _CPU_AND_GPU_CODE_ float GetRadius(int surfelId) const { return surfels[surfelId].radius; }
+    _CPU_AND_GPU_CODE_ int GetTimestamp(int surfelId) const { return surfels[surfelId].timestamp; }
+  };
+
+  /**
+   * \brief An instance of an instantiation of this class template points at surfels that are stored as a structure of arrays.
+   *
+   * The vector-valued fields are stored using the plain vector structs, which (unlike the vector classes) can safely be cleared with memset.
+   */
+  template <typename TSurfel, bool isConst>
+  class ITMSurfelArrayBase<TSurfel,true,isConst>
+  {
+    //#################### PUBLIC VARIABLES ####################
+  public:
+    /** The colours of the surfels (NULL for surfel types that cannot store colour information). */
+    typename ITMSurfelFieldPointer<ORUtils::Vector3_<uchar>,isConst>::Type colours;
+
+    /** The confidence counters of the surfels. */
+    typename ITMSurfelFieldPointer<float,isConst>::Type confidences;
+
+    /** The surface normals at the surfels. */
+    typename ITMSurfelFieldPointer<ORUtils::Vector3_<float>,isConst>::Type normals;
+
+    /** The positions of the surfels. */
+    typename ITMSurfelFieldPointer<ORUtils::Vector3_<float>,isConst>::Type positions;
+
+    /** The radii of the surfels. */
+    typename ITMSurfelFieldPointer<float,isConst>::Type radii;
+
+    /** The timestamps of the surfels. */
+    typename ITMSurfelFieldPointer<int,isConst>::Type timestamps;
+
+#if DEBUG_CORRESPONDENCES
+    /** The new positions of the surfels (prior to fusing). */
+    typename ITMSurfelFieldPointer<ORUtils::Vector3_<float>,isConst>::Type newPositions;
+
+    /** The old positions of the surfels (prior to fusing). */
+    typename ITMSurfelFieldPointer<ORUtils::Vector3_<float>,isConst>::Type oldPositions;
+#endif
+
+    //#################### PUBLIC MEMBER FUNCTIONS ####################
+  public:
+    _CPU_AND_GPU_CODE_
+    TSurfel Get(int surfelId) const
+    {
+      TSurfel surfel;
+      if(TSurfel::hasColourInformation) SurfelColourManipulator<TSurfel::hasColourInformation>::write(surfel, GetColour(surfelId));
+      surfel.confidence = confidences[surfelId];
+      surfel.normal = GetNormal(surfelId);
+      surfel.position = GetPosition(surfelId);
+      surfel.radius = radii[surfelId];
+      surfel.timestamp = timestamps[surfelId];
+#if DEBUG_CORRESPONDENCES
+      surfel.newPosition = Vector3f(newPositions[surfelId].x, newPositions[surfelId].y, newPositions[surfelId].z);
+      surfel.oldPosition = Vector3f(oldPositions[surfelId].x, oldPositions[surfelId].y, oldPositions[surfelId].z);
+#endif
+      return surfel;
+    }
+
+    _CPU_AND_GPU_CODE_
+    Vector3u GetColour(int surfelId) const
+    {
+      return TSurfel::hasColourInformation ? Vector3u(colours[surfelId].x, colours[surfelId].y, colours[surfelId].z) : Vector3u((uchar)0);
+    }
+
+    _CPU_AND_GPU_CODE_ float GetConfidence(int surfelId) const { return confidences[surfelId]; }
+    _CPU_AND_GPU_CODE_ Vector3f GetNormal(int surfelId) const { return Vector3f(normals[surfelId].x, normals[surfelId].y, normals[surfelId].z); }
+    _CPU_AND_GPU_CODE_ Vector3f GetPosition(int surfelId) const { return Vector3f(positions[surfelId].x, positions[surfelId].y, positions[surfelId].z); }
+    _CPU_AND_GPU_CODE_ float GetRadius(int surfelId) const { return radii[surfelId]; }
+    _CPU_AND_GPU_CODE_ int GetTimestamp(int surfelId) const { return timestamps[surfelId]; }
+  };
+
+  /**
+   * \brief An instance of an instantiation of this class template provides read-only access to the surfels of a scene in one type of memory.
+   *
+   * Instances are lightweight views of the scene's memory that can be copied freely, e.g. to pass them to CUDA kernels.
+   *
+   * \tparam TSurfel  The type of surfel.
+   * \tparam useSoA   Whether the surfels are stored as a structure of arrays (true) or an array of structures (false).
+   */
+  template <typename TSurfel, bool useSoA = ITMSurfelStorageTraits<TSurfel>::useSoA>
+  class ITMConstSurfelArray : public ITMSurfelArrayBase<TSurfel,useSoA,true> {};
+
+  /**
+   * \brief An instance of an instantiation of this class template provides read-write access to the surfels of a scene in one type of memory.
+   *
+   * Instances can only be obtained from non-const surfel storage. They convert implicitly to read-only views, but since
+   * template argument deduction does not look at conversions, they must be converted explicitly to pass them to function
+   * templates that take a read-only view.
+   *
+   * \tparam TSurfel  The type of surfel.
+   * \tparam useSoA   Whether the surfels are stored as a structure of arrays (true) or an array of structures (false).
+   */
+  template <typename TSurfel, bool useSoA = ITMSurfelStorageTraits<TSurfel>::useSoA> class ITMSurfelArray;
+
+  /**
+   * \brief An instance of an instantiation of this class template provides read-write access to surfels that are stored as an array of structures.
+   */
+  template <typename TSurfel>
+  class ITMSurfelArray<TSurfel,false> : public ITMSurfelArrayBase<TSurfel,false,false>
+  {
+    //#################### PUBLIC OPERATORS ####################
+  public:
+    /** Gets a read-only view of the same surfels. */
+    _CPU_AND_GPU_CODE_
+    operator ITMConstSurfelArray<TSurfel,false>() const
+    {
+      ITMConstSurfelArray<TSurfel,false> surfelArray;
+      surfelArray.surfels = this->surfels;
+      return surfelArray;
+    }
+
+    //#################### PUBLIC MEMBER FUNCTIONS ####################
+  public:
+    /**
+     * \brief Calls the specified function on each of the arrays in which the surfels are stored.
+     *
+     * \param f The function, which must accept a pointer to the start of the array.
+     */
+    template <typename F>
+    void ForEachField(const F& f) const
+    {
+      f(this->surfels);
+    }
+
+    _CPU_AND_GPU_CODE_ void Set(int surfelId, const TSurfel& surfel) const { this->surfels[surfelId] = surfel; }
+  };
+
+  /**
+   * \brief An instance of an instantiation of this class template provides read-write access to surfels that are stored as a structure of arrays.
+   */
+  template <typename TSurfel>
+  class ITMSurfelArray<TSurfel,true> : public ITMSurfelArrayBase<TSurfel,true,false>
+  {
+    //#################### PUBLIC OPERATORS ####################
+  public:
+    /** Gets a read-only view of the same surfels. */
+    _CPU_AND_GPU_CODE_
+    operator ITMConstSurfelArray<TSurfel,true>() const
+    {
+      ITMConstSurfelArray<TSurfel,true> surfelArray;
+      surfelArray.colours = this->colours;
+      surfelArray.confidences = this->confidences;
+      surfelArray.normals = this->normals;
+      surfelArray.positions = this->positions;
+      surfelArray.radii = this->radii;
+      surfelArray.timestamps = this->timestamps;
+#if DEBUG_CORRESPONDENCES
+      surfelArray.newPositions = this->newPositions;
+      surfelArray.oldPositions = this->oldPositions;
+#endif
+      return surfelArray;
+    }
+
+    //#################### PUBLIC MEMBER FUNCTIONS ####################
+  public:
+    /**
+     * \brief Calls the specified function on each of the arrays in which the surfels are stored.
+     *
+     * \param f The function, which must accept a pointer to the start of the array.
+     */
+    template <typename F>
+    void ForEachField(const F& f) const
+    {
+      if(TSurfel::hasColourInformation) f(this->colours);
+      f(this->confidences);
+      f(this->normals);
+      f(this->positions);
+      f(this->radii);
+      f(this->timestamps);
+#if DEBUG_CORRESPONDENCES
+      f(this->newPositions);
+      f(this->oldPositions);
+#endif
+    }
+
+    _CPU_AND_GPU_CODE_
+    void Set(int surfelId, const TSurfel& surfel) const
+    {
+      if(TSurfel::hasColourInformation) this->colours[surfelId] = SurfelColourManipulator<TSurfel::hasColourInformation>::read(surfel);
+      this->confidences[surfelId] = surfel.confidence;
+      this->normals[surfelId] = surfel.normal;
+      this->positions[surfelId] = surfel.position;
+      this->radii[surfelId] = surfel.radius;
+      this->timestamps[surfelId] = surfel.timestamp;
+#if DEBUG_CORRESPONDENCES
+      this->newPositions[surfelId] = surfel.newPosition;
+      this->oldPositions[surfelId] = surfel.oldPosition;
+#endif
+    }
+  };
+
+  /**
+   * \brief An instance of an instantiation of this class template owns the memory in which the surfels of a scene are stored.
+   *
+   * \tparam TSurfel  The type of surfel.
+   * \tparam useSoA   Whether the surfels are stored as a structure of arrays (true) or an array of structures (false).
+   */
+  template <typename TSurfel, bool useSoA = ITMSurfelStorageTraits<TSurfel>::useSoA> class ITMSurfelStorage;
+
+  /**
+   * \brief An instance of an instantiation of this class template owns surfels that are stored as an array of structures.
+   */
+  template <typename TSurfel>
+  class ITMSurfelStorage<TSurfel,false>
+  {
+    //#################### PRIVATE VARIABLES ####################
+  private:
+    /** The surfels. */
+    ORUtils::MemoryBlock<TSurfel> m_surfelsMB;
+
+    //#################### CONSTRUCTORS ####################
+  public:
+    /**
+     * \brief Constructs the storage for the specified number of surfels, on both the CPU and (if available) the GPU.
+     *
+     * \param capacity  The maximum number of surfels to store.
+     */
+    explicit ITMSurfelStorage(size_t capacity)
+    : m_surfelsMB(capacity, true, true)
+    {}
+
+    //#################### PUBLIC MEMBER FUNCTIONS ####################
+  public:
+    /**
+     * \brief Gets a read-write view of the surfels in the specified type of memory.
+     *
+     * \param memoryType  The type of memory.
+     * \return            A read-write view of the surfels in the specified type of memory.
+     */
+    ITMSurfelArray<TSurfel,false> GetArray(MemoryDeviceType memoryType)
+    {
+      ITMSurfelArray<TSurfel,false> surfelArray;
+      surfelArray.surfels = m_surfelsMB.GetData(memoryType);
+      return surfelArray;
+    }
+
+    /**
+     * \brief Gets a read-only view of the surfels in the specified type of memory.
+     *
+     * \param memoryType  The type of memory.
+     * \return            A read-only view of the surfels in the specified type of memory.
+     */
+    ITMConstSurfelArray<TSurfel,false> GetArray(MemoryDeviceType memoryType) const
+    {
+      ITMConstSurfelArray<TSurfel,false> surfelArray;
+      surfelArray.surfels = m_surfelsMB.GetData(memoryType);
+      return surfelArray;
+    }
+
+    /** Gets the maximum number of surfels that can be stored. */
+    size_t GetCapacity() const
+    {
+      return m_surfelsMB.dataSize;
+    }
+
+    /** Copies the surfels from the GPU to the CPU. */
+    void UpdateHostFromDevice()
+    {
+      m_surfelsMB.UpdateHostFromDevice();
+    }
+
+    /** Copies the surfels from the CPU to the GPU. */
+    void UpdateDeviceFromHost()
+    {
+      m_surfelsMB.UpdateDeviceFromHost();
+    }
+  };
+
+  /**
+   * \brief An instance of an instantiation of this class template owns surfels that are stored as a structure of arrays.
+   */
+  template <typename TSurfel>
+  class ITMSurfelStorage<TSurfel,true>
+  {
+    //#################### PRIVATE VARIABLES ####################
+  private:
+    /** The colours of the surfels (empty for surfel types that cannot store colour information). */
+    ORUtils::MemoryBlock<ORUtils::Vector3_<uchar> > m_coloursMB;
+
+    /** The confidence counters of the surfels. */
+    ORUtils::MemoryBlock<float> m_confidencesMB;
+
+    /** The surface normals at the surfels. */
+    ORUtils::MemoryBlock<ORUtils::Vector3_<float> > m_normalsMB;
+
+    /** The positions of the surfels. */
+    ORUtils::MemoryBlock<ORUtils::Vector3_<float> > m_positionsMB;
+
+    /** The radii of the surfels. */
+    ORUtils::MemoryBlock<float> m_radiiMB;
+
+    /** The timestamps of the surfels. */
+    ORUtils::MemoryBlock<int> m_timestampsMB;
+
+#if DEBUG_CORRESPONDENCES
+    /** The new positions of the surfels (prior to fusing). */
+    ORUtils::MemoryBlock<ORUtils::Vector3_<float> > m_newPositionsMB;
+
+    /** The old positions of the surfels (prior to fusing). */
+    ORUtils::MemoryBlock<ORUtils::Vector3_<float> > m_oldPositionsMB;
+#endif
+
+    //#################### CONSTRUCTORS ####################
+  public:
+    /**
+     * \brief Constructs the storage for the specified number of surfels, on both the CPU and (if available) the GPU.
+     *
+     * \param capacity  The maximum number of surfels to store.
+     */
+    explicit ITMSurfelStorage(size_t capacity)
+    : m_coloursMB(TSurfel::hasColourInformation ? capacity : 0, true, true),
+      m_confidencesMB(capacity, true, true),
+      m_normalsMB(capacity, true, true),
+      m_positionsMB(capacity, true, true),
+      m_radiiMB(capacity, true, true),
+      m_timestampsMB(capacity, true, true)
+#if DEBUG_CORRESPONDENCES
+      , m_newPositionsMB(capacity, true, true),
+      m_oldPositionsMB(capacity, true, true)
+#endif
+    {}
+
+    //#################### PUBLIC MEMBER FUNCTIONS ####################
+  public:
+    /**
+     * \brief Gets a read-write view of the surfels in the specified type of memory.
+     *
+     * \param memoryType  The type of memory.
+     * \return            A read-write view of the surfels in the specified type of memory.
+     */
+    ITMSurfelArray<TSurfel,true> GetArray(MemoryDeviceType memoryType)
+    {
+      ITMSurfelArray<TSurfel,true> surfelArray;
+      FillArray(*this, surfelArray, memoryType);
+      return surfelArray;
+    }
+
+    /**
+     * \brief Gets a read-only view of the surfels in the specified type of memory.
+     *
+     * \param memoryType  The type of memory.
+     * \return            A read-only view of the surfels in the specified type of memory.
+     */
+    ITMConstSurfelArray<TSurfel,true> GetArray(MemoryDeviceType memoryType) const
+    {
+      ITMConstSurfelArray<TSurfel,true> surfelArray;
+      FillArray(*this, surfelArray, memoryType);
+      return surfelArray;
+    }
+
+    /** Gets the maximum number of surfels that can be stored. */
+    size_t GetCapacity() const
+    {
+      return m_positionsMB.dataSize;
+    }
+
+    /** Copies the surfels from the GPU to the CPU. */
+    void UpdateHostFromDevice()
+    {
+      if(TSurfel::hasColourInformation) m_coloursMB.UpdateHostFromDevice();
+      m_confidencesMB.UpdateHostFromDevice();
+      m_normalsMB.UpdateHostFromDevice();
+      m_positionsMB.UpdateHostFromDevice();
+      m_radiiMB.UpdateHostFromDevice();
+      m_timestampsMB.UpdateHostFromDevice();
+#if DEBUG_CORRESPONDENCES
+      m_newPositionsMB.UpdateHostFromDevice();
+      m_oldPositionsMB.UpdateHostFromDevice();
+#endif
+    }
+
+    /** Copies the surfels from the CPU to the GPU. */
+    void UpdateDeviceFromHost()
+    {
+      if(TSurfel::hasColourInformation) m_coloursMB.UpdateDeviceFromHost();
+      m_confidencesMB.UpdateDeviceFromHost();
+      m_normalsMB.UpdateDeviceFromHost();
+      m_positionsMB.UpdateDeviceFromHost();
+      m_radiiMB.UpdateDeviceFromHost();
+      m_timestampsMB.UpdateDeviceFromHost();
+#if DEBUG_CORRESPONDENCES
+      m_newPositionsMB.UpdateDeviceFromHost();
+      m_oldPositionsMB.UpdateDeviceFromHost();
+#endif
+    }
+
+    //#################### PRIVATE STATIC MEMBER FUNCTIONS ####################
+  private:
+    /**
+     * \brief Points a view of the surfels at the arrays in the specified type of memory.
+     *
+     * The view gets const pointers from const storage, so read-write views can only be filled from non-const storage.
+     *
+     * \param storage     The storage.
+     * \param surfelArray The view.
+     * \param memoryType  The type of memory.
+     */
+    template <typename TStorage, typename TSurfelArray>
+    static void FillArray(TStorage& storage, TSurfelArray& surfelArray, MemoryDeviceType memoryType)
+    {
+      surfelArray.colours = TSurfel::hasColourInformation ? storage.m_coloursMB.GetData(memoryType) : NULL;
+      surfelArray.confidences = storage.m_confidencesMB.GetData(memoryType);
+      surfelArray.normals = storage.m_normalsMB.GetData(memoryType);
+      surfelArray.positions = storage.m_positionsMB.GetData(memoryType);
+      surfelArray.radii = storage.m_radiiMB.GetData(memoryType);
+      surfelArray.timestamps = storage.m_timestampsMB.GetData(memoryType);
+#if DEBUG_CORRESPONDENCES
+      surfelArray.newPositions = storage.m_newPositionsMB.GetData(memoryType);
+      surfelArray.oldPositions = storage.m_oldPositionsMB.GetData(memoryType);
+#endif
+    }
+  };
+}
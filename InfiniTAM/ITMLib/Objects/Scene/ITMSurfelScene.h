@@ -5,7 +5,9 @@
 #include <cassert>
 
 #include "../../../ORUtils/MemoryBlock.h"
+#include "../../Utils/ITMMath.h"
 #include "../../Utils/ITMSurfelSceneParams.h"
+#include "ITMSurfelArray.h"
 
 namespace ITMLib
 {
@@ -14,27 +16,61 @@ namespace ITMLib
   /** The maximum number of surfels that we can store in a scene. */
   const size_t MAX_SURFEL_COUNT = 5000000;
 
+  /** The number of consecutive surfels in each of the blocks of the scene's spatial index. */
+  const int SURFEL_BLOCK_SIZE = 1024;
+
   //#################### TYPES ####################
 
+  /**
+   * \brief An instance of this struct holds the bounding box of the positions of the surfels in a block of the scene's spatial index.
+   *
+   * The corners are stored as plain (trivially constructible) vectors, so that the memory block that holds the bounds can be cleared with memset.
+   */
+  struct ITMSurfelBlockBounds
+  {
+    /** The lower corner of the bounding box. */
+    ORUtils::Vector3_<float> minPos;
+
+    /** The upper corner of the bounding box. */
+    ORUtils::Vector3_<float> maxPos;
+  };
+
   /**
    * \brief An instance of an instantiation of this class template represents a surfel-based scene.
+   *
+   * The scene keeps a coarse spatial index of its surfels, which allows the surfels that cannot be in view to be skipped when rendering.
+   * Since new surfels are added for the parts of the scene in view in each frame, and removing surfels does not change the order of the
+   * others, consecutive surfels tend to be close together in space. The index thus simply splits the surfel array into blocks of
+   * SURFEL_BLOCK_SIZE consecutive surfels, and stores the bounding box of the surfel positions in each block. It is updated by the
+   * CPU reconstruction engine at the end of each frame's integration, and only covers the surfels up to GetIndexedSurfelCount().
+   * Within that range, blocks whose surfels have been updated in place (e.g. by fusion) since the last update are marked as dirty.
+   * An update thus only has to recalculate the dirty blocks and the blocks beyond the range, whose surfels have been added or moved.
    */
   template <typename TSurfel>
   class ITMSurfelScene
   {
     //#################### PRIVATE VARIABLES ####################
   private:
+    /** The number of surfels at the start of the scene that are covered by the spatial index. */
+    size_t m_indexedSurfelCount;
+
     /** The type of memory in which the scene is stored. */
     MemoryDeviceType m_memoryType;
 
     /** The scene parameters. */
     const ITMSurfelSceneParams *m_params;
 
+    /** The bounding boxes of the blocks of surfels in the spatial index. */
+    ORUtils::MemoryBlock<ITMSurfelBlockBounds> *m_surfelBlockBoundsMB;
+
+    /** Flags indicating which blocks of surfels have been updated in place since their bounding boxes were last calculated. */
+    ORUtils::MemoryBlock<unsigned char> *m_surfelBlockDirtyFlagsMB;
+
     /** The number of surfels currently in the scene. */
     size_t m_surfelCount;
 
-    /** The surfels in the scene. */
-    ORUtils::MemoryBlock<TSurfel> *m_surfelsMB;
+    /** The surfels in the scene, laid out in memory as specified by ITMSurfelStorageTraits<TSurfel>. */
+    ITMSurfelStorage<TSurfel> *m_surfels;
 
     //#################### CONSTRUCTORS ####################
   public:
@@ -45,10 +81,13 @@ namespace ITMLib
      * \param memoryType  The type of memory in which to store the scene.
      */
     ITMSurfelScene(const ITMSurfelSceneParams *params, MemoryDeviceType memoryType)
-      : m_memoryType(memoryType),
+      : m_indexedSurfelCount(0),
+        m_memoryType(memoryType),
         m_params(params),
+        m_surfelBlockBoundsMB(new ORUtils::MemoryBlock<ITMSurfelBlockBounds>((MAX_SURFEL_COUNT + SURFEL_BLOCK_SIZE - 1) / SURFEL_BLOCK_SIZE, true, false)),
+        m_surfelBlockDirtyFlagsMB(new ORUtils::MemoryBlock<unsigned char>((MAX_SURFEL_COUNT + SURFEL_BLOCK_SIZE - 1) / SURFEL_BLOCK_SIZE, true, false)),
         m_surfelCount(0),
-        m_surfelsMB(new ORUtils::MemoryBlock<TSurfel>(MAX_SURFEL_COUNT, true, true))
+        m_surfels(new ITMSurfelStorage<TSurfel>(MAX_SURFEL_COUNT))
     {}
 
     //#################### DESTRUCTOR ####################
@@ -58,7 +97,9 @@ namespace ITMLib
      */
     ~ITMSurfelScene()
     {
-      delete m_surfelsMB;
+      delete m_surfelBlockBoundsMB;
+      delete m_surfelBlockDirtyFlagsMB;
+      delete m_surfels;
     }
 
     //#################### COPY CONSTRUCTOR & ASSIGNMENT OPERATOR ####################
@@ -73,14 +114,14 @@ namespace ITMLib
      * \brief Allocates a contiguous block of memory to store the specified number of new surfels.
      *
      * \param newSurfelCount  The number of new surfels for which to allocate space.
-     * \return                A pointer to the start of the allocated memory.
+     * \return                The ID of the first new surfel, or -1 if there is not enough space for the new surfels.
      */
-    TSurfel *AllocateSurfels(size_t newSurfelCount)
+    int AllocateSurfels(size_t newSurfelCount)
     {
-      if(m_surfelCount + newSurfelCount > m_surfelsMB->dataSize) return NULL;
-      TSurfel *newSurfels = m_surfelsMB->GetData(m_memoryType) + m_surfelCount;
+      if(m_surfelCount + newSurfelCount > m_surfels->GetCapacity()) return -1;
+      int firstNewSurfelId = static_cast<int>(m_surfelCount);
       m_surfelCount += newSurfelCount;
-      return newSurfels;
+      return firstNewSurfelId;
     }
 
     /**
@@ -90,10 +131,49 @@ namespace ITMLib
      * Deallocation thus simply involves decreasing our count of the number of surfels allocated.
      *
      * \param removedSurfelCount  The number of "removed" surfels that should be deallocated.
+     * \param firstMovedSurfelId  The ID of the first surfel that the removal may have moved (the surfels before it must be unchanged).
      */
-    void DeallocateRemovedSurfels(size_t removedSurfelCount)
+    void DeallocateRemovedSurfels(size_t removedSurfelCount, size_t firstMovedSurfelId)
     {
       m_surfelCount -= removedSurfelCount;
+
+      // The surfels from the first moved surfel onwards are no longer where the spatial index says they are.
+      if(removedSurfelCount > 0 && firstMovedSurfelId < m_indexedSurfelCount) m_indexedSurfelCount = firstMovedSurfelId;
+    }
+
+    /**
+     * \brief Gets the number of blocks of surfels that are covered by the spatial index.
+     *
+     * A block is covered if all of its surfels are covered by the index. If the index covers the whole scene,
+     * this includes the last block, even if it is only partly full. The bounding box of a covered block is
+     * valid unless the block is marked as dirty.
+     *
+     * \return  The number of blocks of surfels that are covered by the spatial index.
+     */
+    int GetIndexedSurfelBlockCount() const
+    {
+      if(m_indexedSurfelCount == m_surfelCount) return static_cast<int>((m_surfelCount + SURFEL_BLOCK_SIZE - 1) / SURFEL_BLOCK_SIZE);
+      else return static_cast<int>(m_indexedSurfelCount / SURFEL_BLOCK_SIZE);
+    }
+
+    /**
+     * \brief Gets the number of surfels at the start of the scene that are covered by the spatial index.
+     *
+     * \return  The number of surfels at the start of the scene that are covered by the spatial index.
+     */
+    size_t GetIndexedSurfelCount() const
+    {
+      return m_indexedSurfelCount;
+    }
+
+    /**
+     * \brief Gets the type of memory in which the scene is stored.
+     *
+     * \return  The type of memory in which the scene is stored.
+     */
+    MemoryDeviceType GetMemoryType() const
+    {
+      return m_memoryType;
     }
 
     /**
@@ -106,6 +186,46 @@ namespace ITMLib
       return *m_params;
     }
 
+    /**
+     * \brief Gets the memory block containing the bounding boxes of the blocks of surfels in the spatial index.
+     *
+     * \return  The memory block containing the bounding boxes of the blocks of surfels in the spatial index.
+     */
+    ORUtils::MemoryBlock<ITMSurfelBlockBounds> *GetSurfelBlockBounds()
+    {
+      return m_surfelBlockBoundsMB;
+    }
+
+    /**
+     * \brief Gets the memory block containing the bounding boxes of the blocks of surfels in the spatial index.
+     *
+     * \return  The memory block containing the bounding boxes of the blocks of surfels in the spatial index.
+     */
+    const ORUtils::MemoryBlock<ITMSurfelBlockBounds> *GetSurfelBlockBounds() const
+    {
+      return m_surfelBlockBoundsMB;
+    }
+
+    /**
+     * \brief Gets the memory block containing the flags that indicate which blocks of surfels have been updated in place since the spatial index was last updated.
+     *
+     * \return  The memory block containing the flags that indicate which blocks of surfels have been updated in place since the spatial index was last updated.
+     */
+    ORUtils::MemoryBlock<unsigned char> *GetSurfelBlockDirtyFlags()
+    {
+      return m_surfelBlockDirtyFlagsMB;
+    }
+
+    /**
+     * \brief Gets the memory block containing the flags that indicate which blocks of surfels have been updated in place since the spatial index was last updated.
+     *
+     * \return  The memory block containing the flags that indicate which blocks of surfels have been updated in place since the spatial index was last updated.
+     */
+    const ORUtils::MemoryBlock<unsigned char> *GetSurfelBlockDirtyFlags() const
+    {
+      return m_surfelBlockDirtyFlagsMB;
+    }
+
     /**
      * \brief Gets the number of surfels currently in the scene.
      *
@@ -117,23 +237,25 @@ namespace ITMLib
     }
 
     /**
-     * \brief Gets the memory block containing the surfels in the scene.
+     * \brief Gets a read-write view of the surfels in the scene, as stored in the specified type of memory.
      *
-     * \return  The memory block containing the surfels in the scene.
+     * \param memoryType  The type of memory.
+     * \return            A read-write view of the surfels in the scene, as stored in the specified type of memory.
      */
-    ORUtils::MemoryBlock<TSurfel> *GetSurfels()
+    ITMSurfelArray<TSurfel> GetSurfels(MemoryDeviceType memoryType)
     {
-      return m_surfelsMB;
+      return m_surfels->GetArray(memoryType);
     }
 
     /**
-     * \brief Gets the memory block containing the surfels in the scene.
+     * \brief Gets a read-only view of the surfels in the scene, as stored in the specified type of memory.
      *
-     * \return  The memory block containing the surfels in the scene.
+     * \param memoryType  The type of memory.
+     * \return            A read-only view of the surfels in the scene, as stored in the specified type of memory.
      */
-    const ORUtils::MemoryBlock<TSurfel> *GetSurfels() const
+    ITMConstSurfelArray<TSurfel> GetSurfels(MemoryDeviceType memoryType) const
     {
-      return m_surfelsMB;
+      return static_cast<const ITMSurfelStorage<TSurfel>*>(m_surfels)->GetArray(memoryType);
     }
 
     /**
@@ -141,7 +263,36 @@ namespace ITMLib
      */
     void Reset()
     {
+      m_indexedSurfelCount = 0;
+      m_surfelBlockDirtyFlagsMB->Clear();
       m_surfelCount = 0;
     }
+
+    /**
+     * \brief Records that the spatial index now covers all of the surfels currently in the scene.
+     *
+     * This should be called once the bounding boxes of all the dirty blocks of surfels, and of all the blocks
+     * beyond GetIndexedSurfelBlockCount(), have been recalculated (and their dirty flags cleared).
+     */
+    void SetSpatialIndexUpToDate()
+    {
+      m_indexedSurfelCount = m_surfelCount;
+    }
+
+    /**
+     * \brief Copies the surfels in the scene from the CPU to the GPU.
+     */
+    void UpdateSurfelsDeviceFromHost()
+    {
+      m_surfels->UpdateDeviceFromHost();
+    }
+
+    /**
+     * \brief Copies the surfels in the scene from the GPU to the CPU.
+     */
+    void UpdateSurfelsHostFromDevice()
+    {
+      m_surfels->UpdateHostFromDevice();
+    }
   };
 }
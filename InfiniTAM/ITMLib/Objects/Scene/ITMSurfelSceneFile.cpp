@@ -0,0 +1,201 @@
+// InfiniTAM: Surffuse. Copyright (c) Torr Vision Group and the authors of InfiniTAM, 2016.
+
+#include "ITMSurfelSceneFile.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ITMLib
+{
+
+//#################### CONSTANTS ####################
+
+const int ITMSurfelSceneFile::SURFEL_FILE_CHUNK_SIZE;
+const size_t ITMSurfelSceneFile::SURFEL_FILE_STREAM_ALIGNMENT;
+const unsigned int ITMSurfelSceneFile::SURFEL_FILE_HALF_PRECISION;
+const unsigned int ITMSurfelSceneFile::SURFEL_FILE_HAS_COLOURS;
+const unsigned int ITMSurfelSceneFile::SURFEL_FILE_VERSION;
+
+//#################### NESTED TYPES ####################
+
+#ifndef _WIN32
+
+ITMSurfelSceneFile::MappedFile::MappedFile(const std::string& fileName)
+: m_data(NULL), m_size(0)
+{
+  int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+  if(fileDescriptor < 0) throw std::runtime_error("Could not open " + fileName + " for reading");
+
+  struct stat fileStatus;
+  if(fstat(fileDescriptor, &fileStatus) != 0)
+  {
+    close(fileDescriptor);
+    throw std::runtime_error("Could not determine the size of " + fileName);
+  }
+
+  m_size = static_cast<size_t>(fileStatus.st_size);
+  if(m_size > 0)
+  {
+    void *data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+    if(data == MAP_FAILED)
+    {
+      close(fileDescriptor);
+      throw std::runtime_error("Could not map " + fileName);
+    }
+
+    // The streams are read through from start to end.
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(data);
+  }
+
+  // The mapping stays valid after the file is closed.
+  close(fileDescriptor);
+}
+
+ITMSurfelSceneFile::MappedFile::~MappedFile()
+{
+  if(m_data != NULL) munmap(const_cast<char*>(m_data), m_size);
+}
+
+#else
+
+ITMSurfelSceneFile::MappedFile::MappedFile(const std::string& fileName)
+: m_data(NULL), m_size(0)
+{
+  FILE *f = fopen(fileName.c_str(), "rb");
+  if(f == NULL) throw std::runtime_error("Could not open " + fileName + " for reading");
+
+  fseek(f, 0, SEEK_END);
+  m_buffer.resize(static_cast<size_t>(ftell(f)));
+  fseek(f, 0, SEEK_SET);
+
+  bool ok = m_buffer.empty() || fread(&m_buffer[0], 1, m_buffer.size(), f) == m_buffer.size();
+  fclose(f);
+  if(!ok) throw std::runtime_error("Could not read " + fileName);
+
+  m_data = m_buffer.empty() ? NULL : &m_buffer[0];
+  m_size = m_buffer.size();
+}
+
+ITMSurfelSceneFile::MappedFile::~MappedFile() {}
+
+#endif
+
+//#################### PUBLIC STATIC MEMBER FUNCTIONS ####################
+
+void ITMSurfelSceneFile::WritePointCloudPLY(const std::string& fileName, int pointCount, const float *positions, const float *normals, const unsigned char *colours, const float *radii)
+{
+  FILE *f = fopen(fileName.c_str(), "wb");
+  if(f == NULL) throw std::runtime_error("Could not open " + fileName + " for writing");
+
+  // The values are written in the byte order of this machine, so the header has to say which order that is.
+  const unsigned int one = 1;
+  const bool littleEndian = *reinterpret_cast<const unsigned char*>(&one) == 1;
+
+  fprintf(f, "ply\nformat %s 1.0\nelement vertex %d\n", littleEndian ? "binary_little_endian" : "binary_big_endian", pointCount);
+  fprintf(f, "property float x\nproperty float y\nproperty float z\nproperty float nx\nproperty float ny\nproperty float nz\n");
+  if(colours != NULL) fprintf(f, "property uchar red\nproperty uchar green\nproperty uchar blue\n");
+  fprintf(f, "property float radius\nend_header\n");
+
+  // Interleave the properties of the points a chunk at a time, and write each chunk out in one go.
+  const size_t pointSize = 7 * sizeof(float) + (colours != NULL ? 3 : 0);
+  std::vector<char> buffer(std::min(pointCount, SURFEL_FILE_CHUNK_SIZE) * pointSize);
+
+  bool ok = true;
+  for(int chunkBegin = 0; ok && chunkBegin < pointCount; chunkBegin += SURFEL_FILE_CHUNK_SIZE)
+  {
+    const int chunkSize = std::min(pointCount - chunkBegin, SURFEL_FILE_CHUNK_SIZE);
+
+#ifdef WITH_OPENMP
+    #pragma omp parallel for
+#endif
+    for(int i = 0; i < chunkSize; ++i)
+    {
+      const int pointId = chunkBegin + i;
+      char *p = &buffer[i * pointSize];
+      memcpy(p, positions + pointId * 3, 3 * sizeof(float)); p += 3 * sizeof(float);
+      memcpy(p, normals + pointId * 3, 3 * sizeof(float)); p += 3 * sizeof(float);
+      if(colours != NULL) { memcpy(p, colours + pointId * 3, 3); p += 3; }
+      memcpy(p, radii + pointId, sizeof(float));
+    }
+
+    ok = fwrite(&buffer[0], pointSize, chunkSize, f) == static_cast<size_t>(chunkSize);
+  }
+
+  ok = fclose(f) == 0 && ok;
+  if(!ok) throw std::runtime_error("Could not write " + fileName);
+}
+
+//#################### PRIVATE STATIC MEMBER FUNCTIONS ####################
+
+unsigned short ITMSurfelSceneFile::FloatToHalf(float value)
+{
+  unsigned int bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const unsigned int sign = (bits >> 16) & 0x8000;
+  const unsigned int floatExponent = (bits >> 23) & 0xff;
+  unsigned int mantissa = bits & 0x7fffff;
+
+  // Infinities and NaNs stay as they are (keeping NaNs quiet).
+  if(floatExponent == 0xff) return static_cast<unsigned short>(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+
+  // Values that are too large for a 16-bit float become infinities.
+  const int exponent = static_cast<int>(floatExponent) - 127 + 15;
+  if(exponent >= 31) return static_cast<unsigned short>(sign | 0x7c00);
+
+  unsigned int half, remainder, halfway;
+  if(exponent <= 0)
+  {
+    // Values that are too small even for a subnormal 16-bit float become zeros.
+    if(exponent < -10) return static_cast<unsigned short>(sign);
+
+    // Otherwise, the value becomes a subnormal 16-bit float.
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    half = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  }
+  else
+  {
+    half = (static_cast<unsigned int>(exponent) << 10) | (mantissa >> 13);
+    remainder = mantissa & 0x1fff;
+    halfway = 0x1000;
+  }
+
+  // Round to the nearest value, and to even in the case of a tie. A carry into the exponent yields the correct result.
+  if(remainder > halfway || (remainder == halfway && (half & 1))) ++half;
+
+  return static_cast<unsigned short>(sign | half);
+}
+
+float ITMSurfelSceneFile::HalfToFloat(unsigned short value)
+{
+  const unsigned int sign = (value & 0x8000u) << 16;
+  const unsigned int exponent = (value >> 10) & 0x1f;
+  const unsigned int mantissa = value & 0x3ff;
+
+  unsigned int bits;
+  if(exponent == 0)
+  {
+    // Zeros and subnormal 16-bit floats (which are normal 32-bit floats).
+    const float magnitude = ldexpf(static_cast<float>(mantissa), -24);
+    return sign ? -magnitude : magnitude;
+  }
+  else if(exponent == 31) bits = sign | 0x7f800000 | (mantissa << 13);
+  else bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+}
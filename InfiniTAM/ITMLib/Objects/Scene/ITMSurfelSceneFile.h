@@ -0,0 +1,376 @@
+// InfiniTAM: Surffuse. Copyright (c) Torr Vision Group and the authors of InfiniTAM, 2016.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ITMSurfelScene.h"
+
+namespace ITMLib
+{
+  /**
+   * \brief This class reads and writes surfel scenes from and to binary files, and writes point clouds as binary PLY files.
+   *
+   * A surfel scene file consists of a header (which also records the frame number at which the scene was saved, against which the
+   * surfel timestamps are measured) followed by one stream per surfel field, each holding the values of that field for all
+   * of the surfels in order: positions, normals, radii, confidences, timestamps and (for surfel types with colour information) colours.
+   * Each stream starts at a multiple of SURFEL_FILE_STREAM_ALIGNMENT bytes. The normals and radii can optionally be stored as 16-bit
+   * floats, which makes the file about a third smaller. All values are stored in the byte order of the machine that wrote the file.
+   *
+   * Streams are written in chunks of SURFEL_FILE_CHUNK_SIZE surfels, and files are memory-mapped when they are loaded (where the
+   * platform supports it), so that the surfels are decoded straight from the page cache rather than being read into a buffer first.
+   */
+  class ITMSurfelSceneFile
+  {
+    //#################### CONSTANTS ####################
+  private:
+    /** The number of surfels whose values are written to a stream at once. */
+    static const int SURFEL_FILE_CHUNK_SIZE = 1 << 16;
+
+    /** The alignment (in bytes) of the start of each stream within a file. */
+    static const size_t SURFEL_FILE_STREAM_ALIGNMENT = 16;
+
+    /** The flag in the file header that indicates that the normals and radii are stored as 16-bit floats. */
+    static const unsigned int SURFEL_FILE_HALF_PRECISION = 1;
+
+    /** The flag in the file header that indicates that the file contains a colour stream. */
+    static const unsigned int SURFEL_FILE_HAS_COLOURS = 2;
+
+    /** The version of the file format. */
+    static const unsigned int SURFEL_FILE_VERSION = 2;
+
+    //#################### NESTED TYPES ####################
+  private:
+    /**
+     * \brief An instance of this struct represents the header of a surfel scene file.
+     */
+    struct Header
+    {
+      /** The magic number identifying the file as a surfel scene file ("ITMSURFL"). */
+      char magic[8];
+
+      /** The version of the file format. */
+      unsigned int version;
+
+      /** The flags describing how the surfels are stored. */
+      unsigned int flags;
+
+      /** The number of surfels in the file. */
+      unsigned long long surfelCount;
+
+      /** The timestamp (i.e. frame number) of the reconstruction when the scene was saved. */
+      int timestamp;
+
+      /** Unused (written as zero, so that the header contains no uninitialised padding). */
+      unsigned int reserved;
+    };
+
+    /**
+     * \brief An instance of this class provides read-only access to the contents of a file (memory-mapped, where possible).
+     */
+    class MappedFile
+    {
+    private:
+      /** The contents of the file (if it could not be memory-mapped). */
+      std::vector<char> m_buffer;
+
+      /** The contents of the file. */
+      const char *m_data;
+
+      /** The size of the file (in bytes). */
+      size_t m_size;
+
+    public:
+      explicit MappedFile(const std::string& fileName);
+      ~MappedFile();
+
+    private:
+      // Deliberately private and unimplemented.
+      MappedFile(const MappedFile&);
+      MappedFile& operator=(const MappedFile&);
+
+    public:
+      const char *GetData() const { return m_data; }
+      size_t GetSize() const { return m_size; }
+    };
+
+    // Each of the following structs describes how the values of one surfel field are stored in a stream.
+
+    struct ColourField
+    {
+      typedef Vector3u StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return surfels.GetColour(surfelId); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { SurfelColourManipulator<TSurfel::hasColourInformation>::write(surfel, value); }
+    };
+
+    struct ConfidenceField
+    {
+      typedef float StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return surfels.GetConfidence(surfelId); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { surfel.confidence = value; }
+    };
+
+    struct HalfNormalField
+    {
+      typedef ORUtils::Vector3<unsigned short> StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId)
+      {
+        const Vector3f n = surfels.GetNormal(surfelId);
+        return StoredType(FloatToHalf(n.x), FloatToHalf(n.y), FloatToHalf(n.z));
+      }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel)
+      {
+        surfel.normal = Vector3f(HalfToFloat(value.x), HalfToFloat(value.y), HalfToFloat(value.z));
+      }
+    };
+
+    struct HalfRadiusField
+    {
+      typedef unsigned short StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return FloatToHalf(surfels.GetRadius(surfelId)); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { surfel.radius = HalfToFloat(value); }
+    };
+
+    struct NormalField
+    {
+      typedef Vector3f StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return surfels.GetNormal(surfelId); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { surfel.normal = value; }
+    };
+
+    struct PositionField
+    {
+      typedef Vector3f StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return surfels.GetPosition(surfelId); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { surfel.position = value; }
+    };
+
+    struct RadiusField
+    {
+      typedef float StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return surfels.GetRadius(surfelId); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { surfel.radius = value; }
+    };
+
+    struct TimestampField
+    {
+      typedef int StoredType;
+      template <typename TSurfel> static StoredType Encode(const ITMConstSurfelArray<TSurfel>& surfels, int surfelId) { return surfels.GetTimestamp(surfelId); }
+      template <typename TSurfel> static void Decode(const StoredType& value, TSurfel& surfel) { surfel.timestamp = value; }
+    };
+
+    //#################### PUBLIC STATIC MEMBER FUNCTIONS ####################
+  public:
+    /**
+     * \brief Replaces the contents of a surfel scene with the surfels in a surfel scene file.
+     *
+     * The scene's spatial index does not cover the loaded surfels until it is next updated. The reconstruction's timestamp
+     * should be set to the returned value, so that the ages of the loaded surfels are measured against the same clock.
+     *
+     * \param scene     The scene.
+     * \param fileName  The name of the file.
+     * \return          The timestamp (i.e. frame number) of the reconstruction when the scene was saved.
+     * \throws std::runtime_error If the file cannot be read, is not a valid surfel scene file, or contains more surfels than the scene can hold.
+     */
+    template <typename TSurfel>
+    static int LoadScene(ITMSurfelScene<TSurfel> *scene, const std::string& fileName)
+    {
+      MappedFile file(fileName);
+
+      Header header;
+      if(file.GetSize() < sizeof(Header)) throw std::runtime_error(fileName + " is not a surfel scene file");
+      std::copy(file.GetData(), file.GetData() + sizeof(Header), reinterpret_cast<char*>(&header));
+      if(!std::equal(header.magic, header.magic + sizeof(header.magic), "ITMSURFL") || header.version != SURFEL_FILE_VERSION)
+      {
+        throw std::runtime_error(fileName + " is not a surfel scene file of a supported version");
+      }
+
+      scene->Reset();
+      const int surfelCount = static_cast<int>(header.surfelCount);
+      if(header.surfelCount > MAX_SURFEL_COUNT || scene->AllocateSurfels(surfelCount) == -1)
+      {
+        throw std::runtime_error(fileName + " contains more surfels than the scene can hold");
+      }
+
+      if(header.flags & SURFEL_FILE_HALF_PRECISION) ReadSurfels<HalfNormalField,HalfRadiusField>(scene, file, header, fileName);
+      else ReadSurfels<NormalField,RadiusField>(scene, file, header, fileName);
+
+      if(scene->GetMemoryType() == MEMORYDEVICE_CUDA) scene->UpdateSurfelsDeviceFromHost();
+
+      return header.timestamp;
+    }
+
+    /**
+     * \brief Writes the surfels in a surfel scene to a surfel scene file.
+     *
+     * \param scene           The scene.
+     * \param fileName        The name of the file.
+     * \param timestamp       The current timestamp (i.e. frame number) of the reconstruction.
+     * \param halfPrecision   Whether or not to store the surfel normals and radii as 16-bit floats.
+     * \throws std::runtime_error If the file cannot be written.
+     */
+    template <typename TSurfel>
+    static void SaveScene(ITMSurfelScene<TSurfel> *scene, const std::string& fileName, int timestamp, bool halfPrecision)
+    {
+      if(scene->GetMemoryType() == MEMORYDEVICE_CUDA) scene->UpdateSurfelsHostFromDevice();
+      const ITMConstSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
+      const int surfelCount = static_cast<int>(scene->GetSurfelCount());
+
+      FILE *f = fopen(fileName.c_str(), "wb");
+      if(f == NULL) throw std::runtime_error("Could not open " + fileName + " for writing");
+
+      Header header;
+      std::copy("ITMSURFL", "ITMSURFL" + sizeof(header.magic), header.magic);
+      header.version = SURFEL_FILE_VERSION;
+      header.flags = (halfPrecision ? SURFEL_FILE_HALF_PRECISION : 0) | (TSurfel::hasColourInformation ? SURFEL_FILE_HAS_COLOURS : 0);
+      header.surfelCount = static_cast<unsigned long long>(surfelCount);
+      header.timestamp = timestamp;
+      header.reserved = 0;
+
+      bool ok = fwrite(&header, sizeof(Header), 1, f) == 1;
+      size_t offset = sizeof(Header);
+
+      ok = ok && WriteStream<PositionField>(f, offset, surfels, surfelCount);
+      if(halfPrecision) ok = ok && WriteStream<HalfNormalField>(f, offset, surfels, surfelCount) && WriteStream<HalfRadiusField>(f, offset, surfels, surfelCount);
+      else ok = ok && WriteStream<NormalField>(f, offset, surfels, surfelCount) && WriteStream<RadiusField>(f, offset, surfels, surfelCount);
+      ok = ok && WriteStream<ConfidenceField>(f, offset, surfels, surfelCount);
+      ok = ok && WriteStream<TimestampField>(f, offset, surfels, surfelCount);
+      if(TSurfel::hasColourInformation) ok = ok && WriteStream<ColourField>(f, offset, surfels, surfelCount);
+
+      ok = fclose(f) == 0 && ok;
+      if(!ok) throw std::runtime_error("Could not write " + fileName);
+    }
+
+    /**
+     * \brief Writes a point cloud as a binary PLY file (in the byte order of this machine) with a normal, (optionally) a colour and a radius for each point.
+     *
+     * \param fileName    The name of the file.
+     * \param pointCount  The number of points.
+     * \param positions   The positions of the points (3 floats per point).
+     * \param normals     The normals of the points (3 floats per point).
+     * \param colours     The colours of the points (3 bytes per point), or NULL if the points have no colours.
+     * \param radii       The radii of the points.
+     * \throws std::runtime_error If the file cannot be written.
+     */
+    static void WritePointCloudPLY(const std::string& fileName, int pointCount, const float *positions, const float *normals, const unsigned char *colours, const float *radii);
+
+    //#################### PRIVATE STATIC MEMBER FUNCTIONS ####################
+  private:
+    /**
+     * \brief Converts a 32-bit float to a 16-bit float, rounding to the nearest representable value.
+     *
+     * \param value The 32-bit float.
+     * \return      The bits of the 16-bit float.
+     */
+    static unsigned short FloatToHalf(float value);
+
+    /**
+     * \brief Converts a 16-bit float to a 32-bit float.
+     *
+     * \param value The bits of the 16-bit float.
+     * \return      The 32-bit float.
+     */
+    static float HalfToFloat(unsigned short value);
+
+    /**
+     * \brief Gets a pointer to the next stream in a surfel scene file.
+     *
+     * \param file        The file.
+     * \param offset      The offset just beyond the end of the previous stream (updated to the offset just beyond the end of this stream).
+     * \param surfelCount The number of surfels in the file.
+     * \param fileName    The name of the file.
+     * \return            A pointer to the start of the stream.
+     * \throws std::runtime_error If the file is too short to contain the stream.
+     */
+    template <typename TField>
+    static const typename TField::StoredType *MapStream(const MappedFile& file, size_t& offset, int surfelCount, const std::string& fileName)
+    {
+      offset = (offset + SURFEL_FILE_STREAM_ALIGNMENT - 1) / SURFEL_FILE_STREAM_ALIGNMENT * SURFEL_FILE_STREAM_ALIGNMENT;
+      const size_t streamSize = surfelCount * sizeof(typename TField::StoredType);
+      if(offset + streamSize > file.GetSize()) throw std::runtime_error(fileName + " is truncated");
+
+      const typename TField::StoredType *stream = reinterpret_cast<const typename TField::StoredType*>(file.GetData() + offset);
+      offset += streamSize;
+      return stream;
+    }
+
+    /**
+     * \brief Decodes the surfels in a surfel scene file into the (already allocated) surfels of a scene.
+     *
+     * \param scene     The scene.
+     * \param file      The file.
+     * \param header    The header of the file.
+     * \param fileName  The name of the file.
+     */
+    template <typename TNormalField, typename TRadiusField, typename TSurfel>
+    static void ReadSurfels(ITMSurfelScene<TSurfel> *scene, const MappedFile& file, const Header& header, const std::string& fileName)
+    {
+      const ITMSurfelArray<TSurfel> surfels = scene->GetSurfels(MEMORYDEVICE_CPU);
+      const int surfelCount = static_cast<int>(header.surfelCount);
+      size_t offset = sizeof(Header);
+
+      const typename PositionField::StoredType *positions = MapStream<PositionField>(file, offset, surfelCount, fileName);
+      const typename TNormalField::StoredType *normals = MapStream<TNormalField>(file, offset, surfelCount, fileName);
+      const typename TRadiusField::StoredType *radii = MapStream<TRadiusField>(file, offset, surfelCount, fileName);
+      const typename ConfidenceField::StoredType *confidences = MapStream<ConfidenceField>(file, offset, surfelCount, fileName);
+      const typename TimestampField::StoredType *timestamps = MapStream<TimestampField>(file, offset, surfelCount, fileName);
+      const typename ColourField::StoredType *colours = (header.flags & SURFEL_FILE_HAS_COLOURS) ? MapStream<ColourField>(file, offset, surfelCount, fileName) : NULL;
+
+#ifdef WITH_OPENMP
+      #pragma omp parallel for
+#endif
+      for(int surfelId = 0; surfelId < surfelCount; ++surfelId)
+      {
+        TSurfel surfel = TSurfel();
+        PositionField::Decode(positions[surfelId], surfel);
+        TNormalField::Decode(normals[surfelId], surfel);
+        TRadiusField::Decode(radii[surfelId], surfel);
+        ConfidenceField::Decode(confidences[surfelId], surfel);
+        TimestampField::Decode(timestamps[surfelId], surfel);
+        ColourField::Decode(colours != NULL ? colours[surfelId] : Vector3u((uchar)0), surfel);
+        surfels.Set(surfelId, surfel);
+      }
+    }
+
+    /**
+     * \brief Writes the values of one surfel field for all of the surfels in a scene as the next stream in a surfel scene file.
+     *
+     * \param f           The file.
+     * \param offset      The offset just beyond the end of the previous stream (updated to the offset just beyond the end of this stream).
+     * \param surfels     The surfels in the scene.
+     * \param surfelCount The number of surfels in the scene.
+     * \return            true, if the stream was successfully written, or false otherwise.
+     */
+    template <typename TField, typename TSurfel>
+    static bool WriteStream(FILE *f, size_t& offset, const ITMConstSurfelArray<TSurfel>& surfels, int surfelCount)
+    {
+      const char padding[SURFEL_FILE_STREAM_ALIGNMENT] = { 0 };
+      const size_t paddingSize = (SURFEL_FILE_STREAM_ALIGNMENT - offset % SURFEL_FILE_STREAM_ALIGNMENT) % SURFEL_FILE_STREAM_ALIGNMENT;
+      if(paddingSize > 0 && fwrite(padding, 1, paddingSize, f) != paddingSize) return false;
+      offset += paddingSize;
+
+      std::vector<typename TField::StoredType> chunk(std::min(surfelCount, SURFEL_FILE_CHUNK_SIZE));
+      for(int chunkBegin = 0; chunkBegin < surfelCount; chunkBegin += SURFEL_FILE_CHUNK_SIZE)
+      {
+        const int chunkSize = std::min(surfelCount - chunkBegin, SURFEL_FILE_CHUNK_SIZE);
+
+#ifdef WITH_OPENMP
+        #pragma omp parallel for
+#endif
+        for(int i = 0; i < chunkSize; ++i)
+        {
+          chunk[i] = TField::Encode(surfels, chunkBegin + i);
+        }
+
+        if(fwrite(&chunk[0], sizeof(typename TField::StoredType), chunkSize, f) != static_cast<size_t>(chunkSize)) return false;
+        offset += chunkSize * sizeof(typename TField::StoredType);
+      }
+
+      return true;
+    }
+  };
+}
@@ -0,0 +1,297 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#ifndef __METALC__
+#include <algorithm>
+#endif
+
+#include "ITMVoxelBlockHash.h"
+
+#define CUCKOO_BUCKET_SIZE 4			// Number of entries per bucket, 4 * sizeof(ITMHashEntry) = 64 bytes, one cache line
+#define CUCKOO_MAX_DISPLACEMENTS 64		// Maximum number of entries moved to make room for a new one
+
+/** \brief
+	A bucket of the cuckoo hash, which fills exactly one cache
+	line. Unused entries have a ptr below -1.
+*/
+struct ITMCuckooHashBucket
+{
+	ITMHashEntry entries[CUCKOO_BUCKET_SIZE];
+};
+
+/** The two buckets a block may live in; they coincide for a few blocks, which then have just the one. */
+_CPU_AND_GPU_CODE_ inline int cuckooHashIndex(const THREADPTR(Vector3i) & blockPos, int which, int noBuckets) {
+	if (which == 0) return (((uint)blockPos.x * 73856093u) ^ ((uint)blockPos.y * 19349669u) ^ ((uint)blockPos.z * 83492791u)) & (uint)(noBuckets - 1);
+	return (((uint)blockPos.x * 2654435761u) ^ ((uint)blockPos.y * 2246822519u) ^ ((uint)blockPos.z * 3266489917u)) & (uint)(noBuckets - 1);
+}
+
+// the bucket in front of the cuckoo hash table records the number of buckets, see ITMVoxelBlockCuckooHash
+_CPU_AND_GPU_CODE_ inline int getCuckooBucketNum(const CONSTPTR(ITMCuckooHashBucket) *buckets) {
+	return buckets[-1].entries[0].offset;
+}
+
+/** Id of the entry of the block at @p blockPos, i.e. its bucket times CUCKOO_BUCKET_SIZE plus its slot, or -1 if the block is not allocated. */
+_CPU_AND_GPU_CODE_ inline int findCuckooHashEntry(const CONSTPTR(ITMCuckooHashBucket) *buckets, const THREADPTR(Vector3i) & blockPos)
+{
+	int noBuckets = getCuckooBucketNum(buckets);
+
+	// at most two buckets, i.e. two cache lines, are read, however full the table
+	for (int which = 0; which < 2; which++)
+	{
+		int bucketIdx = cuckooHashIndex(blockPos, which, noBuckets);
+		const CONSTPTR(ITMHashEntry) *entries = buckets[bucketIdx].entries;
+
+		for (int slot = 0; slot < CUCKOO_BUCKET_SIZE; slot++)
+		{
+			if (IS_EQUAL3(entries[slot].pos, blockPos) && entries[slot].ptr >= 0) return bucketIdx * CUCKOO_BUCKET_SIZE + slot;
+		}
+	}
+
+	return -1;
+}
+
+#ifndef __METALC__
+namespace ITMLib
+{
+	/** \brief
+	    An alternative to ITMVoxelBlockHash that keeps all blocks
+	    in the buckets themselves, rather than chaining the ones
+	    that do not fit into an excess list.
+
+	    Each block may live in either of two buckets of
+	    CUCKOO_BUCKET_SIZE entries, chosen by two different
+	    hash functions, so a lookup reads at most two cache lines
+	    and never follows a chain. When both buckets are full, a
+	    new block displaces one of the blocks there into that
+	    block's other bucket, and so on, for at most
+	    CUCKOO_MAX_DISPLACEMENTS moves. Should that not free up
+	    an entry the insertion fails, leaves the table as it was,
+	    and is counted, see GetNoFailedInsertions.
+
+	    With two choices of bucket and four entries per bucket,
+	    insertions start to fail at a load factor of about 95%.
+	    The table is meant to stay below 90%, see GetLoadFactor;
+	    it has ITMSceneParams::noHashBuckets entries, so with the
+	    default sizes it holds all SDF_LOCAL_BLOCK_NUM blocks at
+	    a load factor of 25%, in less memory than the bucket array
+	    and excess list of ITMVoxelBlockHash.
+
+	    Entries move between buckets as blocks are inserted, so
+	    unlike the ids of ITMVoxelBlockHash, entry ids are only
+	    valid until the next insertion. Blocks are never swapped
+	    out, and the table lives on the CPU only.
+	*/
+	class ITMVoxelBlockCuckooHash
+	{
+	public:
+		typedef ITMCuckooHashBucket IndexData;
+		typedef ITMVoxelBlockHash::IndexCache IndexCache;
+		typedef ITMVoxelBlockHash::NeighbourIndexCache NeighbourIndexCache;
+
+		static const CONSTPTR(int) voxelBlockSize = SDF_BLOCK_SIZE * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
+
+		/** Number of buckets and total number of entries. */
+		const int noBuckets, noTotalEntries;
+
+	private:
+		int noVoxelBlocks;
+		int noUsedEntries, noFailedInsertions;
+		uint displacementSeed;
+
+		/** The buckets, preceded by one bucket whose first
+		entry records the number of buckets (see
+		getCuckooBucketNum). The block has room for three
+		more entries, so that the buckets can start on a cache
+		line whatever the alignment of the allocation; see
+		firstEntry.
+		*/
+		ORUtils::MemoryBlock<ITMHashEntry> *hashEntries;
+		int firstEntry;
+
+		ITMHashEntry *GetEntryData(void) { return hashEntries->GetData(MEMORYDEVICE_CPU) + firstEntry + CUCKOO_BUCKET_SIZE; }
+
+		/** The bucket other than @p bucketIdx in which the block at @p blockPos may live. */
+		int GetAlternativeBucket(const Vector3s &blockPos, int bucketIdx) const
+		{
+			int bucketIdx0 = cuckooHashIndex(blockPos.toInt(), 0, noBuckets);
+			return bucketIdx0 != bucketIdx ? bucketIdx0 : cuckooHashIndex(blockPos.toInt(), 1, noBuckets);
+		}
+
+		int FindFreeEntry(int bucketIdx)
+		{
+			const ITMHashEntry *entries = GetEntryData() + bucketIdx * CUCKOO_BUCKET_SIZE;
+			for (int slot = 0; slot < CUCKOO_BUCKET_SIZE; slot++) if (entries[slot].ptr < -1) return bucketIdx * CUCKOO_BUCKET_SIZE + slot;
+			return -1;
+		}
+
+	public:
+		ITMVoxelBlockCuckooHash(const ITMSceneParams *sceneParams, MemoryDeviceType memoryType)
+			: noBuckets(sceneParams->noHashBuckets / CUCKOO_BUCKET_SIZE), noTotalEntries(noBuckets * CUCKOO_BUCKET_SIZE)
+		{
+			if (memoryType != MEMORYDEVICE_CPU) throw std::runtime_error("The cuckoo hash is only available on the CPU");
+			if (noBuckets <= 0 || (noBuckets & (noBuckets - 1)) != 0) throw std::runtime_error("The number of hash buckets must be a power of two and at least four");
+			if (sceneParams->noVoxelBlocks <= 0) throw std::runtime_error("The hash needs room for voxel blocks");
+
+			this->noVoxelBlocks = sceneParams->noVoxelBlocks;
+
+			hashEntries = new ORUtils::MemoryBlock<ITMHashEntry>(noTotalEntries + 2 * CUCKOO_BUCKET_SIZE - 1, MEMORYDEVICE_CPU);
+
+			// move the start of the buckets onto a cache line, if the allocation is at least aligned to the entries
+			size_t address = (size_t)(hashEntries->GetData(MEMORYDEVICE_CPU) + CUCKOO_BUCKET_SIZE);
+			size_t misalignment = address % sizeof(ITMCuckooHashBucket);
+			firstEntry = misalignment % sizeof(ITMHashEntry) == 0 ? (int)((sizeof(ITMCuckooHashBucket) - misalignment) % sizeof(ITMCuckooHashBucket) / sizeof(ITMHashEntry)) : 0;
+
+			ITMHashEntry header;
+			header.pos = Vector3s(0, 0, 0);
+			header.offset = noBuckets;
+			header.ptr = -2;
+			GetEntryData()[-CUCKOO_BUCKET_SIZE] = header;
+
+			Clear();
+		}
+
+		~ITMVoxelBlockCuckooHash(void)
+		{
+			delete hashEntries;
+		}
+
+		/** Get the entries of the table, bucket after bucket. */
+		const ITMHashEntry *GetEntries(void) const { return hashEntries->GetData(MEMORYDEVICE_CPU) + firstEntry + CUCKOO_BUCKET_SIZE; }
+		ITMHashEntry *GetEntries(void) { return GetEntryData(); }
+
+		const IndexData *getIndexData(void) const { return (const IndexData*)GetEntries(); }
+		IndexData *getIndexData(void) { return (IndexData*)GetEntries(); }
+
+		/** Marks all entries as unused. */
+		void Clear(void)
+		{
+			ITMHashEntry emptyEntry;
+			emptyEntry.pos = Vector3s(0, 0, 0);
+			emptyEntry.offset = 0;
+			emptyEntry.ptr = -2;
+
+			ITMHashEntry *entries = GetEntryData();
+			for (int i = 0; i < noTotalEntries; i++) entries[i] = emptyEntry;
+
+			noUsedEntries = 0;
+			noFailedInsertions = 0;
+			displacementSeed = 1;
+		}
+
+		/** \brief
+		    Inserts @p entry, whose block must not be in the table
+		    yet, and returns the id of the entry it ends up in, or
+		    -1 if there was no room.
+
+		    Other entries may move to make room. If @p entryFlags
+		    is not NULL, it holds one flag per entry, which moves
+		    along with the entries, and the flag of the new entry
+		    is cleared.
+		*/
+		int InsertEntry(const ITMHashEntry &entry, uchar *entryFlags)
+		{
+			ITMHashEntry *entries = GetEntryData();
+			Vector3i blockPos = entry.pos.toInt();
+
+			int entryId = FindFreeEntry(cuckooHashIndex(blockPos, 0, noBuckets));
+			if (entryId < 0) entryId = FindFreeEntry(cuckooHashIndex(blockPos, 1, noBuckets));
+			if (entryId >= 0)
+			{
+				entries[entryId] = entry;
+				if (entryFlags != NULL) entryFlags[entryId] = 0;
+				noUsedEntries++;
+				return entryId;
+			}
+
+			// swap the carried entry with a pseudo-randomly chosen one of the bucket, and carry that one on to its other bucket
+			int movedEntryIds[CUCKOO_MAX_DISPLACEMENTS];
+			ITMHashEntry carriedEntry = entry;
+			uchar carriedFlag = 0;
+			int bucketIdx = cuckooHashIndex(blockPos, 0, noBuckets);
+
+			for (int noDisplacements = 0; noDisplacements < CUCKOO_MAX_DISPLACEMENTS; noDisplacements++)
+			{
+				displacementSeed = displacementSeed * 1103515245u + 12345u;
+				int movedEntryId = bucketIdx * CUCKOO_BUCKET_SIZE + (int)((displacementSeed >> 16) % CUCKOO_BUCKET_SIZE);
+				movedEntryIds[noDisplacements] = movedEntryId;
+
+				std::swap(carriedEntry, entries[movedEntryId]);
+				if (entryFlags != NULL) std::swap(carriedFlag, entryFlags[movedEntryId]);
+
+				bucketIdx = GetAlternativeBucket(carriedEntry.pos, bucketIdx);
+				entryId = FindFreeEntry(bucketIdx);
+				if (entryId >= 0)
+				{
+					entries[entryId] = carriedEntry;
+					if (entryFlags != NULL) entryFlags[entryId] = carriedFlag;
+					noUsedEntries++;
+
+					// the new entry may have been moved on again further along the way
+					int newEntryId = findCuckooHashEntry(getIndexData(), blockPos);
+					if (entryFlags != NULL) entryFlags[newEntryId] = 0;
+					return newEntryId;
+				}
+			}
+
+			// undo the displacements, last first
+			for (int i = CUCKOO_MAX_DISPLACEMENTS - 1; i >= 0; i--)
+			{
+				std::swap(carriedEntry, entries[movedEntryIds[i]]);
+				if (entryFlags != NULL) std::swap(carriedFlag, entryFlags[movedEntryIds[i]]);
+			}
+
+			noFailedInsertions++;
+			return -1;
+		}
+
+		/** Fraction of the entries in use. */
+		float GetLoadFactor(void) const { return (float)noUsedEntries / (float)noTotalEntries; }
+		int GetNoUsedEntries(void) const { return noUsedEntries; }
+
+		/** Number of blocks that could not be inserted since the table was last cleared. */
+		int GetNoFailedInsertions(void) const { return noFailedInsertions; }
+
+		/** The cuckoo hash keeps no map of allocated blocks, see ITMVoxelBlockHash::GetBlockOccupancy. */
+		const ITMBlockOccupancy *GetBlockOccupancy(void) const { return NULL; }
+
+		/** Initial number of voxel blocks, see ITMLocalVBA::GetNoBlocks for the current one. */
+		int getNumAllocatedVoxelBlocks(void) const { return noVoxelBlocks; }
+		int getVoxelBlockSize(void) const { return SDF_BLOCK_SIZE3; }
+
+		void SaveToDirectory(const std::string &outputDirectory) const
+		{
+			std::string hashEntriesFileName = outputDirectory + "cuckoo.dat";
+
+			// the header bucket and the buckets, without the room left for alignment
+			ORUtils::MemoryBlock<ITMHashEntry> savedEntries(noTotalEntries + CUCKOO_BUCKET_SIZE, MEMORYDEVICE_CPU);
+			memcpy(savedEntries.GetData(MEMORYDEVICE_CPU), GetEntries() - CUCKOO_BUCKET_SIZE, savedEntries.dataSize * sizeof(ITMHashEntry));
+			ORUtils::MemoryBlockPersister::SaveMemoryBlock(hashEntriesFileName, savedEntries, MEMORYDEVICE_CPU);
+		}
+
+		void LoadFromDirectory(const std::string &inputDirectory)
+		{
+			std::string hashEntriesFileName = inputDirectory + "cuckoo.dat";
+
+			ORUtils::MemoryBlock<ITMHashEntry> *loadedEntries = ORUtils::MemoryBlockPersister::LoadMemoryBlock(hashEntriesFileName, loadedEntries);
+			const ITMHashEntry *loadedData = loadedEntries->GetData(MEMORYDEVICE_CPU);
+			if (loadedEntries->dataSize != (size_t)(noTotalEntries + CUCKOO_BUCKET_SIZE) || loadedData[0].offset != noBuckets)
+			{
+				delete loadedEntries;
+				throw std::runtime_error(hashEntriesFileName + " was saved from a hash of a different size");
+			}
+
+			Clear();
+			memcpy(GetEntryData(), loadedData + CUCKOO_BUCKET_SIZE, noTotalEntries * sizeof(ITMHashEntry));
+			delete loadedEntries;
+
+			const ITMHashEntry *entries = GetEntries();
+			for (int i = 0; i < noTotalEntries; i++) if (entries[i].ptr >= 0) noUsedEntries++;
+		}
+
+		// Suppress the default copy constructor and assignment operator
+		ITMVoxelBlockCuckooHash(const ITMVoxelBlockCuckooHash&);
+		ITMVoxelBlockCuckooHash& operator=(const ITMVoxelBlockCuckooHash&);
+	};
+}
+#endif
@@ -0,0 +1,77 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#include "ITMVoxelBlockFile.h"
+
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+using namespace ITMLib;
+
+#ifndef _WIN32
+
+ITMVoxelBlockFile::ITMVoxelBlockFile(const std::string &fileName, size_t blockBytes, int noBlocksPerChunk)
+: fileName(fileName), blockBytes(blockBytes), noBlocksPerChunk(noBlocksPerChunk), noBlocks(0)
+{
+	// chunk offsets have to be multiples of the page size
+	if ((blockBytes * noBlocksPerChunk) % sysconf(_SC_PAGESIZE) != 0)
+		throw std::runtime_error("Voxel block file chunks must be a multiple of the page size");
+
+	fileDescriptor = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fileDescriptor < 0) throw std::runtime_error("Could not open " + fileName + " for writing");
+}
+
+ITMVoxelBlockFile::~ITMVoxelBlockFile(void)
+{
+	size_t chunkBytes = blockBytes * noBlocksPerChunk;
+	for (size_t i = 0; i < chunks.size(); i++) munmap(chunks[i], chunkBytes);
+
+	close(fileDescriptor);
+	unlink(fileName.c_str());
+}
+
+int ITMVoxelBlockFile::AllocateBlock(void)
+{
+	if (noBlocks == (int)chunks.size() * noBlocksPerChunk)
+	{
+		size_t chunkBytes = blockBytes * noBlocksPerChunk;
+		off_t chunkOffset = (off_t)chunks.size() * (off_t)chunkBytes;
+
+		if (ftruncate(fileDescriptor, chunkOffset + (off_t)chunkBytes) != 0)
+			throw std::runtime_error("Could not grow " + fileName);
+
+		void *chunk = mmap(NULL, chunkBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, chunkOffset);
+		if (chunk == MAP_FAILED) throw std::runtime_error("Could not map " + fileName);
+
+		chunks.push_back((unsigned char*)chunk);
+	}
+
+	return noBlocks++;
+}
+
+void ITMVoxelBlockFile::Flush(void)
+{
+	size_t chunkBytes = blockBytes * noBlocksPerChunk;
+	for (size_t i = 0; i < chunks.size(); i++) msync(chunks[i], chunkBytes, MS_SYNC);
+}
+
+#else
+
+ITMVoxelBlockFile::ITMVoxelBlockFile(const std::string &fileName, size_t blockBytes, int noBlocksPerChunk)
+: fileName(fileName), fileDescriptor(-1), blockBytes(blockBytes), noBlocksPerChunk(noBlocksPerChunk), noBlocks(0)
+{
+	throw std::runtime_error("Memory-mapped voxel block files are not supported on this platform");
+}
+
+ITMVoxelBlockFile::~ITMVoxelBlockFile(void) {}
+
+int ITMVoxelBlockFile::AllocateBlock(void) { return -1; }
+
+void ITMVoxelBlockFile::Flush(void) {}
+
+#endif
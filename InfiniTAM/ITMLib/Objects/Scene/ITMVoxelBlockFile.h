@@ -0,0 +1,56 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace ITMLib
+{
+	/** \brief
+	    A file of fixed-size voxel blocks, memory-mapped in chunks.
+
+	    Blocks are addressed by the id returned from AllocateBlock.
+	    The file grows by one chunk at a time, and each chunk gets
+	    its own mapping, so pointers returned by GetBlock stay valid
+	    for the lifetime of the file. Writes through those pointers
+	    are written back by the operating system in the background;
+	    Flush forces them to disk.
+	*/
+	class ITMVoxelBlockFile
+	{
+	private:
+		std::string fileName;
+		int fileDescriptor;
+
+		size_t blockBytes;
+		int noBlocksPerChunk;
+		int noBlocks;
+
+		std::vector<unsigned char*> chunks;
+
+	public:
+		ITMVoxelBlockFile(const std::string &fileName, size_t blockBytes, int noBlocksPerChunk = 1024);
+		~ITMVoxelBlockFile(void);
+
+		/** Reserves space for a new block at the end of the file and returns its id. */
+		int AllocateBlock(void);
+
+		/** Gets a pointer to the mapped contents of the given block. */
+		void *GetBlock(int blockId) const
+		{
+			return chunks[blockId / noBlocksPerChunk] + (size_t)(blockId % noBlocksPerChunk) * blockBytes;
+		}
+
+		/** Blocks until all modified blocks have been written to disk. */
+		void Flush(void);
+
+		int GetNoBlocks(void) const { return noBlocks; }
+		size_t GetFileBytes(void) const { return chunks.size() * noBlocksPerChunk * blockBytes; }
+
+		// Suppress the default copy constructor and assignment operator
+		ITMVoxelBlockFile(const ITMVoxelBlockFile&);
+		ITMVoxelBlockFile& operator=(const ITMVoxelBlockFile&);
+	};
+}
@@ -6,28 +6,25 @@
 #include <stdlib.h>
 #include <fstream>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 #endif
 
 #include "../../Utils/ITMMath.h"
+#include "ITMBlockOccupancy.h"
+#ifndef __METALC__
+#include "../../Utils/ITMSceneParams.h"
+#endif
 #include "../../../ORUtils/MemoryBlock.h"
 #include "../../../ORUtils/MemoryBlockPersister.h"
 
 #define SDF_BLOCK_SIZE 8				// SDF block size
 #define SDF_BLOCK_SIZE3 512				// SDF_BLOCK_SIZE3 = SDF_BLOCK_SIZE * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE
 
-#define SDF_LOCAL_BLOCK_NUM 0x40000		// Number of locally stored blocks, currently 2^17
-
-#define SDF_BUCKET_NUM 0x100000			// Number of Hash Bucket, should be 2^n and bigger than SDF_LOCAL_BLOCK_NUM, SDF_HASH_MASK = SDF_BUCKET_NUM - 1
-#define SDF_HASH_MASK 0xfffff			// Used for get hashing value of the bucket index,  SDF_HASH_MASK = SDF_BUCKET_NUM - 1
-#define SDF_EXCESS_LIST_SIZE 0x20000	// 0x20000 Size of excess list, used to handle collisions. Also max offset (unsigned short) value.
-
-//// for loop closure
-//#define SDF_LOCAL_BLOCK_NUM 0x10000		// Number of locally stored blocks, currently 2^12
-//
-//#define SDF_BUCKET_NUM 0x40000			// Number of Hash Bucket, should be 2^n and bigger than SDF_LOCAL_BLOCK_NUM, SDF_HASH_MASK = SDF_BUCKET_NUM - 1
-//#define SDF_HASH_MASK 0x3ffff			// Used for get hashing value of the bucket index,  SDF_HASH_MASK = SDF_BUCKET_NUM - 1
-//#define SDF_EXCESS_LIST_SIZE 0x8000		// 0x8000 Size of excess list, used to handle collisions. Also max offset (unsigned short) value.
-
+// Default size of the hash, see ITMSceneParams::SetHashSize
+#define SDF_LOCAL_BLOCK_NUM 0x40000		// Number of locally stored blocks, currently 2^18
+#define SDF_BUCKET_NUM 0x100000			// Number of Hash Bucket, should be 2^n and bigger than SDF_LOCAL_BLOCK_NUM
+#define SDF_EXCESS_LIST_SIZE 0x20000	// 0x20000 Size of excess list, used to handle collisions.
 #define SDF_TRANSFER_BLOCK_NUM 0x1000	// Maximum number of blocks transfered in one swap operation
 
 /** \brief
@@ -65,15 +62,50 @@ namespace ITMLib
 			_CPU_AND_GPU_CODE_ IndexCache(void) : blockPos(0x7fffffff), blockPtr(-1) {}
 		};
 
-		/** Maximum number of total entries. */
-		static const CONSTPTR(int) noTotalEntries = SDF_BUCKET_NUM + SDF_EXCESS_LIST_SIZE;
+		/** \brief
+		    A cache of the last eight blocks looked up, one for
+		    each combination of odd and even block coordinates, so
+		    that the up to eight blocks read around a block corner,
+		    e.g. by a trilinear interpolation, never evict each
+		    other. Blocks that are not in memory are kept as well.
+
+		    IndexCache is cheaper to set up and to keep in
+		    registers, which suits the GPU better.
+		*/
+		struct NeighbourIndexCache {
+			Vector3i blockPos[8];
+			/** Offset of the block's first voxel, or -1 if the block is not in memory. */
+			int blockPtr[8];
+			/** The hash entry of the block plus 1, or 0 if the block is not in memory. */
+			int vmIndex[8];
+			_CPU_AND_GPU_CODE_ NeighbourIndexCache(void)
+			{
+				for (int i = 0; i < 8; i++)
+				{
+					blockPos[i] = Vector3i(0x7fffffff);
+					blockPtr[i] = -1;
+					vmIndex[i] = 0;
+				}
+			}
+		};
+
 		static const CONSTPTR(int) voxelBlockSize = SDF_BLOCK_SIZE * SDF_BLOCK_SIZE * SDF_BLOCK_SIZE;
 
 #ifndef __METALC__
+		/** Number of buckets, size of the excess list and maximum number of total entries. */
+		const int noBuckets, noExcessEntries, noTotalEntries;
+
 	private:
 		int lastFreeExcessListId;
+		int noVoxelBlocks;
 
-		/** The actual data in the hash table. */
+		/** The actual data in the hash table, preceded by
+		one entry that records the size of the table, so
+		that lookups given just the table can find the
+		excess list (see ITMRepresentationAccess.h): its
+		offset is the number of buckets and its ptr the
+		size of the excess list.
+		*/
 		ORUtils::MemoryBlock<ITMHashEntry> *hashEntries;
 
 		/** Identifies which entries of the overflow
@@ -83,28 +115,62 @@ namespace ITMLib
 		*/
 		ORUtils::MemoryBlock<int> *excessAllocationList;
 
+		/** One flag per entry, set when the voxels of the
+		entry's block change, and cleared once the block
+		has been meshed again. See ITMBlockMeshCache.
+		*/
+		ORUtils::MemoryBlock<uchar> *dirtyEntries;
+
+		/** Host-side list of the entries whose flags have
+		been set since they were last cleared, so that the
+		flags can be found without scanning the table. Not
+		kept while all of the flags are set, see
+		MarkAllEntriesDirty. Only maintained by the CPU engines.
+		*/
+		std::vector<int> dirtyEntryList;
+		bool allEntriesDirty;
+
+		/** Which blocks are allocated and in memory, or NULL
+		unless ITMSceneParams::useBlockOccupancy is set and
+		the hash is on the CPU.
+		*/
+		ITMBlockOccupancy *occupancy;
+
 		MemoryDeviceType memoryType;
 
 	public:
-		ITMVoxelBlockHash(MemoryDeviceType memoryType)
+		ITMVoxelBlockHash(const ITMSceneParams *sceneParams, MemoryDeviceType memoryType)
+			: noBuckets(sceneParams->noHashBuckets), noExcessEntries(sceneParams->noHashExcessEntries), noTotalEntries(noBuckets + noExcessEntries)
 		{
+			if (noBuckets <= 0 || (noBuckets & (noBuckets - 1)) != 0) throw std::runtime_error("The number of hash buckets must be a power of two");
+			if (noExcessEntries <= 0 || sceneParams->noVoxelBlocks <= 0) throw std::runtime_error("The hash needs room for an excess list and voxel blocks");
+
 			this->memoryType = memoryType;
-			hashEntries = new ORUtils::MemoryBlock<ITMHashEntry>(noTotalEntries, memoryType);
-			excessAllocationList = new ORUtils::MemoryBlock<int>(SDF_EXCESS_LIST_SIZE, memoryType);
+			this->noVoxelBlocks = sceneParams->noVoxelBlocks;
+
+			hashEntries = new ORUtils::MemoryBlock<ITMHashEntry>(noTotalEntries + 1, memoryType);
+			excessAllocationList = new ORUtils::MemoryBlock<int>(noExcessEntries, memoryType);
+			dirtyEntries = new ORUtils::MemoryBlock<uchar>(noTotalEntries, memoryType);
+			allEntriesDirty = false;
+			occupancy = sceneParams->useBlockOccupancy && memoryType == MEMORYDEVICE_CPU ? new ITMBlockOccupancy(noBuckets >= 0x100 ? noBuckets / 16 : 16) : NULL;
+
+			WriteHeaderEntry();
 		}
 
 		~ITMVoxelBlockHash(void)
 		{
 			delete hashEntries;
 			delete excessAllocationList;
+			delete dirtyEntries;
+			if (occupancy != NULL) delete occupancy;
 		}
 
 		/** Get the list of actual entries in the hash table. */
-		const ITMHashEntry *GetEntries(void) const { return hashEntries->GetData(memoryType); }
-		ITMHashEntry *GetEntries(void) { return hashEntries->GetData(memoryType); }
+		const ITMHashEntry *GetEntries(void) const { return hashEntries->GetData(memoryType) + 1; }
+		ITMHashEntry *GetEntries(void) { return hashEntries->GetData(memoryType) + 1; }
 
-		const IndexData *getIndexData(void) const { return hashEntries->GetData(memoryType); }
-		IndexData *getIndexData(void) { return hashEntries->GetData(memoryType); }
+		const IndexData *getIndexData(void) const { return hashEntries->GetData(memoryType) + 1; }
+		IndexData *getIndexData(void) { return hashEntries->GetData(memoryType) + 1; }
 
 		/** Get the list that identifies which entries of the
 		overflow list are allocated. This is used if too
@@ -113,18 +179,68 @@ namespace ITMLib
 		const int *GetExcessAllocationList(void) const { return excessAllocationList->GetData(memoryType); }
 		int *GetExcessAllocationList(void) { return excessAllocationList->GetData(memoryType); }
 
+		/** Get the flags that mark the entries whose blocks changed since they were last meshed. */
+		const uchar *GetDirtyEntries(void) const { return dirtyEntries->GetData(memoryType); }
+		void MarkAllEntriesDirty(void) { dirtyEntries->Clear(1); dirtyEntryList.clear(); allEntriesDirty = true; }
+
+		/** Sets the flag of an entry, and records the entry
+		in the list of dirty entries if its flag was not
+		set yet. Not thread safe, and only for hashes on
+		the CPU.
+		*/
+		void MarkEntryDirty(int entryId)
+		{
+			uchar *flags = dirtyEntries->GetData(memoryType);
+			if (flags[entryId]) return;
+
+			flags[entryId] = 1;
+			if (!allEntriesDirty) dirtyEntryList.push_back(entryId);
+		}
+
+		/** Replaces the contents of @p entryIds with the
+		entries whose flags are set, and clears those flags.
+		This only costs in proportion to the number of dirty
+		entries, unless all of them were marked at once.
+		Only for hashes on the CPU.
+		*/
+		void TakeDirtyEntries(std::vector<int> &entryIds)
+		{
+			uchar *flags = dirtyEntries->GetData(memoryType);
+
+			if (allEntriesDirty)
+			{
+				entryIds.resize(noTotalEntries);
+				for (int i = 0; i < noTotalEntries; i++) entryIds[i] = i;
+				dirtyEntries->Clear(0);
+				allEntriesDirty = false;
+			}
+			else
+			{
+				entryIds.swap(dirtyEntryList);
+				for (size_t i = 0; i < entryIds.size(); i++) flags[entryIds[i]] = 0;
+			}
+
+			dirtyEntryList.clear();
+		}
+
+		/** Get the map of allocated blocks, or NULL if the hash does not keep one. */
+		const ITMBlockOccupancy *GetBlockOccupancy(void) const { return occupancy; }
+		ITMBlockOccupancy *GetBlockOccupancy(void) { return occupancy; }
+
 		int GetLastFreeExcessListId(void) { return lastFreeExcessListId; }
 		void SetLastFreeExcessListId(int lastFreeExcessListId) { this->lastFreeExcessListId = lastFreeExcessListId; }
 
 #ifdef COMPILE_WITH_METAL
+		/** The hash entry buffers have to be bound at this offset, to skip the size entry in front of the table. */
+		static const size_t entries_MB_offset = sizeof(ITMHashEntry);
 		const void* GetEntries_MB(void) { return hashEntries->GetMetalBuffer(); }
 		const void* GetExcessAllocationList_MB(void) { return excessAllocationList->GetMetalBuffer(); }
 		const void* getIndexData_MB(void) const { return hashEntries->GetMetalBuffer(); }
 #endif
 
-		/** Maximum number of total entries. */
-		int getNumAllocatedVoxelBlocks(void) { return SDF_LOCAL_BLOCK_NUM; }
-		int getVoxelBlockSize(void) { return SDF_BLOCK_SIZE3; }
+		/** Initial number of voxel blocks, see ITMLocalVBA::GetNoBlocks for the current one. */
+		int getNumAllocatedVoxelBlocks(void) const { return noVoxelBlocks; }
+		int getVoxelBlockSize(void) const { return SDF_BLOCK_SIZE3; }
 
 		void SaveToDirectory(const std::string &outputDirectory) const
 		{
@@ -150,10 +266,70 @@ namespace ITMLib
 			if (!ifs) throw std::runtime_error("Count not open " + lastFreeExcessListIdFileName + " for reading");
 
 			ifs >> this->lastFreeExcessListId;
-			ORUtils::MemoryBlockPersister::LoadMemoryBlock(hashEntriesFileName.c_str(), *hashEntries, memoryType);
+
+			// files written before the size entry was added hold just the entries, which only fit a hash of the default size
+			ORUtils::MemoryBlock<ITMHashEntry> *loadedEntries = ORUtils::MemoryBlockPersister::LoadMemoryBlock(hashEntriesFileName, loadedEntries);
+			const ITMHashEntry *loadedHeader = loadedEntries->GetData(MEMORYDEVICE_CPU);
+			ITMHashEntry header = GetHeaderEntry();
+
+			bool hasHeader = loadedEntries->dataSize == hashEntries->dataSize && loadedHeader->offset == header.offset && loadedHeader->ptr == header.ptr;
+			bool isLegacy = loadedEntries->dataSize == (size_t)noTotalEntries && noBuckets == SDF_BUCKET_NUM && noExcessEntries == SDF_EXCESS_LIST_SIZE;
+			if (!hasHeader && !isLegacy)
+			{
+				delete loadedEntries;
+				throw std::runtime_error(hashEntriesFileName + " was saved from a hash of a different size");
+			}
+
+			if (isLegacy) WriteHeaderEntry();
+			CopyFromHost(*loadedEntries, isLegacy ? 1 : 0);
+			delete loadedEntries;
+
 			ORUtils::MemoryBlockPersister::LoadMemoryBlock(excessAllocationListFileName.c_str(), *excessAllocationList, memoryType);
+			MarkAllEntriesDirty();
+
+			if (occupancy != NULL)
+			{
+				const ITMHashEntry *entries = GetEntries();
+				occupancy->Clear();
+				for (int i = 0; i < noTotalEntries; i++) if (entries[i].ptr >= 0) occupancy->SetBlock(entries[i].pos, true);
+			}
 		}
 
+	private:
+		ITMHashEntry GetHeaderEntry(void) const
+		{
+			ITMHashEntry header;
+			header.pos = Vector3s(0, 0, 0);
+			header.offset = noBuckets;
+			header.ptr = noExcessEntries;
+			return header;
+		}
+
+		/** Copies host entries into hashEntries, starting at the given entry of the underlying block. */
+		void CopyFromHost(const ORUtils::MemoryBlock<ITMHashEntry> &source, size_t firstEntry)
+		{
+			const ITMHashEntry *sourceData = source.GetData(MEMORYDEVICE_CPU);
+			ITMHashEntry *targetData = hashEntries->GetData(memoryType) + firstEntry;
+			size_t noBytes = source.dataSize * sizeof(ITMHashEntry);
+
+#ifndef COMPILE_WITHOUT_CUDA
+			if (memoryType == MEMORYDEVICE_CUDA)
+			{
+				ORcudaSafeCall(cudaMemcpy(targetData, sourceData, noBytes, cudaMemcpyHostToDevice));
+				return;
+			}
+#endif
+			memcpy(targetData, sourceData, noBytes);
+		}
+
+		void WriteHeaderEntry(void)
+		{
+			ORUtils::MemoryBlock<ITMHashEntry> header(1, MEMORYDEVICE_CPU);
+			*header.GetData(MEMORYDEVICE_CPU) = GetHeaderEntry();
+			CopyFromHost(header, 0);
+		}
+
+	public:
 		// Suppress the default copy constructor and assignment operator
 		ITMVoxelBlockHash(const ITMVoxelBlockHash&);
 		ITMVoxelBlockHash& operator=(const ITMVoxelBlockHash&);
@@ -1,8 +1,12 @@
 // Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
 
 #include "ITMColorTracker_CPU.h"
+#include "ITMTrackerAccuCell_CPU.h"
 #include "../Shared/ITMColorTracker_Shared.h"
 
+#include <algorithm>
+#include <vector>
+
 using namespace ITMLib;
 
 ITMColorTracker_CPU::ITMColorTracker_CPU(Vector2i imgSize, TrackerIterationType *trackingRegime, int noHierarchyLevels, const ITMLowLevelEngine *lowLevelEngine)
@@ -28,11 +32,32 @@ int ITMColorTracker_CPU::F_oneLevel(float *f, ORUtils::SE3Pose *pose)
 	Vector4f *colours = trackingState->pointCloud->colours->GetData(MEMORYDEVICE_CPU);
 	Vector4u *rgb = viewHierarchy->GetLevel(levelId)->rgb->GetData(MEMORYDEVICE_CPU);
 
+	// one partial sum per chunk of points, added up in chunk order afterwards
+	const int noPointsPerChunk = ITMTrackerAccuCell_CPU::noPointsPerChunk;
+	int noChunks = (noTotalPoints + noPointsPerChunk - 1) / noPointsPerChunk;
+	std::vector<ITMTrackerAccuCell_CPU> chunkSums(noChunks);
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int chunkId = 0; chunkId < noChunks; chunkId++)
+	{
+		ITMTrackerAccuCell_CPU &chunkSum = chunkSums[chunkId];
+		chunkSum.Clear();
+
+		int chunkEnd = std::min(noTotalPoints, (chunkId + 1) * noPointsPerChunk);
+		for (int locId = chunkId * noPointsPerChunk; locId < chunkEnd; locId++)
+		{
+			float colorDiffSq = getColorDifferenceSq(locations, colours, rgb, imgSize, locId, projParams, M);
+			if (colorDiffSq >= 0) { chunkSum.f += colorDiffSq; chunkSum.noValidPoints++; }
+		}
+	}
+
 	final_f = 0; countedPoints_valid = 0;
-	for (int locId = 0; locId < noTotalPoints; locId++)
+	for (int chunkId = 0; chunkId < noChunks; chunkId++)
 	{
-		float colorDiffSq = getColorDifferenceSq(locations, colours, rgb, imgSize, locId, projParams, M);
-		if (colorDiffSq >= 0) { final_f += colorDiffSq; countedPoints_valid++; }
+		final_f += chunkSums[chunkId].f;
+		countedPoints_valid += chunkSums[chunkId].noValidPoints;
 	}
 
 	if (countedPoints_valid == 0) { final_f = 1e10; scaleForOcclusions = 1.0; }
@@ -60,40 +85,47 @@ void ITMColorTracker_CPU::G_oneLevel(float *gradient, float *hessian, ORUtils::S
 	bool rotationOnly = iterationType == TRACKER_ITERATION_ROTATION;
 	int numPara = rotationOnly ? 3 : 6, startPara = rotationOnly ? 3 : 0, numParaSQ = rotationOnly ? 3 + 2 + 1 : 6 + 5 + 4 + 3 + 2 + 1;
 
-	float globalGradient[6], globalHessian[21];
-	for (int i = 0; i < numPara; i++) globalGradient[i] = 0.0f;
-	for (int i = 0; i < numParaSQ; i++) globalHessian[i] = 0.0f;
-
 	Vector4f *locations = trackingState->pointCloud->locations->GetData(MEMORYDEVICE_CPU);
 	Vector4f *colours = trackingState->pointCloud->colours->GetData(MEMORYDEVICE_CPU);
 	Vector4u *rgb = viewHierarchy->GetLevel(levelId)->rgb->GetData(MEMORYDEVICE_CPU);
 	Vector4s *gx = viewHierarchy->GetLevel(levelId)->gradientX_rgb->GetData(MEMORYDEVICE_CPU);
 	Vector4s *gy = viewHierarchy->GetLevel(levelId)->gradientY_rgb->GetData(MEMORYDEVICE_CPU);
 
-	for (int locId = 0; locId < noTotalPoints; locId++)
+	// one partial sum per chunk of points, added up in chunk order afterwards
+	const int noPointsPerChunk = ITMTrackerAccuCell_CPU::noPointsPerChunk;
+	int noChunks = (noTotalPoints + noPointsPerChunk - 1) / noPointsPerChunk;
+	std::vector<ITMTrackerAccuCell_CPU> chunkSums(noChunks);
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int chunkId = 0; chunkId < noChunks; chunkId++)
 	{
-		float localGradient[6], localHessian[21];
+		ITMTrackerAccuCell_CPU &chunkSum = chunkSums[chunkId];
+		chunkSum.Clear();
 
-		computePerPointGH_rt_Color(localGradient, localHessian, locations, colours, rgb, imgSize, locId,
-			projParams, M, gx, gy, 6, 0);
+		int chunkEnd = std::min(noTotalPoints, (chunkId + 1) * noPointsPerChunk);
+		for (int locId = chunkId * noPointsPerChunk; locId < chunkEnd; locId++)
+		{
+			float localGradient[6], localHessian[21];
 
-		bool isValidPoint = computePerPointGH_rt_Color(localGradient, localHessian, locations, colours, rgb, imgSize, locId,
-			projParams, M, gx, gy, numPara, startPara);
+			bool isValidPoint = computePerPointGH_rt_Color(localGradient, localHessian, locations, colours, rgb, imgSize, locId,
+				projParams, M, gx, gy, numPara, startPara);
 
-		if (isValidPoint)
-		{
-			for (int i = 0; i < numPara; i++) globalGradient[i] += localGradient[i];
-			for (int i = 0; i < numParaSQ; i++) globalHessian[i] += localHessian[i];
+			if (isValidPoint) chunkSum.Add(0.0f, localGradient, localHessian, numPara, numParaSQ);
 		}
 	}
 
+	ITMTrackerAccuCell_CPU sum; sum.Clear();
+	for (int chunkId = 0; chunkId < noChunks; chunkId++) sum.Add(chunkSums[chunkId], numPara, numParaSQ);
+
 	scaleForOcclusions = (float)noTotalPoints / countedPoints_valid;
 	if (countedPoints_valid == 0) { scaleForOcclusions = 1.0f; }
 
 	for (int para = 0, counter = 0; para < numPara; para++)
 	{
-		gradient[para] = globalGradient[para] * scaleForOcclusions;
-		for (int col = 0; col <= para; col++, counter++) hessian[para + col * numPara] = globalHessian[counter] * scaleForOcclusions;
+		gradient[para] = sum.g[para] * scaleForOcclusions;
+		for (int col = 0; col <= para; col++, counter++) hessian[para + col * numPara] = sum.h[counter] * scaleForOcclusions;
 	}
 	for (int row = 0; row < numPara; row++)
 	{
@@ -0,0 +1,215 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+#include "ITMTrackerAccuCell_CPU.h"
+#include "../../Objects/Tracking/TrackerIterationType.h"
+#include "../../Utils/ITMMath.h"
+#include "../../Utils/ITMSIMDUtils.h"
+
+namespace ITMLib
+{
+	/** \brief
+	    Inputs of the batched point-to-plane ICP kernel, shared by
+	    the depth tracker and the depth term of the extended tracker.
+	*/
+	struct ITMDepthBatchParams_CPU
+	{
+		const float *depth;
+		Vector2i viewImageSize;
+		Vector4f viewIntrinsics;
+
+		const Vector4f *pointsMap, *normalsMap;
+		Vector2i sceneImageSize;
+		Vector4f sceneIntrinsics;
+
+		Matrix4f approxInvPose, scenePose;
+
+		/** Largest squared distance between a point and its correspondence. */
+		float distThresh;
+
+		/** Extended tracker only: Huber threshold and depth based weighting. */
+		float huberB, viewFrustum_min, viewFrustum_max;
+		int framesToSkip, framesToWeight;
+	};
+
+#if ITM_SIMD_WIDTH > 1
+	/** Batched version of interpolateBilinear_withHoles, for Vector4f images viewed as arrays of floats. */
+	inline void interpolateBilinear_withHoles(simd_float *result, simd_mask &holes, const float *source, simd_int idx, int width,
+		simd_float dx, simd_float dy)
+	{
+		const simd_float one = simd_set(1.0f), zero = simd_set(0.0f);
+
+		simd_int ia = idx * simd_set(4), ib = ia + simd_set(4), ic = ia + simd_set(4 * width), id = ic + simd_set(4);
+		simd_float wa = (one - dx) * (one - dy), wb = dx * (one - dy), wc = (one - dx) * dy, wd = dx * dy;
+
+		simd_float aw = simd_gather(source + 3, ia), bw = simd_gather(source + 3, ib);
+		simd_float cw = simd_gather(source + 3, ic), dw = simd_gather(source + 3, id);
+		holes = (aw < zero) | (bw < zero) | (cw < zero) | (dw < zero);
+
+		for (int c = 0; c < 3; c++)
+		{
+			result[c] = simd_gather(source + c, ia) * wa + simd_gather(source + c, ib) * wb +
+				simd_gather(source + c, ic) * wc + simd_gather(source + c, id) * wd;
+		}
+		result[3] = aw * wa + bw * wb + cw * wc + dw * wd;
+	}
+#endif
+
+	/** \brief
+	    Accumulates the ICP error, gradient and Hessian of row y in
+	    batches of ITM_SIMD_WIDTH pixels, following
+	    computePerPointGH_Depth (or computePerPointGH_exDepth if
+	    extended is set) lane by lane.
+
+	    Returns the first x that was not processed. The caller
+	    finishes the row from there with the scalar code, which
+	    remains the reference implementation.
+	*/
+	template<bool shortIteration, bool rotationOnly, bool extended, bool useWeights>
+	inline int computeRowGH_Depth_SIMD(ITMTrackerAccuCell_CPU &rowSum, int y, const ITMDepthBatchParams_CPU &p)
+	{
+#if ITM_SIMD_WIDTH > 1
+		const int noPara = shortIteration ? 3 : 6;
+		const float *M = p.approxInvPose.m, *P = p.scenePose.m;
+		const float *depthRow = p.depth + y * p.viewImageSize.x;
+		const float *points = (const float*)p.pointsMap, *normals = (const float*)p.normalsMap;
+		const int sceneWidth = p.sceneImageSize.x;
+
+		const simd_float zero = simd_set(0.0f), one = simd_set(1.0f);
+		const simd_float lanes = simd_lanes();
+		const simd_float view_y = simd_set(((float)y - p.viewIntrinsics.w) / p.viewIntrinsics.y);
+		const simd_float maxU = simd_set((float)(p.sceneImageSize.x - 2)), maxV = simd_set((float)(p.sceneImageSize.y - 2));
+
+		simd_float sumF = zero, sumNabla[6], sumHessian[6 + 5 + 4 + 3 + 2 + 1];
+		for (int i = 0; i < noPara; i++) sumNabla[i] = zero;
+		for (int i = 0; i < noPara * (noPara + 1) / 2; i++) sumHessian[i] = zero;
+		int noValidPoints = 0;
+
+		int x = 0;
+		for (; x + ITM_SIMD_WIDTH <= p.viewImageSize.x; x += ITM_SIMD_WIDTH)
+		{
+			simd_float depth = simd_load(depthRow + x);
+			simd_mask valid = depth > simd_set(1e-8f);
+			if (!simd_any(valid)) continue;
+
+			simd_float ptx = depth * ((simd_set((float)x) + lanes - simd_set(p.viewIntrinsics.z)) / simd_set(p.viewIntrinsics.x));
+			simd_float pty = depth * view_y, ptz = depth;
+
+			// transform to previous frame coordinates
+			simd_float px = simd_set(M[0]) * ptx + simd_set(M[4]) * pty + simd_set(M[8]) * ptz + simd_set(M[12]);
+			simd_float py = simd_set(M[1]) * ptx + simd_set(M[5]) * pty + simd_set(M[9]) * ptz + simd_set(M[13]);
+			simd_float pz = simd_set(M[2]) * ptx + simd_set(M[6]) * pty + simd_set(M[10]) * ptz + simd_set(M[14]);
+
+			// project into previous rendered image
+			simd_float rx = simd_set(P[0]) * px + simd_set(P[4]) * py + simd_set(P[8]) * pz + simd_set(P[12]);
+			simd_float ry = simd_set(P[1]) * px + simd_set(P[5]) * py + simd_set(P[9]) * pz + simd_set(P[13]);
+			simd_float rz = simd_set(P[2]) * px + simd_set(P[6]) * py + simd_set(P[10]) * pz + simd_set(P[14]);
+			valid = valid & (rz > zero);
+
+			simd_float u = simd_set(p.sceneIntrinsics.x) * rx / rz + simd_set(p.sceneIntrinsics.z);
+			simd_float v = simd_set(p.sceneIntrinsics.y) * ry / rz + simd_set(p.sceneIntrinsics.w);
+			valid = valid & (u >= zero) & (u <= maxU) & (v >= zero) & (v <= maxV);
+			if (!simd_any(valid)) continue;
+
+			// lanes that are already invalid read the first pixel instead of going out of bounds
+			simd_int iu = simd_floor_int(u), iv = simd_floor_int(v);
+			simd_float du = u - simd_to_float(iu), dv = v - simd_to_float(iv);
+			simd_int idx = simd_select(valid, iu + iv * simd_set(sceneWidth), simd_set(0));
+
+			simd_float curr[4]; simd_mask holes;
+			interpolateBilinear_withHoles(curr, holes, points, idx, sceneWidth, du, dv);
+			valid = valid & !holes & !(curr[3] < zero);
+
+			simd_float diffx = curr[0] - px, diffy = curr[1] - py, diffz = curr[2] - pz;
+			simd_float dist = diffx * diffx + diffy * diffy + diffz * diffz;
+			valid = valid & !(dist > simd_set(p.distThresh));
+			if (!simd_any(valid)) continue;
+
+			simd_float normal[4]; simd_mask normalHoles;
+			interpolateBilinear_withHoles(normal, normalHoles, normals, idx, sceneWidth, du, dv);
+			for (int c = 0; c < 3; c++) normal[c] = simd_select(normalHoles, zero, normal[c]);
+
+			simd_float depthWeight = one;
+			if (extended)
+			{
+				depthWeight = simd_max(zero, one - (depth - simd_set(p.viewFrustum_min)) / simd_set(p.viewFrustum_max - p.viewFrustum_min));
+				depthWeight = depthWeight * depthWeight;
+
+				if (useWeights)
+				{
+					valid = valid & !(curr[3] < simd_set((float)p.framesToSkip));
+					depthWeight = depthWeight * ((curr[3] - simd_set((float)p.framesToSkip)) / simd_set((float)p.framesToWeight));
+				}
+			}
+
+			simd_float b = normal[0] * diffx + normal[1] * diffy + normal[2] * diffz;
+
+			simd_float A[6];
+			if (!shortIteration || rotationOnly)
+			{
+				A[0] = pz * normal[1] - py * normal[2];
+				A[1] = px * normal[2] - pz * normal[0];
+				A[2] = py * normal[0] - px * normal[1];
+			}
+			if (shortIteration && !rotationOnly) { A[0] = normal[0]; A[1] = normal[1]; A[2] = normal[2]; }
+			if (!shortIteration) { A[3] = normal[0]; A[4] = normal[1]; A[5] = normal[2]; }
+
+			// invalid lanes contribute exact zeros
+			b = simd_select(valid, b, zero);
+			depthWeight = simd_select(valid, depthWeight, zero);
+			for (int r = 0; r < noPara; r++) A[r] = simd_select(valid, A[r], zero);
+
+			if (extended)
+			{
+				simd_float huberB = simd_set(p.huberB), absB = simd_abs(b);
+				simd_float excess = simd_max(absB - huberB, zero);
+
+				simd_float f = (b * b - excess * excess) * depthWeight;
+				simd_float coeffNabla = simd_set(2.0f) * simd_min(simd_max(b, zero - huberB), huberB) * depthWeight;
+				simd_float coeffHessian = simd_select(absB < huberB, simd_set(2.0f), zero) * depthWeight;
+
+				sumF = sumF + f;
+				for (int r = 0, counter = 0; r < noPara; r++)
+				{
+					sumNabla[r] = sumNabla[r] + coeffNabla * A[r];
+					for (int c = 0; c <= r; c++, counter++) sumHessian[counter] = sumHessian[counter] + coeffHessian * A[r] * A[c];
+				}
+			}
+			else
+			{
+				sumF = sumF + b * b;
+				for (int r = 0, counter = 0; r < noPara; r++)
+				{
+					sumNabla[r] = sumNabla[r] + b * A[r];
+					for (int c = 0; c <= r; c++, counter++) sumHessian[counter] = sumHessian[counter] + A[r] * A[c];
+				}
+			}
+
+			noValidPoints += simd_count(valid);
+		}
+
+		rowSum.noValidPoints += noValidPoints;
+		rowSum.f += simd_sum(sumF);
+		for (int i = 0; i < noPara; i++) rowSum.g[i] += simd_sum(sumNabla[i]);
+		for (int i = 0; i < noPara * (noPara + 1) / 2; i++) rowSum.h[i] += simd_sum(sumHessian[i]);
+
+		return x;
+#else
+		return 0;
+#endif
+	}
+
+	/** Picks the computeRowGH_Depth_SIMD instance for the given iteration type. */
+	template<bool extended, bool useWeights>
+	inline int computeRowGH_Depth_SIMD(ITMTrackerAccuCell_CPU &rowSum, int y, const ITMDepthBatchParams_CPU &p, TrackerIterationType iterationType)
+	{
+		switch (iterationType)
+		{
+		case TRACKER_ITERATION_ROTATION: return computeRowGH_Depth_SIMD<true, true, extended, useWeights>(rowSum, y, p);
+		case TRACKER_ITERATION_TRANSLATION: return computeRowGH_Depth_SIMD<true, false, extended, useWeights>(rowSum, y, p);
+		case TRACKER_ITERATION_BOTH: return computeRowGH_Depth_SIMD<false, false, extended, useWeights>(rowSum, y, p);
+		default: return 0;
+		}
+	}
+}
@@ -1,8 +1,11 @@
 // Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
 
 #include "ITMDepthTracker_CPU.h"
+#include "ITMDepthTrackerBatch_CPU.h"
 #include "../Shared/ITMDepthTracker_Shared.h"
 
+#include <vector>
+
 using namespace ITMLib;
 
 ITMDepthTracker_CPU::ITMDepthTracker_CPU(Vector2i imgSize, TrackerIterationType *trackingRegime, int noHierarchyLevels,
@@ -27,54 +30,69 @@ int ITMDepthTracker_CPU::ComputeGandH(float &f, float *nabla, float *hessian, Ma
 
 	bool shortIteration = (iterationType == TRACKER_ITERATION_ROTATION) || (iterationType == TRACKER_ITERATION_TRANSLATION);
 
-	float sumHessian[6 * 6], sumNabla[6], sumF; int noValidPoints;
 	int noPara = shortIteration ? 3 : 6, noParaSQ = shortIteration ? 3 + 2 + 1 : 6 + 5 + 4 + 3 + 2 + 1;
 
-	noValidPoints = 0; sumF = 0.0f;
-	memset(sumHessian, 0, sizeof(float) * noParaSQ);
-	memset(sumNabla, 0, sizeof(float) * noPara);
+	ITMDepthBatchParams_CPU batchParams;
+	batchParams.depth = depth; batchParams.viewImageSize = viewImageSize; batchParams.viewIntrinsics = viewIntrinsics;
+	batchParams.pointsMap = pointsMap; batchParams.normalsMap = normalsMap;
+	batchParams.sceneImageSize = sceneImageSize; batchParams.sceneIntrinsics = sceneIntrinsics;
+	batchParams.approxInvPose = approxInvPose; batchParams.scenePose = scenePose;
+	batchParams.distThresh = distThresh[levelId];
+
+	// one partial sum per row, added up in row order afterwards
+	std::vector<ITMTrackerAccuCell_CPU> rowSums(viewImageSize.y);
 
-	for (int y = 0; y < viewImageSize.y; y++) for (int x = 0; x < viewImageSize.x; x++)
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < viewImageSize.y; y++)
 	{
-		float localHessian[6 + 5 + 4 + 3 + 2 + 1], localNabla[6], localF = 0;
+		ITMTrackerAccuCell_CPU &rowSum = rowSums[y];
+		rowSum.Clear();
 
-		for (int i = 0; i < noPara; i++) localNabla[i] = 0.0f;
-		for (int i = 0; i < noParaSQ; i++) localHessian[i] = 0.0f;
+		// vectorised batches first, the scalar code for whatever is left of the row
+		int x = computeRowGH_Depth_SIMD<false, false>(rowSum, y, batchParams, iterationType);
 
-		bool isValidPoint;
-        
-		switch (iterationType)
+		for (; x < viewImageSize.x; x++)
 		{
-		case TRACKER_ITERATION_ROTATION:
-			isValidPoint = computePerPointGH_Depth<true, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], viewImageSize,
-				viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, distThresh[levelId]);
-			break;
-		case TRACKER_ITERATION_TRANSLATION:
-			isValidPoint = computePerPointGH_Depth<true, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], viewImageSize,
-				viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, distThresh[levelId]);
-			break;
-		case TRACKER_ITERATION_BOTH:
-			isValidPoint = computePerPointGH_Depth<false, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], viewImageSize,
-				viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, distThresh[levelId]);
-			break;
-		default:
-			isValidPoint = false;
-			break;
-		}
+			float localHessian[6 + 5 + 4 + 3 + 2 + 1], localNabla[6], localF = 0;
 
-		if (isValidPoint)
-		{
-			noValidPoints++; sumF += localF;
-			for (int i = 0; i < noPara; i++) sumNabla[i] += localNabla[i];
-			for (int i = 0; i < noParaSQ; i++) sumHessian[i] += localHessian[i];
+			for (int i = 0; i < noPara; i++) localNabla[i] = 0.0f;
+			for (int i = 0; i < noParaSQ; i++) localHessian[i] = 0.0f;
+
+			bool isValidPoint;
+        
+			switch (iterationType)
+			{
+			case TRACKER_ITERATION_ROTATION:
+				isValidPoint = computePerPointGH_Depth<true, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], viewImageSize,
+					viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, distThresh[levelId]);
+				break;
+			case TRACKER_ITERATION_TRANSLATION:
+				isValidPoint = computePerPointGH_Depth<true, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], viewImageSize,
+					viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, distThresh[levelId]);
+				break;
+			case TRACKER_ITERATION_BOTH:
+				isValidPoint = computePerPointGH_Depth<false, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], viewImageSize,
+					viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, distThresh[levelId]);
+				break;
+			default:
+				isValidPoint = false;
+				break;
+			}
+
+			if (isValidPoint) rowSum.Add(localF, localNabla, localHessian, noPara, noParaSQ);
 		}
 	}
 
-	for (int r = 0, counter = 0; r < noPara; r++) for (int c = 0; c <= r; c++, counter++) hessian[r + c * 6] = sumHessian[counter];
+	ITMTrackerAccuCell_CPU sum; sum.Clear();
+	for (int y = 0; y < viewImageSize.y; y++) sum.Add(rowSums[y], noPara, noParaSQ);
+
+	for (int r = 0, counter = 0; r < noPara; r++) for (int c = 0; c <= r; c++, counter++) hessian[r + c * 6] = sum.h[counter];
 	for (int r = 0; r < noPara; ++r) for (int c = r + 1; c < noPara; c++) hessian[r + c * 6] = hessian[c + r * 6];
 	
-	memcpy(nabla, sumNabla, noPara * sizeof(float));
-	f = (noValidPoints > 100) ? sumF / noValidPoints : 1e5f;
+	memcpy(nabla, sum.g, noPara * sizeof(float));
+	f = (sum.noValidPoints > 100) ? sum.f / sum.noValidPoints : 1e5f;
 
-	return noValidPoints;
+	return sum.noValidPoints;
 }
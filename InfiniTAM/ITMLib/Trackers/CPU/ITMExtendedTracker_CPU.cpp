@@ -1,8 +1,11 @@
 // Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
 
 #include "ITMExtendedTracker_CPU.h"
+#include "ITMDepthTrackerBatch_CPU.h"
 #include "../Shared/ITMExtendedTracker_Shared.h"
 
+#include <vector>
+
 using namespace ITMLib;
 
 ITMExtendedTracker_CPU::ITMExtendedTracker_CPU(Vector2i imgSize_d,
@@ -58,97 +61,114 @@ int ITMExtendedTracker_CPU::ComputeGandH_Depth(float &f, float *nabla, float *he
 	bool shortIteration = (currentIterationType == TRACKER_ITERATION_ROTATION)
 						   || (currentIterationType == TRACKER_ITERATION_TRANSLATION);
 
-	float sumHessian[6 * 6], sumNabla[6], sumF; int noValidPoints;
 	int noPara = shortIteration ? 3 : 6, noParaSQ = shortIteration ? 3 + 2 + 1 : 6 + 5 + 4 + 3 + 2 + 1;
 
-	noValidPoints = 0; sumF = 0.0f;
-	memset(sumHessian, 0, sizeof(float) * noParaSQ);
-	memset(sumNabla, 0, sizeof(float) * noPara);
-
-	for (int y = 0; y < viewImageSize.y; y++) for (int x = 0; x < viewImageSize.x; x++)
+	ITMDepthBatchParams_CPU batchParams;
+	batchParams.depth = depth; batchParams.viewImageSize = viewImageSize; batchParams.viewIntrinsics = viewIntrinsics;
+	batchParams.pointsMap = pointsMap; batchParams.normalsMap = normalsMap;
+	batchParams.sceneImageSize = sceneImageSize; batchParams.sceneIntrinsics = sceneIntrinsics;
+	batchParams.approxInvPose = approxInvPose; batchParams.scenePose = scenePose;
+	batchParams.distThresh = tukeyCutOff * spaceThresh[currentLevelId]; batchParams.huberB = spaceThresh[currentLevelId];
+	batchParams.viewFrustum_min = viewFrustum_min; batchParams.viewFrustum_max = viewFrustum_max;
+	batchParams.framesToSkip = framesToSkip; batchParams.framesToWeight = framesToWeight;
+
+	// one partial sum per row, added up in row order afterwards
+	std::vector<ITMTrackerAccuCell_CPU> rowSums(viewImageSize.y);
+
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < viewImageSize.y; y++)
 	{
-		float localHessian[6 + 5 + 4 + 3 + 2 + 1], localNabla[6], localF = 0;
+		ITMTrackerAccuCell_CPU &rowSum = rowSums[y];
+		rowSum.Clear();
 
-		for (int i = 0; i < noPara; i++) localNabla[i] = 0.0f;
-		for (int i = 0; i < noParaSQ; i++) localHessian[i] = 0.0f;
+		// vectorised batches first, the scalar code for whatever is left of the row
+		int x = framesProcessed < 100 ? computeRowGH_Depth_SIMD<true, false>(rowSum, y, batchParams, currentIterationType)
+			: computeRowGH_Depth_SIMD<true, true>(rowSum, y, batchParams, currentIterationType);
 
-		bool isValidPoint;
+		for (; x < viewImageSize.x; x++)
+		{
+			float localHessian[6 + 5 + 4 + 3 + 2 + 1], localNabla[6], localF = 0;
 
-		float depthWeight;
+			for (int i = 0; i < noPara; i++) localNabla[i] = 0.0f;
+			for (int i = 0; i < noParaSQ; i++) localHessian[i] = 0.0f;
 
-		if (framesProcessed < 100)
-		{
-			switch (currentIterationType)
+			bool isValidPoint;
+
+			float depthWeight;
+
+			if (framesProcessed < 100)
 			{
-			case TRACKER_ITERATION_ROTATION:
-				isValidPoint = computePerPointGH_exDepth<true, true, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
-					viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
-					viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
-				break;
-			case TRACKER_ITERATION_TRANSLATION:
-				isValidPoint = computePerPointGH_exDepth<true, false, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
-					viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
-					viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
-				break;
-			case TRACKER_ITERATION_BOTH:
-				isValidPoint = computePerPointGH_exDepth<false, false, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
-					viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
-					viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
-				break;
-			default:
-				isValidPoint = false;
-				break;
+				switch (currentIterationType)
+				{
+				case TRACKER_ITERATION_ROTATION:
+					isValidPoint = computePerPointGH_exDepth<true, true, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
+						viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
+						viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
+					break;
+				case TRACKER_ITERATION_TRANSLATION:
+					isValidPoint = computePerPointGH_exDepth<true, false, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
+						viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
+						viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
+					break;
+				case TRACKER_ITERATION_BOTH:
+					isValidPoint = computePerPointGH_exDepth<false, false, false>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
+						viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
+						viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
+					break;
+				default:
+					isValidPoint = false;
+					break;
+				}
 			}
-		}
-		else
-		{
-			switch (currentIterationType)
+			else
 			{
-			case TRACKER_ITERATION_ROTATION:
-				isValidPoint = computePerPointGH_exDepth<true, true, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
-					viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
-					viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
-				break;
-			case TRACKER_ITERATION_TRANSLATION:
-				isValidPoint = computePerPointGH_exDepth<true, false, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
-					viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
-					viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
-				break;
-			case TRACKER_ITERATION_BOTH:
-				isValidPoint = computePerPointGH_exDepth<false, false, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
-					viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
-					viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
-				break;
-			default:
-				isValidPoint = false;
-				break;
+				switch (currentIterationType)
+				{
+				case TRACKER_ITERATION_ROTATION:
+					isValidPoint = computePerPointGH_exDepth<true, true, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
+						viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
+						viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
+					break;
+				case TRACKER_ITERATION_TRANSLATION:
+					isValidPoint = computePerPointGH_exDepth<true, false, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
+						viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
+						viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
+					break;
+				case TRACKER_ITERATION_BOTH:
+					isValidPoint = computePerPointGH_exDepth<false, false, true>(localNabla, localHessian, localF, x, y, depth[x + y * viewImageSize.x], depthWeight,
+						viewImageSize, viewIntrinsics, sceneImageSize, sceneIntrinsics, approxInvPose, scenePose, pointsMap, normalsMap, spaceThresh[currentLevelId],
+						viewFrustum_min, viewFrustum_max, tukeyCutOff, framesToSkip, framesToWeight);
+					break;
+				default:
+					isValidPoint = false;
+					break;
+				}
 			}
-		}
 
-		if (isValidPoint)
-		{
-			noValidPoints++;
-			sumF += localF;
-			for (int i = 0; i < noPara; i++) sumNabla[i] += localNabla[i];
-			for (int i = 0; i < noParaSQ; i++) sumHessian[i] += localHessian[i];
+			if (isValidPoint) rowSum.Add(localF, localNabla, localHessian, noPara, noParaSQ);
 		}
 	}
 
+	ITMTrackerAccuCell_CPU sum; sum.Clear();
+	for (int y = 0; y < viewImageSize.y; y++) sum.Add(rowSums[y], noPara, noParaSQ);
+
 	// Copy the lower triangular part of the matrix.
 	for (int r = 0, counter = 0; r < noPara; r++)
 		for (int c = 0; c <= r; c++, counter++)
-			hessian[r + c * 6] = sumHessian[counter];
+			hessian[r + c * 6] = sum.h[counter];
 
 	// Transpose to fill the upper triangle.
 	for (int r = 0; r < noPara; ++r)
 		for (int c = r + 1; c < noPara; c++)
 			hessian[r + c * 6] = hessian[c + r * 6];
 
-	memcpy(nabla, sumNabla, noPara * sizeof(float));
+	memcpy(nabla, sum.g, noPara * sizeof(float));
 
-	f = sumF;
+	f = sum.f;
 
-	return noValidPoints;
+	return sum.noValidPoints;
 }
 
 int ITMExtendedTracker_CPU::ComputeGandH_RGB(float &f, float *nabla, float *hessian, Matrix4f approxInvPose)
@@ -169,126 +189,129 @@ int ITMExtendedTracker_CPU::ComputeGandH_RGB(float &f, float *nabla, float *hess
 	bool shortIteration = (currentIterationType == TRACKER_ITERATION_ROTATION)
 						   || (currentIterationType == TRACKER_ITERATION_TRANSLATION);
 
-	float sumHessian[6 * 6], sumNabla[6], sumF;
-	int noValidPoints;
 	int noPara = shortIteration ? 3 : 6, noParaSQ = shortIteration ? 3 + 2 + 1 : 6 + 5 + 4 + 3 + 2 + 1;
 
-	noValidPoints = 0; sumF = 0.0f;
-	memset(sumHessian, 0, sizeof(float) * noParaSQ);
-	memset(sumNabla, 0, sizeof(float) * noPara);
+	// one partial sum per row, added up in row order afterwards
+	std::vector<ITMTrackerAccuCell_CPU> rowSums(viewImageSize_depth.y);
 
-	for (int y = 0; y < viewImageSize_depth.y; y++) for (int x = 0; x < viewImageSize_depth.x; x++)
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
+	for (int y = 0; y < viewImageSize_depth.y; y++)
 	{
-		float localHessian[6 + 5 + 4 + 3 + 2 + 1], localNabla[6], localF = 0;
+		ITMTrackerAccuCell_CPU &rowSum = rowSums[y];
+		rowSum.Clear();
 
-		for (int i = 0; i < noPara; i++) localNabla[i] = 0.0f;
-		for (int i = 0; i < noParaSQ; i++) localHessian[i] = 0.0f;
+		for (int x = 0; x < viewImageSize_depth.x; x++)
+		{
+			float localHessian[6 + 5 + 4 + 3 + 2 + 1], localNabla[6], localF = 0;
 
-		bool isValidPoint = false;
+			for (int i = 0; i < noPara; i++) localNabla[i] = 0.0f;
+			for (int i = 0; i < noParaSQ; i++) localHessian[i] = 0.0f;
 
-		switch (currentIterationType)
-		{
-		case TRACKER_ITERATION_ROTATION:
-			isValidPoint = computePerPointGH_exRGB_inv_Ab<true, true>(
-					localF,
-					localNabla,
-					localHessian,
-					x,
-					y,
-					points_curr,
-					intensities_current,
-					intensities_prev,
-					gradients,
-					viewImageSize_depth,
-					viewImageSize_rgb,
-					projParams_depth,
-					projParams_rgb,
-					approxInvPose,
-					depthToRGBTransform * scenePose,
-					colourThresh[currentLevelId],
-					minColourGradient,
-					viewFrustum_min,
-					viewFrustum_max,
-					tukeyCutOff
-					);
-			break;
-		case TRACKER_ITERATION_TRANSLATION:
-			isValidPoint = computePerPointGH_exRGB_inv_Ab<true, false>(
-					localF,
-					localNabla,
-					localHessian,
-					x,
-					y,
-					points_curr,
-					intensities_current,
-					intensities_prev,
-					gradients,
-					viewImageSize_depth,
-					viewImageSize_rgb,
-					projParams_depth,
-					projParams_rgb,
-					approxInvPose,
-					depthToRGBTransform * scenePose,
-					colourThresh[currentLevelId],
-					minColourGradient,
-					viewFrustum_min,
-					viewFrustum_max,
-					tukeyCutOff
-					);
-			break;
-		case TRACKER_ITERATION_BOTH:
-			isValidPoint = computePerPointGH_exRGB_inv_Ab<false, false>(
-					localF,
-					localNabla,
-					localHessian,
-					x,
-					y,
-					points_curr,
-					intensities_current,
-					intensities_prev,
-					gradients,
-					viewImageSize_depth,
-					viewImageSize_rgb,
-					projParams_depth,
-					projParams_rgb,
-					approxInvPose,
-					depthToRGBTransform * scenePose,
-					colourThresh[currentLevelId],
-					minColourGradient,
-					viewFrustum_min,
-					viewFrustum_max,
-					tukeyCutOff
-					);
-			break;
-		default:
-			isValidPoint = false;
-			break;
-		}
+			bool isValidPoint = false;
 
-		if (isValidPoint)
-		{
-			noValidPoints++;
-			sumF += localF;
-			for (int i = 0; i < noPara; i++) sumNabla[i] += localNabla[i];
-			for (int i = 0; i < noParaSQ; i++) sumHessian[i] += localHessian[i];
+			switch (currentIterationType)
+			{
+			case TRACKER_ITERATION_ROTATION:
+				isValidPoint = computePerPointGH_exRGB_inv_Ab<true, true>(
+						localF,
+						localNabla,
+						localHessian,
+						x,
+						y,
+						points_curr,
+						intensities_current,
+						intensities_prev,
+						gradients,
+						viewImageSize_depth,
+						viewImageSize_rgb,
+						projParams_depth,
+						projParams_rgb,
+						approxInvPose,
+						depthToRGBTransform * scenePose,
+						colourThresh[currentLevelId],
+						minColourGradient,
+						viewFrustum_min,
+						viewFrustum_max,
+						tukeyCutOff
+						);
+				break;
+			case TRACKER_ITERATION_TRANSLATION:
+				isValidPoint = computePerPointGH_exRGB_inv_Ab<true, false>(
+						localF,
+						localNabla,
+						localHessian,
+						x,
+						y,
+						points_curr,
+						intensities_current,
+						intensities_prev,
+						gradients,
+						viewImageSize_depth,
+						viewImageSize_rgb,
+						projParams_depth,
+						projParams_rgb,
+						approxInvPose,
+						depthToRGBTransform * scenePose,
+						colourThresh[currentLevelId],
+						minColourGradient,
+						viewFrustum_min,
+						viewFrustum_max,
+						tukeyCutOff
+						);
+				break;
+			case TRACKER_ITERATION_BOTH:
+				isValidPoint = computePerPointGH_exRGB_inv_Ab<false, false>(
+						localF,
+						localNabla,
+						localHessian,
+						x,
+						y,
+						points_curr,
+						intensities_current,
+						intensities_prev,
+						gradients,
+						viewImageSize_depth,
+						viewImageSize_rgb,
+						projParams_depth,
+						projParams_rgb,
+						approxInvPose,
+						depthToRGBTransform * scenePose,
+						colourThresh[currentLevelId],
+						minColourGradient,
+						viewFrustum_min,
+						viewFrustum_max,
+						tukeyCutOff
+						);
+				break;
+			default:
+				isValidPoint = false;
+				break;
+			}
+
+			if (isValidPoint) rowSum.Add(localF, localNabla, localHessian, noPara, noParaSQ);
 		}
 	}
 
+	ITMTrackerAccuCell_CPU sum; sum.Clear();
+	for (int y = 0; y < viewImageSize_depth.y; y++) sum.Add(rowSums[y], noPara, noParaSQ);
+
 	// Copy the lower triangular part of the matrix.
 	for (int r = 0, counter = 0; r < noPara; r++)
 		for (int c = 0; c <= r; c++, counter++)
-			hessian[r + c * 6] = sumHessian[counter];
+			hessian[r + c * 6] = sum.h[counter];
 
 	// Transpose to fill the upper triangle.
 	for (int r = 0; r < noPara; ++r)
 		for (int c = r + 1; c < noPara; c++)
 			hessian[r + c * 6] = hessian[c + r * 6];
 
-	memcpy(nabla, sumNabla, noPara * sizeof(float));
+	memcpy(nabla, sum.g, noPara * sizeof(float));
 
-	f = sumF;
+	f = sum.f;
 
-	return noValidPoints;
+	return sum.noValidPoints;
 }
 
 void ITMExtendedTracker_CPU::ProjectCurrentIntensityFrame(ITMFloat4Image *points_out,
@@ -310,6 +333,9 @@ void ITMExtendedTracker_CPU::ProjectCurrentIntensityFrame(ITMFloat4Image *points
 	Vector4f *pointsOut = points_out->GetData(MEMORYDEVICE_CPU);
 	float *intensityOut = intensity_out->GetData(MEMORYDEVICE_CPU);
 
+#ifdef WITH_OPENMP
+	#pragma omp parallel for
+#endif
 	for (int y = 0; y < imageSize_depth.y; y++) for (int x = 0; x < imageSize_depth.x; x++)
 		projectPoint_exRGB(x, y, pointsOut, intensityOut, intensityIn, depths, imageSize_rgb, imageSize_depth, intrinsics_rgb, intrinsics_depth, scenePose);
 }
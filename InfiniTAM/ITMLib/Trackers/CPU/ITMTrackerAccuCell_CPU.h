@@ -0,0 +1,46 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+namespace ITMLib
+{
+	/** \brief
+	    Sums of the error, the gradient and the lower triangle of
+	    the Hessian over a set of points, used by the CPU trackers.
+
+	    The trackers accumulate one cell per image row (or per
+	    fixed-size chunk of points) in parallel and then add the
+	    cells up in order. The summation order therefore does not
+	    depend on the number of threads, and the results are the
+	    same from run to run.
+	*/
+	struct ITMTrackerAccuCell_CPU
+	{
+		/** Number of points accumulated in each chunk when there are no image rows to go by. */
+		static const int noPointsPerChunk = 1024;
+
+		int noValidPoints;
+		float f, g[6], h[6 + 5 + 4 + 3 + 2 + 1];
+
+		void Clear(void)
+		{
+			noValidPoints = 0; f = 0.0f;
+			for (int i = 0; i < 6; i++) g[i] = 0.0f;
+			for (int i = 0; i < 6 + 5 + 4 + 3 + 2 + 1; i++) h[i] = 0.0f;
+		}
+
+		void Add(float localF, const float *localNabla, const float *localHessian, int noPara, int noParaSQ)
+		{
+			noValidPoints++; f += localF;
+			for (int i = 0; i < noPara; i++) g[i] += localNabla[i];
+			for (int i = 0; i < noParaSQ; i++) h[i] += localHessian[i];
+		}
+
+		void Add(const ITMTrackerAccuCell_CPU &cell, int noPara, int noParaSQ)
+		{
+			noValidPoints += cell.noValidPoints; f += cell.f;
+			for (int i = 0; i < noPara; i++) g[i] += cell.g[i];
+			for (int i = 0; i < noParaSQ; i++) h[i] += cell.h[i];
+		}
+	};
+}
@@ -4,6 +4,7 @@
 #include "../../../ORUtils/Cholesky.h"
 
 #include <math.h>
+#include <vector>
 
 using namespace ITMLib;
 
@@ -92,11 +93,16 @@ void ITMDepthTracker::SetEvaluationData(ITMTrackingState *trackingState, const I
 
 void ITMDepthTracker::PrepareForEvaluation()
 {
-	for (int i = 1; i < viewHierarchy->GetNoLevels(); i++)
+	int noLevels = viewHierarchy->GetNoLevels();
+	std::vector<ITMFloatImage*> depthLevels(noLevels);
+	for (int i = 0; i < noLevels; i++) depthLevels[i] = viewHierarchy->GetLevel(i)->data;
+
+	lowLevelEngine->FilterSubsampleWithHolesPyramid(&depthLevels[0], noLevels);
+
+	for (int i = 1; i < noLevels; i++)
 	{
 		ITMTemplatedHierarchyLevel<ITMFloatImage> *currentLevelView = viewHierarchy->GetLevel(i);
 		ITMTemplatedHierarchyLevel<ITMFloatImage> *previousLevelView = viewHierarchy->GetLevel(i - 1);
-		lowLevelEngine->FilterSubsampleWithHoles(currentLevelView->data, previousLevelView->data);
 		currentLevelView->intrinsics = previousLevelView->intrinsics * 0.5f;
 
 		ITMSceneHierarchyLevel *currentLevelScene = sceneHierarchy->GetLevel(i);
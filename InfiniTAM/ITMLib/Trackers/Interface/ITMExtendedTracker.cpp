@@ -11,6 +11,7 @@
 
 #include <math.h>
 #include <limits>
+#include <vector>
 
 using namespace ITMLib;
 
@@ -197,27 +198,36 @@ void ITMExtendedTracker::SetEvaluationData(ITMTrackingState *trackingState, cons
 void ITMExtendedTracker::PrepareForEvaluation()
 {
 	// Create depth pyramid
-	for (int i = 1; i < viewHierarchy_Depth->GetNoLevels(); i++)
-	{
-		ITMDepthHierarchyLevel *currentLevel = viewHierarchy_Depth->GetLevel(i);
-		ITMDepthHierarchyLevel *previousLevel = viewHierarchy_Depth->GetLevel(i - 1);
+	int noDepthLevels = viewHierarchy_Depth->GetNoLevels();
+	std::vector<ITMFloatImage*> depthLevels(noDepthLevels);
+	for (int i = 0; i < noDepthLevels; i++) depthLevels[i] = viewHierarchy_Depth->GetLevel(i)->depth;
 
-		lowLevelEngine->FilterSubsampleWithHoles(currentLevel->depth, previousLevel->depth);
+	lowLevelEngine->FilterSubsampleWithHolesPyramid(&depthLevels[0], noDepthLevels);
 
-		currentLevel->intrinsics = previousLevel->intrinsics * 0.5f;
+	for (int i = 1; i < noDepthLevels; i++)
+	{
+		viewHierarchy_Depth->GetLevel(i)->intrinsics = viewHierarchy_Depth->GetLevel(i - 1)->intrinsics * 0.5f;
 	}
 
 	// Create current and previous frame pyramids
 	if (useColour)
 	{
-		for (int i = 1; i < viewHierarchy_Intensity->GetNoLevels(); i++)
+		int noIntensityLevels = viewHierarchy_Intensity->GetNoLevels();
+		std::vector<ITMFloatImage*> currentLevels(noIntensityLevels), prevLevels(noIntensityLevels);
+		for (int i = 0; i < noIntensityLevels; i++)
+		{
+			currentLevels[i] = viewHierarchy_Intensity->GetLevel(i)->intensity_current;
+			prevLevels[i] = viewHierarchy_Intensity->GetLevel(i)->intensity_prev;
+		}
+
+		lowLevelEngine->FilterSubsamplePyramid(&currentLevels[0], noIntensityLevels);
+		lowLevelEngine->FilterSubsamplePyramid(&prevLevels[0], noIntensityLevels);
+
+		for (int i = 1; i < noIntensityLevels; i++)
 		{
 			ITMIntensityHierarchyLevel *currentLevel = viewHierarchy_Intensity->GetLevel(i);
 			ITMIntensityHierarchyLevel *previousLevel = viewHierarchy_Intensity->GetLevel(i - 1);
 
-			lowLevelEngine->FilterSubsample(currentLevel->intensity_current, previousLevel->intensity_current);
-			lowLevelEngine->FilterSubsample(currentLevel->intensity_prev, previousLevel->intensity_prev);
-
 			currentLevel->intrinsics = previousLevel->intrinsics * 0.5f;
 
 			// Also compute gradients
@@ -246,14 +256,20 @@ void ITMExtendedTracker::PrepareForEvaluation()
 	// Create raycasted pyramid
 	if (useDepth)
 	{
-		for (int i = 1; i < sceneHierarchy->GetNoLevels(); i++)
+		int noSceneLevels = sceneHierarchy->GetNoLevels();
+		std::vector<ITMFloat4Image*> pointsLevels(noSceneLevels), normalsLevels(noSceneLevels);
+		for (int i = 0; i < noSceneLevels; i++)
 		{
-			ITMSceneHierarchyLevel *currentLevel = sceneHierarchy->GetLevel(i);
-			ITMSceneHierarchyLevel *previousLevel = sceneHierarchy->GetLevel(i - 1);
+			pointsLevels[i] = sceneHierarchy->GetLevel(i)->pointsMap;
+			normalsLevels[i] = sceneHierarchy->GetLevel(i)->normalsMap;
+		}
 
-			lowLevelEngine->FilterSubsampleWithHoles(currentLevel->pointsMap, previousLevel->pointsMap);
-			lowLevelEngine->FilterSubsampleWithHoles(currentLevel->normalsMap, previousLevel->normalsMap);
-			currentLevel->intrinsics = previousLevel->intrinsics * 0.5f;
+		lowLevelEngine->FilterSubsampleWithHolesPyramid(&pointsLevels[0], noSceneLevels);
+		lowLevelEngine->FilterSubsampleWithHolesPyramid(&normalsLevels[0], noSceneLevels);
+
+		for (int i = 1; i < noSceneLevels; i++)
+		{
+			sceneHierarchy->GetLevel(i)->intrinsics = sceneHierarchy->GetLevel(i - 1)->intrinsics * 0.5f;
 		}
 	}
 }
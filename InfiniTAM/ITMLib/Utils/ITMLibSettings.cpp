@@ -1,6 +1,7 @@
 // Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
 
 #include "ITMLibSettings.h"
+#include "../Objects/Scene/ITMVoxelBlockHash.h"
 using namespace ITMLib;
 
 #include <climits>
@@ -29,18 +30,46 @@ ITMLibSettings::ITMLibSettings(void)
 
 	//deviceType = DEVICE_CPU;
 
+	/// size of the voxel block hash: voxel blocks kept in memory, hash buckets, excess list entries and blocks moved per swap operation
+	sceneParams.SetHashSize(SDF_LOCAL_BLOCK_NUM, SDF_BUCKET_NUM, SDF_EXCESS_LIST_SIZE, SDF_TRANSFER_BLOCK_NUM);
+	//// smaller local maps for loop closure
+	//sceneParams.SetHashSize(0x10000, 0x40000, 0x8000, SDF_TRANSFER_BLOCK_NUM);
+
+	/// growth of the voxel block array once it runs full: blocks added at a time and the most it may hold
+	sceneParams.SetVoxelBlockGrowth(0, SDF_LOCAL_BLOCK_NUM);
+	//// start small and grow on demand
+	//sceneParams.SetHashSize(0x8000, SDF_BUCKET_NUM, SDF_EXCESS_LIST_SIZE, SDF_TRANSFER_BLOCK_NUM);
+	//sceneParams.SetVoxelBlockGrowth(0x8000, 4 * SDF_LOCAL_BLOCK_NUM);
+
+	/// skip empty space in the CPU raycasts using a coarse map of the allocated voxel blocks
+	sceneParams.useBlockOccupancy = false;
+
 	/// how swapping works: disabled, fully enabled (still with dragons) and delete what's not visible - not supported in loop closure version
 	swappingMode = SWAPPINGMODE_DISABLED;
 
+	/// memory-mapped file for swapped-out voxel blocks and how many of them to keep in host memory - only used with swapping enabled
+	swappingBlockFile = NULL;
+	swappingMaxResidentBlocks = 0x10000;
+
 	/// enables or disables approximate raycast
 	useApproximateRaycast = false;
 
+	/// march the CPU raycasts in packets of 8x8 pixel tiles rather than ray by ray
+	useTiledRaycast = false;
+
+	/// render the freeview image in full, rather than coarse first and refined while the camera stays
+	freeviewMaxSubsample = 1;
+	freeviewTimeBudget = 0.0f;
+
 	/// enable or disable bilateral depth filtering
 	useBilateralFilter = false;
 
 	/// what to do on tracker failure: ignore, relocalise or stop integration - not supported in loop closure version
 	behaviourOnFailure = FAILUREMODE_IGNORE;
 
+	/// store the normals and radii of saved surfel scenes as 16 bit floats, which makes the files about a third smaller
+	saveSurfelsAtHalfPrecision = false;
+
 	/// switch between various library modes - basic, with loop closure, etc.
 	libMode = LIBMODE_BASIC;
 	//libMode = LIBMODE_BASIC_SURFELS;
@@ -44,6 +44,14 @@ namespace ITMLib
 
 		bool useApproximateRaycast;
 
+		/// For the CPU visualisation engine: raycast tiles of pixels as packets of rays, see ITMVisualisationEngine_CPU.
+		bool useTiledRaycast;
+
+		/// For freeview rendering: raycast only every freeviewMaxSubsample-th pixel after the camera moves, and refine the image while it stays, see ITMVisualisationEngine::RenderImageProgressive. 1 renders every image in full.
+		int freeviewMaxSubsample;
+		/// Time in milliseconds that refining a freeview image may take per frame, or 0 for no limit.
+		float freeviewTimeBudget;
+
 		bool useBilateralFilter;
 
 		/// For ITMColorTracker: skip every other point in energy function evaluation.
@@ -53,8 +61,15 @@ namespace ITMLib
         
 		FailureMode behaviourOnFailure;
 		SwappingMode swappingMode;
+
+		/// If set, swapped-out voxel blocks beyond swappingMaxResidentBlocks are kept in this file instead of host memory
+		const char *swappingBlockFile;
+		int swappingMaxResidentBlocks;
 		LibMode libMode;
 
+		/// For surfel scenes: store the surfel normals and radii as 16 bit floats when saving the scene, see ITMSurfelSceneFile.
+		bool saveSurfelsAtHalfPrecision;
+
 		const char *trackerConfig;
 
 		/// Further, scene specific parameters such as voxel size
@@ -0,0 +1,243 @@
+// Copyright 2014-2017 Oxford University Innovation Limited and the authors of InfiniTAM
+
+#pragma once
+
+/**
+ * \brief A thin wrapper around the CPU vector instruction sets, used by the batched CPU kernels.
+ *
+ * The instruction set is picked at compile time from the target flags (the build uses -march=native):
+ * AVX-512 processes 16 floats per step, AVX2 8 and AArch64 NEON 4. ITM_SIMD_WIDTH is 1 if none of them
+ * is available, or if ITM_NO_SIMD is defined, in which case the types below are not defined and callers
+ * fall back to their scalar code.
+ */
+
+#if !defined(ITM_NO_SIMD) && !defined(__CUDACC__) && defined(__AVX512F__)
+#define ITM_SIMD_AVX512
+#define ITM_SIMD_WIDTH 16
+// GCC warns about the deliberately uninitialised pass-through operands inside the AVX-512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#else
+#include <immintrin.h>
+#endif
+#elif !defined(ITM_NO_SIMD) && !defined(__CUDACC__) && defined(__AVX2__)
+#define ITM_SIMD_AVX2
+#define ITM_SIMD_WIDTH 8
+#include <immintrin.h>
+#elif !defined(ITM_NO_SIMD) && !defined(__CUDACC__) && defined(__ARM_NEON) && defined(__aarch64__)
+#define ITM_SIMD_NEON
+#define ITM_SIMD_WIDTH 4
+#include <arm_neon.h>
+#else
+#define ITM_SIMD_WIDTH 1
+#endif
+
+#if ITM_SIMD_WIDTH > 1
+
+namespace ITMLib
+{
+#if defined(ITM_SIMD_AVX512)
+	struct simd_float { __m512 v; };
+	struct simd_int { __m512i v; };
+	struct simd_mask { __mmask16 v; };
+
+	inline simd_float simd_set(float a) { simd_float r = { _mm512_set1_ps(a) }; return r; }
+	inline simd_float simd_load(const float *p) { simd_float r = { _mm512_loadu_ps(p) }; return r; }
+	inline simd_float simd_lanes(void) { simd_float r = { _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15) }; return r; }
+
+	inline simd_float operator+(simd_float a, simd_float b) { simd_float r = { _mm512_add_ps(a.v, b.v) }; return r; }
+	inline simd_float operator-(simd_float a, simd_float b) { simd_float r = { _mm512_sub_ps(a.v, b.v) }; return r; }
+	inline simd_float operator*(simd_float a, simd_float b) { simd_float r = { _mm512_mul_ps(a.v, b.v) }; return r; }
+	inline simd_float operator/(simd_float a, simd_float b) { simd_float r = { _mm512_div_ps(a.v, b.v) }; return r; }
+	inline simd_float simd_min(simd_float a, simd_float b) { simd_float r = { _mm512_min_ps(a.v, b.v) }; return r; }
+	inline simd_float simd_max(simd_float a, simd_float b) { simd_float r = { _mm512_max_ps(a.v, b.v) }; return r; }
+	inline simd_float simd_abs(simd_float a) { simd_float r = { _mm512_abs_ps(a.v) }; return r; }
+
+	inline simd_mask operator<(simd_float a, simd_float b) { simd_mask r = { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; return r; }
+	inline simd_mask operator<=(simd_float a, simd_float b) { simd_mask r = { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; return r; }
+	inline simd_mask operator>(simd_float a, simd_float b) { simd_mask r = { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; return r; }
+	inline simd_mask operator>=(simd_float a, simd_float b) { simd_mask r = { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; return r; }
+
+	inline simd_mask operator&(simd_mask a, simd_mask b) { simd_mask r = { (__mmask16)(a.v & b.v) }; return r; }
+	inline simd_mask operator|(simd_mask a, simd_mask b) { simd_mask r = { (__mmask16)(a.v | b.v) }; return r; }
+	inline simd_mask operator!(simd_mask a) { simd_mask r = { (__mmask16)~a.v }; return r; }
+	inline unsigned int simd_bits(simd_mask a) { return a.v; }
+
+	/** Picks a where the mask is set and b elsewhere. */
+	inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { simd_float r = { _mm512_mask_blend_ps(m.v, b.v, a.v) }; return r; }
+	inline simd_int simd_select(simd_mask m, simd_int a, simd_int b) { simd_int r = { _mm512_mask_blend_epi32(m.v, b.v, a.v) }; return r; }
+
+	inline simd_int simd_set(int a) { simd_int r = { _mm512_set1_epi32(a) }; return r; }
+	inline simd_int simd_floor_int(simd_float a) { simd_int r = { _mm512_cvttps_epi32(_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC)) }; return r; }
+	inline simd_float simd_to_float(simd_int a) { simd_float r = { _mm512_cvtepi32_ps(a.v) }; return r; }
+	inline simd_int operator+(simd_int a, simd_int b) { simd_int r = { _mm512_add_epi32(a.v, b.v) }; return r; }
+	inline simd_int operator*(simd_int a, simd_int b) { simd_int r = { _mm512_mullo_epi32(a.v, b.v) }; return r; }
+
+	/** Loads base[idx] for every lane. */
+	inline simd_float simd_gather(const float *base, simd_int idx) { simd_float r = { _mm512_i32gather_ps(idx.v, base, 4) }; return r; }
+
+	inline void simd_store(float *p, simd_float a) { _mm512_storeu_ps(p, a.v); }
+
+	/** Loads 2 * ITM_SIMD_WIDTH floats and splits them into the ones at even and at odd offsets. */
+	inline void simd_load_even_odd(const float *p, simd_float &even, simd_float &odd)
+	{
+		__m512 a = _mm512_loadu_ps(p), b = _mm512_loadu_ps(p + 16);
+		even.v = _mm512_permutex2var_ps(a, _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30), b);
+		odd.v = _mm512_permutex2var_ps(a, _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31), b);
+	}
+
+	/** Stores a and b interleaved, as 2 * ITM_SIMD_WIDTH floats. */
+	inline void simd_store_pairs(float *p, simd_float a, simd_float b)
+	{
+		_mm512_storeu_ps(p, _mm512_permutex2var_ps(a.v, _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23), b.v));
+		_mm512_storeu_ps(p + 16, _mm512_permutex2var_ps(a.v, _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31), b.v));
+	}
+#elif defined(ITM_SIMD_AVX2)
+	struct simd_float { __m256 v; };
+	struct simd_int { __m256i v; };
+	struct simd_mask { __m256 v; };
+
+	inline simd_float simd_set(float a) { simd_float r = { _mm256_set1_ps(a) }; return r; }
+	inline simd_float simd_load(const float *p) { simd_float r = { _mm256_loadu_ps(p) }; return r; }
+	inline simd_float simd_lanes(void) { simd_float r = { _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7) }; return r; }
+
+	inline simd_float operator+(simd_float a, simd_float b) { simd_float r = { _mm256_add_ps(a.v, b.v) }; return r; }
+	inline simd_float operator-(simd_float a, simd_float b) { simd_float r = { _mm256_sub_ps(a.v, b.v) }; return r; }
+	inline simd_float operator*(simd_float a, simd_float b) { simd_float r = { _mm256_mul_ps(a.v, b.v) }; return r; }
+	inline simd_float operator/(simd_float a, simd_float b) { simd_float r = { _mm256_div_ps(a.v, b.v) }; return r; }
+	inline simd_float simd_min(simd_float a, simd_float b) { simd_float r = { _mm256_min_ps(a.v, b.v) }; return r; }
+	inline simd_float simd_max(simd_float a, simd_float b) { simd_float r = { _mm256_max_ps(a.v, b.v) }; return r; }
+	inline simd_float simd_abs(simd_float a) { simd_float r = { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v) }; return r; }
+
+	inline simd_mask operator<(simd_float a, simd_float b) { simd_mask r = { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; return r; }
+	inline simd_mask operator<=(simd_float a, simd_float b) { simd_mask r = { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; return r; }
+	inline simd_mask operator>(simd_float a, simd_float b) { simd_mask r = { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; return r; }
+	inline simd_mask operator>=(simd_float a, simd_float b) { simd_mask r = { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; return r; }
+
+	inline simd_mask operator&(simd_mask a, simd_mask b) { simd_mask r = { _mm256_and_ps(a.v, b.v) }; return r; }
+	inline simd_mask operator|(simd_mask a, simd_mask b) { simd_mask r = { _mm256_or_ps(a.v, b.v) }; return r; }
+	inline simd_mask operator!(simd_mask a) { simd_mask r = { _mm256_xor_ps(a.v, _mm256_castsi256_ps(_mm256_set1_epi32(-1))) }; return r; }
+	inline unsigned int simd_bits(simd_mask a) { return (unsigned int)_mm256_movemask_ps(a.v); }
+
+	/** Picks a where the mask is set and b elsewhere. */
+	inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { simd_float r = { _mm256_blendv_ps(b.v, a.v, m.v) }; return r; }
+	inline simd_int simd_select(simd_mask m, simd_int a, simd_int b) { simd_int r = { _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), m.v)) }; return r; }
+
+	inline simd_int simd_set(int a) { simd_int r = { _mm256_set1_epi32(a) }; return r; }
+	inline simd_int simd_floor_int(simd_float a) { simd_int r = { _mm256_cvttps_epi32(_mm256_floor_ps(a.v)) }; return r; }
+	inline simd_float simd_to_float(simd_int a) { simd_float r = { _mm256_cvtepi32_ps(a.v) }; return r; }
+	inline simd_int operator+(simd_int a, simd_int b) { simd_int r = { _mm256_add_epi32(a.v, b.v) }; return r; }
+	inline simd_int operator*(simd_int a, simd_int b) { simd_int r = { _mm256_mullo_epi32(a.v, b.v) }; return r; }
+
+	/** Loads base[idx] for every lane. */
+	inline simd_float simd_gather(const float *base, simd_int idx) { simd_float r = { _mm256_i32gather_ps(base, idx.v, 4) }; return r; }
+
+	inline void simd_store(float *p, simd_float a) { _mm256_storeu_ps(p, a.v); }
+
+	/** Loads 2 * ITM_SIMD_WIDTH floats and splits them into the ones at even and at odd offsets. */
+	inline void simd_load_even_odd(const float *p, simd_float &even, simd_float &odd)
+	{
+		__m256 a = _mm256_loadu_ps(p), b = _mm256_loadu_ps(p + 8);
+		// shuffle_ps works within 128 bit halves, permute4x64 puts the halves back in order
+		__m256 e = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), o = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+		even.v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(e), _MM_SHUFFLE(3, 1, 2, 0)));
+		odd.v = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(o), _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	/** Stores a and b interleaved, as 2 * ITM_SIMD_WIDTH floats. */
+	inline void simd_store_pairs(float *p, simd_float a, simd_float b)
+	{
+		__m256 lo = _mm256_unpacklo_ps(a.v, b.v), hi = _mm256_unpackhi_ps(a.v, b.v);
+		_mm256_storeu_ps(p, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(p + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+#elif defined(ITM_SIMD_NEON)
+	struct simd_float { float32x4_t v; };
+	struct simd_int { int32x4_t v; };
+	struct simd_mask { uint32x4_t v; };
+
+	inline simd_float simd_set(float a) { simd_float r = { vdupq_n_f32(a) }; return r; }
+	inline simd_float simd_load(const float *p) { simd_float r = { vld1q_f32(p) }; return r; }
+	inline simd_float simd_lanes(void) { const float lanes[4] = { 0, 1, 2, 3 }; return simd_load(lanes); }
+
+	inline simd_float operator+(simd_float a, simd_float b) { simd_float r = { vaddq_f32(a.v, b.v) }; return r; }
+	inline simd_float operator-(simd_float a, simd_float b) { simd_float r = { vsubq_f32(a.v, b.v) }; return r; }
+	inline simd_float operator*(simd_float a, simd_float b) { simd_float r = { vmulq_f32(a.v, b.v) }; return r; }
+	inline simd_float operator/(simd_float a, simd_float b) { simd_float r = { vdivq_f32(a.v, b.v) }; return r; }
+	inline simd_float simd_min(simd_float a, simd_float b) { simd_float r = { vminq_f32(a.v, b.v) }; return r; }
+	inline simd_float simd_max(simd_float a, simd_float b) { simd_float r = { vmaxq_f32(a.v, b.v) }; return r; }
+	inline simd_float simd_abs(simd_float a) { simd_float r = { vabsq_f32(a.v) }; return r; }
+
+	inline simd_mask operator<(simd_float a, simd_float b) { simd_mask r = { vcltq_f32(a.v, b.v) }; return r; }
+	inline simd_mask operator<=(simd_float a, simd_float b) { simd_mask r = { vcleq_f32(a.v, b.v) }; return r; }
+	inline simd_mask operator>(simd_float a, simd_float b) { simd_mask r = { vcgtq_f32(a.v, b.v) }; return r; }
+	inline simd_mask operator>=(simd_float a, simd_float b) { simd_mask r = { vcgeq_f32(a.v, b.v) }; return r; }
+
+	inline simd_mask operator&(simd_mask a, simd_mask b) { simd_mask r = { vandq_u32(a.v, b.v) }; return r; }
+	inline simd_mask operator|(simd_mask a, simd_mask b) { simd_mask r = { vorrq_u32(a.v, b.v) }; return r; }
+	inline simd_mask operator!(simd_mask a) { simd_mask r = { vmvnq_u32(a.v) }; return r; }
+	inline unsigned int simd_bits(simd_mask a)
+	{
+		const uint32_t weights[4] = { 1, 2, 4, 8 };
+		return vaddvq_u32(vandq_u32(a.v, vld1q_u32(weights)));
+	}
+
+	/** Picks a where the mask is set and b elsewhere. */
+	inline simd_float simd_select(simd_mask m, simd_float a, simd_float b) { simd_float r = { vbslq_f32(m.v, a.v, b.v) }; return r; }
+	inline simd_int simd_select(simd_mask m, simd_int a, simd_int b) { simd_int r = { vbslq_s32(m.v, a.v, b.v) }; return r; }
+
+	inline simd_int simd_set(int a) { simd_int r = { vdupq_n_s32(a) }; return r; }
+	inline simd_int simd_floor_int(simd_float a) { simd_int r = { vcvtq_s32_f32(vrndmq_f32(a.v)) }; return r; }
+	inline simd_float simd_to_float(simd_int a) { simd_float r = { vcvtq_f32_s32(a.v) }; return r; }
+	inline simd_int operator+(simd_int a, simd_int b) { simd_int r = { vaddq_s32(a.v, b.v) }; return r; }
+	inline simd_int operator*(simd_int a, simd_int b) { simd_int r = { vmulq_s32(a.v, b.v) }; return r; }
+
+	/** Loads base[idx] for every lane. */
+	inline simd_float simd_gather(const float *base, simd_int idx)
+	{
+		int i[4]; vst1q_s32(i, idx.v);
+		const float values[4] = { base[i[0]], base[i[1]], base[i[2]], base[i[3]] };
+		return simd_load(values);
+	}
+
+	inline void simd_store(float *p, simd_float a) { vst1q_f32(p, a.v); }
+
+	/** Loads 2 * ITM_SIMD_WIDTH floats and splits them into the ones at even and at odd offsets. */
+	inline void simd_load_even_odd(const float *p, simd_float &even, simd_float &odd)
+	{
+		float32x4x2_t v = vld2q_f32(p);
+		even.v = v.val[0]; odd.v = v.val[1];
+	}
+
+	/** Stores a and b interleaved, as 2 * ITM_SIMD_WIDTH floats. */
+	inline void simd_store_pairs(float *p, simd_float a, simd_float b)
+	{
+		float32x4x2_t v; v.val[0] = a.v; v.val[1] = b.v;
+		vst2q_f32(p, v);
+	}
+#endif
+
+	inline bool simd_any(simd_mask a) { return simd_bits(a) != 0; }
+
+	inline int simd_count(simd_mask a)
+	{
+		int count = 0;
+		for (unsigned int bits = simd_bits(a); bits != 0; bits &= bits - 1) count++;
+		return count;
+	}
+
+	/** Adds up the lanes in lane order, so the result does not depend on the instruction set's own reduction order. */
+	inline float simd_sum(simd_float a)
+	{
+		float lanes[ITM_SIMD_WIDTH]; simd_store(lanes, a);
+		float sum = 0.0f;
+		for (int i = 0; i < ITM_SIMD_WIDTH; i++) sum += lanes[i];
+		return sum;
+	}
+}
+
+#endif
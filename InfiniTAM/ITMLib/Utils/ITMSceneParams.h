@@ -42,7 +42,43 @@ namespace ITMLib
 		/** Stop integration once maxW has been reached. */
 		bool stopIntegratingAtMaxW;
 
-		ITMSceneParams(void) {}
+		/** @{ */
+		/** \brief
+		    Size of the voxel block hash: the local voxel block
+		    array holds @ref noVoxelBlocks blocks, the hash table
+		    has @ref noHashBuckets buckets (a power of two) and an
+		    excess list of @ref noHashExcessEntries entries for
+		    colliding blocks, and at most @ref noSwapTransferBlocks
+		    blocks are moved per swap operation. Not used by the
+		    plain voxel array.
+		*/
+		int noVoxelBlocks, noHashBuckets, noHashExcessEntries, noSwapTransferBlocks;
+		/** @} */
+
+		/** @{ */
+		/** \brief
+		    Growth of the local voxel block array: once its free
+		    blocks run out, it grows by @ref noVoxelBlocksPerChunk
+		    blocks at a time, up to the high-water mark of
+		    @ref maxVoxelBlocks blocks. A chunk size of zero keeps
+		    the array at @ref noVoxelBlocks blocks.
+		*/
+		int noVoxelBlocksPerChunk, maxVoxelBlocks;
+		/** @} */
+
+		/** \brief
+		    Keep a coarse map of the allocated voxel blocks, so
+		    that raycasts on the CPU can leap over empty space,
+		    see ITMLib::ITMBlockOccupancy.
+		*/
+		bool useBlockOccupancy;
+
+		ITMSceneParams(void)
+		{
+			this->noVoxelBlocks = this->noHashBuckets = this->noHashExcessEntries = this->noSwapTransferBlocks = 0;
+			this->noVoxelBlocksPerChunk = this->maxVoxelBlocks = 0;
+			this->useBlockOccupancy = false;
+		}
 
 		ITMSceneParams(float mu, int maxW, float voxelSize, 
 			float viewFrustum_min, float viewFrustum_max, bool stopIntegratingAtMaxW)
@@ -52,6 +88,24 @@ namespace ITMLib
 			this->voxelSize = voxelSize;
 			this->viewFrustum_min = viewFrustum_min; this->viewFrustum_max = viewFrustum_max;
 			this->stopIntegratingAtMaxW = stopIntegratingAtMaxW;
+			this->noVoxelBlocks = this->noHashBuckets = this->noHashExcessEntries = this->noSwapTransferBlocks = 0;
+			this->noVoxelBlocksPerChunk = this->maxVoxelBlocks = 0;
+			this->useBlockOccupancy = false;
+		}
+
+		void SetHashSize(int noVoxelBlocks, int noHashBuckets, int noHashExcessEntries, int noSwapTransferBlocks)
+		{
+			this->noVoxelBlocks = noVoxelBlocks;
+			this->noHashBuckets = noHashBuckets;
+			this->noHashExcessEntries = noHashExcessEntries;
+			this->noSwapTransferBlocks = noSwapTransferBlocks;
+			if (this->maxVoxelBlocks < noVoxelBlocks) this->maxVoxelBlocks = noVoxelBlocks;
+		}
+
+		void SetVoxelBlockGrowth(int noVoxelBlocksPerChunk, int maxVoxelBlocks)
+		{
+			this->noVoxelBlocksPerChunk = noVoxelBlocksPerChunk;
+			this->maxVoxelBlocks = maxVoxelBlocks < noVoxelBlocks ? noVoxelBlocks : maxVoxelBlocks;
 		}
 
 		explicit ITMSceneParams(const ITMSceneParams *sceneParams) { this->SetFrom(sceneParams); }
@@ -64,6 +118,13 @@ namespace ITMLib
 			this->mu = sceneParams->mu;
 			this->maxW = sceneParams->maxW;
 			this->stopIntegratingAtMaxW = sceneParams->stopIntegratingAtMaxW;
+			this->noVoxelBlocks = sceneParams->noVoxelBlocks;
+			this->noHashBuckets = sceneParams->noHashBuckets;
+			this->noHashExcessEntries = sceneParams->noHashExcessEntries;
+			this->noSwapTransferBlocks = sceneParams->noSwapTransferBlocks;
+			this->noVoxelBlocksPerChunk = sceneParams->noVoxelBlocksPerChunk;
+			this->maxVoxelBlocks = sceneParams->maxVoxelBlocks;
+			this->useBlockOccupancy = sceneParams->useBlockOccupancy;
 		}
 	};
 }